@@ -47,6 +47,9 @@ const char *nc_msgtype2str[] = {
 
 #define BUFFERSIZE 512
 
+/* size of an SSH channel input buffer, maximum SSH packet payload */
+#define SSH_IN_BUFSIZE (64 * BUFFERSIZE)
+
 #ifdef NC_ENABLED_TLS
 
 static char *
@@ -83,127 +86,223 @@ nc_ssl_error_get_reasons(void)
 
 #endif
 
+#ifdef NC_ENABLED_SSH
+
+/*
+ * Session input lock must be held. The SSH session, shared by all the channels, is accessed with the IO lock
+ * held only for a single non-blocking read into the channel input buffer, io_timeout is used only for
+ * acquiring the IO lock.
+ * returns: number of buffered bytes, 0 if there is no data or the IO lock timeout elapsed,
+ *          -1 on error (can change session status)
+ */
 static ssize_t
-nc_read(struct nc_session *session, char *buf, size_t count, uint32_t inact_timeout, struct timespec *ts_act_timeout)
+nc_ssh_in_fill(struct nc_session *session, int io_timeout)
 {
-    size_t readd = 0;
-    ssize_t r = -1;
-    int fd, interrupted;
-    struct timespec ts_cur, ts_inact_timeout;
+    int r;
 
-    assert(session);
-    assert(buf);
+    if (session->ti.libssh.in_len) {
+        return session->ti.libssh.in_len;
+    }
 
-    if ((session->status != NC_STATUS_RUNNING) && (session->status != NC_STATUS_STARTING)) {
-        return -1;
+    /* SESSION IO LOCK */
+    r = nc_session_io_lock(session, io_timeout, __func__);
+    if (r < 1) {
+        return r;
     }
 
-    if (!count) {
-        return 0;
+    /* the buffer is allocated only when there are some data */
+    r = ssh_channel_poll(session->ti.libssh.channel, 0);
+    if ((r > 0) && !session->ti.libssh.in_buf) {
+        session->ti.libssh.in_buf = malloc(SSH_IN_BUFSIZE);
+        if (!session->ti.libssh.in_buf) {
+            ERRMEM;
+            nc_session_io_unlock(session, __func__);
+            return -1;
+        }
+    }
+    if (r > 0) {
+        r = ssh_channel_read_nonblocking(session->ti.libssh.channel, session->ti.libssh.in_buf, SSH_IN_BUFSIZE, 0);
     }
 
-    nc_gettimespec_mono(&ts_inact_timeout);
-    nc_addtimespec(&ts_inact_timeout, inact_timeout);
-    do {
-        interrupted = 0;
-        switch (session->ti_type) {
-        case NC_TI_NONE:
-            return 0;
+    if (r == SSH_AGAIN) {
+        r = 0;
+    } else if (r == SSH_ERROR) {
+        ERR("Session %u: reading from the SSH channel failed (%s).", session->id,
+            ssh_get_error(session->ti.libssh.session));
+        session->status = NC_STATUS_INVALID;
+        session->term_reason = NC_SESSION_TERM_OTHER;
+        r = -1;
+    } else if ((r == SSH_EOF) || (!r && ssh_channel_is_eof(session->ti.libssh.channel))) {
+        ERR("Session %u: SSH channel unexpected EOF.", session->id);
+        session->status = NC_STATUS_INVALID;
+        session->term_reason = NC_SESSION_TERM_DROPPED;
+        r = -1;
+    }
 
-        case NC_TI_FD:
-        case NC_TI_UNIX:
-            fd = (session->ti_type == NC_TI_FD) ? session->ti.fd.in : session->ti.unixsock.sock;
-            /* read via standard file descriptor */
-            r = read(fd, buf + readd, count - readd);
-            if (r < 0) {
-                if (errno == EAGAIN) {
-                    r = 0;
-                    break;
-                } else if (errno == EINTR) {
-                    r = 0;
-                    interrupted = 1;
-                    break;
-                } else {
-                    ERR("Session %u: reading from file descriptor (%d) failed (%s).",
-                        session->id, fd, strerror(errno));
-                    session->status = NC_STATUS_INVALID;
-                    session->term_reason = NC_SESSION_TERM_OTHER;
-                    return -1;
-                }
-            } else if (r == 0) {
-                ERR("Session %u: communication file descriptor (%d) unexpectedly closed.",
-                    session->id, fd);
+    /* SESSION IO UNLOCK */
+    nc_session_io_unlock(session, __func__);
+
+    if (r > 0) {
+        session->ti.libssh.in_start = 0;
+        session->ti.libssh.in_len = r;
+    }
+    return r;
+}
+
+#endif
+
+/*
+ * Read the data available without waiting.
+ * returns: number of read bytes, 0 if there are none, -1 on error (changes session status)
+ */
+static ssize_t
+nc_read_avail(struct nc_session *session, char *buf, size_t count, int *interrupted)
+{
+    ssize_t r = -1;
+    int fd;
+
+    *interrupted = 0;
+    switch (session->ti_type) {
+    case NC_TI_NONE:
+        return 0;
+
+    case NC_TI_FD:
+    case NC_TI_UNIX:
+        fd = (session->ti_type == NC_TI_FD) ? session->ti.fd.in : session->ti.unixsock.sock;
+        /* read via standard file descriptor */
+        r = read(fd, buf, count);
+        if (r < 0) {
+            if (errno == EAGAIN) {
+                r = 0;
+                break;
+            } else if (errno == EINTR) {
+                r = 0;
+                *interrupted = 1;
+                break;
+            } else {
+                ERR("Session %u: reading from file descriptor (%d) failed (%s).",
+                    session->id, fd, strerror(errno));
                 session->status = NC_STATUS_INVALID;
-                session->term_reason = NC_SESSION_TERM_DROPPED;
+                session->term_reason = NC_SESSION_TERM_OTHER;
                 return -1;
             }
-            break;
+        } else if (r == 0) {
+            ERR("Session %u: communication file descriptor (%d) unexpectedly closed.",
+                session->id, fd);
+            session->status = NC_STATUS_INVALID;
+            session->term_reason = NC_SESSION_TERM_DROPPED;
+            return -1;
+        }
+        break;
 
 #ifdef NC_ENABLED_SSH
-        case NC_TI_LIBSSH:
-            /* read via libssh */
-            r = ssh_channel_read(session->ti.libssh.channel, buf + readd, count - readd, 0);
-            if (r == SSH_AGAIN) {
+    case NC_TI_LIBSSH:
+        /* read from the channel input buffer, refill it from the SSH session when empty */
+        r = nc_ssh_in_fill(session, 0);
+        if (r < 0) {
+            return -1;
+        } else if (!r) {
+            break;
+        } else if ((size_t)r > count) {
+            r = count;
+        }
+        memcpy(buf, session->ti.libssh.in_buf + session->ti.libssh.in_start, r);
+        session->ti.libssh.in_start += r;
+        session->ti.libssh.in_len -= r;
+        break;
+#endif
+
+#ifdef NC_ENABLED_TLS
+    case NC_TI_OPENSSL:
+        /* read via OpenSSL */
+        ERR_clear_error();
+        r = SSL_read(session->ti.tls, buf, count);
+        if (r <= 0) {
+            int e;
+            char *reasons;
+
+            switch (e = SSL_get_error(session->ti.tls, r)) {
+            case SSL_ERROR_WANT_READ:
+            case SSL_ERROR_WANT_WRITE:
                 r = 0;
                 break;
-            } else if (r == SSH_ERROR) {
-                ERR("Session %u: reading from the SSH channel failed (%s).", session->id,
-                    ssh_get_error(session->ti.libssh.session));
+            case SSL_ERROR_ZERO_RETURN:
+                ERR("Session %u: communication socket unexpectedly closed (OpenSSL).", session->id);
+                session->status = NC_STATUS_INVALID;
+                session->term_reason = NC_SESSION_TERM_DROPPED;
+                return -1;
+            case SSL_ERROR_SYSCALL:
+                ERR("Session %u: SSL socket error (%s).", session->id, strerror(errno));
+                session->status = NC_STATUS_INVALID;
+                session->term_reason = NC_SESSION_TERM_OTHER;
+                return -1;
+            case SSL_ERROR_SSL:
+                reasons = nc_ssl_error_get_reasons();
+                ERR("Session %u: SSL error (%s).", session->id, reasons);
+                free(reasons);
+                session->status = NC_STATUS_INVALID;
+                session->term_reason = NC_SESSION_TERM_OTHER;
+                return -1;
+            default:
+                ERR("Session %u: unknown SSL error occured (err code %d).", session->id, e);
                 session->status = NC_STATUS_INVALID;
                 session->term_reason = NC_SESSION_TERM_OTHER;
                 return -1;
-            } else if (r == 0) {
-                if (ssh_channel_is_eof(session->ti.libssh.channel)) {
-                    ERR("Session %u: SSH channel unexpected EOF.", session->id);
-                    session->status = NC_STATUS_INVALID;
-                    session->term_reason = NC_SESSION_TERM_DROPPED;
-                    return -1;
-                }
-                break;
             }
-            break;
+        }
+        break;
 #endif
+    }
 
-#ifdef NC_ENABLED_TLS
-        case NC_TI_OPENSSL:
-            /* read via OpenSSL */
-            ERR_clear_error();
-            r = SSL_read(session->ti.tls, buf + readd, count - readd);
-            if (r <= 0) {
-                int e;
-                char *reasons;
+    return r;
+}
 
-                switch (e = SSL_get_error(session->ti.tls, r)) {
-                case SSL_ERROR_WANT_READ:
-                case SSL_ERROR_WANT_WRITE:
-                    r = 0;
-                    break;
-                case SSL_ERROR_ZERO_RETURN:
-                    ERR("Session %u: communication socket unexpectedly closed (OpenSSL).", session->id);
-                    session->status = NC_STATUS_INVALID;
-                    session->term_reason = NC_SESSION_TERM_DROPPED;
-                    return -1;
-                case SSL_ERROR_SYSCALL:
-                    ERR("Session %u: SSL socket error (%s).", session->id, strerror(errno));
-                    session->status = NC_STATUS_INVALID;
-                    session->term_reason = NC_SESSION_TERM_OTHER;
-                    return -1;
-                case SSL_ERROR_SSL:
-                    reasons = nc_ssl_error_get_reasons();
-                    ERR("Session %u: SSL error (%s).", session->id, reasons);
-                    free(reasons);
-                    session->status = NC_STATUS_INVALID;
-                    session->term_reason = NC_SESSION_TERM_OTHER;
-                    return -1;
-                default:
-                    ERR("Session %u: unknown SSL error occured (err code %d).", session->id, e);
-                    session->status = NC_STATUS_INVALID;
-                    session->term_reason = NC_SESSION_TERM_OTHER;
-                    return -1;
-                }
-            }
-            break;
-#endif
+/* drop the first len bytes of the pending data, the buffer is not kept when empty */
+static void
+nc_read_pend_consume(struct nc_session *session, size_t len)
+{
+    session->in_pend_len -= len;
+    if (session->in_pend_len) {
+        memmove(session->in_pend, session->in_pend + len, session->in_pend_len);
+    } else {
+        free(session->in_pend);
+        session->in_pend = NULL;
+        session->in_pend_size = 0;
+    }
+}
+
+static ssize_t
+nc_read(struct nc_session *session, char *buf, size_t count, uint32_t inact_timeout, struct timespec *ts_act_timeout)
+{
+    size_t readd = 0;
+    ssize_t r;
+    int interrupted;
+    struct timespec ts_cur, ts_inact_timeout;
+
+    assert(session);
+    assert(buf);
+
+    if ((session->status != NC_STATUS_RUNNING) && (session->status != NC_STATUS_STARTING)) {
+        return -1;
+    }
+
+    if (!count || (session->ti_type == NC_TI_NONE)) {
+        return 0;
+    }
+
+    if (session->in_pend_len) {
+        /* continue with the data of a partially received message */
+        readd = (count < session->in_pend_len) ? count : session->in_pend_len;
+        memcpy(buf, session->in_pend, readd);
+        nc_read_pend_consume(session, readd);
+    }
+
+    nc_gettimespec_mono(&ts_inact_timeout);
+    nc_addtimespec(&ts_inact_timeout, inact_timeout);
+    while (readd < count) {
+        r = nc_read_avail(session, buf + readd, count - readd, &interrupted);
+        if (r < 0) {
+            return -1;
         }
 
         if (r == 0) {
@@ -230,8 +329,7 @@ nc_read(struct nc_session *session, char *buf, size_t count, uint32_t inact_time
             nc_gettimespec_mono(&ts_inact_timeout);
             nc_addtimespec(&ts_inact_timeout, inact_timeout);
         }
-
-    } while (readd < count);
+    }
     buf[count] = '\0';
 
     return (ssize_t)readd;
@@ -344,20 +442,177 @@ nc_read_until(struct nc_session *session, const char *endtag, size_t limit, uint
     return count;
 }
 
+/* compare a non-terminated string with a literal */
+static int
+nc_strn_eq(const char *str, size_t len, const char *lit)
+{
+    return (len == strlen(lit)) && !strncmp(str, lit, len);
+}
+
+/*
+ * Look only at the root element of a message and learn its type (and message-id) without
+ * building the XML tree. Returns NC_MSG_ERROR if the root element is invalid.
+ */
+static NC_MSG_TYPE
+nc_msg_sniff(struct nc_session *session, const char *msg, uint64_t *msgid)
+{
+    const char *ptr = msg, *name, *prefix = NULL, *ns = NULL, *aname, *aval;
+    size_t name_len, prefix_len = 0, ns_len = 0, aname_len, aval_len;
+    char quot;
+
+    if (msgid) {
+        *msgid = 0;
+    }
+
+    /* skip XML declaration, processing instructions and comments */
+    while (1) {
+        ptr += strspn(ptr, " \t\r\n");
+        if (!strncmp(ptr, "<?", 2)) {
+            ptr = strstr(ptr, "?>");
+            if (!ptr) {
+                goto invalid;
+            }
+            ptr += 2;
+        } else if (!strncmp(ptr, "<!--", 4)) {
+            ptr = strstr(ptr, "-->");
+            if (!ptr) {
+                goto invalid;
+            }
+            ptr += 3;
+        } else {
+            break;
+        }
+    }
+    if (*ptr != '<') {
+        goto invalid;
+    }
+    ++ptr;
+
+    /* root element qualified name */
+    name = ptr;
+    name_len = strcspn(ptr, " \t\r\n/>");
+    if (!name_len) {
+        goto invalid;
+    }
+    ptr += name_len;
+    aname = memchr(name, ':', name_len);
+    if (aname) {
+        prefix = name;
+        prefix_len = aname - name;
+        name = aname + 1;
+        name_len -= prefix_len + 1;
+    }
+
+    /* root element attributes */
+    while (1) {
+        ptr += strspn(ptr, " \t\r\n");
+        if ((*ptr == '>') || (*ptr == '/')) {
+            break;
+        }
+
+        aname = ptr;
+        aname_len = strcspn(ptr, " \t\r\n=");
+        if (!aname_len) {
+            goto invalid;
+        }
+        ptr += aname_len;
+        ptr += strspn(ptr, " \t\r\n");
+        if (*ptr != '=') {
+            goto invalid;
+        }
+        ++ptr;
+        ptr += strspn(ptr, " \t\r\n");
+        if ((*ptr != '\"') && (*ptr != '\'')) {
+            goto invalid;
+        }
+        quot = *ptr;
+        ++ptr;
+        aval = ptr;
+        ptr = strchr(ptr, quot);
+        if (!ptr) {
+            goto invalid;
+        }
+        aval_len = ptr - aval;
+        ++ptr;
+
+        if (!prefix && nc_strn_eq(aname, aname_len, "xmlns")) {
+            ns = aval;
+            ns_len = aval_len;
+        } else if (prefix && (aname_len == 6 + prefix_len) && !strncmp(aname, "xmlns:", 6)
+                && !strncmp(aname + 6, prefix, prefix_len)) {
+            ns = aval;
+            ns_len = aval_len;
+        } else if (msgid && nc_strn_eq(aname, aname_len, "message-id")) {
+            *msgid = strtoull(aval, NULL, 10);
+        }
+    }
+
+    if (!ns) {
+        ERR("Session %u: invalid message root element (invalid namespace).", session->id);
+        return NC_MSG_ERROR;
+    }
+
+    /* get and return message type */
+    if (nc_strn_eq(ns, ns_len, NC_NS_BASE)) {
+        if (nc_strn_eq(name, name_len, "rpc")) {
+            return NC_MSG_RPC;
+        } else if (nc_strn_eq(name, name_len, "rpc-reply")) {
+            return NC_MSG_REPLY;
+        } else if (nc_strn_eq(name, name_len, "hello")) {
+            return NC_MSG_HELLO;
+        }
+    } else if (nc_strn_eq(ns, ns_len, NC_NS_NOTIF)) {
+        if (nc_strn_eq(name, name_len, "notification")) {
+            return NC_MSG_NOTIF;
+        }
+    } else {
+        ERR("Session %u: invalid message root element (invalid namespace \"%.*s\").", session->id, (int)ns_len, ns);
+        return NC_MSG_ERROR;
+    }
+
+    ERR("Session %u: invalid message root element (invalid name \"%.*s\").", session->id, (int)name_len, name);
+    return NC_MSG_ERROR;
+
+invalid:
+    ERR("Session %u: invalid message root element.", session->id);
+    return NC_MSG_ERROR;
+}
+
+/* IO lock must not be held, can change session status */
+void
+nc_msg_malformed(struct nc_session *session, int io_timeout)
+{
+    struct nc_server_reply *reply;
+
+    ERR("Session %u: malformed message received.", session->id);
+    if ((session->side == NC_SERVER) && (session->version == NC_VERSION_11)) {
+        /* NETCONF version 1.1 defines sending error reply from the server (RFC 6241 sec. 3) */
+        reply = nc_server_reply_err(nc_err(NC_ERR_MALFORMED_MSG));
+
+        if (nc_write_msg_io(session, io_timeout, NC_MSG_REPLY, NULL, NULL, reply) != NC_MSG_REPLY) {
+            ERR("Session %u: unable to send a \"Malformed message\" error reply, terminating session.", session->id);
+            if (session->status != NC_STATUS_INVALID) {
+                session->status = NC_STATUS_INVALID;
+                session->term_reason = NC_SESSION_TERM_OTHER;
+            }
+        }
+        nc_server_reply_free(reply);
+    }
+}
+
 /* return NC_MSG_ERROR can change session status, acquires IO lock as needed */
 NC_MSG_TYPE
-nc_read_msg_io(struct nc_session *session, int io_timeout, struct lyxml_elem **data, int passing_io_lock)
+nc_read_msg_str_io(struct nc_session *session, int io_timeout, char **msg, uint64_t *msgid, int passing_in_lock)
 {
-    int ret, io_locked = passing_io_lock;
-    char *msg = NULL, *chunk;
+    int ret, in_locked = passing_in_lock;
+    char *chunk;
     uint64_t chunk_len, len = 0;
     /* use timeout in milliseconds instead seconds */
     uint32_t inact_timeout = NC_READ_INACT_TIMEOUT * 1000;
     struct timespec ts_act_timeout;
-    struct nc_server_reply *reply;
 
-    assert(session && data);
-    *data = NULL;
+    assert(session && msg);
+    *msg = NULL;
 
     if ((session->status != NC_STATUS_RUNNING) && (session->status != NC_STATUS_STARTING)) {
         ERR("Session %u: invalid session to read from.", session->id);
@@ -368,9 +623,9 @@ nc_read_msg_io(struct nc_session *session, int io_timeout, struct lyxml_elem **d
     nc_gettimespec_mono(&ts_act_timeout);
     nc_addtimespec(&ts_act_timeout, NC_READ_ACT_TIMEOUT * 1000);
 
-    if (!io_locked) {
-        /* SESSION IO LOCK */
-        ret = nc_session_io_lock(session, io_timeout, __func__);
+    if (!in_locked) {
+        /* SESSION IN LOCK */
+        ret = nc_session_in_lock(session, io_timeout, __func__);
         if (ret < 0) {
             ret = NC_MSG_ERROR;
             goto cleanup;
@@ -378,20 +633,21 @@ nc_read_msg_io(struct nc_session *session, int io_timeout, struct lyxml_elem **d
             ret = NC_MSG_WOULDBLOCK;
             goto cleanup;
         }
-        io_locked = 1;
+        in_locked = 1;
     }
 
     /* read the message */
     switch (session->version) {
     case NC_VERSION_10:
-        ret = nc_read_until(session, NC_VERSION_10_ENDTAG, 0, inact_timeout, &ts_act_timeout, &msg);
+        ret = nc_read_until(session, NC_VERSION_10_ENDTAG, 0, inact_timeout, &ts_act_timeout, msg);
         if (ret == -1) {
             ret = NC_MSG_ERROR;
             goto cleanup;
         }
 
         /* cut off the end tag */
-        msg[ret - NC_VERSION_10_ENDTAG_LEN] = '\0';
+        (*msg)[ret - NC_VERSION_10_ENDTAG_LEN] = '\0';
+        len = ret - NC_VERSION_10_ENDTAG_LEN;
         break;
     case NC_VERSION_11:
         while (1) {
@@ -409,7 +665,7 @@ nc_read_msg_io(struct nc_session *session, int io_timeout, struct lyxml_elem **d
             if (!strcmp(chunk, "#\n")) {
                 /* end of chunked framing message */
                 free(chunk);
-                if (!msg) {
+                if (!*msg) {
                     ERR("Session %u: invalid frame chunk delimiters.", session->id);
                     goto malformed_msg;
                 }
@@ -432,38 +688,240 @@ nc_read_msg_io(struct nc_session *session, int io_timeout, struct lyxml_elem **d
             }
 
             /* realloc message buffer, remember to count terminating null byte */
-            msg = nc_realloc(msg, len + chunk_len + 1);
-            if (!msg) {
+            *msg = nc_realloc(*msg, len + chunk_len + 1);
+            if (!*msg) {
                 ERRMEM;
                 ret = NC_MSG_ERROR;
                 goto cleanup;
             }
-            memcpy(msg + len, chunk, chunk_len);
+            memcpy(*msg + len, chunk, chunk_len);
             len += chunk_len;
-            msg[len] = '\0';
+            (*msg)[len] = '\0';
             free(chunk);
         }
 
         break;
     }
 
-    /* SESSION IO UNLOCK */
-    assert(io_locked);
-    nc_session_io_unlock(session, __func__);
-    io_locked = 0;
+    /* SESSION IN UNLOCK */
+    assert(in_locked);
+    nc_session_in_unlock(session, __func__);
+    in_locked = 0;
+
+    if (session->side == NC_SERVER) {
+        /* remember the size for rate limiting */
+        session->opts.server.last_msg_len = len;
+    }
+
+    DBG("Session %u: received message:\n%s\n", session->id, *msg);
+
+    /* only the root element is examined, the message is parsed by the caller if needed */
+    ret = nc_msg_sniff(session, *msg, msgid);
+    if (ret == NC_MSG_ERROR) {
+        goto malformed_msg;
+    }
+    return ret;
+
+malformed_msg:
+    if (in_locked) {
+        /* nc_write_msg_io locks and unlocks the IO lock by itself */
+        nc_session_in_unlock(session, __func__);
+        in_locked = 0;
+    }
+    nc_msg_malformed(session, io_timeout);
+    ret = NC_MSG_ERROR;
+
+cleanup:
+    if (in_locked) {
+        nc_session_in_unlock(session, __func__);
+    }
+    free(*msg);
+    *msg = NULL;
+
+    return ret;
+}
+
+/*
+ * Find a complete framed message at the beginning of the pending data.
+ * returns: 1 with the message in msg and its framed length in len, 0 if incomplete, -1 if malformed or on error
+ */
+static int
+nc_read_pend_msg(struct nc_session *session, char **msg, size_t *len)
+{
+    const char *buf = session->in_pend, *ptr;
+    size_t pos = 0, msg_len = 0;
+    unsigned long chunk_len;
+
+    *msg = NULL;
+    if (!buf) {
+        return 0;
+    }
+
+    switch (session->version) {
+    case NC_VERSION_10:
+        ptr = memmem(buf, session->in_pend_len, NC_VERSION_10_ENDTAG, NC_VERSION_10_ENDTAG_LEN);
+        if (!ptr) {
+            return 0;
+        }
+        msg_len = ptr - buf;
+        *msg = strndup(buf, msg_len);
+        if (!*msg) {
+            ERRMEM;
+            return -1;
+        }
+        *len = msg_len + NC_VERSION_10_ENDTAG_LEN;
+        return 1;
+    case NC_VERSION_11:
+        while (1) {
+            /* chunk header, anything before it is skipped like by nc_read_until() */
+            ptr = memmem(buf + pos, session->in_pend_len - pos, "\n#", 2);
+            if (!ptr) {
+                break;
+            }
+            pos = ptr - buf + 2;
+            ptr = memchr(buf + pos, '\n', session->in_pend_len - pos);
+            if (!ptr) {
+                break;
+            }
+
+            if ((ptr == buf + pos + 1) && (buf[pos] == '#')) {
+                /* end of chunked framing message */
+                if (!*msg) {
+                    ERR("Session %u: invalid frame chunk delimiters.", session->id);
+                    return -1;
+                }
+                *len = ptr - buf + 1;
+                return 1;
+            }
+
+            chunk_len = strtoul(buf + pos, NULL, 10);
+            if (!chunk_len) {
+                ERR("Session %u: invalid frame chunk size detected, fatal error.", session->id);
+                free(*msg);
+                *msg = NULL;
+                return -1;
+            }
+            pos = ptr - buf + 1;
+            if (session->in_pend_len - pos < chunk_len) {
+                break;
+            }
+
+            *msg = nc_realloc(*msg, msg_len + chunk_len + 1);
+            if (!*msg) {
+                ERRMEM;
+                return -1;
+            }
+            memcpy(*msg + msg_len, buf + pos, chunk_len);
+            msg_len += chunk_len;
+            (*msg)[msg_len] = '\0';
+            pos += chunk_len;
+        }
+
+        /* incomplete, parsed again once more data arrive */
+        free(*msg);
+        *msg = NULL;
+        return 0;
+    }
+
+    ERRINT;
+    return -1;
+}
+
+/* return NC_MSG_ERROR can change session status, acquires IO lock as needed */
+NC_MSG_TYPE
+nc_read_msg_nonblock_str_io(struct nc_session *session, char **msg, uint64_t *msgid)
+{
+    int ret, interrupted;
+    ssize_t r;
+    size_t len;
+    char *ptr;
+
+    assert(session && msg);
+    *msg = NULL;
+
+    if ((session->status != NC_STATUS_RUNNING) && (session->status != NC_STATUS_STARTING)) {
+        ERR("Session %u: invalid session to read from.", session->id);
+        return NC_MSG_ERROR;
+    }
 
-    DBG("Session %u: received message:\n%s\n", session->id, msg);
+    /* SESSION IN LOCK */
+    ret = nc_session_in_lock(session, 0, __func__);
+    if (ret < 0) {
+        return NC_MSG_ERROR;
+    } else if (!ret) {
+        return NC_MSG_WOULDBLOCK;
+    }
+
+    while (!(ret = nc_read_pend_msg(session, msg, &len))) {
+        /* append all the available data to the pending data */
+        if (session->in_pend_size - session->in_pend_len < BUFFERSIZE) {
+            ptr = realloc(session->in_pend, session->in_pend_size + 8 * BUFFERSIZE);
+            if (!ptr) {
+                ERRMEM;
+                ret = -1;
+                break;
+            }
+            session->in_pend = ptr;
+            session->in_pend_size += 8 * BUFFERSIZE;
+        }
+
+        do {
+            r = nc_read_avail(session, session->in_pend + session->in_pend_len,
+                              session->in_pend_size - session->in_pend_len, &interrupted);
+        } while (!r && interrupted);
+        if (r < 1) {
+            if (!session->in_pend_len) {
+                nc_read_pend_consume(session, 0);
+            }
+
+            /* SESSION IN UNLOCK */
+            nc_session_in_unlock(session, __func__);
+            return r ? NC_MSG_ERROR : NC_MSG_WOULDBLOCK;
+        }
+        session->in_pend_len += r;
+    }
+
+    if (ret == 1) {
+        nc_read_pend_consume(session, len);
+    } else {
+        /* framing cannot be recovered */
+        nc_read_pend_consume(session, session->in_pend_len);
+    }
+
+    /* SESSION IN UNLOCK */
+    nc_session_in_unlock(session, __func__);
+
+    if (ret < 0) {
+        nc_msg_malformed(session, 0);
+        return NC_MSG_ERROR;
+    }
+
+    DBG("Session %u: received message:\n%s\n", session->id, *msg);
+
+    ret = nc_msg_sniff(session, *msg, msgid);
+    if (ret == NC_MSG_ERROR) {
+        nc_msg_malformed(session, 0);
+        free(*msg);
+        *msg = NULL;
+    }
+    return ret;
+}
+
+/* return NC_MSG_ERROR can change session status, msg is always consumed */
+NC_MSG_TYPE
+nc_parse_msg(struct nc_session *session, int io_timeout, char *msg, struct lyxml_elem **data)
+{
+    assert(session && msg && data);
 
     /* build XML tree */
     *data = lyxml_parse_mem(session->ctx, msg, LYXML_PARSE_NOMIXEDCONTENT);
+    free(msg);
     if (!*data) {
         goto malformed_msg;
     } else if (!(*data)->ns) {
         ERR("Session %u: invalid message root element (invalid namespace).", session->id);
         goto malformed_msg;
     }
-    free(msg);
-    msg = NULL;
 
     /* get and return message type */
     if (!strcmp((*data)->ns->value, NC_NS_BASE)) {
@@ -490,37 +948,29 @@ nc_read_msg_io(struct nc_session *session, int io_timeout, struct lyxml_elem **d
     }
 
 malformed_msg:
-    ERR("Session %u: malformed message received.", session->id);
-    if ((session->side == NC_SERVER) && (session->version == NC_VERSION_11)) {
-        /* NETCONF version 1.1 defines sending error reply from the server (RFC 6241 sec. 3) */
-        reply = nc_server_reply_err(nc_err(NC_ERR_MALFORMED_MSG));
+    nc_msg_malformed(session, io_timeout);
+    lyxml_free(session->ctx, *data);
+    *data = NULL;
 
-        if (io_locked) {
-            /* nc_write_msg_io locks and unlocks the lock by itself */
-            nc_session_io_unlock(session, __func__);
-            io_locked = 0;
-        }
+    return NC_MSG_ERROR;
+}
 
-        if (nc_write_msg_io(session, io_timeout, NC_MSG_REPLY, NULL, reply) != NC_MSG_REPLY) {
-            ERR("Session %u: unable to send a \"Malformed message\" error reply, terminating session.", session->id);
-            if (session->status != NC_STATUS_INVALID) {
-                session->status = NC_STATUS_INVALID;
-                session->term_reason = NC_SESSION_TERM_OTHER;
-            }
-        }
-        nc_server_reply_free(reply);
-    }
-    ret = NC_MSG_ERROR;
+/* return NC_MSG_ERROR can change session status, acquires IO lock as needed */
+NC_MSG_TYPE
+nc_read_msg_io(struct nc_session *session, int io_timeout, struct lyxml_elem **data, int passing_in_lock)
+{
+    NC_MSG_TYPE ret;
+    char *msg;
 
-cleanup:
-    if (io_locked) {
-        nc_session_io_unlock(session, __func__);
-    }
-    free(msg);
-    free(*data);
+    assert(session && data);
     *data = NULL;
 
-    return ret;
+    ret = nc_read_msg_str_io(session, io_timeout, &msg, NULL, passing_in_lock);
+    if ((ret == NC_MSG_ERROR) || (ret == NC_MSG_WOULDBLOCK)) {
+        return ret;
+    }
+
+    return nc_parse_msg(session, io_timeout, msg, data);
 }
 
 /* return -1 means either poll error or that session was invalidated (socket error), EINTR is handled inside */
@@ -530,27 +980,68 @@ nc_read_poll(struct nc_session *session, int io_timeout)
     sigset_t sigmask, origmask;
     int ret = -2;
     struct pollfd fds;
+#ifdef NC_ENABLED_SSH
+    struct timespec ts_timeout, ts_cur;
+    int timeout, poll_timeout;
+#endif
 
     if ((session->status != NC_STATUS_RUNNING) && (session->status != NC_STATUS_STARTING)) {
         ERR("Session %u: invalid session to poll.", session->id);
         return -1;
     }
 
+    if (session->in_pend_len) {
+        /* a partially received message */
+        return 1;
+    }
+
     switch (session->ti_type) {
 #ifdef NC_ENABLED_SSH
     case NC_TI_LIBSSH:
-        /* EINTR is handled, it resumes waiting */
-        ret = ssh_channel_poll_timeout(session->ti.libssh.channel, io_timeout, 0);
-        if (ret == SSH_ERROR) {
-            ERR("Session %u: SSH channel poll error (%s).", session->id,
-                ssh_get_error(session->ti.libssh.session));
-            session->status = NC_STATUS_INVALID;
-            session->term_reason = NC_SESSION_TERM_OTHER;
-            return -1;
-        } else if (ret == SSH_EOF) {
-            ERR("Session %u: SSH channel unexpected EOF.", session->id);
-            session->status = NC_STATUS_INVALID;
-            session->term_reason = NC_SESSION_TERM_DROPPED;
+        /* the IO lock is shared with the other channels, so hold it only while trying to fill the input buffer */
+        if (io_timeout > 0) {
+            nc_gettimespec_mono(&ts_timeout);
+            nc_addtimespec(&ts_timeout, io_timeout);
+        }
+        timeout = io_timeout;
+        while (!(ret = nc_ssh_in_fill(session, timeout)) && timeout) {
+            if (io_timeout > 0) {
+                nc_gettimespec_mono(&ts_cur);
+                timeout = nc_difftimespec(&ts_cur, &ts_timeout);
+                if (timeout < 1) {
+                    break;
+                }
+            }
+
+            /* wait for the SSH session socket, another channel can read our data so shared sockets only briefly */
+            fds.fd = ssh_get_fd(session->ti.libssh.session);
+            if (fds.fd == SSH_INVALID_SOCKET) {
+                ERR("Session %u: communication SSH socket unexpectedly closed.", session->id);
+                session->status = NC_STATUS_INVALID;
+                session->term_reason = NC_SESSION_TERM_DROPPED;
+                return -1;
+            }
+            fds.events = POLLIN;
+            fds.revents = 0;
+
+            poll_timeout = timeout;
+            if (session->ti.libssh.next && ((poll_timeout < 0) || (poll_timeout > NC_SSH_CHANNEL_POLL_STEP))) {
+                poll_timeout = NC_SSH_CHANNEL_POLL_STEP;
+            }
+
+            sigfillset(&sigmask);
+            pthread_sigmask(SIG_SETMASK, &sigmask, &origmask);
+            ret = poll(&fds, 1, poll_timeout);
+            pthread_sigmask(SIG_SETMASK, &origmask, NULL);
+            if ((ret < 0) && (errno != EINTR)) {
+                ERR("Session %u: poll error (%s).", session->id, strerror(errno));
+                session->status = NC_STATUS_INVALID;
+                session->term_reason = NC_SESSION_TERM_OTHER;
+                return -1;
+            }
+        }
+        if (ret < 0) {
+            /* error printed, session invalidated */
             return -1;
         } else if (ret > 0) {
             /* fake it */
@@ -626,20 +1117,20 @@ nc_read_poll(struct nc_session *session, int io_timeout)
 
 /* return NC_MSG_ERROR can change session status, acquires IO lock as needed */
 NC_MSG_TYPE
-nc_read_msg_poll_io(struct nc_session *session, int io_timeout, struct lyxml_elem **data)
+nc_read_msg_poll_str_io(struct nc_session *session, int io_timeout, char **msg, uint64_t *msgid)
 {
     int ret;
 
-    assert(data);
-    *data = NULL;
+    assert(msg);
+    *msg = NULL;
 
     if ((session->status != NC_STATUS_RUNNING) && (session->status != NC_STATUS_STARTING)) {
         ERR("Session %u: invalid session to read from.", session->id);
         return NC_MSG_ERROR;
     }
 
-    /* SESSION IO LOCK */
-    ret = nc_session_io_lock(session, io_timeout, __func__);
+    /* SESSION IN LOCK */
+    ret = nc_session_in_lock(session, io_timeout, __func__);
     if (ret < 0) {
         return NC_MSG_ERROR;
     } else if (!ret) {
@@ -650,19 +1141,37 @@ nc_read_msg_poll_io(struct nc_session *session, int io_timeout, struct lyxml_ele
     if (ret == 0) {
         /* timed out */
 
-        /* SESSION IO UNLOCK */
-        nc_session_io_unlock(session, __func__);
+        /* SESSION IN UNLOCK */
+        nc_session_in_unlock(session, __func__);
         return NC_MSG_WOULDBLOCK;
     } else if (ret < 0) {
         /* poll error, error written */
 
-        /* SESSION IO UNLOCK */
-        nc_session_io_unlock(session, __func__);
+        /* SESSION IN UNLOCK */
+        nc_session_in_unlock(session, __func__);
         return NC_MSG_ERROR;
     }
 
-    /* SESSION IO LOCK passed down */
-    return nc_read_msg_io(session, io_timeout, data, 1);
+    /* SESSION IN LOCK passed down */
+    return nc_read_msg_str_io(session, io_timeout, msg, msgid, 1);
+}
+
+/* return NC_MSG_ERROR can change session status, acquires IO lock as needed */
+NC_MSG_TYPE
+nc_read_msg_poll_io(struct nc_session *session, int io_timeout, struct lyxml_elem **data)
+{
+    NC_MSG_TYPE ret;
+    char *msg;
+
+    assert(data);
+    *data = NULL;
+
+    ret = nc_read_msg_poll_str_io(session, io_timeout, &msg, NULL);
+    if ((ret == NC_MSG_ERROR) || (ret == NC_MSG_WOULDBLOCK)) {
+        return ret;
+    }
+
+    return nc_parse_msg(session, io_timeout, msg, data);
 }
 
 /* does not really log, only fatal errors */
@@ -713,12 +1222,35 @@ nc_session_is_connected(struct nc_session *session)
 }
 
 #define WRITE_BUFSIZE (2 * BUFFERSIZE)
+/* room around the buffered data for the chunk header and the end tag to be written together with the data */
+#define WRITE_HDRSIZE 24
+#define WRITE_TAILSIZE 6
 struct wclb_arg {
     struct nc_session *session;
-    char buf[WRITE_BUFSIZE];
+    char *buf;                  /* buffered data, there is WRITE_HDRSIZE bytes before and WRITE_TAILSIZE after it */
+    size_t size;
     size_t len;
+    char sbuf[WRITE_HDRSIZE + WRITE_BUFSIZE + WRITE_TAILSIZE];
 };
 
+/* size of the buffer coalescing writes of a message */
+static size_t
+nc_write_bufsize(struct nc_session *session)
+{
+#ifdef NC_ENABLED_SSH
+    if ((session->ti_type == NC_TI_LIBSSH) && (session->ti.libssh.out_bufsize > WRITE_BUFSIZE)) {
+        if (session->ti.libssh.out_bufsize > NC_SSH_WRITE_BUFSIZE_MAX) {
+            return NC_SSH_WRITE_BUFSIZE_MAX;
+        }
+        return session->ti.libssh.out_bufsize;
+    }
+#else
+    (void)session;
+#endif
+
+    return WRITE_BUFSIZE;
+}
+
 static int
 nc_write(struct nc_session *session, const void *buf, size_t count)
 {
@@ -863,16 +1395,31 @@ nc_write_endtag(struct nc_session *session)
 }
 
 static int
-nc_write_clb_flush(struct wclb_arg *warg)
+nc_write_clb_flush(struct wclb_arg *warg, int last)
 {
-    int ret = 0;
+    int ret = 0, hdr_len = 0, end_len = 0;
+    char chunksize[WRITE_HDRSIZE];
 
-    /* flush current buffer */
-    if (warg->len) {
-        ret = nc_write_starttag_and_msg(warg->session, warg->buf, warg->len);
-        warg->len = 0;
+    if (!warg->len) {
+        return last ? nc_write_endtag(warg->session) : 0;
     }
 
+    /* write the chunk header and possibly the end tag with the buffered data */
+    if (warg->session->version == NC_VERSION_11) {
+        hdr_len = sprintf(chunksize, "\n#%zu\n", warg->len);
+        memcpy(warg->buf - hdr_len, chunksize, hdr_len);
+        if (last) {
+            end_len = 4;
+            memcpy(warg->buf + warg->len, "\n##\n", end_len);
+        }
+    } else if (last) {
+        end_len = 6;
+        memcpy(warg->buf + warg->len, "]]>]]>", end_len);
+    }
+
+    ret = nc_write(warg->session, warg->buf - hdr_len, hdr_len + warg->len + end_len);
+    warg->len = 0;
+
     return ret;
 }
 
@@ -884,32 +1431,20 @@ nc_write_clb(void *arg, const void *buf, size_t count, int xmlcontent)
     struct wclb_arg *warg = (struct wclb_arg *)arg;
 
     if (!buf) {
-        c = nc_write_clb_flush(warg);
-        if (c == -1) {
-            return -1;
-        }
-        ret += c;
-
-        /* endtag */
-        c = nc_write_endtag(warg->session);
-        if (c == -1) {
-            return -1;
-        }
-        ret += c;
-
-        return ret;
+        /* flush with the endtag */
+        return nc_write_clb_flush(warg, 1);
     }
 
-    if (warg->len && (warg->len + count > WRITE_BUFSIZE)) {
+    if (warg->len && (warg->len + count > warg->size)) {
         /* dump current buffer */
-        c = nc_write_clb_flush(warg);
+        c = nc_write_clb_flush(warg, 0);
         if (c == -1) {
             return -1;
         }
         ret += c;
     }
 
-    if (!xmlcontent && count > WRITE_BUFSIZE) {
+    if (!xmlcontent && count > warg->size) {
         /* write directly */
         c = nc_write_starttag_and_msg(warg->session, buf, count);
         if (c == -1) {
@@ -920,9 +1455,9 @@ nc_write_clb(void *arg, const void *buf, size_t count, int xmlcontent)
         /* keep in buffer and write later */
         if (xmlcontent) {
             for (l = 0; l < count; l++) {
-                if (warg->len + 5 >= WRITE_BUFSIZE) {
+                if (warg->len + 5 >= warg->size) {
                     /* buffer is full */
-                    c = nc_write_clb_flush(warg);
+                    c = nc_write_clb_flush(warg, 0);
                     if (c == -1) {
                         return -1;
                     }
@@ -953,7 +1488,7 @@ nc_write_clb(void *arg, const void *buf, size_t count, int xmlcontent)
             }
         } else {
             memcpy(&warg->buf[warg->len], buf, count);
-            warg->len += count; /* is <= WRITE_BUFSIZE */
+            warg->len += count; /* is <= warg->size */
             ret += count;
         }
     }
@@ -1158,9 +1693,8 @@ nc_write_msg_io(struct nc_session *session, int io_timeout, int type, ...)
 {
     va_list ap;
     int count, ret;
-    const char *attrs, *base_prefix;
+    const char *attrs, *base_prefix, *rpc_prefix, *rpc_attrs;
     struct lyd_node *content;
-    struct lyxml_elem *rpc_elem;
     struct nc_server_notif *notif;
     struct nc_server_reply *reply;
     struct nc_server_reply_error *error_rpl;
@@ -1179,13 +1713,26 @@ nc_write_msg_io(struct nc_session *session, int io_timeout, int type, ...)
 
     arg.session = session;
     arg.len = 0;
+    arg.size = nc_write_bufsize(session);
+    if (arg.size > WRITE_BUFSIZE) {
+        arg.buf = malloc(WRITE_HDRSIZE + arg.size + WRITE_TAILSIZE);
+        if (!arg.buf) {
+            ERRMEM;
+            return NC_MSG_ERROR;
+        }
+        arg.buf += WRITE_HDRSIZE;
+    } else {
+        arg.buf = arg.sbuf + WRITE_HDRSIZE;
+    }
 
     /* SESSION IO LOCK */
     ret = nc_session_io_lock(session, io_timeout, __func__);
     if (ret < 0) {
-        return NC_MSG_ERROR;
+        ret = NC_MSG_ERROR;
+        goto free_buf;
     } else if (!ret) {
-        return NC_MSG_WOULDBLOCK;
+        ret = NC_MSG_WOULDBLOCK;
+        goto free_buf;
     }
 
     va_start(ap, type);
@@ -1211,18 +1758,24 @@ nc_write_msg_io(struct nc_session *session, int io_timeout, int type, ...)
         }
         nc_write_clb((void *)&arg, "</rpc>", 6, 0);
 
+        /* the reply can be read by any thread once the message is flushed */
+        if (nc_client_reply_slot_add(session, session->opts.client.msgid + 1)) {
+            ret = NC_MSG_ERROR;
+            goto cleanup;
+        }
         session->opts.client.msgid++;
         break;
 
     case NC_MSG_REPLY:
-        rpc_elem = va_arg(ap, struct lyxml_elem *);
+        rpc_prefix = va_arg(ap, const char *);
+        rpc_attrs = va_arg(ap, const char *);
         reply = va_arg(ap, struct nc_server_reply *);
 
-        if (rpc_elem && rpc_elem->ns && rpc_elem->ns->prefix) {
+        if (rpc_prefix) {
             nc_write_clb((void *)&arg, "<", 1, 0);
-            nc_write_clb((void *)&arg, rpc_elem->ns->prefix, strlen(rpc_elem->ns->prefix), 0);
+            nc_write_clb((void *)&arg, rpc_prefix, strlen(rpc_prefix), 0);
             nc_write_clb((void *)&arg, ":rpc-reply", 10, 0);
-            base_prefix = rpc_elem->ns->prefix;
+            base_prefix = rpc_prefix;
         }
         else {
             nc_write_clb((void *)&arg, "<rpc-reply", 10, 0);
@@ -1230,8 +1783,8 @@ nc_write_msg_io(struct nc_session *session, int io_timeout, int type, ...)
         }
 
         /* can be NULL if replying with a malformed-message error */
-        if (rpc_elem) {
-            lyxml_print_clb(nc_write_xmlclb, (void *)&arg, rpc_elem, LYXML_PRINT_ATTRS);
+        if (rpc_attrs) {
+            nc_write_clb((void *)&arg, rpc_attrs, strlen(rpc_attrs), 0);
             nc_write_clb((void *)&arg, ">", 1, 0);
         } else {
             /* but put there at least the correct namespace */
@@ -1280,9 +1833,9 @@ nc_write_msg_io(struct nc_session *session, int io_timeout, int type, ...)
             ret = NC_MSG_ERROR;
             goto cleanup;
         }
-        if (rpc_elem && rpc_elem->ns && rpc_elem->ns->prefix) {
+        if (rpc_prefix) {
             nc_write_clb((void *)&arg, "</", 2, 0);
-            nc_write_clb((void *)&arg, rpc_elem->ns->prefix, strlen(rpc_elem->ns->prefix), 0);
+            nc_write_clb((void *)&arg, rpc_prefix, strlen(rpc_prefix), 0);
             nc_write_clb((void *)&arg, ":rpc-reply>", 11, 0);
         }
         else {
@@ -1358,6 +1911,11 @@ nc_write_msg_io(struct nc_session *session, int io_timeout, int type, ...)
 cleanup:
     va_end(ap);
     nc_session_io_unlock(session, __func__);
+
+free_buf:
+    if (arg.buf != arg.sbuf + WRITE_HDRSIZE) {
+        free(arg.buf - WRITE_HDRSIZE);
+    }
     return ret;
 }
 
@@ -571,6 +571,14 @@
  * this request with nc_ps_accept_ssh_channel() or nc_session_accept_ssh_channel()
  * depending on the structure you want to use as the argument.
  *
+ * Sessions waiting for requests hold as little memory as possible so that
+ * many mostly idle sessions can be kept. Once no RPC was received on a session
+ * for a few seconds, nc_ps_poll() releases its SSH channel input buffer and
+ * the OpenSSL record buffers (with OpenSSL 1.1.1 or newer, older versions release
+ * them whenever no data are pending) until some data arrive again. What remains
+ * are the transport library session structures and the message buffers
+ * of messages being processed.
+ *
  * Functions List
  * --------------
  *
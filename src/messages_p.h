@@ -64,8 +64,10 @@ struct nc_server_reply_error {
 };
 
 struct nc_server_rpc {
-    struct lyxml_elem *root; /**< RPC element of the received XML message */
+    const char *prefix;      /**< namespace prefix of the received RPC element, if any (dictionary) */
+    char *attrs;             /**< printed attributes of the received RPC element to be echoed in the reply */
     struct lyd_node *tree;   /**< libyang data tree of the message (NETCONF operation) */
+    struct lys_node *op;     /**< schema node of the RPC or action, its private pointer holds the callback */
 };
 
 struct nc_server_notif {
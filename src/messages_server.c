@@ -753,7 +753,8 @@ nc_server_rpc_free(struct nc_server_rpc *rpc, struct ly_ctx *ctx)
         return;
     }
 
-    lyxml_free(ctx, rpc->root);
+    lydict_remove(ctx, rpc->prefix);
+    free(rpc->attrs);
     lyd_free(rpc->tree);
 
     free(rpc);
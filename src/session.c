@@ -18,6 +18,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
 #include <pthread.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -229,6 +230,9 @@ nc_new_session(NC_SIDE side, int shared_ti)
         pthread_mutex_init(sess->opts.server.rpc_lock, NULL);
         pthread_cond_init(sess->opts.server.rpc_cond, NULL);
         *sess->opts.server.rpc_inuse = 0;
+    } else {
+        pthread_mutex_init(&sess->opts.client.msgs_lock, NULL);
+        pthread_cond_init(&sess->opts.client.msgs_cond, NULL);
     }
 
     if (!shared_ti) {
@@ -239,6 +243,12 @@ nc_new_session(NC_SIDE side, int shared_ti)
         pthread_mutex_init(sess->io_lock, NULL);
     }
 
+    sess->in_lock = malloc(sizeof *sess->in_lock);
+    if (!sess->in_lock) {
+        goto error;
+    }
+    pthread_mutex_init(sess->in_lock, NULL);
+
     return sess;
 
 error:
@@ -247,6 +257,10 @@ error:
         free(sess->opts.server.rpc_cond);
         free((int *)sess->opts.server.rpc_inuse);
     }
+    if (!shared_ti && sess->io_lock) {
+        pthread_mutex_destroy(sess->io_lock);
+        free(sess->io_lock);
+    }
     free(sess);
     return NULL;
 }
@@ -439,6 +453,72 @@ nc_session_io_unlock(struct nc_session *session, const char *func)
     return 1;
 }
 
+/*
+ * Lock held while reading a message. Only libssh sessions have their own input lock because their
+ * IO lock is shared by all the channels, for others it is the IO lock.
+ *
+ * @return 1 - success
+ *         0 - timeout
+ *        -1 - error
+ */
+int
+nc_session_in_lock(struct nc_session *session, int timeout, const char *func)
+{
+#ifdef NC_ENABLED_SSH
+    int ret;
+    struct timespec ts_timeout;
+
+    if (session->ti_type == NC_TI_LIBSSH) {
+        if (timeout > 0) {
+            nc_gettimespec_real(&ts_timeout);
+            nc_addtimespec(&ts_timeout, timeout);
+
+            ret = pthread_mutex_timedlock(session->in_lock, &ts_timeout);
+        } else if (!timeout) {
+            ret = pthread_mutex_trylock(session->in_lock);
+        } else { /* timeout == -1 */
+            ret = pthread_mutex_lock(session->in_lock);
+        }
+
+        if (ret) {
+            if ((ret == EBUSY) || (ret == ETIMEDOUT)) {
+                /* timeout */
+                return 0;
+            }
+
+            /* error */
+            ERR("%s: failed to input lock a session (%s).", func, strerror(ret));
+            return -1;
+        }
+
+        return 1;
+    }
+#endif
+
+    return nc_session_io_lock(session, timeout, func);
+}
+
+int
+nc_session_in_unlock(struct nc_session *session, const char *func)
+{
+#ifdef NC_ENABLED_SSH
+    int ret;
+
+    if (session->ti_type == NC_TI_LIBSSH) {
+        ret = pthread_mutex_unlock(session->in_lock);
+        if (ret) {
+            /* error */
+            ERR("%s: failed to input unlock a session (%s).", func, strerror(ret));
+            return -1;
+        }
+
+        return 1;
+    }
+#endif
+
+    return nc_session_io_unlock(session, func);
+}
+
 API NC_STATUS
 nc_session_get_status(const struct nc_session *session)
 {
@@ -584,6 +664,51 @@ nc_session_get_data(const struct nc_session *session)
     return session->data;
 }
 
+API int
+nc_session_get_fd(const struct nc_session *session, short *events)
+{
+    int fd = -1;
+
+    if (!session) {
+        ERRARG("session");
+        return -1;
+    }
+
+    if (events) {
+        *events = POLLIN;
+    }
+
+    switch (session->ti_type) {
+    case NC_TI_FD:
+        fd = session->ti.fd.in;
+        break;
+    case NC_TI_UNIX:
+        fd = session->ti.unixsock.sock;
+        break;
+#ifdef NC_ENABLED_SSH
+    case NC_TI_LIBSSH:
+        fd = ssh_get_fd(session->ti.libssh.session);
+        if (events && (ssh_get_poll_flags(session->ti.libssh.session) & SSH_WRITE_PENDING)) {
+            /* libssh finishes sending the data once the socket is writable */
+            *events |= POLLOUT;
+        }
+        break;
+#endif
+#ifdef NC_ENABLED_TLS
+    case NC_TI_OPENSSL:
+        fd = SSL_get_fd(session->ti.tls);
+        break;
+#endif
+    default:
+        break;
+    }
+
+    if (fd == -1) {
+        ERR("Session %u: no transport file descriptor.", session->id);
+    }
+    return fd;
+}
+
 NC_MSG_TYPE
 nc_send_msg_io(struct nc_session *session, int io_timeout, struct lyd_node *op)
 {
@@ -629,25 +754,6 @@ nc_session_free(struct nc_session *session, void (*data_free)(void *))
     }
 
     if ((session->side == NC_CLIENT) && (session->status == NC_STATUS_RUNNING)) {
-        /* cleanup message queues */
-        /* notifications */
-        for (contiter = session->opts.client.notifs; contiter; ) {
-            lyxml_free(session->ctx, contiter->msg);
-
-            p = contiter;
-            contiter = contiter->next;
-            free(p);
-        }
-
-        /* rpc replies */
-        for (contiter = session->opts.client.replies; contiter; ) {
-            lyxml_free(session->ctx, contiter->msg);
-
-            p = contiter;
-            contiter = contiter->next;
-            free(p);
-        }
-
         /* send closing info to the other side */
         ietfnc = ly_ctx_get_module(session->ctx, "ietf-netconf", NULL, 1);
         if (!ietfnc) {
@@ -689,6 +795,32 @@ nc_session_free(struct nc_session *session, void (*data_free)(void *))
         }
     }
 
+    if (session->side == NC_CLIENT) {
+        /* cleanup message queues */
+        /* notifications */
+        for (contiter = session->opts.client.notifs; contiter; ) {
+            free(contiter->msg);
+
+            p = contiter;
+            contiter = contiter->next;
+            free(p);
+        }
+
+        /* rpc replies, the map is allocated with the first reply slot */
+        for (i = 0; session->opts.client.replies && (i < NC_REPLY_MAP_SIZE); ++i) {
+            for (contiter = session->opts.client.replies[i]; contiter; ) {
+                free(contiter->msg);
+
+                p = contiter;
+                contiter = contiter->next;
+                free(p);
+            }
+        }
+        free(session->opts.client.replies);
+        pthread_cond_destroy(&session->opts.client.msgs_cond);
+        pthread_mutex_destroy(&session->opts.client.msgs_lock);
+    }
+
     if (session->data && data_free) {
         data_free(session->data);
     }
@@ -774,6 +906,9 @@ nc_session_free(struct nc_session *session, void (*data_free)(void *))
                         ly_ctx_destroy(session->ctx, NULL);
                     }
 
+                    free(siter->ti.libssh.in_buf);
+                    pthread_mutex_destroy(siter->in_lock);
+                    free(siter->in_lock);
                     free(siter);
                 } while (session->ti.libssh.next != session);
             }
@@ -811,6 +946,8 @@ nc_session_free(struct nc_session *session, void (*data_free)(void *))
         if (r == 1) {
             nc_session_io_unlock(session, __func__);
         }
+
+        free(session->ti.libssh.in_buf);
         break;
 #endif
 
@@ -859,11 +996,27 @@ nc_session_free(struct nc_session *session, void (*data_free)(void *))
         free(session->io_lock);
     }
 
+    if (session->in_lock) {
+        pthread_mutex_destroy(session->in_lock);
+        free(session->in_lock);
+    }
+    free(session->in_pend);
+
     if (!(session->flags & NC_SESSION_SHAREDCTX)) {
         ly_ctx_destroy(session->ctx, NULL);
     }
 
     if (session->side == NC_SERVER) {
+#if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
+        /* the application may still complete a deferred authentication */
+        nc_server_auth_release(session);
+#endif
+
+        /* the connection no longer counts to the limits of its source */
+        if (session->flags & NC_SESSION_SRC_COUNTED) {
+            nc_server_accept_src_release(session->opts.server.src_addr);
+        }
+
         /* free CH synchronization structures if used */
         if (session->opts.server.ch_cond) {
             pthread_cond_destroy(session->opts.server.ch_cond);
@@ -1516,6 +1669,34 @@ tls_dyn_destroy_func(struct CRYPTO_dynlock_value *l, const char *UNUSED(file), i
 }
 #endif
 
+int
+nc_tls_ktls_enable(SSL *tls)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+    /* OpenSSL keeps processing the records itself if the kernel or the cipher do not support it */
+    SSL_set_options(tls, SSL_OP_ENABLE_KTLS);
+    return 0;
+#else
+    (void)tls;
+    return -1;
+#endif
+}
+
+void
+nc_tls_ktls_print(SSL *tls)
+{
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send) && defined(BIO_get_ktls_recv)
+    if (!(SSL_get_options(tls) & SSL_OP_ENABLE_KTLS)) {
+        return;
+    }
+
+    VRB("Kernel TLS offload: sending %s, receiving %s.", BIO_get_ktls_send(SSL_get_wbio(tls)) ? "on" : "off",
+        BIO_get_ktls_recv(SSL_get_rbio(tls)) ? "on" : "off");
+#else
+    (void)tls;
+#endif
+}
+
 #endif /* NC_ENABLED_TLS */
 
 #if defined(NC_ENABLED_TLS) && !defined(NC_ENABLED_SSH)
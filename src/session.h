@@ -96,6 +96,22 @@ typedef enum {
     NC_CH_RANDOM
 } NC_CH_START_WITH;
 
+/**
+ * @brief Enumeration of server load states.
+ */
+typedef enum {
+    NC_LOAD_NORMAL = 0,     /**< server handles the load */
+    NC_LOAD_OVERLOAD        /**< server is overloaded, new sessions and low-priority RPCs are rejected */
+} NC_LOAD_STATE;
+
+/**
+ * @brief Enumeration of actions of server accept filter rules.
+ */
+typedef enum {
+    NC_ACCEPT_ALLOW = 0,    /**< connections from the prefix are accepted */
+    NC_ACCEPT_DENY          /**< connections from the prefix are closed before any handshake */
+} NC_ACCEPT_ACTION;
+
 /**
  * @brief Enumeration of SSH key types.
  */
@@ -191,6 +207,17 @@ uint16_t nc_session_get_port(const struct nc_session *session);
  */
 const char *nc_session_get_path(const struct nc_session *session);
 
+/**
+ * @brief Get the file descriptor of the session transport for an external event loop.
+ *
+ * On the client, once any of \p events occurs, call nc_session_process_io().
+ *
+ * @param[in] session Session to get the information from.
+ * @param[out] events Optional poll(2) events the caller should wait for.
+ * @return File descriptor of the transport, -1 on error.
+ */
+int nc_session_get_fd(const struct nc_session *session, short *events);
+
 /**
  * @brief Get session context.
  *
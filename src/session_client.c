@@ -19,8 +19,10 @@
 #endif
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -107,6 +109,7 @@ nc_client_context_free(void *ptr)
     {
         /* for the main thread the same is done in nc_client_destroy() */
         free(c->opts.schema_searchpath);
+        free(c->opts.schema_cache);
 
 #if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
         int i;
@@ -269,6 +272,30 @@ nc_client_get_schema_searchpath(void)
     return client_opts.schema_searchpath;
 }
 
+API int
+nc_client_set_schema_cache(const char *path)
+{
+    free(client_opts.schema_cache);
+
+    if (path) {
+        client_opts.schema_cache = strdup(path);
+        if (!client_opts.schema_cache) {
+            ERRMEM;
+            return 1;
+        }
+    } else {
+        client_opts.schema_cache = NULL;
+    }
+
+    return 0;
+}
+
+API const char *
+nc_client_get_schema_cache(void)
+{
+    return client_opts.schema_cache;
+}
+
 API int
 nc_client_set_schema_callback(ly_module_imp_clb clb, void *user_data)
 {
@@ -303,14 +330,379 @@ struct schema_info {
     int implemented;
 };
 
+/* FNV-1a offset basis */
+#define SCHEMA_CACHE_HASH_INIT 0xcbf29ce484222325ULL
+
+/* index of the schemas of a single server module set in the schema cache */
+struct schema_cache {
+    char *index_path;
+    struct {
+        char *name;
+        char *revision;
+        uint64_t hash;
+    } *items;
+    uint32_t count;
+    int dirty;
+};
+
 struct clb_data_s {
     void *user_data;
     ly_module_imp_clb user_clb;
     struct schema_info *schemas;
     struct nc_session *session;
     int has_get_schema;
+    struct schema_cache *cache;
 };
 
+static uint64_t
+schema_cache_hash(uint64_t hash, const char *str)
+{
+    for (; *str; ++str) {
+        hash ^= (unsigned char)*str;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+/* names and revisions come from the server and are used in file paths, allow only YANG identifiers and dates */
+static int
+schema_cache_name_valid(const char *name, const char *revision)
+{
+    const char *ptr;
+
+    if (!(((name[0] >= 'A') && (name[0] <= 'Z')) || ((name[0] >= 'a') && (name[0] <= 'z')) || (name[0] == '_'))) {
+        return 0;
+    }
+    for (ptr = name + 1; *ptr; ++ptr) {
+        if (!isalnum((unsigned char)*ptr) && (*ptr != '_') && (*ptr != '.') && (*ptr != '-')) {
+            return 0;
+        }
+    }
+
+    if (!strcmp(revision, "-")) {
+        return 1;
+    }
+    for (ptr = revision; *ptr; ++ptr) {
+        if (((ptr - revision == 4) || (ptr - revision == 7)) ? (*ptr != '-') : !isdigit((unsigned char)*ptr)) {
+            return 0;
+        }
+    }
+    return (ptr - revision == 10);
+}
+
+static char *
+schema_cache_read_file(const char *path)
+{
+    FILE *f;
+    long length;
+    char *data;
+
+    f = fopen(path, "r");
+    if (!f) {
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (length < 0) {
+        fclose(f);
+        return NULL;
+    }
+
+    data = malloc(length + 1);
+    if (!data) {
+        ERRMEM;
+    } else if (fread(data, 1, length, f) != (size_t)length) {
+        free(data);
+        data = NULL;
+    } else {
+        data[length] = '\0';
+    }
+    fclose(f);
+
+    return data;
+}
+
+/* write data into a temporary file in the cache directory and atomically move it to path */
+static int
+schema_cache_write_file(const char *path, const char *data)
+{
+    char *tmp_path;
+    int fd, ret = -1;
+    FILE *f;
+
+    if (asprintf(&tmp_path, "%s/.nc_schema_XXXXXX", client_opts.schema_cache) == -1) {
+        ERRMEM;
+        return -1;
+    }
+
+    fd = mkstemp(tmp_path);
+    if (fd == -1) {
+        WRN("Unable to create a file in the schema cache \"%s\" (%s).", client_opts.schema_cache, strerror(errno));
+        free(tmp_path);
+        return -1;
+    }
+    f = fdopen(fd, "w");
+    if (!f) {
+        close(fd);
+    } else {
+        if (fputs(data, f) != EOF) {
+            ret = 0;
+        }
+        if (fclose(f)) {
+            ret = -1;
+        }
+    }
+
+    if (!ret && rename(tmp_path, path)) {
+        ret = -1;
+    }
+    if (ret) {
+        WRN("Unable to store \"%s\" into the schema cache (%s).", path, strerror(errno));
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+
+    return ret;
+}
+
+static int
+schema_cache_add(struct schema_cache *cache, const char *name, const char *revision, uint64_t hash)
+{
+    void *ptr;
+    uint32_t i;
+
+    for (i = 0; i < cache->count; ++i) {
+        if (!strcmp(cache->items[i].name, name) && !strcmp(cache->items[i].revision, revision)) {
+            if (cache->items[i].hash != hash) {
+                cache->items[i].hash = hash;
+                cache->dirty = 1;
+            }
+            return 0;
+        }
+    }
+
+    ptr = realloc(cache->items, (cache->count + 1) * sizeof *cache->items);
+    if (!ptr) {
+        ERRMEM;
+        return -1;
+    }
+    cache->items = ptr;
+    cache->items[cache->count].name = strdup(name);
+    cache->items[cache->count].revision = strdup(revision);
+    if (!cache->items[cache->count].name || !cache->items[cache->count].revision) {
+        ERRMEM;
+        free(cache->items[cache->count].name);
+        free(cache->items[cache->count].revision);
+        return -1;
+    }
+    cache->items[cache->count].hash = hash;
+    ++cache->count;
+    cache->dirty = 1;
+
+    return 0;
+}
+
+static void
+schema_cache_clean(struct schema_cache *cache)
+{
+    uint32_t i;
+
+    if (!cache) {
+        return;
+    }
+
+    for (i = 0; i < cache->count; ++i) {
+        free(cache->items[i].name);
+        free(cache->items[i].revision);
+    }
+    free(cache->items);
+    free(cache->index_path);
+    free(cache);
+}
+
+/* the cache can be used only if the server identifies its module set, the index is then
+ * keyed by the server and all its capabilities (including the module set identifier) */
+static struct schema_cache *
+schema_cache_init(struct nc_session *session)
+{
+    struct schema_cache *cache;
+    uint64_t key, hash;
+    int i, msid = 0;
+    FILE *f;
+    char *line = NULL, *hash_str, *name, *revision, *ptr;
+    size_t line_len = 0;
+
+    if (!client_opts.schema_cache) {
+        return NULL;
+    }
+
+    key = schema_cache_hash(SCHEMA_CACHE_HASH_INIT, session->host ? session->host : "");
+    for (i = 0; session->opts.client.cpblts[i]; ++i) {
+        if (strstr(session->opts.client.cpblts[i], "module-set-id=") || strstr(session->opts.client.cpblts[i], "content-id=")) {
+            msid = 1;
+        }
+        key = schema_cache_hash(key, session->opts.client.cpblts[i]);
+    }
+    if (!msid) {
+        VRB("Session %u: server does not identify its module set, schema cache not used.", session->id);
+        return NULL;
+    }
+
+    cache = calloc(1, sizeof *cache);
+    if (!cache) {
+        ERRMEM;
+        return NULL;
+    }
+    if (asprintf(&cache->index_path, "%s/%016" PRIx64 ".index", client_opts.schema_cache, key) == -1) {
+        ERRMEM;
+        free(cache);
+        return NULL;
+    }
+
+    f = fopen(cache->index_path, "r");
+    if (!f) {
+        /* server module set not cached yet */
+        return cache;
+    }
+    while (getline(&line, &line_len, f) != -1) {
+        hash_str = strtok_r(line, " \n", &ptr);
+        name = strtok_r(NULL, " \n", &ptr);
+        revision = strtok_r(NULL, " \n", &ptr);
+        if (!hash_str || !name || !revision) {
+            continue;
+        }
+        if (!schema_cache_name_valid(name, revision)) {
+            WRN("Session %u: invalid schema \"%s\" in the schema cache index \"%s\", ignoring it.", session->id,
+                name, cache->index_path);
+            continue;
+        }
+        hash = strtoull(hash_str, NULL, 16);
+        if (schema_cache_add(cache, name, revision, hash)) {
+            break;
+        }
+    }
+    free(line);
+    fclose(f);
+
+    /* just loaded */
+    cache->dirty = 0;
+    VRB("Session %u: using schema cache index \"%s\" with %u schemas.", session->id, cache->index_path, cache->count);
+
+    return cache;
+}
+
+static void
+schema_cache_store_index(struct schema_cache *cache)
+{
+    char *data = NULL;
+    size_t size = 0;
+    FILE *f;
+    uint32_t i;
+
+    if (!cache || !cache->dirty) {
+        return;
+    }
+
+    f = open_memstream(&data, &size);
+    if (!f) {
+        ERRMEM;
+        return;
+    }
+    for (i = 0; i < cache->count; ++i) {
+        fprintf(f, "%016" PRIx64 " %s %s\n", cache->items[i].hash, cache->items[i].name, cache->items[i].revision);
+    }
+    fclose(f);
+
+    if (!schema_cache_write_file(cache->index_path, data)) {
+        cache->dirty = 0;
+    }
+    free(data);
+}
+
+static char *
+schema_cache_file_path(const char *name, const char *revision, uint64_t hash)
+{
+    char *path;
+
+    if (asprintf(&path, "%s/%s%s%s.%016" PRIx64 ".yang", client_opts.schema_cache, name,
+                 strcmp(revision, "-") ? "@" : "", strcmp(revision, "-") ? revision : "", hash) == -1) {
+        ERRMEM;
+        return NULL;
+    }
+
+    return path;
+}
+
+static char *
+schema_cache_get(struct schema_cache *cache, struct nc_session *session, const char *name, const char *rev,
+                 LYS_INFORMAT *format)
+{
+    uint32_t i;
+    char *path, *model_data;
+
+    if (!cache) {
+        return NULL;
+    }
+
+    for (i = 0; i < cache->count; ++i) {
+        if (!strcmp(cache->items[i].name, name) && !strcmp(cache->items[i].revision, rev ? rev : "-")) {
+            break;
+        }
+    }
+    if (i == cache->count) {
+        return NULL;
+    }
+
+    path = schema_cache_file_path(cache->items[i].name, cache->items[i].revision, cache->items[i].hash);
+    if (!path) {
+        return NULL;
+    }
+    model_data = schema_cache_read_file(path);
+    if (model_data && (schema_cache_hash(SCHEMA_CACHE_HASH_INIT, model_data) != cache->items[i].hash)) {
+        WRN("Session %u: cached schema \"%s\" is corrupted, removing it.", session->id, path);
+        free(model_data);
+        model_data = NULL;
+        /* so that it is stored again once retrieved */
+        unlink(path);
+    }
+    if (model_data) {
+        VRB("Session %u: reading schema from the schema cache \"%s\".", session->id, path);
+        *format = LYS_IN_YANG;
+    }
+    free(path);
+
+    return model_data;
+}
+
+static void
+schema_cache_put(struct schema_cache *cache, const char *name, const char *rev, const char *model_data)
+{
+    uint64_t hash;
+    char *path;
+
+    if (!cache) {
+        return;
+    } else if (!schema_cache_name_valid(name, rev ? rev : "-")) {
+        WRN("Schema \"%s\" name or revision cannot be used in the schema cache, not caching it.", name);
+        return;
+    }
+
+    hash = schema_cache_hash(SCHEMA_CACHE_HASH_INIT, model_data);
+    path = schema_cache_file_path(name, rev ? rev : "-", hash);
+    if (!path) {
+        return;
+    }
+
+    /* the same content may have been cached already for another module set */
+    if (!access(path, R_OK) || !schema_cache_write_file(path, model_data)) {
+        schema_cache_add(cache, name, rev ? rev : "-", hash);
+    }
+    free(path);
+}
+
 static char *
 retrieve_schema_data_localfile(const char *name, const char *rev, struct clb_data_s *clb_data,
                                LYS_INFORMAT *format)
@@ -483,6 +875,8 @@ retrieve_schema_data_getschema(const char *name, const char *rev, struct clb_dat
                 free(localfile);
             }
         }
+
+        schema_cache_put(clb_data->cache, name, rev, model_data);
     }
 
     return model_data;
@@ -549,7 +943,12 @@ retrieve_schema_data(const char *mod_name, const char *mod_rev, const char *subm
 
     VRB("Session %u: retreiving data for schema \"%s\", revision \"%s\".", clb_data->session->id, name, rev);
 
-    if (match) {
+    /* 0. try the schema cache of this server module set */
+    model_data = schema_cache_get(clb_data->cache, clb_data->session, name, rev, format);
+
+    if (model_data) {
+        /* no communication with the server needed */
+    } else if (match) {
         /* we have enough information to avoid communication with server and try to get
          * the schema locally */
 
@@ -590,7 +989,8 @@ retrieve_schema_data(const char *mod_name, const char *mod_rev, const char *subm
 
 static int
 nc_ctx_load_module(struct nc_session *session, const char *name, const char *revision, struct schema_info *schemas,
-                   ly_module_imp_clb user_clb, void *user_data, int has_get_schema, const struct lys_module **mod)
+                   ly_module_imp_clb user_clb, void *user_data, int has_get_schema, struct schema_cache *cache,
+                   const struct lys_module **mod)
 {
     int ret = 0;
     struct ly_err_item *eitem;
@@ -618,6 +1018,7 @@ nc_ctx_load_module(struct nc_session *session, const char *name, const char *rev
         clb_data.session = session;
         clb_data.user_clb = user_clb;
         clb_data.user_data = user_data;
+        clb_data.cache = cache;
 
         /* clear all the errors and just collect them for now */
         ly_err_clean(session->ctx, NULL);
@@ -903,7 +1304,8 @@ build_schema_info_cpblts(char **cpblts, struct schema_info **result)
 }
 
 static int
-nc_ctx_fill(struct nc_session *session, struct schema_info *modules, ly_module_imp_clb user_clb, void *user_data, int has_get_schema)
+nc_ctx_fill(struct nc_session *session, struct schema_info *modules, ly_module_imp_clb user_clb, void *user_data,
+            int has_get_schema, struct schema_cache *cache)
 {
     int ret = EXIT_FAILURE;
     const struct lys_module *mod;
@@ -916,7 +1318,8 @@ nc_ctx_fill(struct nc_session *session, struct schema_info *modules, ly_module_i
         }
 
         /* we can continue even if it fails */
-        nc_ctx_load_module(session, modules[u].name, modules[u].revision, modules, user_clb, user_data, has_get_schema, &mod);
+        nc_ctx_load_module(session, modules[u].name, modules[u].revision, modules, user_clb, user_data, has_get_schema,
+                           cache, &mod);
 
         if (!mod) {
             if (session->status != NC_STATUS_RUNNING) {
@@ -946,14 +1349,15 @@ cleanup:
 }
 
 static int
-nc_ctx_fill_ietf_netconf(struct nc_session *session, struct schema_info *modules, ly_module_imp_clb user_clb, void *user_data, int has_get_schema)
+nc_ctx_fill_ietf_netconf(struct nc_session *session, struct schema_info *modules, ly_module_imp_clb user_clb, void *user_data,
+                         int has_get_schema, struct schema_cache *cache)
 {
     unsigned int u, v;
     const struct lys_module *ietfnc;
 
     ietfnc = ly_ctx_get_module(session->ctx, "ietf-netconf", NULL, 1);
     if (!ietfnc) {
-        nc_ctx_load_module(session, "ietf-netconf", NULL, modules, user_clb, user_data, has_get_schema, &ietfnc);
+        nc_ctx_load_module(session, "ietf-netconf", NULL, modules, user_clb, user_data, has_get_schema, cache, &ietfnc);
         if (!ietfnc) {
             ietfnc = lys_parse_mem(session->ctx, ietf_netconf_2013_09_29_yang, LYS_YANG);
         }
@@ -987,6 +1391,7 @@ nc_ctx_check_and_fill(struct nc_session *session)
     const struct lys_module *mod = NULL;
     char *revision;
     struct schema_info *server_modules = NULL, *sm = NULL;
+    struct schema_cache *cache = NULL;
 
     assert(session->opts.client.cpblts && session->ctx);
 
@@ -1025,6 +1430,9 @@ nc_ctx_check_and_fill(struct nc_session *session)
         VRB("Session %u: capability for yang-library support not found.", session->id);
     }
 
+    /* schemas of an already seen server module set are read from the schema cache */
+    cache = schema_cache_init(session);
+
     /* get information about server's schemas from capabilities list until we will have yang-library */
     if (build_schema_info_cpblts(session->opts.client.cpblts, &server_modules) || !server_modules) {
         ERR("Session %u: unable to get server's schema information from the <hello>'s capabilities.", session->id);
@@ -1038,7 +1446,7 @@ nc_ctx_check_and_fill(struct nc_session *session)
     }
 
     /* load base model disregarding whether it's in capabilities (but NETCONF capabilities are used to enable features) */
-    if (nc_ctx_fill_ietf_netconf(session, server_modules, old_clb, old_data, get_schema_support)) {
+    if (nc_ctx_fill_ietf_netconf(session, server_modules, old_clb, old_data, get_schema_support, cache)) {
         goto cleanup;
     }
 
@@ -1053,7 +1461,7 @@ nc_ctx_check_and_fill(struct nc_session *session)
         } else {
             revision = strndup(&revision[9], 10);
             if (nc_ctx_load_module(session, "ietf-yang-library", revision, server_modules, old_clb, old_data,
-                    get_schema_support, &mod)) {
+                    get_schema_support, cache, &mod)) {
                 WRN("Session %u: loading NETCONF ietf-yang-library schema failed, unable to use it to learn all the supported modules.",
                     session->id);
                 yanglib_support = 0;
@@ -1061,7 +1469,7 @@ nc_ctx_check_and_fill(struct nc_session *session)
             if (strcmp(revision, "2019-01-04") >= 0) {
                 /* we also need ietf-datastores to be implemented */
                 if (nc_ctx_load_module(session, "ietf-datastores", NULL, server_modules, old_clb, old_data,
-                        get_schema_support, &mod)) {
+                        get_schema_support, cache, &mod)) {
                     WRN("Session %u: loading NETCONF ietf-datastores schema failed, unable to use yang-library"
                         " to learn all the supported modules.", session->id);
                     yanglib_support = 0;
@@ -1084,12 +1492,13 @@ nc_ctx_check_and_fill(struct nc_session *session)
         }
     }
 
-    if (nc_ctx_fill(session, server_modules, old_clb, old_data, get_schema_support)) {
+    if (nc_ctx_fill(session, server_modules, old_clb, old_data, get_schema_support, cache)) {
         goto cleanup;
     }
 
     /* succsess */
     ret = 0;
+    schema_cache_store_index(cache);
 
     if (session->flags & NC_SESSION_CLIENT_NOT_STRICT) {
         WRN("Session %u: some models failed to be loaded, any data from these models (and any other unknown) will be ignored.", session->id);
@@ -1097,6 +1506,7 @@ nc_ctx_check_and_fill(struct nc_session *session)
 
 cleanup:
     free_schema_info(server_modules);
+    schema_cache_clean(cache);
 
     /* set user callback back */
     ly_ctx_set_module_imp_clb(session->ctx, old_clb, old_data);
@@ -1433,84 +1843,351 @@ error:
     return -1;
 }
 
-static NC_MSG_TYPE
-get_msg(struct nc_session *session, int timeout, uint64_t msgid, struct lyxml_elem **msg)
+/* MSGS LOCK expected to be held and the map allocated, returns the slot pointer or the pointer to the end of its bucket */
+static struct nc_msg_cont **
+nc_client_reply_slot_find(struct nc_session *session, uint64_t msgid)
+{
+    struct nc_msg_cont **cont_ptr;
+
+    cont_ptr = &session->opts.client.replies[msgid & (NC_REPLY_MAP_SIZE - 1)];
+    while (*cont_ptr && ((*cont_ptr)->msgid != msgid)) {
+        cont_ptr = &(*cont_ptr)->next;
+    }
+
+    return cont_ptr;
+}
+
+/* MSGS LOCK expected to be held, frees the slot with its reply, if any */
+static void
+nc_client_reply_slot_del(struct nc_session *session, uint64_t msgid)
 {
-    char *ptr;
-    const char *str_msgid;
-    uint64_t cur_msgid;
-    struct lyxml_elem *xml;
     struct nc_msg_cont *cont, **cont_ptr;
-    NC_MSG_TYPE msgtype = 0; /* NC_MSG_ERROR */
 
-    /* try to get notification from the session's queue */
-    if (!msgid && session->opts.client.notifs) {
-        cont = session->opts.client.notifs;
-        session->opts.client.notifs = cont->next;
+    if (!session->opts.client.replies) {
+        return;
+    }
 
-        xml = cont->msg;
-        free(cont);
+    cont_ptr = nc_client_reply_slot_find(session, msgid);
+    cont = *cont_ptr;
+    if (!cont) {
+        return;
+    }
+    *cont_ptr = cont->next;
 
-        msgtype = NC_MSG_NOTIF;
+    if (cont->reply_clb && cont->msg) {
+        --session->opts.client.async_ready;
     }
+    free(cont->msg);
+    free(cont);
+}
 
-    /* try to get rpc-reply from the session's queue */
-    if (msgid && session->opts.client.replies) {
-        cont = session->opts.client.replies;
-        session->opts.client.replies = cont->next;
+/* MSGS LOCK expected to be held, the waiter gave up, the slot is kept only for a while for the reply */
+static void
+nc_client_reply_slot_abandon(struct nc_session *session, uint64_t msgid)
+{
+    struct nc_msg_cont *cont;
+    struct timespec ts_cur;
 
-        xml = cont->msg;
-        free(cont);
+    if (!session->opts.client.replies) {
+        return;
+    }
 
-        msgtype = NC_MSG_REPLY;
+    cont = *nc_client_reply_slot_find(session, msgid);
+    if (cont && !cont->reply_clb) {
+        nc_gettimespec_mono(&ts_cur);
+        /* 0 means awaited */
+        cont->abandoned = ts_cur.tv_sec ? ts_cur.tv_sec : 1;
     }
+}
+
+/* MSGS LOCK expected to be held, frees the slots abandoned for too long, at most once a second */
+static void
+nc_client_reply_slot_purge(struct nc_session *session)
+{
+    struct nc_msg_cont *cont, **cont_ptr;
+    struct timespec ts_cur;
+    uint16_t i;
 
-    if (!msgtype) {
-        /* read message from wire */
-        msgtype = nc_read_msg_poll_io(session, timeout, &xml);
+    nc_gettimespec_mono(&ts_cur);
+    if (session->opts.client.replies_purged == ts_cur.tv_sec) {
+        return;
     }
+    session->opts.client.replies_purged = ts_cur.tv_sec;
 
-    /* we read rpc-reply, want a notif */
-    if (!msgid && (msgtype == NC_MSG_REPLY)) {
-        cont_ptr = &session->opts.client.replies;
+    for (i = 0; i < NC_REPLY_MAP_SIZE; ++i) {
+        cont_ptr = &session->opts.client.replies[i];
         while (*cont_ptr) {
-            cont_ptr = &((*cont_ptr)->next);
+            cont = *cont_ptr;
+            if (!cont->abandoned || (ts_cur.tv_sec - cont->abandoned < NC_REPLY_SLOT_TIMEOUT)) {
+                cont_ptr = &cont->next;
+                continue;
+            }
+
+            if (cont->msg) {
+                VRB("Session %u: discarding an uncollected <rpc-reply> with message-id \"%" PRIu64 "\".",
+                    session->id, cont->msgid);
+            }
+            *cont_ptr = cont->next;
+            free(cont->msg);
+            free(cont);
         }
-        *cont_ptr = malloc(sizeof **cont_ptr);
-        if (!*cont_ptr) {
+    }
+}
+
+/* MSGS LOCK expected to be held */
+static int
+_nc_client_reply_slot_add(struct nc_session *session, uint64_t msgid)
+{
+    struct nc_msg_cont **cont_ptr;
+
+    if (!session->opts.client.replies) {
+        session->opts.client.replies = calloc(NC_REPLY_MAP_SIZE, sizeof *session->opts.client.replies);
+        if (!session->opts.client.replies) {
             ERRMEM;
-            lyxml_free(session->ctx, xml);
-            return NC_MSG_ERROR;
+            return -1;
         }
-        (*cont_ptr)->msg = xml;
-        (*cont_ptr)->next = NULL;
     }
+    nc_client_reply_slot_purge(session);
 
-    /* we read notif, want a rpc-reply */
-    if (msgid && (msgtype == NC_MSG_NOTIF)) {
-        if (!session->opts.client.ntf_tid) {
-            ERR("Session %u: received a <notification> but session is not subscribed.", session->id);
-            lyxml_free(session->ctx, xml);
-            return NC_MSG_ERROR;
+    cont_ptr = nc_client_reply_slot_find(session, msgid);
+    if (*cont_ptr) {
+        /* already awaited, maybe again */
+        (*cont_ptr)->abandoned = 0;
+        return 0;
+    }
+
+    *cont_ptr = calloc(1, sizeof **cont_ptr);
+    if (!*cont_ptr) {
+        ERRMEM;
+        return -1;
+    }
+    (*cont_ptr)->msgid = msgid;
+
+    return 0;
+}
+
+int
+nc_client_reply_slot_add(struct nc_session *session, uint64_t msgid)
+{
+    int ret;
+
+    /* MSGS LOCK */
+    pthread_mutex_lock(&session->opts.client.msgs_lock);
+
+    ret = _nc_client_reply_slot_add(session, msgid);
+
+    /* MSGS UNLOCK */
+    pthread_mutex_unlock(&session->opts.client.msgs_lock);
+
+    return ret;
+}
+
+/* MSGS LOCK expected to be held, takes the awaited message if it was already read by another thread */
+static char *
+nc_client_msg_take(struct nc_session *session, uint64_t msgid)
+{
+    struct nc_msg_cont *cont, **cont_ptr;
+    char *str = NULL;
+
+    if (!msgid) {
+        cont = session->opts.client.notifs;
+        if (cont) {
+            session->opts.client.notifs = cont->next;
+            if (!cont->next) {
+                session->opts.client.notifs_last = NULL;
+            }
+            str = cont->msg;
+            free(cont);
         }
+    } else if (session->opts.client.replies) {
+        cont_ptr = nc_client_reply_slot_find(session, msgid);
+        if (*cont_ptr && (*cont_ptr)->msg) {
+            cont = *cont_ptr;
+            *cont_ptr = cont->next;
+            str = cont->msg;
+            free(cont);
+        }
+    }
 
-        cont_ptr = &session->opts.client.notifs;
-        while (*cont_ptr) {
-            cont_ptr = &((*cont_ptr)->next);
+    return str;
+}
+
+/* MSGS LOCK expected to be held, stores a message awaited by another thread,
+ * ret 0 on success, 1 if nobody awaits the reply, -1 on error */
+static int
+nc_client_msg_store(struct nc_session *session, NC_MSG_TYPE msgtype, char *str, uint64_t msgid)
+{
+    struct nc_msg_cont *cont, **cont_ptr;
+
+    if (msgtype == NC_MSG_REPLY) {
+        if (!msgid || !session->opts.client.replies) {
+            return 1;
         }
-        *cont_ptr = malloc(sizeof **cont_ptr);
-        if (!*cont_ptr) {
+        cont_ptr = nc_client_reply_slot_find(session, msgid);
+        if (!*cont_ptr || (*cont_ptr)->msg) {
+            return 1;
+        }
+        (*cont_ptr)->msg = str;
+        if ((*cont_ptr)->reply_clb) {
+            ++session->opts.client.async_ready;
+        }
+    } else {
+        cont = calloc(1, sizeof *cont);
+        if (!cont) {
             ERRMEM;
-            lyxml_free(session->ctx, xml);
-            return NC_MSG_ERROR;
+            return -1;
+        }
+        cont->msg = str;
+
+        if (session->opts.client.notifs_last) {
+            session->opts.client.notifs_last->next = cont;
+        } else {
+            session->opts.client.notifs = cont;
+        }
+        session->opts.client.notifs_last = cont;
+    }
+
+    /* wake the waiting threads */
+    pthread_cond_broadcast(&session->opts.client.msgs_cond);
+    return 0;
+}
+
+static NC_MSG_TYPE
+get_msg(struct nc_session *session, int timeout, uint64_t msgid, struct lyxml_elem **msg)
+{
+    char *str = NULL;
+    uint64_t cur_msgid = 0;
+    struct lyxml_elem *xml;
+    struct timespec ts_timeout, ts_timeout_real, ts_cur;
+    int r, io_timeout;
+    NC_MSG_TYPE msgtype = 0; /* NC_MSG_ERROR */
+
+    if (timeout > -1) {
+        nc_gettimespec_mono(&ts_timeout);
+        nc_addtimespec(&ts_timeout, timeout);
+        nc_gettimespec_real(&ts_timeout_real);
+        nc_addtimespec(&ts_timeout_real, timeout);
+    }
+
+    /* MSGS LOCK */
+    pthread_mutex_lock(&session->opts.client.msgs_lock);
+
+    /* the reply may have been awaited before, keep its slot even on timeout to store it once it arrives */
+    if (msgid && _nc_client_reply_slot_add(session, msgid)) {
+        /* MSGS UNLOCK */
+        pthread_mutex_unlock(&session->opts.client.msgs_lock);
+        return NC_MSG_ERROR;
+    }
+
+    while (1) {
+        /* try to get the message read by another thread */
+        str = nc_client_msg_take(session, msgid);
+        if (str) {
+            msgtype = msgid ? NC_MSG_REPLY : NC_MSG_NOTIF;
+            cur_msgid = msgid;
+            break;
+        }
+
+        if (session->opts.client.msgs_reading) {
+            /* another thread is reading, wait until it stores our message or stops reading */
+            if (!timeout) {
+                msgtype = NC_MSG_WOULDBLOCK;
+                break;
+            } else if (timeout > -1) {
+                r = pthread_cond_timedwait(&session->opts.client.msgs_cond, &session->opts.client.msgs_lock,
+                        &ts_timeout_real);
+            } else {
+                r = pthread_cond_wait(&session->opts.client.msgs_cond, &session->opts.client.msgs_lock);
+            }
+            if (r == ETIMEDOUT) {
+                msgtype = NC_MSG_WOULDBLOCK;
+                break;
+            } else if (r) {
+                ERR("Pthread condition wait failed (%s).", strerror(r));
+                msgtype = NC_MSG_ERROR;
+                break;
+            }
+            continue;
+        }
+
+        io_timeout = timeout;
+        if (timeout > 0) {
+            nc_gettimespec_mono(&ts_cur);
+            io_timeout = nc_difftimespec(&ts_cur, &ts_timeout);
+            if (io_timeout < 1) {
+                msgtype = NC_MSG_WOULDBLOCK;
+                break;
+            }
+        }
+        session->opts.client.msgs_reading = 1;
+
+        /* MSGS UNLOCK */
+        pthread_mutex_unlock(&session->opts.client.msgs_lock);
+
+        /* read message from wire, it is parsed only once it is actually returned */
+        msgtype = nc_read_msg_poll_str_io(session, io_timeout, &str, &cur_msgid);
+
+        /* MSGS LOCK */
+        pthread_mutex_lock(&session->opts.client.msgs_lock);
+
+        session->opts.client.msgs_reading = 0;
+        pthread_cond_broadcast(&session->opts.client.msgs_cond);
+
+        if ((msgtype == NC_MSG_REPLY) && msgid && (cur_msgid == msgid)) {
+            /* our reply, remove its slot */
+            nc_client_reply_slot_del(session, msgid);
+            break;
+        } else if ((msgtype == NC_MSG_NOTIF) && !msgid) {
+            /* our notification */
+            break;
+        } else if ((msgtype != NC_MSG_REPLY) && (msgtype != NC_MSG_NOTIF)) {
+            /* error, timeout, or an unexpected message */
+            break;
         }
-        (*cont_ptr)->msg = xml;
-        (*cont_ptr)->next = NULL;
+
+        /* we read a message for another thread */
+        if ((msgtype == NC_MSG_NOTIF) && !session->opts.client.ntf_tid && !session->opts.client.notif_clb) {
+            ERR("Session %u: received a <notification> but session is not subscribed.", session->id);
+            free(str);
+            msgtype = NC_MSG_ERROR;
+            break;
+        }
+
+        r = nc_client_msg_store(session, msgtype, str, cur_msgid);
+        if (r == -1) {
+            free(str);
+            msgtype = NC_MSG_ERROR;
+            break;
+        } else if (r) {
+            /* nobody awaits this reply */
+            if (msgid) {
+                /* return it to the caller to decide, one without a message-id is taken as ours */
+                if (!cur_msgid) {
+                    nc_client_reply_slot_del(session, msgid);
+                }
+                break;
+            }
+            ERR("Session %u: received an unexpected <rpc-reply> with message-id \"%" PRIu64 "\", discarding it.",
+                session->id, cur_msgid);
+            free(str);
+        }
+        str = NULL;
     }
 
+    if (msgid && ((msgtype == NC_MSG_WOULDBLOCK) || (msgtype == NC_MSG_ERROR))) {
+        /* the reply may still be received by a later call */
+        nc_client_reply_slot_abandon(session, msgid);
+    }
+
+    /* MSGS UNLOCK */
+    pthread_mutex_unlock(&session->opts.client.msgs_lock);
+
     switch (msgtype) {
     case NC_MSG_NOTIF:
         if (!msgid) {
+            if (nc_parse_msg(session, timeout, str, &xml) != NC_MSG_NOTIF) {
+                return NC_MSG_ERROR;
+            }
             *msg = xml;
         }
         break;
@@ -1518,16 +2195,15 @@ get_msg(struct nc_session *session, int timeout, uint64_t msgid, struct lyxml_el
     case NC_MSG_REPLY:
         if (msgid) {
             /* check message-id */
-            str_msgid = lyxml_get_attr(xml, "message-id", NULL);
-            if (!str_msgid) {
+            if (!cur_msgid) {
                 WRN("Session %u: received a <rpc-reply> without a message-id.", session->id);
-            } else {
-                cur_msgid = strtoul(str_msgid, &ptr, 10);
-                if (cur_msgid != msgid) {
-                    ERR("Session %u: received a <rpc-reply> with an unexpected message-id \"%s\".",
-                        session->id, str_msgid);
-                    msgtype = NC_MSG_REPLY_ERR_MSGID;
-                }
+            } else if (cur_msgid != msgid) {
+                ERR("Session %u: received a <rpc-reply> with an unexpected message-id \"%" PRIu64 "\".",
+                    session->id, cur_msgid);
+                msgtype = NC_MSG_REPLY_ERR_MSGID;
+            }
+            if (nc_parse_msg(session, timeout, str, &xml) != NC_MSG_REPLY) {
+                return NC_MSG_ERROR;
             }
             *msg = xml;
         }
@@ -1535,13 +2211,13 @@ get_msg(struct nc_session *session, int timeout, uint64_t msgid, struct lyxml_el
 
     case NC_MSG_HELLO:
         ERR("Session %u: received another <hello> message.", session->id);
-        lyxml_free(session->ctx, xml);
+        free(str);
         msgtype = NC_MSG_ERROR;
         break;
 
     case NC_MSG_RPC:
         ERR("Session %u: received <rpc> from a NETCONF server.", session->id);
-        lyxml_free(session->ctx, xml);
+        free(str);
         msgtype = NC_MSG_ERROR;
         break;
 
@@ -1876,6 +2552,328 @@ parse_reply(struct ly_ctx *ctx, struct lyxml_elem *xml, struct nc_rpc *rpc, int
 
 #if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
 
+/* established sessions shared by all the threads */
+static struct {
+    pthread_mutex_t lock;
+    struct nc_client_pool_entry *entries;
+    uint32_t max_idle;
+    uint32_t max_lifetime;
+} client_pool = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static int
+nc_client_pool_strcmp(const char *str1, const char *str2)
+{
+    if (!str1 || !str2) {
+        return (str1 != str2);
+    }
+    return strcmp(str1, str2);
+}
+
+/* frees the entry without its session */
+static void
+nc_client_pool_entry_clear(struct nc_client_pool_entry *entry)
+{
+    free(entry->host);
+    free(entry->username);
+    free(entry->cert_path);
+    free(entry->key_path);
+    free(entry);
+}
+
+static void
+nc_client_pool_entry_free(struct nc_client_pool_entry *entry)
+{
+    nc_session_free(entry->session, NULL);
+    nc_client_pool_entry_clear(entry);
+}
+
+/* milliseconds elapsed since a monotonic time */
+static uint64_t
+nc_client_pool_elapsed(const struct timespec *since, const struct timespec *now)
+{
+    return ((int64_t)now->tv_sec - since->tv_sec) * 1000 + (now->tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/* POOL LOCK expected to be held, moves idle entries over the limits into the list */
+static void
+nc_client_pool_expire(const struct timespec *now, struct nc_client_pool_entry **expired)
+{
+    struct nc_client_pool_entry **entry_ptr, *entry;
+
+    entry_ptr = &client_pool.entries;
+    while (*entry_ptr) {
+        entry = *entry_ptr;
+        if (entry->in_use || ((entry->session->status == NC_STATUS_RUNNING)
+                && (!client_pool.max_idle || (nc_client_pool_elapsed(&entry->idle_since, now) < client_pool.max_idle))
+                && (!client_pool.max_lifetime
+                    || (nc_client_pool_elapsed(&entry->created, now) < client_pool.max_lifetime)))) {
+            entry_ptr = &entry->next;
+            continue;
+        }
+
+        *entry_ptr = entry->next;
+        entry->next = *expired;
+        *expired = entry;
+    }
+}
+
+static struct nc_session *
+nc_client_pool_connect(const char *host, uint16_t port, const char *username, NC_TRANSPORT_IMPL ti, struct ly_ctx *ctx)
+{
+    struct nc_session *session = NULL;
+#ifdef NC_ENABLED_SSH
+    char *orig_username = NULL;
+#endif
+
+    switch (ti) {
+#ifdef NC_ENABLED_SSH
+    case NC_TI_LIBSSH:
+        if (username) {
+            /* the client options are thread-specific, change them only for this connection */
+            if (nc_client_ssh_get_username()) {
+                orig_username = strdup(nc_client_ssh_get_username());
+                if (!orig_username) {
+                    ERRMEM;
+                    return NULL;
+                }
+            }
+            if (nc_client_ssh_set_username(username)) {
+                free(orig_username);
+                return NULL;
+            }
+        }
+
+        session = nc_connect_ssh(host, port, ctx);
+
+        if (username) {
+            nc_client_ssh_set_username(orig_username);
+            free(orig_username);
+        }
+        break;
+#endif
+#ifdef NC_ENABLED_TLS
+    case NC_TI_OPENSSL:
+        /* the username is given by the client certificate */
+        (void)username;
+        session = nc_connect_tls(host, port, ctx);
+        break;
+#endif
+    default:
+        ERRARG("ti");
+        break;
+    }
+
+    return session;
+}
+
+API struct nc_session *
+nc_client_pool_get(const char *host, uint16_t port, const char *username, NC_TRANSPORT_IMPL ti, struct ly_ctx *ctx)
+{
+    struct nc_client_pool_entry *entry, *expired = NULL;
+    struct nc_session *session = NULL;
+    struct timespec ts;
+    const char *cert_path = NULL, *key_path = NULL;
+
+    if (!host) {
+        ERRARG("host");
+        return NULL;
+    }
+
+    /* sessions are shared only among the callers authenticating as the same client */
+    switch (ti) {
+#ifdef NC_ENABLED_SSH
+    case NC_TI_LIBSSH:
+        if (!username) {
+            username = nc_client_ssh_get_username();
+        }
+        break;
+#endif
+#ifdef NC_ENABLED_TLS
+    case NC_TI_OPENSSL:
+        /* the username is given by the client certificate */
+        username = NULL;
+        nc_client_tls_get_cert_key_paths(&cert_path, &key_path);
+        break;
+#endif
+    default:
+        ERRARG("ti");
+        return NULL;
+    }
+
+    while (!session) {
+        nc_gettimespec_mono(&ts);
+
+        /* POOL LOCK */
+        pthread_mutex_lock(&client_pool.lock);
+
+        nc_client_pool_expire(&ts, &expired);
+        for (entry = client_pool.entries; entry; entry = entry->next) {
+            if (!entry->in_use && (entry->ti == ti) && (entry->port == port) && (entry->ctx == ctx)
+                    && !strcmp(entry->host, host) && !nc_client_pool_strcmp(entry->username, username)
+                    && !nc_client_pool_strcmp(entry->cert_path, cert_path)
+                    && !nc_client_pool_strcmp(entry->key_path, key_path)) {
+                entry->in_use = 1;
+                break;
+            }
+        }
+
+        /* POOL UNLOCK */
+        pthread_mutex_unlock(&client_pool.lock);
+
+        /* free the sessions outside the lock, it sends <close-session> */
+        while (expired) {
+            entry = expired;
+            expired = expired->next;
+            nc_client_pool_entry_free(entry);
+        }
+
+        if (!entry) {
+            break;
+        }
+
+        if (nc_session_is_connected(entry->session)) {
+            session = entry->session;
+        } else {
+            /* the server dropped the session, it will be freed on the next pass */
+            VRB("Session %u: pooled session no longer connected.", entry->session->id);
+            entry->session->status = NC_STATUS_INVALID;
+            entry->session->term_reason = NC_SESSION_TERM_DROPPED;
+
+            /* POOL LOCK */
+            pthread_mutex_lock(&client_pool.lock);
+            entry->in_use = 0;
+            /* POOL UNLOCK */
+            pthread_mutex_unlock(&client_pool.lock);
+        }
+    }
+
+    if (session) {
+        return session;
+    }
+
+    /* no session to reuse */
+    entry = calloc(1, sizeof *entry);
+    if (!entry) {
+        ERRMEM;
+        return NULL;
+    }
+    entry->host = strdup(host);
+    entry->username = username ? strdup(username) : NULL;
+    entry->cert_path = cert_path ? strdup(cert_path) : NULL;
+    entry->key_path = key_path ? strdup(key_path) : NULL;
+    if (!entry->host || (username && !entry->username) || (cert_path && !entry->cert_path)
+            || (key_path && !entry->key_path)) {
+        ERRMEM;
+        goto fail;
+    }
+    entry->port = port;
+    entry->ti = ti;
+    entry->ctx = ctx;
+    entry->in_use = 1;
+
+    entry->session = nc_client_pool_connect(host, port, username, ti, ctx);
+    if (!entry->session) {
+        goto fail;
+    }
+    nc_gettimespec_mono(&entry->created);
+
+    /* POOL LOCK */
+    pthread_mutex_lock(&client_pool.lock);
+
+    entry->next = client_pool.entries;
+    client_pool.entries = entry;
+
+    /* POOL UNLOCK */
+    pthread_mutex_unlock(&client_pool.lock);
+
+    return entry->session;
+
+fail:
+    nc_client_pool_entry_clear(entry);
+    return NULL;
+}
+
+API void
+nc_client_pool_put(struct nc_session *session)
+{
+    struct nc_client_pool_entry *entry, *expired = NULL;
+    struct timespec ts;
+
+    if (!session) {
+        ERRARG("session");
+        return;
+    }
+
+    nc_gettimespec_mono(&ts);
+
+    /* POOL LOCK */
+    pthread_mutex_lock(&client_pool.lock);
+
+    for (entry = client_pool.entries; entry && (entry->session != session); entry = entry->next);
+    if (entry) {
+        entry->in_use = 0;
+        entry->idle_since = ts;
+        nc_client_pool_expire(&ts, &expired);
+    }
+
+    /* POOL UNLOCK */
+    pthread_mutex_unlock(&client_pool.lock);
+
+    if (!entry) {
+        /* the pool was flushed meanwhile */
+        nc_session_free(session, NULL);
+    }
+    while (expired) {
+        entry = expired;
+        expired = expired->next;
+        nc_client_pool_entry_free(entry);
+    }
+}
+
+API void
+nc_client_pool_set_limits(uint32_t max_idle, uint32_t max_lifetime)
+{
+    /* POOL LOCK */
+    pthread_mutex_lock(&client_pool.lock);
+
+    client_pool.max_idle = max_idle;
+    client_pool.max_lifetime = max_lifetime;
+
+    /* POOL UNLOCK */
+    pthread_mutex_unlock(&client_pool.lock);
+}
+
+API void
+nc_client_pool_flush(void)
+{
+    struct nc_client_pool_entry **entry_ptr, *entry, *expired = NULL;
+
+    /* POOL LOCK */
+    pthread_mutex_lock(&client_pool.lock);
+
+    entry_ptr = &client_pool.entries;
+    while (*entry_ptr) {
+        entry = *entry_ptr;
+        *entry_ptr = entry->next;
+        if (entry->in_use) {
+            /* freed by nc_client_pool_put() */
+            nc_client_pool_entry_clear(entry);
+        } else {
+            entry->next = expired;
+            expired = entry;
+        }
+    }
+
+    /* POOL UNLOCK */
+    pthread_mutex_unlock(&client_pool.lock);
+
+    while (expired) {
+        entry = expired;
+        expired = expired->next;
+        nc_client_pool_entry_free(entry);
+    }
+}
+
 int
 nc_client_ch_add_bind_listen(const char *address, uint16_t port, NC_TRANSPORT_IMPL ti)
 {
@@ -2067,8 +3065,10 @@ API void
 nc_client_destroy(void)
 {
     nc_client_set_schema_searchpath(NULL);
+    nc_client_set_schema_cache(NULL);
 #if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
     nc_client_ch_del_bind(NULL, 0, 0);
+    nc_client_pool_flush();
 #endif
 #ifdef NC_ENABLED_SSH
     nc_client_ssh_destroy_opts();
@@ -2079,6 +3079,19 @@ nc_client_destroy(void)
     nc_destroy();
 }
 
+static int
+nc_client_reply_parseroptions(struct nc_session *session, int parseroptions)
+{
+    parseroptions &= ~(LYD_OPT_DESTRUCT | LYD_OPT_NOSIBLINGS);
+    if (!(session->flags & NC_SESSION_CLIENT_NOT_STRICT)) {
+        parseroptions |= LYD_OPT_STRICT;
+    }
+    /* no mechanism to check external dependencies is provided */
+    parseroptions|= LYD_OPT_NOEXTDEPS;
+
+    return parseroptions;
+}
+
 API NC_MSG_TYPE
 nc_recv_reply(struct nc_session *session, struct nc_rpc *rpc, uint64_t msgid, int timeout, int parseroptions, struct nc_reply **reply)
 {
@@ -2104,12 +3117,7 @@ nc_recv_reply(struct nc_session *session, struct nc_rpc *rpc, uint64_t msgid, in
         ERR("Session %u: invalid session to receive RPC replies.", session->id);
         return NC_MSG_ERROR;
     }
-    parseroptions &= ~(LYD_OPT_DESTRUCT | LYD_OPT_NOSIBLINGS);
-    if (!(session->flags & NC_SESSION_CLIENT_NOT_STRICT)) {
-        parseroptions &= LYD_OPT_STRICT;
-    }
-    /* no mechanism to check external dependencies is provided */
-    parseroptions|= LYD_OPT_NOEXTDEPS;
+    parseroptions = nc_client_reply_parseroptions(session, parseroptions);
     *reply = NULL;
 
     msgtype = get_msg(session, timeout, msgid, &xml);
@@ -2127,10 +3135,59 @@ nc_recv_reply(struct nc_session *session, struct nc_rpc *rpc, uint64_t msgid, in
     return msgtype;
 }
 
+/* xml is always freed */
+static int
+parse_notif(struct nc_session *session, struct lyxml_elem *xml, struct nc_notif **notif)
+{
+    struct lyxml_elem *ev_time;
+
+    *notif = calloc(1, sizeof **notif);
+    if (!*notif) {
+        ERRMEM;
+        lyxml_free(session->ctx, xml);
+        return -1;
+    }
+
+    /* eventTime */
+    LY_TREE_FOR(xml->child, ev_time) {
+        if (!strcmp(ev_time->name, "eventTime")) {
+            (*notif)->datetime = lydict_insert(session->ctx, ev_time->content, 0);
+            /* lyd_parse does not know this element */
+            lyxml_free(session->ctx, ev_time);
+            break;
+        }
+    }
+    if (!(*notif)->datetime) {
+        ERR("Session %u: notification is missing the \"eventTime\" element.", session->id);
+        goto fail;
+    }
+
+    /* notification body */
+    (*notif)->tree = lyd_parse_xml(session->ctx, &xml->child, LYD_OPT_NOTIF | LYD_OPT_DESTRUCT | LYD_OPT_NOEXTDEPS
+                                   | (session->flags & NC_SESSION_CLIENT_NOT_STRICT ? 0 : LYD_OPT_STRICT), NULL);
+    lyxml_free(session->ctx, xml);
+    xml = NULL;
+    if (!(*notif)->tree) {
+        ERR("Session %u: failed to parse a new notification.", session->id);
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    lydict_remove(session->ctx, (*notif)->datetime);
+    lyd_free((*notif)->tree);
+    free(*notif);
+    *notif = NULL;
+    lyxml_free(session->ctx, xml);
+
+    return -1;
+}
+
 API NC_MSG_TYPE
 nc_recv_notif(struct nc_session *session, int timeout, struct nc_notif **notif)
 {
-    struct lyxml_elem *xml, *ev_time;
+    struct lyxml_elem *xml;
     NC_MSG_TYPE msgtype = 0; /* NC_MSG_ERROR */
 
     if (!session) {
@@ -2146,49 +3203,11 @@ nc_recv_notif(struct nc_session *session, int timeout, struct nc_notif **notif)
 
     msgtype = get_msg(session, timeout, 0, &xml);
 
-    if (msgtype == NC_MSG_NOTIF) {
-        *notif = calloc(1, sizeof **notif);
-        if (!*notif) {
-            ERRMEM;
-            lyxml_free(session->ctx, xml);
-            return NC_MSG_ERROR;
-        }
-
-        /* eventTime */
-        LY_TREE_FOR(xml->child, ev_time) {
-            if (!strcmp(ev_time->name, "eventTime")) {
-                (*notif)->datetime = lydict_insert(session->ctx, ev_time->content, 0);
-                /* lyd_parse does not know this element */
-                lyxml_free(session->ctx, ev_time);
-                break;
-            }
-        }
-        if (!(*notif)->datetime) {
-            ERR("Session %u: notification is missing the \"eventTime\" element.", session->id);
-            goto fail;
-        }
-
-        /* notification body */
-        (*notif)->tree = lyd_parse_xml(session->ctx, &xml->child, LYD_OPT_NOTIF | LYD_OPT_DESTRUCT | LYD_OPT_NOEXTDEPS
-                                       | (session->flags & NC_SESSION_CLIENT_NOT_STRICT ? 0 : LYD_OPT_STRICT), NULL);
-        lyxml_free(session->ctx, xml);
-        xml = NULL;
-        if (!(*notif)->tree) {
-            ERR("Session %u: failed to parse a new notification.", session->id);
-            goto fail;
-        }
+    if ((msgtype == NC_MSG_NOTIF) && parse_notif(session, xml, notif)) {
+        return NC_MSG_ERROR;
     }
 
     return msgtype;
-
-fail:
-    lydict_remove(session->ctx, (*notif)->datetime);
-    lyd_free((*notif)->tree);
-    free(*notif);
-    *notif = NULL;
-    lyxml_free(session->ctx, xml);
-
-    return NC_MSG_ERROR;
 }
 
 static void *
@@ -2253,6 +3272,9 @@ nc_recv_notif_dispatch(struct nc_session *session, void (*notif_clb)(struct nc_s
     } else if (session->opts.client.ntf_tid) {
         ERR("Session %u: separate notification thread is already running.", session->id);
         return -1;
+    } else if (session->opts.client.notif_clb) {
+        ERR("Session %u: notifications are already received asynchronously.", session->id);
+        return -1;
     }
 
     ntarg = malloc(sizeof *ntarg);
@@ -2924,6 +3946,277 @@ nc_send_rpc(struct nc_session *session, struct nc_rpc *rpc, int timeout, uint64_
     return r;
 }
 
+API NC_MSG_TYPE
+nc_send_rpc_async(struct nc_session *session, struct nc_rpc *rpc, int timeout, int parseroptions,
+        void (*reply_clb)(struct nc_session *session, uint64_t msgid, NC_MSG_TYPE msgtype, struct nc_reply *reply,
+        void *user_data), void *user_data, uint64_t *msgid)
+{
+    struct nc_msg_cont *cont;
+    NC_MSG_TYPE r;
+
+    if (!reply_clb) {
+        ERRARG("reply_clb");
+        return NC_MSG_ERROR;
+    } else if (parseroptions & LYD_OPT_TYPEMASK) {
+        ERRARG("parseroptions");
+        return NC_MSG_ERROR;
+    }
+
+    r = nc_send_rpc(session, rpc, timeout, msgid);
+    if (r != NC_MSG_RPC) {
+        return r;
+    }
+
+    /* MSGS LOCK */
+    pthread_mutex_lock(&session->opts.client.msgs_lock);
+
+    /* the slot was added when sending the RPC, the reply may have even been stored already */
+    cont = *nc_client_reply_slot_find(session, *msgid);
+    if (!cont) {
+        ERRINT;
+        r = NC_MSG_ERROR;
+    } else {
+        cont->reply_clb = reply_clb;
+        cont->user_data = user_data;
+        cont->rpc = rpc;
+        cont->parseroptions = nc_client_reply_parseroptions(session, parseroptions);
+        if (cont->msg) {
+            ++session->opts.client.async_ready;
+        }
+    }
+
+    /* MSGS UNLOCK */
+    pthread_mutex_unlock(&session->opts.client.msgs_lock);
+
+    return r;
+}
+
+API int
+nc_recv_notif_async(struct nc_session *session, void (*notif_clb)(struct nc_session *session, const struct nc_notif *notif))
+{
+    if (!session) {
+        ERRARG("session");
+        return -1;
+    } else if (!notif_clb) {
+        ERRARG("notif_clb");
+        return -1;
+    } else if ((session->status != NC_STATUS_RUNNING) || (session->side != NC_CLIENT)) {
+        ERR("Session %u: invalid session to receive Notifications.", session->id);
+        return -1;
+    } else if (session->opts.client.ntf_tid) {
+        ERR("Session %u: separate notification thread is already running.", session->id);
+        return -1;
+    }
+
+    /* MSGS LOCK */
+    pthread_mutex_lock(&session->opts.client.msgs_lock);
+
+    session->opts.client.notif_clb = notif_clb;
+
+    /* MSGS UNLOCK */
+    pthread_mutex_unlock(&session->opts.client.msgs_lock);
+
+    return 0;
+}
+
+/* MSGS LOCK expected to be held, takes a received message to be passed to a callback */
+static struct nc_msg_cont *
+nc_client_async_take(struct nc_session *session)
+{
+    struct nc_msg_cont *cont, **cont_ptr;
+    uint16_t i;
+
+    if (session->opts.client.notif_clb && session->opts.client.notifs) {
+        cont = session->opts.client.notifs;
+        session->opts.client.notifs = cont->next;
+        if (!cont->next) {
+            session->opts.client.notifs_last = NULL;
+        }
+        return cont;
+    }
+
+    if (!session->opts.client.async_ready) {
+        return NULL;
+    }
+
+    for (i = 0; session->opts.client.replies && (i < NC_REPLY_MAP_SIZE); ++i) {
+        for (cont_ptr = &session->opts.client.replies[i]; *cont_ptr; cont_ptr = &(*cont_ptr)->next) {
+            if ((*cont_ptr)->reply_clb && (*cont_ptr)->msg) {
+                cont = *cont_ptr;
+                *cont_ptr = cont->next;
+                --session->opts.client.async_ready;
+                return cont;
+            }
+        }
+    }
+
+    ERRINT;
+    session->opts.client.async_ready = 0;
+    return NULL;
+}
+
+/* cont is always freed, a reply without the message is delivered as an error */
+static void
+nc_client_async_deliver(struct nc_session *session, struct nc_msg_cont *cont)
+{
+    struct lyxml_elem *xml;
+    struct nc_notif *notif;
+    struct nc_reply *reply = NULL;
+    NC_MSG_TYPE msgtype = NC_MSG_ERROR;
+
+    if (!cont->reply_clb) {
+        /* notification */
+        if ((nc_parse_msg(session, 0, cont->msg, &xml) == NC_MSG_NOTIF) && !parse_notif(session, xml, &notif)) {
+            session->opts.client.notif_clb(session, notif);
+            nc_notif_free(notif);
+        }
+        free(cont);
+        return;
+    }
+
+    if (cont->msg && (nc_parse_msg(session, 0, cont->msg, &xml) == NC_MSG_REPLY)) {
+        reply = parse_reply(session->ctx, xml, cont->rpc, cont->parseroptions);
+        lyxml_free_withsiblings(session->ctx, xml);
+        if (reply) {
+            msgtype = NC_MSG_REPLY;
+        }
+    }
+
+    cont->reply_clb(session, cont->msgid, msgtype, reply, cont->user_data);
+    free(cont);
+}
+
+/* the session is broken, deliver what was received and fail the rest of the replies */
+static void
+nc_client_async_fail(struct nc_session *session)
+{
+    struct nc_msg_cont *list = NULL, *cont, **cont_ptr;
+    uint16_t i;
+
+    /* MSGS LOCK */
+    pthread_mutex_lock(&session->opts.client.msgs_lock);
+
+    for (i = 0; session->opts.client.replies && (i < NC_REPLY_MAP_SIZE); ++i) {
+        cont_ptr = &session->opts.client.replies[i];
+        while (*cont_ptr) {
+            if (!(*cont_ptr)->reply_clb) {
+                cont_ptr = &(*cont_ptr)->next;
+                continue;
+            }
+
+            cont = *cont_ptr;
+            *cont_ptr = cont->next;
+            cont->next = list;
+            list = cont;
+        }
+    }
+    session->opts.client.async_ready = 0;
+
+    /* MSGS UNLOCK */
+    pthread_mutex_unlock(&session->opts.client.msgs_lock);
+
+    while (list) {
+        cont = list;
+        list = list->next;
+        nc_client_async_deliver(session, cont);
+    }
+}
+
+API int
+nc_session_process_io(struct nc_session *session)
+{
+    struct nc_msg_cont *cont;
+    char *str;
+    uint64_t cur_msgid;
+    NC_MSG_TYPE msgtype;
+    int r, ret = 0;
+
+    if (!session) {
+        ERRARG("session");
+        return -1;
+    } else if ((session->status != NC_STATUS_RUNNING) || (session->side != NC_CLIENT)) {
+        ERR("Session %u: invalid session to process.", session->id);
+        return -1;
+    }
+
+    /* MSGS LOCK */
+    pthread_mutex_lock(&session->opts.client.msgs_lock);
+
+    while (1) {
+        /* deliver all the messages received so far */
+        cont = nc_client_async_take(session);
+        if (cont) {
+            /* MSGS UNLOCK */
+            pthread_mutex_unlock(&session->opts.client.msgs_lock);
+
+            nc_client_async_deliver(session, cont);
+            ++ret;
+
+            /* MSGS LOCK */
+            pthread_mutex_lock(&session->opts.client.msgs_lock);
+            continue;
+        }
+
+        if (session->opts.client.msgs_reading) {
+            /* another thread is reading, it stores the messages for us */
+            break;
+        }
+        session->opts.client.msgs_reading = 1;
+
+        /* MSGS UNLOCK */
+        pthread_mutex_unlock(&session->opts.client.msgs_lock);
+
+        /* read everything available, never block, partial messages are completed by the next calls */
+        msgtype = nc_read_msg_nonblock_str_io(session, &str, &cur_msgid);
+
+        /* MSGS LOCK */
+        pthread_mutex_lock(&session->opts.client.msgs_lock);
+
+        session->opts.client.msgs_reading = 0;
+        pthread_cond_broadcast(&session->opts.client.msgs_cond);
+
+        if (msgtype == NC_MSG_WOULDBLOCK) {
+            break;
+        } else if ((msgtype != NC_MSG_REPLY) && (msgtype != NC_MSG_NOTIF)) {
+            if (msgtype == NC_MSG_HELLO) {
+                ERR("Session %u: received another <hello> message.", session->id);
+            } else if (msgtype == NC_MSG_RPC) {
+                ERR("Session %u: received <rpc> from a NETCONF server.", session->id);
+            }
+            free(str);
+            ret = -1;
+            break;
+        }
+
+        if ((msgtype == NC_MSG_NOTIF) && !session->opts.client.ntf_tid && !session->opts.client.notif_clb) {
+            ERR("Session %u: received a <notification> but session is not subscribed.", session->id);
+            free(str);
+            continue;
+        }
+
+        r = nc_client_msg_store(session, msgtype, str, cur_msgid);
+        if (r == -1) {
+            free(str);
+            ret = -1;
+            break;
+        } else if (r) {
+            ERR("Session %u: received an unexpected <rpc-reply> with message-id \"%" PRIu64 "\", discarding it.",
+                session->id, cur_msgid);
+            free(str);
+        }
+    }
+
+    /* MSGS UNLOCK */
+    pthread_mutex_unlock(&session->opts.client.msgs_lock);
+
+    if ((ret == -1) && (session->status != NC_STATUS_RUNNING)) {
+        /* no more replies will arrive */
+        nc_client_async_fail(session);
+    }
+
+    return ret;
+}
+
 API void
 nc_client_session_set_not_strict(struct nc_session *session)
 {
@@ -66,6 +66,27 @@ int nc_client_set_schema_searchpath(const char *path);
  */
 const char *nc_client_get_schema_searchpath(void);
 
+/**
+ * @brief Set the directory of the schema cache.
+ *
+ * Schemas retrieved via \<get-schema\> are stored in the cache with their content hash
+ * together with an index of the module set of the server. If the server later advertises
+ * the same yang-library module-set-id (or content-id) and capabilities, the schemas are
+ * read from the cache and no \<get-schema\> is sent. Servers not advertising any module
+ * set identifier do not use the cache. The directory can be shared by several processes.
+ *
+ * @param[in] path Existing cache directory, NULL to disable the cache (default).
+ * @return 0 on success, 1 on (memory allocation) failure.
+ */
+int nc_client_set_schema_cache(const char *path);
+
+/**
+ * @brief Get the schema cache directory set by nc_client_set_schema_cache().
+ *
+ * @return Schema cache directory, NULL if not set.
+ */
+const char *nc_client_get_schema_cache(void);
+
 /**
  * @brief Set callback function to get missing schemas.
  *
@@ -351,6 +372,23 @@ int nc_client_ssh_set_username(const char *username);
  */
 const char *nc_client_ssh_get_username(void);
 
+/**
+ * @brief Set client SSH write buffer size. Message data are coalesced into writes of this size
+ *        (including the chunk header and the end tag) before being sent to the SSH channel, larger
+ *        buffer means fewer SSH packets for large messages. 1 kB by default.
+ *
+ * @param[in] size Buffer size in bytes, 0 or values smaller than the default mean the default, at most 1 MB.
+ * @return 0 on success, -1 on error.
+ */
+int nc_client_ssh_set_write_buffer(uint32_t size);
+
+/**
+ * @brief Get client SSH write buffer size.
+ *
+ * @return Set buffer size, 0 for the default.
+ */
+uint32_t nc_client_ssh_get_write_buffer(void);
+
 /**
  * @brief Connect to the NETCONF server using SSH transport (via libssh).
  *
@@ -478,6 +516,16 @@ int nc_client_tls_set_crl_paths(const char *crl_file, const char *crl_dir);
  */
 void nc_client_tls_get_crl_paths(const char **crl_file, const char **crl_dir);
 
+/**
+ * @brief Set kernel TLS (kTLS) offload of new TLS sessions. Once the handshake is finished, the records
+ *        are encrypted and decrypted by the kernel. If the kernel or the negotiated cipher does not support it,
+ *        OpenSSL processes the records as usual. Disabled by default.
+ *
+ * @param[in] enable Whether to request kTLS offload.
+ * @return 0 on success, -1 on error (OpenSSL without kTLS support).
+ */
+int nc_client_tls_set_ktls(int enable);
+
 /**
  * @brief Connect to the NETCONF server using TLS transport (via libssl)
  *
@@ -519,6 +567,61 @@ struct nc_session *nc_connect_libssl(SSL *tls, struct ly_ctx *ctx);
 
 #endif /* NC_ENABLED_TLS */
 
+#if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
+
+/**
+ * @addtogroup client_session
+ * @{
+ */
+
+/**
+ * @brief Get an established session from the client session pool, connect a new one if none is available.
+ *
+ * The pool is shared by all the threads. An idle session is checked to be still connected before
+ * it is returned, so repeated short-lived uses of a server skip the transport and NETCONF handshakes.
+ * Sessions are shared only by the callers authenticating as the same client, that is using the same
+ * SSH username or the same TLS client certificate and key paths of the calling thread.
+ * The session must be returned using nc_client_pool_put() and not freed directly.
+ *
+ * @param[in] host Hostname or address of the server.
+ * @param[in] port Port of the server, 0 for the transport default.
+ * @param[in] username Username to connect as, used only for SSH. NULL for the client SSH username.
+ * @param[in] ti Transport of the session, #NC_TI_LIBSSH or #NC_TI_OPENSSL. A new session is
+ *               connected using the client options of the calling thread for this transport.
+ * @param[in] ctx Optional context of the session, sessions are shared only among callers using the same one.
+ * @return Established NETCONF session, NULL on error.
+ */
+struct nc_session *nc_client_pool_get(const char *host, uint16_t port, const char *username, NC_TRANSPORT_IMPL ti,
+        struct ly_ctx *ctx);
+
+/**
+ * @brief Return a session to the client session pool. Session that is no longer running
+ *        or that exceeded its lifetime is freed. All the expected RPC replies must have been received.
+ *
+ * @param[in] session Session obtained from nc_client_pool_get().
+ */
+void nc_client_pool_put(struct nc_session *session);
+
+/**
+ * @brief Set the limits of the sessions in the client session pool. Idle sessions over the limits
+ *        are freed the next time the pool is used.
+ *
+ * @param[in] max_idle Maximum number of milliseconds a session is kept unused, 0 for no limit (default).
+ * @param[in] max_lifetime Maximum number of milliseconds since a session was established for it to be
+ *                         handed out again, 0 for no limit (default).
+ */
+void nc_client_pool_set_limits(uint32_t max_idle, uint32_t max_lifetime);
+
+/**
+ * @brief Free all the idle sessions in the client session pool. Sessions in use are freed once
+ *        they are returned. Called by nc_client_destroy().
+ */
+void nc_client_pool_flush(void);
+
+/**@} Client Session */
+
+#endif /* NC_ENABLED_SSH || NC_ENABLED_TLS */
+
 /**
  * @addtogroup client_session
  * @{
@@ -558,6 +661,12 @@ int nc_session_ntf_thread_running(const struct nc_session *session);
  * that the reply data in these cases should not be validated with \b LYD_OPT_RPCREPLY,
  * but \b LYD_OPT_GET and \b LYD_OPT_GETCONFIG, respectively.
  *
+ * Several RPCs can be sent before their replies are received and several threads can wait
+ * for the replies of different RPCs at once. Only one of them reads from the session at a time,
+ * replies to the other RPCs and notifications it reads are stored for their own waiters.
+ * After #NC_MSG_WOULDBLOCK, the reply can still be received by another call, but it is discarded
+ * if nobody waits for it for a minute.
+ *
  * @param[in] session NETCONF session from which the function gets data. It must be the
  *            client side session object.
  * @param[in] rpc Original RPC this should be the reply to.
@@ -570,8 +679,8 @@ int nc_session_ntf_thread_running(const struct nc_session *session);
  * @return #NC_MSG_REPLY for success,
  *         #NC_MSG_WOULDBLOCK if \p timeout has elapsed,
  *         #NC_MSG_ERROR if reading has failed,
- *         #NC_MSG_NOTIF if a notification was read instead (call this function again to get the reply), and
- *         #NC_MSG_REPLY_ERR_MSGID if a reply with missing or wrong message-id was received.
+ *         #NC_MSG_REPLY_ERR_MSGID if a reply with missing message-id or a message-id of no sent RPC
+ *         was received.
  */
 NC_MSG_TYPE nc_recv_reply(struct nc_session *session, struct nc_rpc *rpc, uint64_t msgid, int timeout,
                           int parseroptions, struct nc_reply **reply);
@@ -619,6 +728,58 @@ int nc_recv_notif_dispatch(struct nc_session *session,
  */
 NC_MSG_TYPE nc_send_rpc(struct nc_session *session, struct nc_rpc *rpc, int timeout, uint64_t *msgid);
 
+/**
+ * @brief Send NETCONF RPC message via the session and have its reply passed to a callback.
+ *
+ * The reply is delivered from nc_session_process_io(), which allows to drive many sessions
+ * from a single event loop together with nc_session_get_fd() and nc_recv_notif_async().
+ * Replies of RPCs still pending when the session is freed are dropped without calling \p reply_clb.
+ *
+ * @param[in] session NETCONF session where the RPC will be written.
+ * @param[in] rpc NETCONF RPC object to send, it must not be freed before \p reply_clb is called.
+ * @param[in] timeout Timeout for writing in milliseconds. Use negative value for infinite
+ *            waiting and 0 for return if data cannot be sent immediately.
+ * @param[in] parseroptions libyang parseroptions flags for parsing the reply, same as for nc_recv_reply().
+ * @param[in] reply_clb Callback called once the reply is received or the session fails. \p msgtype
+ *            is #NC_MSG_REPLY with the \p reply that the callback is responsible for freeing
+ *            with nc_reply_free() or #NC_MSG_ERROR with no \p reply.
+ * @param[in] user_data Arbitrary user data passed to \p reply_clb.
+ * @param[out] msgid If RPC was successfully sent, this is it's message ID.
+ * @return #NC_MSG_RPC on success,
+ *         #NC_MSG_WOULDBLOCK in case of a busy session, and
+ *         #NC_MSG_ERROR on error.
+ */
+NC_MSG_TYPE nc_send_rpc_async(struct nc_session *session, struct nc_rpc *rpc, int timeout, int parseroptions,
+        void (*reply_clb)(struct nc_session *session, uint64_t msgid, NC_MSG_TYPE msgtype, struct nc_reply *reply,
+        void *user_data), void *user_data, uint64_t *msgid);
+
+/**
+ * @brief Receive NETCONF Notifications from nc_session_process_io() instead of a separate thread.
+ *
+ * @param[in] session Netconf session to read notifications from.
+ * @param[in] notif_clb Function that is called for every received notification (including
+ *            \<notificationComplete\>). The notification is freed once it returns.
+ * @return 0 on success, -1 on error.
+ */
+int nc_recv_notif_async(struct nc_session *session,
+                        void (*notif_clb)(struct nc_session *session, const struct nc_notif *notif));
+
+/**
+ * @brief Process all the data available on a session without blocking and call the callbacks
+ *        of the received replies (nc_send_rpc_async()) and notifications (nc_recv_notif_async()).
+ *
+ * Call it whenever the events returned by nc_session_get_fd() occur and also after sending
+ * an RPC, the transport library may have read some data while writing. Data of a partially
+ * received message are kept in the session until the rest arrives. It is not meant to be
+ * combined with nc_recv_reply() or nc_recv_notif() on the same session, messages read by those
+ * are delivered only by the next call of this function.
+ *
+ * @param[in] session Client session to process.
+ * @return Number of called callbacks, -1 on error (if the session is no longer running,
+ *         all the pending replies were delivered as errors).
+ */
+int nc_session_process_io(struct nc_session *session);
+
 /**
  * @brief Make a session not strict when sending RPCs and receiving RPC replies. In other words,
  *        it will silently skip unknown nodes without an error.
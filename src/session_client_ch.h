@@ -248,6 +248,21 @@ int nc_client_ssh_ch_set_username(const char *username);
  */
 const char *nc_client_ssh_ch_get_username(void);
 
+/**
+ * @brief Set client Call Home SSH write buffer size. 1 kB by default.
+ *
+ * @param[in] size Buffer size in bytes, 0 or values smaller than the default mean the default, at most 1 MB.
+ * @return 0 on success, -1 on error.
+ */
+int nc_client_ssh_ch_set_write_buffer(uint32_t size);
+
+/**
+ * @brief Get client Call Home SSH write buffer size.
+ *
+ * @return Set buffer size, 0 for the default.
+ */
+uint32_t nc_client_ssh_ch_get_write_buffer(void);
+
 /**@} Client-side Call Home on SSH */
 
 #endif /* NC_ENABLED_SSH */
@@ -339,6 +354,14 @@ int nc_client_tls_ch_set_crl_paths(const char *crl_file, const char *crl_dir);
  */
 void nc_client_tls_ch_get_crl_paths(const char **crl_file, const char **crl_dir);
 
+/**
+ * @brief Set client Call Home kernel TLS (kTLS) offload of new TLS sessions. Disabled by default.
+ *
+ * @param[in] enable Whether to request kTLS offload.
+ * @return 0 on success, -1 on error (OpenSSL without kTLS support).
+ */
+int nc_client_tls_ch_set_ktls(int enable);
+
 /**@} Client-side Call Home on TLS */
 
 #endif /* NC_ENABLED_TLS */
@@ -1136,6 +1136,48 @@ nc_client_ssh_ch_get_username(void)
     return _nc_client_ssh_get_username(&ssh_ch_opts);
 }
 
+static int
+_nc_client_ssh_set_write_buffer(uint32_t size, struct nc_client_ssh_opts *opts)
+{
+    if (size > NC_SSH_WRITE_BUFSIZE_MAX) {
+        ERRARG("size");
+        return -1;
+    }
+
+    opts->out_bufsize = size;
+    return 0;
+}
+
+API int
+nc_client_ssh_set_write_buffer(uint32_t size)
+{
+    return _nc_client_ssh_set_write_buffer(size, &ssh_opts);
+}
+
+API int
+nc_client_ssh_ch_set_write_buffer(uint32_t size)
+{
+    return _nc_client_ssh_set_write_buffer(size, &ssh_ch_opts);
+}
+
+static uint32_t
+_nc_client_ssh_get_write_buffer(struct nc_client_ssh_opts *opts)
+{
+    return opts->out_bufsize;
+}
+
+API uint32_t
+nc_client_ssh_get_write_buffer(void)
+{
+    return _nc_client_ssh_get_write_buffer(&ssh_opts);
+}
+
+API uint32_t
+nc_client_ssh_ch_get_write_buffer(void)
+{
+    return _nc_client_ssh_get_write_buffer(&ssh_ch_opts);
+}
+
 API int
 nc_client_ssh_ch_add_bind_listen(const char *address, uint16_t port)
 {
@@ -1555,6 +1597,7 @@ _nc_connect_libssh(ssh_session ssh_session, struct ly_ctx *ctx, struct nc_keepal
     session->status = NC_STATUS_STARTING;
     session->ti_type = NC_TI_LIBSSH;
     session->ti.libssh.session = ssh_session;
+    session->ti.libssh.out_bufsize = opts->out_bufsize;
 
     /* was port set? */
     ssh_options_get_port(ssh_session, (unsigned int *)&port);
@@ -1716,6 +1759,7 @@ nc_connect_ssh(const char *host, uint16_t port, struct ly_ctx *ctx)
         ERR("Unable to initialize SSH session.");
         goto fail;
     }
+    session->ti.libssh.out_bufsize = ssh_opts.out_bufsize;
 
     /* set some basic SSH session options */
     ssh_options_set(session->ti.libssh.session, SSH_OPTIONS_HOST, host);
@@ -1795,6 +1839,7 @@ nc_connect_ssh_channel(struct nc_session *session, struct ly_ctx *ctx)
     /* share some parameters including the IO lock (we are using one socket for both sessions) */
     new_session->ti_type = NC_TI_LIBSSH;
     new_session->ti.libssh.session = session->ti.libssh.session;
+    new_session->ti.libssh.out_bufsize = session->ti.libssh.out_bufsize;
     new_session->io_lock = session->io_lock;
 
     /* append to the session ring list */
@@ -481,6 +481,32 @@ nc_client_tls_ch_get_crl_paths(const char **crl_file, const char **crl_dir)
     _nc_client_tls_get_crl_paths(crl_file, crl_dir, &tls_ch_opts);
 }
 
+static int
+_nc_client_tls_set_ktls(int enable, struct nc_client_tls_opts *opts)
+{
+#ifndef SSL_OP_ENABLE_KTLS
+    if (enable) {
+        ERR("Kernel TLS offload is not supported by the OpenSSL library.");
+        return -1;
+    }
+#endif
+
+    opts->ktls = enable ? 1 : 0;
+    return 0;
+}
+
+API int
+nc_client_tls_set_ktls(int enable)
+{
+    return _nc_client_tls_set_ktls(enable, &tls_opts);
+}
+
+API int
+nc_client_tls_ch_set_ktls(int enable)
+{
+    return _nc_client_tls_set_ktls(enable, &tls_ch_opts);
+}
+
 API int
 nc_client_tls_ch_add_bind_listen(const char *address, uint16_t port)
 {
@@ -631,6 +657,9 @@ nc_connect_tls(const char *host, unsigned short port, struct ly_ctx *ctx)
 
     /* set the SSL_MODE_AUTO_RETRY flag to allow OpenSSL perform re-handshake automatically */
     SSL_set_mode(session->ti.tls, SSL_MODE_AUTO_RETRY);
+    if (tls_opts.ktls) {
+        nc_tls_ktls_enable(session->ti.tls);
+    }
 
     /* connect and perform the handshake */
     nc_gettimespec_mono(&ts_timeout);
@@ -668,6 +697,7 @@ nc_connect_tls(const char *host, unsigned short port, struct ly_ctx *ctx)
     default:
         WRN("Server certificate verification problem (%s).", X509_verify_cert_error_string(verify));
     }
+    nc_tls_ktls_print(session->ti.tls);
 
     if (nc_session_new_ctx(session, ctx) != EXIT_SUCCESS) {
         goto fail;
@@ -765,6 +795,9 @@ nc_accept_callhome_tls_sock(int sock, const char *host, uint16_t port, struct ly
 
     /* set the SSL_MODE_AUTO_RETRY flag to allow OpenSSL perform re-handshake automatically */
     SSL_set_mode(tls, SSL_MODE_AUTO_RETRY);
+    if (tls_ch_opts.ktls) {
+        nc_tls_ktls_enable(tls);
+    }
 
     /* connect and perform the handshake */
     if (timeout > -1) {
@@ -808,6 +841,7 @@ nc_accept_callhome_tls_sock(int sock, const char *host, uint16_t port, struct ly
     default:
         WRN("Server certificate verification problem (%s).", X509_verify_cert_error_string(verify));
     }
+    nc_tls_ktls_print(tls);
 
     session = nc_connect_libssl(tls, ctx);
     if (session) {
@@ -19,6 +19,7 @@
 #include <stdint.h>
 #include <pthread.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
 
 #include <libyang/libyang.h>
 
@@ -67,6 +68,14 @@ struct nc_client_ssh_opts {
     void *auth_privkey_passphrase_priv;
 
     char *username;
+    uint32_t out_bufsize;           /**< size of the buffer coalescing writes to a channel, 0 for default */
+};
+
+/* SSH bind with the host keys imported, shared by all the sessions accepted on an endpoint */
+struct nc_server_ssh_bind {
+    ssh_bind sbind;
+    pthread_mutex_t lock;           /**< serializes accepting sessions on the bind */
+    uint32_t refs;                  /**< the options and the sessions being accepted on it (tied with sbind_lock) */
 };
 
 /* ACCESS locked, separate locks */
@@ -74,10 +83,13 @@ struct nc_server_ssh_opts {
     /* SSH bind options */
     const char **hostkeys;
     uint8_t hostkey_count;
+    struct nc_server_ssh_bind *sbind;   /**< created on the first accept */
 
     int auth_methods;
     uint16_t auth_attempts;
     uint16_t auth_timeout;
+
+    uint32_t out_bufsize;           /**< size of the buffer coalescing writes to a channel, 0 for default */
 };
 
 #endif /* NC_ENABLED_SSH */
@@ -100,6 +112,8 @@ struct nc_client_tls_opts {
     char *crl_dir;
     int8_t crl_store_change;
     X509_STORE *crl_store;
+
+    int8_t ktls;
 };
 
 /* ACCESS locked, separate locks */
@@ -109,7 +123,19 @@ struct nc_server_tls_opts {
     uint16_t trusted_cert_list_count;
     const char *trusted_ca_file;
     const char *trusted_ca_dir;
-    X509_STORE *crl_store;
+    struct nc_crl {
+        X509_CRL *crl;
+        unsigned long issuer_hash;      /**< X509_NAME_hash() of the CRL issuer */
+        const ASN1_INTEGER **revoked;   /**< hash set of revoked serials (owned by crl), NULL slots are empty */
+        uint32_t revoked_size;          /**< size of the set, a power of 2 */
+        int8_t verified;                /**< whether the signature was verified using the key below */
+        unsigned char verified_key[32]; /**< SHA-256 of the key the signature was verified with */
+    } *crls;                        /**< loaded CRLs, the most recent one of every issuer */
+    uint16_t crl_count;
+    uint32_t sess_cache_size;       /**< maximum number of cached TLS sessions, 0 for no resumption */
+    uint32_t sess_timeout;          /**< cached TLS session lifetime in seconds, 0 for OpenSSL default */
+    int8_t ktls;                    /**< whether kernel TLS offload is requested */
+    SSL_CTX *tls_ctx;               /**< context built from the options above, created on the first accept */
 
     struct nc_ctn {
         uint32_t id;
@@ -117,7 +143,24 @@ struct nc_server_tls_opts {
         NC_TLS_CTN_MAPTYPE map_type;
         const char *name;
         struct nc_ctn *next;
+
+        uint8_t fp_alg;             /**< decoded fingerprint hash algorithm, 0 if the entry is not valid */
+        uint8_t fp_len;             /**< decoded fingerprint length */
+        unsigned char fp[64];       /**< decoded fingerprint */
+        struct nc_ctn *fp_next;     /**< next entry in the same index bucket, in the order of ids */
     } *ctn;
+    struct nc_ctn **ctn_buckets;    /**< fingerprint index of valid CTN entries */
+    uint32_t ctn_bucket_count;
+    uint8_t ctn_algs;               /**< bitmask of fingerprint algorithms in the index */
+
+    struct nc_ctn_cache {
+        unsigned char cert_digest[32];  /**< SHA-256 of the certificate */
+        NC_TLS_CTN_MAPTYPE map_type;    /**< 0 if no entry matched */
+        const char *name;               /**< specified name (dictionary) */
+        uint64_t used;
+    } *ctn_cache;                   /**< recent cert-to-name results, protected by a separate lock */
+    uint16_t ctn_cache_count;
+    uint64_t ctn_cache_tick;
 };
 
 #endif /* NC_ENABLED_TLS */
@@ -130,6 +173,31 @@ struct nc_keepalives {
     uint16_t probe_interval;
 };
 
+/* ACCESS unlocked */
+struct nc_rate_limit {
+    uint32_t rpc_rate;      /**< RPCs per second, 0 for no limit */
+    uint32_t rpc_burst;     /**< maximum burst of RPCs */
+    uint32_t byte_rate;     /**< received bytes per second, 0 for no limit */
+    uint32_t byte_burst;    /**< maximum burst of received bytes */
+};
+
+/* ACCESS locked by its owner */
+struct nc_rate_bucket {
+    uint32_t rate;          /**< tokens added per second, 0 for no limit */
+    uint32_t burst;         /**< maximum number of tokens */
+    uint64_t mtokens;       /**< currently available tokens in thousandths */
+    struct timespec last;   /**< monotonic time of the last refill */
+};
+
+/* ACCESS locked - lock */
+struct nc_auth_token {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;    /**< signalled once the authentication is completed */
+    int pipe[2];            /**< written once the authentication is completed, to wait together with the transport */
+    int8_t result;          /**< -1 while pending, 1 authenticated, 0 not */
+    uint8_t refs;           /**< the session and the application each hold a reference */
+};
+
 /* ACCESS unlocked */
 struct nc_server_unix_opts {
     mode_t mode;
@@ -140,6 +208,7 @@ struct nc_server_unix_opts {
 /* ACCESS unlocked */
 struct nc_client_opts {
     char *schema_searchpath;
+    char *schema_cache;             /**< schema cache directory, NULL if disabled */
     ly_module_imp_clb schema_clb;
     void *schema_clb_data;
     struct nc_keepalives ka;
@@ -154,6 +223,22 @@ struct nc_client_opts {
     uint16_t ch_bind_count;
 };
 
+/* ACCESS locked - client pool lock */
+struct nc_client_pool_entry {
+    struct nc_session *session;
+    char *host;
+    uint16_t port;
+    char *username;                 /**< SSH username the session was authenticated with, NULL for the system one */
+    char *cert_path;                /**< TLS client certificate the session was authenticated with */
+    char *key_path;                 /**< TLS client private key of the certificate */
+    NC_TRANSPORT_IMPL ti;
+    struct ly_ctx *ctx;             /**< context requested for the session, NULL if it has its own */
+    struct timespec created;        /**< monotonic time the session was established */
+    struct timespec idle_since;     /**< monotonic time the session was returned */
+    uint8_t in_use;
+    struct nc_client_pool_entry *next;
+};
+
 /* ACCESS unlocked */
 struct nc_client_context {
     unsigned int refcount;
@@ -168,6 +253,18 @@ struct nc_client_context {
 #endif /* NC_ENABLED_TLS */
 };
 
+#if defined(HAVE_EPOLL) && defined(HAVE_ACCEPT4)
+/**
+ * Listening sockets are kept in an epoll set and all the pending connections are accepted at once.
+ */
+#   define NC_ACCEPT_EPOLL
+
+/**
+ * Maximum number of connections accepted at once.
+ */
+#   define NC_ACCEPT_BATCH_SIZE 16
+#endif
+
 struct nc_server_opts {
     /* ACCESS unlocked (dictionary locked internally in libyang) */
     struct ly_ctx *ctx;
@@ -214,19 +311,42 @@ struct nc_server_opts {
 #endif
 
 #ifdef NC_ENABLED_SSH
-    /* ACCESS locked with authkey_lock */
+    /* ACCESS locked with authkey_lock, WRITE lock to modify */
     struct {
         const char *path;
         const char *base64;
         NC_SSH_KEY_TYPE type;
         const char *username;
+        ssh_key key;            /**< parsed public key */
+        uint32_t hash;          /**< hash of the public key */
+        int32_t next;           /**< index of the next key in the same hash bucket, -1 for none */
     } *authkeys;
     uint16_t authkey_count;
-    pthread_mutex_t authkey_lock;
+    int32_t *authkey_buckets;   /**< hash index of authkeys, index of the first key in every bucket */
+    uint32_t authkey_bucket_count;
+    pthread_rwlock_t authkey_lock;
 
     int (*hostkey_clb)(const char *name, void *user_data, char **privkey_path, char **privkey_data, NC_SSH_KEY_TYPE *privkey_type);
     void *hostkey_data;
     void (*hostkey_data_free)(void *data);
+
+    /* ACCESS locked with pwd_cache_lock */
+    struct nc_pwd_cache {
+        const char *username;
+        char *pass_hash;        /**< NULL if the user cannot authenticate with a password */
+        time_t expires;         /**< monotonic time (seconds) */
+    } *pwd_cache;
+    uint16_t pwd_cache_count;
+    uint16_t pwd_cache_ttl;
+    pthread_mutex_t pwd_cache_lock;
+
+    /* ACCESS locked with crypt_limit_lock */
+    uint16_t crypt_max_running;
+    uint16_t crypt_max_waiting;
+    uint16_t crypt_running;
+    uint16_t crypt_waiting;
+    pthread_mutex_t crypt_limit_lock;
+    pthread_cond_t crypt_limit_cond;
 #endif
 
     /* ACCESS locked, add/remove endpts/binds - bind_lock + WRITE endpt_lock (strict order!)
@@ -235,10 +355,20 @@ struct nc_server_opts {
      *                modify/poll binds - bind_lock */
     struct nc_bind *binds;
     pthread_mutex_t bind_lock;
+#ifdef NC_ACCEPT_EPOLL
+    int accept_epfd;                    /**< epoll set of the listening sockets, -1 until the first accept */
+    struct nc_accepted {
+        int sock;
+        int listen_sock;                /**< listening socket the connection was accepted on */
+        struct sockaddr_storage saddr;
+    } accepted[NC_ACCEPT_BATCH_SIZE];   /**< connections accepted in the last batch not returned yet */
+    uint16_t accepted_count;
+#endif
     struct nc_endpt {
         const char *name;
         NC_TRANSPORT_IMPL ti;
         struct nc_keepalives ka;
+        struct nc_rate_limit rate;
         union {
 #ifdef NC_ENABLED_SSH
             struct nc_server_ssh_opts *ssh;
@@ -289,11 +419,99 @@ struct nc_server_opts {
     uint16_t ch_client_count;
     pthread_rwlock_t ch_client_lock;
 
+    /* ACCESS locked with user_rate_lock */
+    struct nc_user_rate {
+        const char *username;
+        struct nc_rate_bucket rpcs;
+        struct nc_rate_bucket bytes;
+    } *user_rates;
+    uint16_t user_rate_count;
+    pthread_mutex_t user_rate_lock;
+
+    /* ACCESS locked with load_lock */
+    struct {
+        uint32_t queue_high;
+        uint32_t queue_low;
+        uint32_t latency_high;
+        uint32_t latency_low;
+        uint64_t mem_high;
+        uint64_t mem_low;
+
+        uint32_t latency;       /**< moving average of RPC processing time in msec */
+        time_t latency_time;    /**< monotonic time (seconds) of the last latency update */
+        uint64_t mem;           /**< last measured resident memory in bytes */
+        time_t mem_time;        /**< monotonic time (seconds) of the last memory measurement */
+        NC_LOAD_STATE state;
+    } load;
+    pthread_mutex_t load_lock;
+    ATOMIC_UINT32_T load_enabled;   /**< whether any threshold is set, read without load_lock */
+
+    /* ACCESS unlocked */
+    int (*rpc_prio_clb)(const struct lyd_node *rpc, const struct nc_session *session);
+
+    /* ACCESS locked with accept_filter.lock */
+    struct {
+        struct nc_accept_rule {
+            uint8_t addr[16];           /**< IPv6 or IPv4-mapped prefix */
+            uint8_t prefix_len;         /**< prefix length in bits */
+            NC_ACCEPT_ACTION action;
+        } *rules;                       /**< sorted from the longest prefix so that the first match wins */
+        uint16_t rule_count;
+
+        uint32_t conn_rate;             /**< new connections per second from a single source, 0 for no limit */
+        uint32_t conn_burst;            /**< maximum burst of new connections from a single source */
+        uint16_t max_sessions;          /**< concurrent connections from a single source, 0 for no limit */
+
+        struct nc_accept_src {
+            uint8_t addr[16];           /**< IPv6 or IPv4-mapped address */
+            uint16_t sessions;          /**< counted connections, released when their session is freed */
+            struct nc_rate_bucket conns;
+            struct nc_accept_src *next;
+        } **srcs;                       /**< hash table of the sources with NC_ACCEPT_SRC_BUCKETS buckets */
+        uint32_t src_count;
+        pthread_mutex_t lock;
+    } accept_filter;
+
+    /* ACCESS locked with accept_pipe.lock */
+    struct {
+        struct nc_accept_job {
+            int sock;
+            char *host;
+            uint16_t port;
+            const char *endpt_name;     /**< endpoint the connection was accepted on (dictionary) */
+            uint8_t src_addr[16];       /**< source address if counted by the accept filter */
+            int src_counted;
+            struct nc_accept_job *next;
+        } *jobs, *jobs_last;            /**< FIFO of accepted connections waiting for a handshake */
+        uint16_t job_count;
+        pthread_t acceptor;
+        pthread_t *workers;
+        uint16_t worker_count;
+        int stop;
+        void (*session_clb)(struct nc_session *new_session, void *user_data);
+        void *clb_data;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+    } accept_pipe;
+
     /* Atomic IDs */
     ATOMIC_UINT32_T new_session_id;
     ATOMIC_UINT32_T new_client_id;
+
+    /* Atomic number of threads in all the pollsession queues */
+    ATOMIC_UINT32_T ps_queued;
 };
 
+/**
+ * Number of buckets of the client map of awaited RPC replies (must be a power of 2).
+ */
+#define NC_REPLY_MAP_SIZE 64
+
+/**
+ * Time in seconds an RPC reply slot is kept after its waiter gave up, so that the reply can still be received.
+ */
+#define NC_REPLY_SLOT_TIMEOUT 60
+
 /**
  * Sleep time in msec to wait between nc_recv_notif() calls.
  */
@@ -326,6 +544,18 @@ struct nc_server_opts {
  */
 #define NC_PS_QUEUE_TIMEOUT 5000
 
+/**
+ * Longest time in msec to wait on an SSH session socket shared by several channels, any of them
+ * can read the data of the others so the channel must be checked again after this time.
+ */
+#define NC_SSH_CHANNEL_POLL_STEP 10
+
+/**
+ * Time in seconds without any RPC after which the input buffers of a server session
+ * are released, they are allocated again once some data arrive.
+ */
+#define NC_SESSION_IDLE_BUF_TIMEOUT 10
+
 /**
  * Time slept in msec if no endpoint was created for a running Call Home client.
  */
@@ -341,6 +571,45 @@ struct nc_server_opts {
  */
 #define NC_REVERSE_QUEUE 5
 
+/**
+ * Maximum number of cached local user password hashes.
+ */
+#define NC_PWD_CACHE_SIZE 256
+
+/**
+ * Maximum number of cached cert-to-name results of a TLS endpoint.
+ */
+#define NC_CTN_CACHE_SIZE 64
+
+/**
+ * Number of hash buckets of connection sources tracked by the accept filter.
+ */
+#define NC_ACCEPT_SRC_BUCKETS 1024
+
+/**
+ * Maximum number of connection sources tracked by the accept filter, idle ones are
+ * forgotten first and connections from new sources are dropped if there are none.
+ */
+#define NC_ACCEPT_SRC_MAX 65536
+
+/**
+ * Timeout in msec of a single accept attempt of the accept pipeline thread,
+ * it is the longest time it takes for the thread to notice it should stop.
+ */
+#define NC_ACCEPT_PIPE_POLL_TIMEOUT 200
+
+/**
+ * Maximum number of accepted connections waiting for a handshake thread, no more
+ * connections are accepted until a handshake thread takes one of them.
+ */
+#define NC_ACCEPT_PIPE_QUEUE_SIZE 64
+
+/**
+ * Maximum size in bytes of the buffer coalescing writes of a message to an SSH channel,
+ * it is allocated for every message written.
+ */
+#define NC_SSH_WRITE_BUFSIZE_MAX (1024 * 1024)
+
 /**
  * @brief Type of the session
  */
@@ -361,11 +630,21 @@ typedef enum {
 #define NC_VERSION_10_ENDTAG_LEN 6
 
 /**
- * @brief Container to serialize PRC messages
+ * @brief Container to serialize PRC messages, also a slot of an awaited RPC reply
  */
 struct nc_msg_cont {
-    struct lyxml_elem *msg;
+    char *msg;                  /**< received message, not parsed yet, NULL if the reply was not received yet */
+    uint64_t msgid;             /**< message-id of the message, 0 if none */
     struct nc_msg_cont *next;
+
+    /* reply delivered to a callback (nc_send_rpc_async()) */
+    void (*reply_clb)(struct nc_session *session, uint64_t msgid, NC_MSG_TYPE msgtype, struct nc_reply *reply,
+            void *user_data);
+    void *user_data;
+    struct nc_rpc *rpc;         /**< RPC the reply is parsed for */
+    int parseroptions;
+
+    time_t abandoned;           /**< monotonic time in seconds the waiter of the reply gave up, 0 while awaited */
 };
 
 /**
@@ -385,6 +664,12 @@ struct nc_session {
     NC_TRANSPORT_IMPL ti_type;   /**< transport implementation type to select items from ti union */
     pthread_mutex_t *io_lock;    /**< input/output lock, note that in case of libssh TI, it will be shared
                                       with other NETCONF sessions on the same SSH session (but different SSH channel) */
+    pthread_mutex_t *in_lock;    /**< input lock of this NETCONF session only, in case of libssh TI it is held while
+                                      reading a message instead of io_lock, which then guards only the SSH session
+                                      access (always locked before io_lock) */
+    char *in_pend;               /**< data of a partially received message, with in_lock held */
+    size_t in_pend_len;          /**< number of bytes in in_pend */
+    size_t in_pend_size;         /**< allocated size of in_pend */
 
     union {
         struct {
@@ -401,6 +686,12 @@ struct nc_session {
             struct nc_session *next; /**< pointer to the next NETCONF session on the same
                                           SSH session, but different SSH channel. If no such session exists, it is NULL.
                                           otherwise there is a ring list of the NETCONF sessions */
+            char *in_buf;            /**< input buffer of the SSH channel, filled from the SSH session with io_lock held
+                                          and consumed with in_lock held, allocated on the first data and released while
+                                          the session is idle */
+            size_t in_start;         /**< offset of the first unread byte in in_buf */
+            size_t in_len;           /**< number of unread bytes in in_buf */
+            uint32_t out_bufsize;    /**< size of the buffer coalescing writes of a message to the channel, 0 for default */
         } libssh;
 #endif
 #ifdef NC_ENABLED_TLS
@@ -424,8 +715,16 @@ struct nc_session {
             /* client side only data */
             uint64_t msgid;
             char **cpblts;                 /**< list of server's capabilities on client side */
-            struct nc_msg_cont *replies;   /**< queue for RPC replies received instead of notifications */
+            struct nc_msg_cont **replies;  /**< map of RPC reply slots by message-id, NC_REPLY_MAP_SIZE buckets,
+                                                allocated with the first slot */
+            time_t replies_purged;         /**< monotonic time in seconds abandoned reply slots were last purged */
             struct nc_msg_cont *notifs;    /**< queue for notifications received instead of RPC reply */
+            struct nc_msg_cont *notifs_last; /**< last notification in the queue */
+            pthread_mutex_t msgs_lock;     /**< lock for replies, notifs, and msgs_reading */
+            pthread_cond_t msgs_cond;      /**< broadcast when a message is stored or the reading thread leaves */
+            uint8_t msgs_reading;          /**< a thread is reading messages from the session for all the waiting threads */
+            uint32_t async_ready;          /**< number of received replies waiting for nc_session_process_io() */
+            void (*notif_clb)(struct nc_session *session, const struct nc_notif *notif); /**< nc_recv_notif_async() */
             volatile pthread_t *ntf_tid;   /**< running notifications receiving thread */
 
             /* client flags */
@@ -446,7 +745,19 @@ struct nc_session {
             pthread_mutex_t *ch_lock;      /**< Call Home thread lock */
             pthread_cond_t *ch_cond;       /**< Call Home thread condition */
 
+            uint64_t last_msg_len;         /**< length of the last received message */
+            struct nc_rate_bucket rpc_bucket;  /**< session RPC rate limit (tied with rpc_lock) */
+            struct nc_rate_bucket byte_bucket; /**< session received bytes rate limit (tied with rpc_lock) */
+            uint8_t src_addr[16];          /**< source address if NC_SESSION_SRC_COUNTED */
+            struct nc_auth_token *auth_token; /**< deferred authentication, set by its callback until the result is used */
+            struct timespec auth_deadline; /**< monotonic deadline of the authentication, zero for none */
+            const char *endpt_name;        /**< endpoint of a session in the transport handshake, whose options are
+                                                looked up only while needed (dictionary) */
+
             /* server flags */
+            /* connection counted to the limits of its source */
+#           define NC_SESSION_SRC_COUNTED 0x80
+
 #ifdef NC_ENABLED_SSH
             /* SSH session authenticated */
 #           define NC_SESSION_SSH_AUTHENTICATED 0x04
@@ -499,6 +810,15 @@ void *nc_realloc(void *ptr, size_t size);
 
 NC_MSG_TYPE nc_send_msg_io(struct nc_session *session, int io_timeout, struct lyd_node *op);
 
+/**
+ * @brief Add a slot for the reply of an RPC into the client reply map.
+ *
+ * @param[in] session Client session.
+ * @param[in] msgid Message-id of the RPC.
+ * @return 0 on success, -1 on error.
+ */
+int nc_client_reply_slot_add(struct nc_session *session, uint64_t msgid);
+
 #ifndef HAVE_PTHREAD_MUTEX_TIMEDLOCK
 int pthread_mutex_timedlock(pthread_mutex_t *mutex, const struct timespec *abstime);
 #endif
@@ -525,6 +845,10 @@ int nc_session_io_lock(struct nc_session *session, int timeout, const char *func
 
 int nc_session_io_unlock(struct nc_session *session, const char *func);
 
+int nc_session_in_lock(struct nc_session *session, int timeout, const char *func);
+
+int nc_session_in_unlock(struct nc_session *session, const char *func);
+
 int nc_ps_lock(struct nc_pollsession *ps, uint8_t *id, const char *func);
 
 int nc_ps_unlock(struct nc_pollsession *ps, uint8_t id, const char *func);
@@ -604,6 +928,13 @@ int nc_sock_listen_unix(const char *address, const struct nc_server_unix_opts *o
  */
 int nc_sock_accept_binds(struct nc_bind *binds, uint16_t bind_count, int timeout, char **host, uint16_t *port, uint16_t *idx);
 
+/**
+ * @brief Release a connection counted by the server accept filter.
+ *
+ * @param[in] addr Source address of the connection.
+ */
+void nc_server_accept_src_release(const uint8_t *addr);
+
 /**
  * @brief Lock endpoint structures for reading and the specific endpoint.
  *
@@ -614,6 +945,25 @@ int nc_sock_accept_binds(struct nc_bind *binds, uint16_t bind_count, int timeout
  */
 struct nc_endpt *nc_server_endpt_lock_get(const char *name, NC_TRANSPORT_IMPL ti, uint16_t *idx);
 
+/**
+ * @brief Get the transport options of a session in the transport handshake.
+ *
+ * If the options were not set as the session data by a caller holding their lock, they are looked up
+ * by the endpoint name with endpoint structures locked for reading.
+ *
+ * @param[in] session Session in the transport handshake.
+ * @param[in] ti Expected transport.
+ * @return Transport options, NULL if the endpoint was removed.
+ */
+void *nc_server_endpt_opts_lock(struct nc_session *session, NC_TRANSPORT_IMPL ti);
+
+/**
+ * @brief Release the transport options got by nc_server_endpt_opts_lock().
+ *
+ * @param[in] session Session in the transport handshake.
+ */
+void nc_server_endpt_opts_unlock(struct nc_session *session);
+
 /**
  * @brief Lock CH client structures for reading and lock the specific client.
  *
@@ -669,6 +1019,55 @@ void nc_init(void);
 
 void nc_destroy(void);
 
+#if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
+
+/**
+ * @brief Resolve the return value of an authentication callback, wait for the result if it was deferred.
+ *
+ * Waits at most until the authentication deadline of the session.
+ *
+ * @param[in] session Session being authenticated.
+ * @param[in] clb_ret Value returned by the callback.
+ * @return 1 if authenticated, 0 if not or on timeout, -1 if the authentication was not deferred.
+ */
+int nc_server_auth_wait(struct nc_session *session, int clb_ret);
+
+/**
+ * @brief Resolve the return value of an authentication callback, keep the token if it was deferred.
+ *
+ * The result is then learned using nc_server_auth_result().
+ *
+ * @param[in] session Session being authenticated.
+ * @param[in] clb_ret Value returned by the callback.
+ * @return 1 if the authentication is pending, -1 if it was not deferred.
+ */
+int nc_server_auth_pending(struct nc_session *session, int clb_ret);
+
+/**
+ * @brief Get the result of a pending deferred authentication without waiting.
+ *
+ * @param[in] session Session being authenticated.
+ * @return 1 if authenticated, 0 if not, -1 if still pending or not deferred.
+ */
+int nc_server_auth_result(struct nc_session *session);
+
+/**
+ * @brief Get the file descriptor readable once a pending deferred authentication is completed.
+ *
+ * @param[in] session Session being authenticated.
+ * @return File descriptor, -1 if there is no pending authentication.
+ */
+int nc_server_auth_fd(const struct nc_session *session);
+
+/**
+ * @brief Drop a pending deferred authentication of a failed session.
+ *
+ * @param[in] session Session being freed.
+ */
+void nc_server_auth_release(struct nc_session *session);
+
+#endif
+
 #ifdef NC_ENABLED_SSH
 
 /**
@@ -729,6 +1128,21 @@ void nc_server_tls_clear_opts(struct nc_server_tls_opts *opts);
 void nc_client_tls_destroy_opts(void);
 void _nc_client_tls_destroy_opts(struct nc_client_tls_opts *opts);
 
+/**
+ * @brief Request kernel TLS offload for a TLS session before its handshake.
+ *
+ * @param[in] tls TLS session.
+ * @return 0 on success, -1 if not supported by OpenSSL.
+ */
+int nc_tls_ktls_enable(SSL *tls);
+
+/**
+ * @brief Print whether kernel TLS offload is used by an established TLS session.
+ *
+ * @param[in] tls Established TLS session.
+ */
+void nc_tls_ktls_print(SSL *tls);
+
 #endif /* NC_ENABLED_TLS */
 
 /**
@@ -762,13 +1176,76 @@ NC_MSG_TYPE nc_read_msg_poll_io(struct nc_session* session, int io_timeout, stru
  * @param[in] io_timeout Timeout in milliseconds. Negative value means infinite timeout,
  *            zero value causes to return immediately.
  * @param[out] data XML tree built from the read data.
- * @param[in] passing_io_lock True if \p session IO lock is already held. This function always unlocks
- *            it before returning!
+ * @param[in] passing_in_lock True if \p session input lock (see nc_session_in_lock()) is already held.
+ *            This function always unlocks it before returning!
  * @return Type of the read message. #NC_MSG_WOULDBLOCK is returned if timeout is positive
  * (or zero) value and it passed out without any data on the wire. #NC_MSG_ERROR is
  * returned on error and #NC_MSG_NONE is never returned by this function.
  */
-NC_MSG_TYPE nc_read_msg_io(struct nc_session* session, int io_timeout, struct lyxml_elem **data, int passing_io_lock);
+NC_MSG_TYPE nc_read_msg_io(struct nc_session* session, int io_timeout, struct lyxml_elem **data, int passing_in_lock);
+
+/**
+ * @brief Read message from the wire without parsing it.
+ *
+ * Only the top level element is examined to learn the message type so that the message can
+ * be dropped or queued without building the XML tree. Use nc_parse_msg() to parse it.
+ *
+ * @param[in] session NETCONF session from which the message is being read.
+ * @param[in] io_timeout Timeout in milliseconds. Negative value means infinite timeout,
+ *            zero value causes to return immediately.
+ * @param[out] msg Read message string, NULL on error.
+ * @param[out] msgid Optional message-id of the message, 0 if none.
+ * @param[in] passing_in_lock True if \p session input lock (see nc_session_in_lock()) is already held.
+ *            This function always unlocks it before returning!
+ * @return Type of the read message, same meaning as nc_read_msg_io().
+ */
+NC_MSG_TYPE nc_read_msg_str_io(struct nc_session *session, int io_timeout, char **msg, uint64_t *msgid,
+                               int passing_in_lock);
+
+/**
+ * @brief Poll and read message from the wire without parsing it.
+ *
+ * @param[in] session NETCONF session from which the message is being read.
+ * @param[in] io_timeout Timeout in milliseconds. Negative value means infinite timeout,
+ *            zero value causes to return immediately.
+ * @param[out] msg Read message string, NULL on error.
+ * @param[out] msgid Optional message-id of the message, 0 if none.
+ * @return Type of the read message, same meaning as nc_read_msg_poll_io().
+ */
+NC_MSG_TYPE nc_read_msg_poll_str_io(struct nc_session *session, int io_timeout, char **msg, uint64_t *msgid);
+
+/**
+ * @brief Read message from the wire without parsing it and without ever waiting.
+ *
+ * The data of an incomplete message are kept in the session and the message framing
+ * continues on the next call, so a slow peer cannot block the caller.
+ *
+ * @param[in] session NETCONF session from which the message is being read.
+ * @param[out] msg Read message string, NULL on error.
+ * @param[out] msgid Optional message-id of the message, 0 if none.
+ * @return Type of the read message, #NC_MSG_WOULDBLOCK if no complete message is available.
+ */
+NC_MSG_TYPE nc_read_msg_nonblock_str_io(struct nc_session *session, char **msg, uint64_t *msgid);
+
+/**
+ * @brief Parse a message read by nc_read_msg_str_io().
+ *
+ * @param[in] session NETCONF session the message was read from.
+ * @param[in] io_timeout Timeout in milliseconds for sending a possible malformed message error reply.
+ * @param[in] msg Message string, it is always freed.
+ * @param[out] data XML tree built from the message.
+ * @return Type of the message, #NC_MSG_ERROR on error.
+ */
+NC_MSG_TYPE nc_parse_msg(struct nc_session *session, int io_timeout, char *msg, struct lyxml_elem **data);
+
+/**
+ * @brief Handle a malformed message, a server session sends the "malformed-message" error reply
+ *        if NETCONF 1.1 is used. IO lock must not be held.
+ *
+ * @param[in] session NETCONF session the message was received on, its status can be changed.
+ * @param[in] io_timeout Timeout in milliseconds for sending the reply.
+ */
+void nc_msg_malformed(struct nc_session *session, int io_timeout);
 
 /**
  * @brief Write message into wire.
@@ -785,7 +1262,9 @@ NC_MSG_TYPE nc_read_msg_io(struct nc_session* session, int io_timeout, struct ly
  *     `message-id` attribute is added automatically and default namespace is set to #NC_NS_BASE.
  *     Optional parameter.
  * - #NC_MSG_REPLY
- *   - `struct lyxml_node *rpc_elem;` - root of the RPC object to reply to. Required parameter.
+ *   - `const char *rpc_prefix;` - namespace prefix of the RPC element to reply to. Optional parameter.
+ *   - `const char *rpc_attrs;` - printed attributes of the RPC element to reply to, NULL only when
+ *     replying to a malformed message. Optional parameter.
  *   - `struct nc_server_reply *reply;` - RPC reply. Required parameter.
  * - #NC_MSG_NOTIF
  *   - `struct nc_server_notif *notif;` - notification object. Required parameter.
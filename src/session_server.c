@@ -15,8 +15,11 @@
 #define _GNU_SOURCE /* signals, threads, SO_PEERCRED */
 
 #include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <ctype.h>
 #include <string.h>
 #include <poll.h>
 #include <sys/types.h>
@@ -36,13 +39,32 @@
 #include "session_server.h"
 #include "session_server_ch.h"
 
+#ifdef NC_ACCEPT_EPOLL
+#   include <sys/epoll.h>
+#endif
+
 struct nc_server_opts server_opts = {
 #ifdef NC_ENABLED_SSH
-    .authkey_lock = PTHREAD_MUTEX_INITIALIZER,
+    .authkey_lock = PTHREAD_RWLOCK_INITIALIZER,
+    .pwd_cache_lock = PTHREAD_MUTEX_INITIALIZER,
+    .crypt_limit_lock = PTHREAD_MUTEX_INITIALIZER,
+    .crypt_limit_cond = PTHREAD_COND_INITIALIZER,
 #endif
     .bind_lock = PTHREAD_MUTEX_INITIALIZER,
+#ifdef NC_ACCEPT_EPOLL
+    .accept_epfd = -1,
+#endif
     .endpt_lock = PTHREAD_RWLOCK_INITIALIZER,
-    .ch_client_lock = PTHREAD_RWLOCK_INITIALIZER
+    .ch_client_lock = PTHREAD_RWLOCK_INITIALIZER,
+    .user_rate_lock = PTHREAD_MUTEX_INITIALIZER,
+    .load_lock = PTHREAD_MUTEX_INITIALIZER,
+    .accept_filter = {
+        .lock = PTHREAD_MUTEX_INITIALIZER
+    },
+    .accept_pipe = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER
+    }
 };
 
 static nc_rpc_clb global_rpc_clb = NULL;
@@ -82,6 +104,52 @@ nc_server_endpt_lock_get(const char *name, NC_TRANSPORT_IMPL ti, uint16_t *idx)
     return endpt;
 }
 
+void *
+nc_server_endpt_opts_lock(struct nc_session *session, NC_TRANSPORT_IMPL ti)
+{
+    uint16_t i;
+
+    if (session->data) {
+        /* locked by the caller */
+        return session->data;
+    }
+
+    /* ENDPT READ LOCK */
+    pthread_rwlock_rdlock(&server_opts.endpt_lock);
+
+    for (i = 0; i < server_opts.endpt_count; ++i) {
+        if ((server_opts.endpts[i].ti == ti) && !strcmp(server_opts.endpts[i].name, session->opts.server.endpt_name)) {
+            break;
+        }
+    }
+
+#ifdef NC_ENABLED_SSH
+    if ((i < server_opts.endpt_count) && (ti == NC_TI_LIBSSH)) {
+        return server_opts.endpts[i].opts.ssh;
+    }
+#endif
+#ifdef NC_ENABLED_TLS
+    if ((i < server_opts.endpt_count) && (ti == NC_TI_OPENSSL)) {
+        return server_opts.endpts[i].opts.tls;
+    }
+#endif
+
+    /* ENDPT UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+    ERR("Endpoint \"%s\" was removed while accepting a session on it.", session->opts.server.endpt_name);
+    return NULL;
+}
+
+void
+nc_server_endpt_opts_unlock(struct nc_session *session)
+{
+    if (!session->data) {
+        /* ENDPT UNLOCK */
+        pthread_rwlock_unlock(&server_opts.endpt_lock);
+    }
+}
+
 struct nc_ch_endpt *
 nc_server_ch_client_lock(const char *name, const char *endpt_name, NC_TRANSPORT_IMPL ti, struct nc_ch_client **client_p)
 {
@@ -329,6 +397,53 @@ fail:
     return -1;
 }
 
+static void
+nc_sock_get_host_port(const struct sockaddr_storage *saddr, char **host, uint16_t *port)
+{
+    if (saddr->ss_family == AF_INET) {
+        *host = malloc(INET_ADDRSTRLEN);
+        if (*host) {
+            if (!inet_ntop(AF_INET, &((struct sockaddr_in *)saddr)->sin_addr.s_addr, *host, INET_ADDRSTRLEN)) {
+                ERR("inet_ntop failed (%s).", strerror(errno));
+                free(*host);
+                *host = NULL;
+            }
+
+            if (port) {
+                *port = ntohs(((struct sockaddr_in *)saddr)->sin_port);
+            }
+        } else {
+            ERRMEM;
+        }
+    } else if (saddr->ss_family == AF_INET6) {
+        *host = malloc(INET6_ADDRSTRLEN);
+        if (*host) {
+            if (!inet_ntop(AF_INET6, ((struct sockaddr_in6 *)saddr)->sin6_addr.s6_addr, *host, INET6_ADDRSTRLEN)) {
+                ERR("inet_ntop failed (%s).", strerror(errno));
+                free(*host);
+                *host = NULL;
+            }
+
+            if (port) {
+                *port = ntohs(((struct sockaddr_in6 *)saddr)->sin6_port);
+            }
+        } else {
+            ERRMEM;
+        }
+    } else if (saddr->ss_family == AF_UNIX) {
+        *host = strdup(((struct sockaddr_un *)saddr)->sun_path);
+        if (*host) {
+            if (port) {
+                *port = 0;
+            }
+        } else {
+            ERRMEM;
+        }
+    } else {
+        ERR("Source host of an unknown protocol family.");
+    }
+}
+
 int
 nc_sock_accept_binds(struct nc_bind *binds, uint16_t bind_count, int timeout, char **host, uint16_t *port, uint16_t *idx)
 {
@@ -337,7 +452,10 @@ nc_sock_accept_binds(struct nc_bind *binds, uint16_t bind_count, int timeout, ch
     struct pollfd *pfd;
     struct sockaddr_storage saddr;
     socklen_t saddr_len = sizeof(saddr);
-    int ret, sock = -1, flags;
+    int ret, sock = -1;
+#ifndef HAVE_ACCEPT4
+    int flags;
+#endif
 
     pfd = malloc(bind_count * sizeof *pfd);
     if (!pfd) {
@@ -407,6 +525,14 @@ nc_sock_accept_binds(struct nc_bind *binds, uint16_t bind_count, int timeout, ch
         return -1;
     }
 
+#ifdef HAVE_ACCEPT4
+    ret = accept4(sock, (struct sockaddr *)&saddr, &saddr_len, SOCK_NONBLOCK);
+    if (ret < 0) {
+        ERR("Accept failed (%s).", strerror(errno));
+        return -1;
+    }
+    VRB("Accepted a connection on %s:%u.", binds[i].address, binds[i].port);
+#else
     ret = accept(sock, (struct sockaddr *)&saddr, &saddr_len);
     if (ret < 0) {
         ERR("Accept failed (%s).", strerror(errno));
@@ -420,6 +546,7 @@ nc_sock_accept_binds(struct nc_bind *binds, uint16_t bind_count, int timeout, ch
         close(ret);
         return -1;
     }
+#endif
 
     if (idx) {
         *idx = i;
@@ -427,51 +554,181 @@ nc_sock_accept_binds(struct nc_bind *binds, uint16_t bind_count, int timeout, ch
 
     /* host was requested */
     if (host) {
-        if (saddr.ss_family == AF_INET) {
-            *host = malloc(INET_ADDRSTRLEN);
-            if (*host) {
-                if (!inet_ntop(AF_INET, &((struct sockaddr_in *)&saddr)->sin_addr.s_addr, *host, INET_ADDRSTRLEN)) {
-                    ERR("inet_ntop failed (%s).", strerror(errno));
-                    free(*host);
-                    *host = NULL;
-                }
+        nc_sock_get_host_port(&saddr, host, port);
+    }
 
-                if (port) {
-                    *port = ntohs(((struct sockaddr_in *)&saddr)->sin_port);
-                }
-            } else {
-                ERRMEM;
-            }
-        } else if (saddr.ss_family == AF_INET6) {
-            *host = malloc(INET6_ADDRSTRLEN);
-            if (*host) {
-                if (!inet_ntop(AF_INET6, ((struct sockaddr_in6 *)&saddr)->sin6_addr.s6_addr, *host, INET6_ADDRSTRLEN)) {
-                    ERR("inet_ntop failed (%s).", strerror(errno));
-                    free(*host);
-                    *host = NULL;
-                }
+    return ret;
+}
 
-                if (port) {
-                    *port = ntohs(((struct sockaddr_in6 *)&saddr)->sin6_port);
-                }
-            } else {
-                ERRMEM;
-            }
-        } else if (saddr.ss_family == AF_UNIX) {
-            *host = strdup(((struct sockaddr_un *)&saddr)->sun_path);
-            if (*host) {
-                if (port) {
-                    *port = 0;
+#ifdef NC_ACCEPT_EPOLL
+
+/* BIND LOCK expected to be held */
+static int
+nc_server_accept_epoll_add(int sock)
+{
+    struct epoll_event ev;
+    int flags;
+
+    if (server_opts.accept_epfd == -1) {
+        /* the set is created on the first accept */
+        return 0;
+    }
+
+    /* pending connections are accepted until there are none */
+    if (((flags = fcntl(sock, F_GETFL)) == -1) || (fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1)) {
+        ERR("Fcntl failed (%s).", strerror(errno));
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof ev);
+    ev.events = EPOLLIN;
+    ev.data.fd = sock;
+    if (epoll_ctl(server_opts.accept_epfd, EPOLL_CTL_ADD, sock, &ev) == -1) {
+        ERR("Adding a listening socket to epoll failed (%s).", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* BIND LOCK expected to be held */
+static int
+nc_server_accept_epoll_init(void)
+{
+    uint16_t i;
+
+    if (server_opts.accept_epfd > -1) {
+        return 0;
+    }
+
+    server_opts.accept_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (server_opts.accept_epfd == -1) {
+        ERR("Creating an epoll set failed (%s).", strerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i < server_opts.endpt_count; ++i) {
+        if ((server_opts.binds[i].sock > -1) && nc_server_accept_epoll_add(server_opts.binds[i].sock)) {
+            close(server_opts.accept_epfd);
+            server_opts.accept_epfd = -1;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* BIND LOCK expected to be held */
+static int
+nc_server_accept_binds(int timeout, char **host, uint16_t *port, uint16_t *idx)
+{
+    struct epoll_event events[NC_ACCEPT_BATCH_SIZE];
+    struct nc_accepted *acc, first;
+    sigset_t sigmask;
+    socklen_t saddr_len;
+    uint16_t i;
+    int ret, j, sock;
+
+    if (nc_server_accept_epoll_init()) {
+        return -1;
+    }
+
+    if (!server_opts.accepted_count) {
+        /* wait for new connections */
+        sigfillset(&sigmask);
+        ret = epoll_pwait(server_opts.accept_epfd, events, NC_ACCEPT_BATCH_SIZE, timeout, &sigmask);
+        if (!ret) {
+            /* we timeouted */
+            return 0;
+        } else if (ret == -1) {
+            ERR("Epoll wait failed (%s).", strerror(errno));
+            return -1;
+        }
+
+        /* accept all the pending connections that fit */
+        for (j = 0; j < ret; ++j) {
+            while (server_opts.accepted_count < NC_ACCEPT_BATCH_SIZE) {
+                acc = &server_opts.accepted[server_opts.accepted_count];
+                saddr_len = sizeof acc->saddr;
+                sock = accept4(events[j].data.fd, (struct sockaddr *)&acc->saddr, &saddr_len, SOCK_NONBLOCK);
+                if (sock == -1) {
+                    if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                        ERR("Accept failed (%s).", strerror(errno));
+                    }
+                    break;
                 }
-            } else {
-                ERRMEM;
+
+                acc->sock = sock;
+                acc->listen_sock = events[j].data.fd;
+                ++server_opts.accepted_count;
             }
+        }
+
+        if (!server_opts.accepted_count) {
+            /* the connections were closed in the meantime */
+            return 0;
+        }
+    }
+
+    /* return the oldest connection */
+    first = server_opts.accepted[0];
+    --server_opts.accepted_count;
+    memmove(&server_opts.accepted[0], &server_opts.accepted[1], server_opts.accepted_count * sizeof *server_opts.accepted);
+
+    for (i = 0; i < server_opts.endpt_count; ++i) {
+        if (server_opts.binds[i].sock == first.listen_sock) {
+            break;
+        }
+    }
+    if (i == server_opts.endpt_count) {
+        /* connections of a closed listening socket are always dropped */
+        ERRINT;
+        close(first.sock);
+        return -1;
+    }
+    VRB("Accepted a connection on %s:%u.", server_opts.binds[i].address, server_opts.binds[i].port);
+
+    if (idx) {
+        *idx = i;
+    }
+    if (host) {
+        nc_sock_get_host_port(&first.saddr, host, port);
+    }
+
+    return first.sock;
+}
+
+#else
+
+/* BIND LOCK expected to be held */
+static int
+nc_server_accept_binds(int timeout, char **host, uint16_t *port, uint16_t *idx)
+{
+    return nc_sock_accept_binds(server_opts.binds, server_opts.endpt_count, timeout, host, port, idx);
+}
+
+#endif
+
+/* BIND LOCK expected to be held */
+static void
+nc_server_bind_close(int listen_sock)
+{
+#ifdef NC_ACCEPT_EPOLL
+    uint16_t i, j;
+
+    /* drop the connections accepted on this socket that were not returned yet */
+    for (i = 0, j = 0; i < server_opts.accepted_count; ++i) {
+        if (server_opts.accepted[i].listen_sock == listen_sock) {
+            close(server_opts.accepted[i].sock);
         } else {
-            ERR("Source host of an unknown protocol family.");
+            server_opts.accepted[j++] = server_opts.accepted[i];
         }
     }
+    server_opts.accepted_count = j;
+#endif
 
-    return ret;
+    /* also removes it from the epoll set */
+    close(listen_sock);
 }
 
 static struct nc_server_reply *
@@ -612,6 +869,11 @@ API void
 nc_server_destroy(void)
 {
     unsigned int i;
+    struct nc_accept_src *src;
+
+#if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
+    nc_server_accept_pipeline_stop();
+#endif
 
     for (i = 0; i < server_opts.capabilities_count; i++) {
         lydict_remove(server_opts.ctx, server_opts.capabilities[i]);
@@ -624,6 +886,19 @@ nc_server_destroy(void)
     nc_server_del_endpt(NULL, 0);
     nc_server_ch_del_client(NULL);
 #endif
+#ifdef NC_ACCEPT_EPOLL
+    /* BIND LOCK */
+    pthread_mutex_lock(&server_opts.bind_lock);
+    while (server_opts.accepted_count) {
+        close(server_opts.accepted[--server_opts.accepted_count].sock);
+    }
+    if (server_opts.accept_epfd > -1) {
+        close(server_opts.accept_epfd);
+        server_opts.accept_epfd = -1;
+    }
+    /* BIND UNLOCK */
+    pthread_mutex_unlock(&server_opts.bind_lock);
+#endif
 #ifdef NC_ENABLED_SSH
     if (server_opts.passwd_auth_data && server_opts.passwd_auth_data_free) {
         server_opts.passwd_auth_data_free(server_opts.passwd_auth_data);
@@ -632,6 +907,7 @@ nc_server_destroy(void)
     server_opts.passwd_auth_data_free = NULL;
 
     nc_server_ssh_del_authkey(NULL, NULL, 0, NULL);
+    nc_server_ssh_set_passwd_cache_ttl(0);
 
     if (server_opts.hostkey_data && server_opts.hostkey_data_free) {
         server_opts.hostkey_data_free(server_opts.hostkey_data);
@@ -651,6 +927,36 @@ nc_server_destroy(void)
     server_opts.trusted_cert_list_data = NULL;
     server_opts.trusted_cert_list_data_free = NULL;
 #endif
+
+    /* USER RATE LOCK */
+    pthread_mutex_lock(&server_opts.user_rate_lock);
+    for (i = 0; i < server_opts.user_rate_count; ++i) {
+        lydict_remove(server_opts.ctx, server_opts.user_rates[i].username);
+    }
+    free(server_opts.user_rates);
+    server_opts.user_rates = NULL;
+    server_opts.user_rate_count = 0;
+    /* USER RATE UNLOCK */
+    pthread_mutex_unlock(&server_opts.user_rate_lock);
+
+    /* ACCEPT FILTER LOCK */
+    pthread_mutex_lock(&server_opts.accept_filter.lock);
+    free(server_opts.accept_filter.rules);
+    server_opts.accept_filter.rules = NULL;
+    server_opts.accept_filter.rule_count = 0;
+    for (i = 0; server_opts.accept_filter.srcs && (i < NC_ACCEPT_SRC_BUCKETS); ++i) {
+        while (server_opts.accept_filter.srcs[i]) {
+            src = server_opts.accept_filter.srcs[i];
+            server_opts.accept_filter.srcs[i] = src->next;
+            free(src);
+        }
+    }
+    free(server_opts.accept_filter.srcs);
+    server_opts.accept_filter.srcs = NULL;
+    server_opts.accept_filter.src_count = 0;
+    /* ACCEPT FILTER UNLOCK */
+    pthread_mutex_unlock(&server_opts.accept_filter.lock);
+
     nc_destroy();
 }
 
@@ -732,1635 +1038,3270 @@ nc_server_get_idle_timeout(void)
     return server_opts.idle_timeout;
 }
 
-API NC_MSG_TYPE
-nc_accept_inout(int fdin, int fdout, const char *username, struct nc_session **session)
+static int
+nc_server_load_enabled(void)
 {
-    NC_MSG_TYPE msgtype;
-    struct timespec ts_cur;
+    /* the thresholds themselves are read only with the lock held */
+    return ATOMIC_LOAD(&server_opts.load_enabled) ? 1 : 0;
+}
 
-    if (!server_opts.ctx) {
-        ERRINIT;
-        return NC_MSG_ERROR;
-    } else if (fdin < 0) {
-        ERRARG("fdin");
-        return NC_MSG_ERROR;
-    } else if (fdout < 0) {
-        ERRARG("fdout");
-        return NC_MSG_ERROR;
-    } else if (!username) {
-        ERRARG("username");
-        return NC_MSG_ERROR;
-    } else if (!session) {
-        ERRARG("session");
-        return NC_MSG_ERROR;
+/* returns resident memory of the process in bytes, 0 if it cannot be learned */
+static uint64_t
+nc_server_get_rss(void)
+{
+    FILE *file;
+    unsigned long size, resident;
+    long page_size;
+
+    file = fopen("/proc/self/statm", "r");
+    if (!file) {
+        return 0;
+    }
+    if (fscanf(file, "%lu %lu", &size, &resident) != 2) {
+        fclose(file);
+        return 0;
     }
+    fclose(file);
 
-    /* prepare session structure */
-    *session = nc_new_session(NC_SERVER, 0);
-    if (!(*session)) {
-        ERRMEM;
-        return NC_MSG_ERROR;
+    page_size = sysconf(_SC_PAGESIZE);
+    if (page_size < 1) {
+        return 0;
     }
-    (*session)->status = NC_STATUS_STARTING;
 
-    /* transport specific data */
-    (*session)->ti_type = NC_TI_FD;
-    (*session)->ti.fd.in = fdin;
-    (*session)->ti.fd.out = fdout;
+    return (uint64_t)resident * page_size;
+}
 
-    /* assign context (dicionary needed for handshake) */
-    (*session)->flags = NC_SESSION_SHAREDCTX;
-    (*session)->ctx = server_opts.ctx;
+/* LOAD LOCK must be held, latency -1 if there is no new RPC processing time sample */
+static void
+nc_server_load_update(int32_t latency)
+{
+    struct timespec ts_cur;
+    uint32_t queued;
+    int over, under;
 
-    /* assign new SID atomically */
-    (*session)->id = ATOMIC_INC(&server_opts.new_session_id);
+    nc_gettimespec_mono(&ts_cur);
 
-    /* NETCONF handshake */
-    msgtype = nc_handshake_io(*session);
-    if (msgtype != NC_MSG_HELLO) {
-        nc_session_free(*session, NULL);
-        *session = NULL;
-        return msgtype;
+    if (latency > -1) {
+        /* moving average */
+        server_opts.load.latency = (server_opts.load.latency * 7 + latency) / 8;
+        server_opts.load.latency_time = ts_cur.tv_sec;
+    } else if (ts_cur.tv_sec > server_opts.load.latency_time) {
+        /* no RPCs processed, let the average decay so that an idle server recovers */
+        if (ts_cur.tv_sec - server_opts.load.latency_time < 32) {
+            server_opts.load.latency >>= ts_cur.tv_sec - server_opts.load.latency_time;
+        } else {
+            server_opts.load.latency = 0;
+        }
+        server_opts.load.latency_time = ts_cur.tv_sec;
     }
 
-    nc_gettimespec_mono(&ts_cur);
-    (*session)->opts.server.last_rpc = ts_cur.tv_sec;
-    nc_gettimespec_real(&ts_cur);
-    (*session)->opts.server.session_start = ts_cur.tv_sec;
+    if (server_opts.load.mem_high && (ts_cur.tv_sec != server_opts.load.mem_time)) {
+        /* measure memory at most once a second */
+        server_opts.load.mem = nc_server_get_rss();
+        server_opts.load.mem_time = ts_cur.tv_sec;
+    }
 
-    (*session)->status = NC_STATUS_RUNNING;
+    queued = ATOMIC_LOAD(&server_opts.ps_queued);
 
-    return msgtype;
+    over = (server_opts.load.queue_high && (queued >= server_opts.load.queue_high))
+            || (server_opts.load.latency_high && (server_opts.load.latency >= server_opts.load.latency_high))
+            || (server_opts.load.mem_high && (server_opts.load.mem >= server_opts.load.mem_high));
+    under = (!server_opts.load.queue_high || (queued <= server_opts.load.queue_low))
+            && (!server_opts.load.latency_high || (server_opts.load.latency <= server_opts.load.latency_low))
+            && (!server_opts.load.mem_high || (server_opts.load.mem <= server_opts.load.mem_low));
+
+    if ((server_opts.load.state == NC_LOAD_NORMAL) && over) {
+        WRN("Server overloaded (queued threads %u, RPC latency %u ms, memory %" PRIu64 " B), shedding load.",
+            queued, server_opts.load.latency, server_opts.load.mem);
+        server_opts.load.state = NC_LOAD_OVERLOAD;
+    } else if ((server_opts.load.state == NC_LOAD_OVERLOAD) && under) {
+        VRB("Server load back to normal.");
+        server_opts.load.state = NC_LOAD_NORMAL;
+    }
 }
 
-static void
-nc_ps_queue_add_id(struct nc_pollsession *ps, uint8_t *id)
+static NC_LOAD_STATE
+nc_server_load_get(void)
 {
-    uint8_t q_last;
+    NC_LOAD_STATE state;
 
-    if (ps->queue_len == NC_PS_QUEUE_SIZE) {
-        ERRINT;
-        return;
+    if (!nc_server_load_enabled()) {
+        return NC_LOAD_NORMAL;
     }
 
-    /* get a unique queue value (by adding 1 to the last added value, if any) */
-    if (ps->queue_len) {
-        q_last = (ps->queue_begin + ps->queue_len - 1) % NC_PS_QUEUE_SIZE;
-        *id = ps->queue[q_last] + 1;
-    } else {
-        *id = 0;
-    }
+    /* LOAD LOCK */
+    pthread_mutex_lock(&server_opts.load_lock);
 
-    /* add the id into the queue */
-    ++ps->queue_len;
-    q_last = (ps->queue_begin + ps->queue_len - 1) % NC_PS_QUEUE_SIZE;
-    ps->queue[q_last] = *id;
+    nc_server_load_update(-1);
+    state = server_opts.load.state;
+
+    /* LOAD UNLOCK */
+    pthread_mutex_unlock(&server_opts.load_lock);
+
+    return state;
 }
 
 static void
-nc_ps_queue_remove_id(struct nc_pollsession *ps, uint8_t id)
+nc_server_load_rpc_done(const struct timespec *ts_start)
 {
-    uint8_t i, q_idx, found = 0;
-
-    for (i = 0; i < ps->queue_len; ++i) {
-        /* get the actual queue idx */
-        q_idx = (ps->queue_begin + i) % NC_PS_QUEUE_SIZE;
+    struct timespec ts_cur;
 
-        if (found) {
-            if (ps->queue[q_idx] == id) {
-                /* another equal value, simply cannot be */
-                ERRINT;
-            }
-            if (found == 2) {
-                /* move the following values */
-                ps->queue[q_idx ? q_idx - 1 : NC_PS_QUEUE_SIZE - 1] = ps->queue[q_idx];
-            }
-        } else if (ps->queue[q_idx] == id) {
-            /* found our id, there can be no more equal valid values */
-            if (i == 0) {
-                found = 1;
-            } else {
-                /* this is not okay, our id is in the middle of the queue */
-                found = 2;
-            }
-        }
-    }
-    if (!found) {
-        ERRINT;
+    if (!nc_server_load_enabled()) {
         return;
     }
 
-    --ps->queue_len;
-    if (found == 1) {
-        /* remove the id by moving the queue, otherwise all the values in the queue were moved */
-        ps->queue_begin = (ps->queue_begin + 1) % NC_PS_QUEUE_SIZE;
-    }
-}
+    nc_gettimespec_mono(&ts_cur);
 
-int
-nc_ps_lock(struct nc_pollsession *ps, uint8_t *id, const char *func)
-{
-    int ret;
-    struct timespec ts;
+    /* LOAD LOCK */
+    pthread_mutex_lock(&server_opts.load_lock);
 
-    nc_gettimespec_real(&ts);
-    nc_addtimespec(&ts, NC_PS_LOCK_TIMEOUT);
+    nc_server_load_update(nc_difftimespec(ts_start, &ts_cur));
 
-    /* LOCK */
-    ret = pthread_mutex_timedlock(&ps->lock, &ts);
-    if (ret) {
-        ERR("%s: failed to lock a pollsession (%s).", func, strerror(ret));
-        return -1;
-    }
+    /* LOAD UNLOCK */
+    pthread_mutex_unlock(&server_opts.load_lock);
+}
 
-    /* check that the queue is long enough */
-    if (ps->queue_len == NC_PS_QUEUE_SIZE) {
-        ERR("%s: pollsession queue size (%d) too small.", func, NC_PS_QUEUE_SIZE);
-        pthread_mutex_unlock(&ps->lock);
+API int
+nc_server_set_overload_thresholds(uint32_t queue_high, uint32_t queue_low, uint32_t latency_high, uint32_t latency_low,
+        uint64_t mem_high, uint64_t mem_low)
+{
+    if (queue_high && (queue_low > queue_high)) {
+        ERRARG("queue_low");
+        return -1;
+    } else if (latency_high && (latency_low > latency_high)) {
+        ERRARG("latency_low");
+        return -1;
+    } else if (mem_high && (mem_low > mem_high)) {
+        ERRARG("mem_low");
         return -1;
     }
 
-    /* add ourselves into the queue */
-    nc_ps_queue_add_id(ps, id);
-    DBL("PS 0x%p TID %lu queue: added %u, head %u, lenght %u", ps, (long unsigned int)pthread_self(), *id,
-            ps->queue[ps->queue_begin], ps->queue_len);
-
-    /* is it our turn? */
-    while (ps->queue[ps->queue_begin] != *id) {
-        nc_gettimespec_real(&ts);
-        nc_addtimespec(&ts, NC_PS_QUEUE_TIMEOUT);
+    /* LOAD LOCK */
+    pthread_mutex_lock(&server_opts.load_lock);
 
-        ret = pthread_cond_timedwait(&ps->cond, &ps->lock, &ts);
-        if (ret) {
-            /**
-             * This may happen when another thread releases the lock and broadcasts the condition
-             * and this thread had already timed out. When this thread is scheduled, it returns timed out error
-             * but when actually this thread was ready for condition.
-             */
-            if ((ETIMEDOUT == ret) && (ps->queue[ps->queue_begin] == *id)) {
-                break;
-            }
+    server_opts.load.queue_high = queue_high;
+    server_opts.load.queue_low = queue_low;
+    server_opts.load.latency_high = latency_high;
+    server_opts.load.latency_low = latency_low;
+    server_opts.load.mem_high = mem_high;
+    server_opts.load.mem_low = mem_low;
+    if (!mem_high) {
+        server_opts.load.mem = 0;
+    }
+    server_opts.load.mem_time = 0;
 
-            ERR("%s: failed to wait for a pollsession condition (%s).", func, strerror(ret));
-            /* remove ourselves from the queue */
-            nc_ps_queue_remove_id(ps, *id);
-            pthread_mutex_unlock(&ps->lock);
-            return -1;
-        }
+    if (!queue_high && !latency_high && !mem_high) {
+        ATOMIC_STORE(&server_opts.load_enabled, 0);
+        server_opts.load.state = NC_LOAD_NORMAL;
+    } else {
+        ATOMIC_STORE(&server_opts.load_enabled, 1);
+        nc_server_load_update(-1);
     }
 
-    /* UNLOCK */
-    pthread_mutex_unlock(&ps->lock);
+    /* LOAD UNLOCK */
+    pthread_mutex_unlock(&server_opts.load_lock);
 
     return 0;
 }
 
-int
-nc_ps_unlock(struct nc_pollsession *ps, uint8_t id, const char *func)
+API NC_LOAD_STATE
+nc_server_get_load_state(uint32_t *queue_depth, uint32_t *latency, uint64_t *mem)
 {
-    int ret;
-    struct timespec ts;
+    NC_LOAD_STATE state;
 
-    nc_gettimespec_real(&ts);
-    nc_addtimespec(&ts, NC_PS_LOCK_TIMEOUT);
+    /* LOAD LOCK */
+    pthread_mutex_lock(&server_opts.load_lock);
 
-    /* LOCK */
-    ret = pthread_mutex_timedlock(&ps->lock, &ts);
-    if (ret) {
-        ERR("%s: failed to lock a pollsession (%s).", func, strerror(ret));
-        ret = -1;
+    nc_server_load_update(-1);
+    state = server_opts.load.state;
+    if (queue_depth) {
+        *queue_depth = ATOMIC_LOAD(&server_opts.ps_queued);
     }
-
-    /* we must be the first, it was our turn after all, right? */
-    if (ps->queue[ps->queue_begin] != id) {
-        ERRINT;
-        /* UNLOCK */
-        if (!ret) {
-            pthread_mutex_unlock(&ps->lock);
-        }
-        return -1;
+    if (latency) {
+        *latency = server_opts.load.latency;
+    }
+    if (mem) {
+        *mem = server_opts.load.mem;
     }
 
-    /* remove ourselves from the queue */
-    nc_ps_queue_remove_id(ps, id);
-    DBL("PS 0x%p TID %lu queue: removed %u, head %u, lenght %u", ps, (long unsigned int)pthread_self(), id,
-            ps->queue[ps->queue_begin], ps->queue_len);
+    /* LOAD UNLOCK */
+    pthread_mutex_unlock(&server_opts.load_lock);
 
-    /* broadcast to all other threads that the queue moved */
-    pthread_cond_broadcast(&ps->cond);
+    return state;
+}
 
-    /* UNLOCK */
-    if (!ret) {
-        pthread_mutex_unlock(&ps->lock);
+API void
+nc_server_set_rpc_priority_clb(int (*prio_clb)(const struct lyd_node *rpc, const struct nc_session *session))
+{
+    server_opts.rpc_prio_clb = prio_clb;
+}
+
+/* returns 1 if the RPC operation element should be denied without parsing it because the server is overloaded,
+ * 0 otherwise, the priority callback needs the parsed RPC so then it is decided only once parsed */
+static int
+nc_server_load_shed_op(const struct lyxml_elem *op)
+{
+    if (server_opts.rpc_prio_clb || (nc_server_load_get() == NC_LOAD_NORMAL)) {
+        return 0;
     }
 
-    return ret;
+    /* by default keep only the operations that release resources */
+    if (op && op->ns && !strcmp(op->ns->value, NC_NS_BASE)
+            && (!strcmp(op->name, "close-session") || !strcmp(op->name, "kill-session"))) {
+        return 0;
+    }
+    return 1;
 }
 
-API struct nc_pollsession *
-nc_ps_new(void)
+/* returns 1 if the parsed RPC should be denied by the priority callback because the server is overloaded, 0 otherwise */
+static int
+nc_server_load_shed_rpc(struct nc_session *session, const struct lyd_node *rpc)
 {
-    struct nc_pollsession *ps;
-
-    ps = calloc(1, sizeof(struct nc_pollsession));
-    if (!ps) {
-        ERRMEM;
-        return NULL;
+    if (!server_opts.rpc_prio_clb || (nc_server_load_get() == NC_LOAD_NORMAL)) {
+        return 0;
     }
-    pthread_cond_init(&ps->cond, NULL);
-    pthread_mutex_init(&ps->lock, NULL);
 
-    return ps;
+    return server_opts.rpc_prio_clb(rpc, session) ? 0 : 1;
 }
 
-API void
-nc_ps_free(struct nc_pollsession *ps)
+static void
+nc_rate_bucket_init(struct nc_rate_bucket *bucket, uint32_t rate, uint32_t burst)
 {
-    uint16_t i;
+    bucket->rate = rate;
+    bucket->burst = (burst ? burst : rate);
+    bucket->mtokens = (uint64_t)bucket->burst * 1000;
+    nc_gettimespec_mono(&bucket->last);
+}
 
-    if (!ps) {
-        return;
+/* returns 1 if the bucket has enough tokens (refilling it first), 0 otherwise */
+static int
+nc_rate_bucket_check(struct nc_rate_bucket *bucket, uint64_t tokens, const struct timespec *now)
+{
+    int32_t diff;
+
+    if (!bucket->rate) {
+        /* no limit */
+        return 1;
     }
 
-    if (ps->queue_len) {
-        ERR("FATAL: Freeing a pollsession structure that is currently being worked with!");
+    diff = nc_difftimespec(&bucket->last, now);
+    if (diff > 0) {
+        bucket->mtokens += (uint64_t)diff * bucket->rate;
+        if (bucket->mtokens > (uint64_t)bucket->burst * 1000) {
+            bucket->mtokens = (uint64_t)bucket->burst * 1000;
+        }
+        bucket->last = *now;
     }
 
-    for (i = 0; i < ps->session_count; i++) {
-        free(ps->sessions[i]);
+    return (bucket->mtokens >= tokens * 1000) ? 1 : 0;
+}
+
+/* must be called after a successful nc_rate_bucket_check() */
+static void
+nc_rate_bucket_take(struct nc_rate_bucket *bucket, uint64_t tokens)
+{
+    if (bucket->rate) {
+        bucket->mtokens -= tokens * 1000;
     }
+}
 
-    free(ps->sessions);
-    pthread_mutex_destroy(&ps->lock);
-    pthread_cond_destroy(&ps->cond);
+/* changes the limits of a bucket in use, the available tokens are kept up to the new burst */
+static void
+nc_rate_bucket_update(struct nc_rate_bucket *bucket, uint32_t rate, uint32_t burst)
+{
+    struct timespec ts_cur;
 
-    free(ps);
+    if (!bucket->rate) {
+        /* was not limited, start full */
+        nc_rate_bucket_init(bucket, rate, burst);
+        return;
+    }
+
+    /* refill with the previous rate */
+    nc_gettimespec_mono(&ts_cur);
+    nc_rate_bucket_check(bucket, 0, &ts_cur);
+
+    bucket->rate = rate;
+    bucket->burst = (burst ? burst : rate);
+    if (bucket->mtokens > (uint64_t)bucket->burst * 1000) {
+        bucket->mtokens = (uint64_t)bucket->burst * 1000;
+    }
 }
 
 API int
-nc_ps_add_session(struct nc_pollsession *ps, struct nc_session *session)
+nc_server_set_user_rate_limit(const char *username, uint32_t rpc_rate, uint32_t rpc_burst, uint32_t byte_rate,
+        uint32_t byte_burst)
 {
-    uint8_t q_id;
+    uint16_t i;
+    struct nc_user_rate *user_rate = NULL, *mem;
+    int ret = 0;
 
-    if (!ps) {
-        ERRARG("ps");
-        return -1;
-    } else if (!session) {
-        ERRARG("session");
+    if (!username) {
+        ERRARG("username");
         return -1;
     }
 
-    /* LOCK */
-    if (nc_ps_lock(ps, &q_id, __func__)) {
-        return -1;
+    /* USER RATE LOCK */
+    pthread_mutex_lock(&server_opts.user_rate_lock);
+
+    for (i = 0; i < server_opts.user_rate_count; ++i) {
+        if (!strcmp(server_opts.user_rates[i].username, username)) {
+            user_rate = &server_opts.user_rates[i];
+            break;
+        }
     }
 
-    ++ps->session_count;
-    ps->sessions = nc_realloc(ps->sessions, ps->session_count * sizeof *ps->sessions);
-    if (!ps->sessions) {
-        ERRMEM;
-        /* UNLOCK */
-        nc_ps_unlock(ps, q_id, __func__);
-        return -1;
+    if (!rpc_rate && !byte_rate) {
+        /* remove the limit */
+        if (user_rate) {
+            lydict_remove(server_opts.ctx, user_rate->username);
+            --server_opts.user_rate_count;
+            if (i < server_opts.user_rate_count) {
+                memcpy(user_rate, &server_opts.user_rates[server_opts.user_rate_count], sizeof *user_rate);
+            } else if (!server_opts.user_rate_count) {
+                free(server_opts.user_rates);
+                server_opts.user_rates = NULL;
+            }
+        }
+        goto cleanup;
     }
-    ps->sessions[ps->session_count - 1] = calloc(1, sizeof **ps->sessions);
-    if (!ps->sessions[ps->session_count - 1]) {
-        ERRMEM;
-        --ps->session_count;
-        /* UNLOCK */
-        nc_ps_unlock(ps, q_id, __func__);
-        return -1;
+
+    if (!user_rate) {
+        /* the current limits are kept on failure */
+        mem = realloc(server_opts.user_rates, (server_opts.user_rate_count + 1) * sizeof *server_opts.user_rates);
+        if (!mem) {
+            ERRMEM;
+            ret = -1;
+            goto cleanup;
+        }
+        server_opts.user_rates = mem;
+        user_rate = &server_opts.user_rates[server_opts.user_rate_count];
+        ++server_opts.user_rate_count;
+        user_rate->username = lydict_insert(server_opts.ctx, username, 0);
     }
-    ps->sessions[ps->session_count - 1]->session = session;
-    ps->sessions[ps->session_count - 1]->state = NC_PS_STATE_NONE;
 
-    /* UNLOCK */
-    return nc_ps_unlock(ps, q_id, __func__);
+    nc_rate_bucket_init(&user_rate->rpcs, rpc_rate, rpc_burst);
+    nc_rate_bucket_init(&user_rate->bytes, byte_rate, byte_burst);
+
+cleanup:
+    /* USER RATE UNLOCK */
+    pthread_mutex_unlock(&server_opts.user_rate_lock);
+
+    return ret;
 }
 
+/* parses "<address>[/<length>]" into an IPv6 or IPv4-mapped prefix, returns 0 on success */
 static int
-_nc_ps_del_session(struct nc_pollsession *ps, struct nc_session *session, int index)
+nc_accept_prefix_parse(const char *prefix, uint8_t *addr, uint8_t *prefix_len)
 {
-    uint16_t i;
+    char *str, *ptr;
+    struct in_addr addr4;
+    unsigned long len = 128;
+    int ret = -1;
 
-    if (index >= 0) {
-        i = (uint16_t)index;
-        goto remove;
+    str = strdup(prefix);
+    if (!str) {
+        ERRMEM;
+        return -1;
     }
-    for (i = 0; i < ps->session_count; ++i) {
-        if (ps->sessions[i]->session == session) {
-remove:
-            --ps->session_count;
-            if (i <= ps->session_count) {
-                free(ps->sessions[i]);
-                ps->sessions[i] = ps->sessions[ps->session_count];
-            }
-            if (!ps->session_count) {
-                free(ps->sessions);
-                ps->sessions = NULL;
-            }
-            ps->last_event_session = 0;
-            return 0;
+
+    ptr = strchr(str, '/');
+    if (ptr) {
+        *ptr = '\0';
+        ++ptr;
+        if (!isdigit((unsigned char)ptr[0])) {
+            goto cleanup;
+        }
+        len = strtoul(ptr, &ptr, 10);
+        if (*ptr) {
+            goto cleanup;
         }
     }
 
-    return -1;
+    if (inet_pton(AF_INET, str, &addr4) == 1) {
+        if (!strchr(prefix, '/')) {
+            len = 32;
+        } else if (len > 32) {
+            goto cleanup;
+        }
+        memset(addr, 0, 10);
+        memset(addr + 10, 0xff, 2);
+        memcpy(addr + 12, &addr4, 4);
+        len += 96;
+    } else if ((inet_pton(AF_INET6, str, addr) != 1) || (len > 128)) {
+        goto cleanup;
+    }
+
+    /* clear the host bits so that equal prefixes compare equal */
+    if (len < 128) {
+        addr[len / 8] &= (uint8_t)(0xff00 >> (len % 8));
+        memset(addr + len / 8 + 1, 0, 15 - len / 8);
+    }
+    *prefix_len = len;
+    ret = 0;
+
+cleanup:
+    free(str);
+    return ret;
+}
+
+static int
+nc_accept_prefix_match(const uint8_t *addr, const uint8_t *prefix, uint8_t prefix_len)
+{
+    if (memcmp(addr, prefix, prefix_len / 8)) {
+        return 0;
+    }
+    if ((prefix_len % 8) && ((addr[prefix_len / 8] ^ prefix[prefix_len / 8]) & (uint8_t)(0xff00 >> (prefix_len % 8)))) {
+        return 0;
+    }
+    return 1;
 }
 
 API int
-nc_ps_del_session(struct nc_pollsession *ps, struct nc_session *session)
+nc_server_add_accept_rule(const char *prefix, NC_ACCEPT_ACTION action)
 {
-    uint8_t q_id;
-    int ret, ret2;
+    uint8_t addr[16], prefix_len;
+    uint16_t i;
+    struct nc_accept_rule *mem;
+    int ret = 0;
 
-    if (!ps) {
-        ERRARG("ps");
+    if (!prefix) {
+        ERRARG("prefix");
         return -1;
-    } else if (!session) {
-        ERRARG("session");
+    } else if (nc_accept_prefix_parse(prefix, addr, &prefix_len)) {
+        ERR("Invalid accept filter prefix \"%s\".", prefix);
         return -1;
     }
 
-    /* LOCK */
-    if (nc_ps_lock(ps, &q_id, __func__)) {
-        return -1;
+    /* ACCEPT FILTER LOCK */
+    pthread_mutex_lock(&server_opts.accept_filter.lock);
+
+    for (i = 0; i < server_opts.accept_filter.rule_count; ++i) {
+        if ((server_opts.accept_filter.rules[i].prefix_len == prefix_len)
+                && !memcmp(server_opts.accept_filter.rules[i].addr, addr, 16)) {
+            /* just change the action */
+            server_opts.accept_filter.rules[i].action = action;
+            goto cleanup;
+        }
+        if (server_opts.accept_filter.rules[i].prefix_len < prefix_len) {
+            break;
+        }
     }
 
-    ret = _nc_ps_del_session(ps, session, -1);
+    /* the current rules are kept on failure */
+    mem = realloc(server_opts.accept_filter.rules,
+                  (server_opts.accept_filter.rule_count + 1) * sizeof *server_opts.accept_filter.rules);
+    if (!mem) {
+        ERRMEM;
+        ret = -1;
+        goto cleanup;
+    }
+    server_opts.accept_filter.rules = mem;
 
-    /* UNLOCK */
-    ret2 = nc_ps_unlock(ps, q_id, __func__);
+    /* keep the rules sorted from the longest prefix */
+    memmove(&server_opts.accept_filter.rules[i + 1], &server_opts.accept_filter.rules[i],
+            (server_opts.accept_filter.rule_count - i) * sizeof *server_opts.accept_filter.rules);
+    memcpy(server_opts.accept_filter.rules[i].addr, addr, 16);
+    server_opts.accept_filter.rules[i].prefix_len = prefix_len;
+    server_opts.accept_filter.rules[i].action = action;
+    ++server_opts.accept_filter.rule_count;
 
-    return (ret || ret2 ? -1 : 0);
+cleanup:
+    /* ACCEPT FILTER UNLOCK */
+    pthread_mutex_unlock(&server_opts.accept_filter.lock);
+    return ret;
 }
 
-API struct nc_session *
-nc_ps_get_session(const struct nc_pollsession *ps, uint16_t idx)
+API int
+nc_server_del_accept_rule(const char *prefix)
 {
-    uint8_t q_id;
-    struct nc_session *ret = NULL;
+    uint8_t addr[16], prefix_len;
+    uint16_t i;
+    int ret = -1;
 
-    if (!ps) {
-        ERRARG("ps");
-        return NULL;
+    if (prefix && nc_accept_prefix_parse(prefix, addr, &prefix_len)) {
+        ERR("Invalid accept filter prefix \"%s\".", prefix);
+        return -1;
     }
 
-    /* LOCK */
-    if (nc_ps_lock((struct nc_pollsession *)ps, &q_id, __func__)) {
-        return NULL;
-    }
+    /* ACCEPT FILTER LOCK */
+    pthread_mutex_lock(&server_opts.accept_filter.lock);
 
-    if (idx < ps->session_count) {
-        ret = ps->sessions[idx]->session;
+    if (!prefix) {
+        free(server_opts.accept_filter.rules);
+        server_opts.accept_filter.rules = NULL;
+        server_opts.accept_filter.rule_count = 0;
+        ret = 0;
+        goto cleanup;
     }
 
-    /* UNLOCK */
-    nc_ps_unlock((struct nc_pollsession *)ps, q_id, __func__);
+    for (i = 0; i < server_opts.accept_filter.rule_count; ++i) {
+        if ((server_opts.accept_filter.rules[i].prefix_len == prefix_len)
+                && !memcmp(server_opts.accept_filter.rules[i].addr, addr, 16)) {
+            --server_opts.accept_filter.rule_count;
+            memmove(&server_opts.accept_filter.rules[i], &server_opts.accept_filter.rules[i + 1],
+                    (server_opts.accept_filter.rule_count - i) * sizeof *server_opts.accept_filter.rules);
+            ret = 0;
+            break;
+        }
+    }
 
+cleanup:
+    /* ACCEPT FILTER UNLOCK */
+    pthread_mutex_unlock(&server_opts.accept_filter.lock);
     return ret;
 }
 
-API uint16_t
-nc_ps_session_count(struct nc_pollsession *ps)
+API void
+nc_server_set_accept_src_limits(uint32_t conn_rate, uint32_t conn_burst, uint16_t max_sessions)
 {
-    uint8_t q_id;
-    uint16_t session_count;
-
-    if (!ps) {
-        ERRARG("ps");
-        return 0;
-    }
+    uint32_t i;
+    struct nc_accept_src *src;
 
-    /* LOCK (just for memory barrier so that we read the current value) */
-    if (nc_ps_lock((struct nc_pollsession *)ps, &q_id, __func__)) {
-        return 0;
-    }
+    /* ACCEPT FILTER LOCK */
+    pthread_mutex_lock(&server_opts.accept_filter.lock);
 
-    session_count = ps->session_count;
+    server_opts.accept_filter.conn_rate = conn_rate;
+    server_opts.accept_filter.conn_burst = conn_burst;
+    server_opts.accept_filter.max_sessions = max_sessions;
 
-    /* UNLOCK */
-    nc_ps_unlock((struct nc_pollsession *)ps, q_id, __func__);
+    /* apply the new rate to the tracked sources, without refilling them */
+    for (i = 0; server_opts.accept_filter.srcs && (i < NC_ACCEPT_SRC_BUCKETS); ++i) {
+        for (src = server_opts.accept_filter.srcs[i]; src; src = src->next) {
+            nc_rate_bucket_update(&src->conns, conn_rate, conn_burst);
+        }
+    }
 
-    return session_count;
+    /* ACCEPT FILTER UNLOCK */
+    pthread_mutex_unlock(&server_opts.accept_filter.lock);
 }
 
-/* should be called holding the session RPC lock! IO lock will be acquired as needed
- * returns: NC_PSPOLL_ERROR,
- *          NC_PSPOLL_BAD_RPC,
- *          NC_PSPOLL_BAD_RPC | NC_PSPOLL_REPLY_ERROR,
- *          NC_PSPOLL_RPC
- */
-static int
-nc_server_recv_rpc_io(struct nc_session *session, int io_timeout, struct nc_server_rpc **rpc)
+static uint32_t
+nc_accept_src_hash(const uint8_t *addr)
 {
-    struct lyxml_elem *xml = NULL;
-    NC_MSG_TYPE msgtype;
-    struct nc_server_reply *reply = NULL;
-    int ret;
+    uint32_t hash = 2166136261u;
+    int i;
 
-    if (!session) {
-        ERRARG("session");
-        return NC_PSPOLL_ERROR;
-    } else if (!rpc) {
-        ERRARG("rpc");
-        return NC_PSPOLL_ERROR;
-    } else if ((session->status != NC_STATUS_RUNNING) || (session->side != NC_SERVER)) {
-        ERR("Session %u: invalid session to receive RPCs.", session->id);
-        return NC_PSPOLL_ERROR;
+    /* FNV-1a */
+    for (i = 0; i < 16; ++i) {
+        hash = (hash ^ addr[i]) * 16777619u;
     }
+    return hash % NC_ACCEPT_SRC_BUCKETS;
+}
 
-    msgtype = nc_read_msg_io(session, io_timeout, &xml, 0);
-
-    switch (msgtype) {
-    case NC_MSG_RPC:
-        *rpc = calloc(1, sizeof **rpc);
-        if (!*rpc) {
-            ERRMEM;
-            goto error;
-        }
-
-        ly_errno = LY_SUCCESS;
-        (*rpc)->tree = lyd_parse_xml(server_opts.ctx, &xml->child,
-                                     LYD_OPT_RPC | LYD_OPT_DESTRUCT | LYD_OPT_NOEXTDEPS | LYD_OPT_STRICT, NULL);
-        if (!(*rpc)->tree) {
-            /* parsing RPC failed */
-            reply = nc_server_reply_err(nc_err_libyang(server_opts.ctx));
-            ret = nc_write_msg_io(session, io_timeout, NC_MSG_REPLY, xml, reply);
-            nc_server_reply_free(reply);
-            if (ret != NC_MSG_REPLY) {
-                ERR("Session %u: failed to write reply (%s).", session->id, nc_msgtype2str[ret]);
+/* ACCEPT FILTER LOCK expected to be held, forgets sources without connections that are not rate limited */
+static void
+nc_accept_src_prune(const struct timespec *now)
+{
+    uint32_t i;
+    struct nc_accept_src **iter, *src;
+
+    for (i = 0; i < NC_ACCEPT_SRC_BUCKETS; ++i) {
+        for (iter = &server_opts.accept_filter.srcs[i]; *iter; ) {
+            src = *iter;
+            if (!src->sessions && nc_rate_bucket_check(&src->conns, src->conns.burst, now)) {
+                *iter = src->next;
+                free(src);
+                --server_opts.accept_filter.src_count;
+            } else {
+                iter = &src->next;
             }
-            ret = NC_PSPOLL_REPLY_ERROR | NC_PSPOLL_BAD_RPC;
-        } else {
-            ret = NC_PSPOLL_RPC;
         }
-        (*rpc)->root = xml;
-        break;
-    case NC_MSG_HELLO:
-        ERR("Session %u: received another <hello> message.", session->id);
-        ret = NC_PSPOLL_BAD_RPC;
-        goto error;
-    case NC_MSG_REPLY:
-        ERR("Session %u: received <rpc-reply> from a NETCONF client.", session->id);
-        ret = NC_PSPOLL_BAD_RPC;
-        goto error;
-    case NC_MSG_NOTIF:
-        ERR("Session %u: received <notification> from a NETCONF client.", session->id);
-        ret = NC_PSPOLL_BAD_RPC;
-        goto error;
-    default:
-        /* NC_MSG_ERROR,
-         * NC_MSG_WOULDBLOCK and NC_MSG_NONE is not returned by nc_read_msg_io()
-         */
-        ret = NC_PSPOLL_ERROR;
-        break;
     }
-
-    return ret;
-
-error:
-    /* cleanup */
-    lyxml_free(server_opts.ctx, xml);
-
-    return NC_PSPOLL_ERROR;
 }
 
-API void
-nc_set_global_rpc_clb(nc_rpc_clb clb)
+/* ACCEPT FILTER LOCK expected to be held */
+static struct nc_accept_src *
+nc_accept_src_get(const uint8_t *addr, const struct timespec *now)
 {
-    global_rpc_clb = clb;
-}
+    uint32_t hash;
+    struct nc_accept_src *src;
 
-API NC_MSG_TYPE
-nc_server_notif_send(struct nc_session *session, struct nc_server_notif *notif, int timeout)
-{
-    NC_MSG_TYPE ret;
+    if (!server_opts.accept_filter.srcs) {
+        server_opts.accept_filter.srcs = calloc(NC_ACCEPT_SRC_BUCKETS, sizeof *server_opts.accept_filter.srcs);
+        if (!server_opts.accept_filter.srcs) {
+            ERRMEM;
+            return NULL;
+        }
+    }
 
-    /* check parameters */
-    if (!session || (session->side != NC_SERVER) || !session->opts.server.ntf_status) {
-        ERRARG("session");
-        return NC_MSG_ERROR;
-    } else if (!notif || !notif->tree || !notif->eventtime) {
-        ERRARG("notif");
-        return NC_MSG_ERROR;
+    hash = nc_accept_src_hash(addr);
+    for (src = server_opts.accept_filter.srcs[hash]; src; src = src->next) {
+        if (!memcmp(src->addr, addr, 16)) {
+            return src;
+        }
     }
 
-    /* we do not need RPC lock for this, IO lock will be acquired properly */
-    ret = nc_write_msg_io(session, timeout, NC_MSG_NOTIF, notif);
-    if (ret != NC_MSG_NOTIF) {
-        ERR("Session %u: failed to write notification (%s).", session->id, nc_msgtype2str[ret]);
+    if (server_opts.accept_filter.src_count >= NC_ACCEPT_SRC_MAX) {
+        nc_accept_src_prune(now);
+        if (server_opts.accept_filter.src_count >= NC_ACCEPT_SRC_MAX) {
+            return NULL;
+        }
     }
 
-    return ret;
+    src = calloc(1, sizeof *src);
+    if (!src) {
+        ERRMEM;
+        return NULL;
+    }
+    memcpy(src->addr, addr, 16);
+    nc_rate_bucket_init(&src->conns, server_opts.accept_filter.conn_rate, server_opts.accept_filter.conn_burst);
+    src->next = server_opts.accept_filter.srcs[hash];
+    server_opts.accept_filter.srcs[hash] = src;
+    ++server_opts.accept_filter.src_count;
+
+    return src;
 }
 
-/* must be called holding the session RPC lock! IO lock will be acquired as needed
- * returns: NC_PSPOLL_ERROR,
- *          NC_PSPOLL_ERROR | NC_PSPOLL_REPLY_ERROR,
- *          NC_PSPOLL_REPLY_ERROR,
- *          0
- */
+/* returns -1 if the connection should be dropped, 1 if it was counted to its source (src_addr is set), 0 otherwise */
 static int
-nc_server_send_reply_io(struct nc_session *session, int io_timeout, struct nc_server_rpc *rpc)
+nc_server_accept_filter(int sock, const char *host, uint8_t *src_addr)
 {
-    nc_rpc_clb clb;
-    struct nc_server_reply *reply;
-    struct lys_node *rpc_act = NULL;
-    struct lyd_node *next, *elem;
+    struct sockaddr_storage saddr;
+    socklen_t saddr_len = sizeof saddr;
+    struct nc_accept_src *src;
+    struct timespec ts_cur;
+    uint16_t i;
     int ret = 0;
-    NC_MSG_TYPE r;
 
-    if (!rpc) {
-        ERRINT;
-        return NC_PSPOLL_ERROR;
+    if (getpeername(sock, (struct sockaddr *)&saddr, &saddr_len) == -1) {
+        ERR("Getpeername failed (%s).", strerror(errno));
+        return -1;
     }
 
-    if (rpc->tree->schema->nodetype == LYS_RPC) {
-        /* RPC */
-        rpc_act = rpc->tree->schema;
+    if (saddr.ss_family == AF_INET) {
+        memset(src_addr, 0, 10);
+        memset(src_addr + 10, 0xff, 2);
+        memcpy(src_addr + 12, &((struct sockaddr_in *)&saddr)->sin_addr, 4);
+    } else if (saddr.ss_family == AF_INET6) {
+        memcpy(src_addr, &((struct sockaddr_in6 *)&saddr)->sin6_addr, 16);
     } else {
-        /* action */
-        LY_TREE_DFS_BEGIN(rpc->tree, next, elem) {
-            if (elem->schema->nodetype == LYS_ACTION) {
-                rpc_act = elem->schema;
-                break;
-            }
-            LY_TREE_DFS_END(rpc->tree, next, elem);
-        }
-        if (!rpc_act) {
-            ERRINT;
-            return NC_PSPOLL_ERROR;
-        }
+        /* UNIX sockets are not filtered */
+        return 0;
     }
 
-    if (!rpc_act->priv) {
-        if (!global_rpc_clb) {
-            /* no callback, reply with a not-implemented error */
-            reply = nc_server_reply_err(nc_err(NC_ERR_OP_NOT_SUPPORTED, NC_ERR_TYPE_PROT));
-        } else {
-          reply = global_rpc_clb(rpc->tree, session);
+    /* ACCEPT FILTER LOCK */
+    pthread_mutex_lock(&server_opts.accept_filter.lock);
+
+    /* longest prefix match */
+    for (i = 0; i < server_opts.accept_filter.rule_count; ++i) {
+        if (nc_accept_prefix_match(src_addr, server_opts.accept_filter.rules[i].addr,
+                                   server_opts.accept_filter.rules[i].prefix_len)) {
+            break;
         }
-    } else {
-        clb = (nc_rpc_clb)rpc_act->priv;
-        reply = clb(rpc->tree, session);
     }
-
-    if (!reply) {
-        reply = nc_server_reply_err(nc_err(NC_ERR_OP_FAILED, NC_ERR_TYPE_APP));
+    if ((i < server_opts.accept_filter.rule_count) && (server_opts.accept_filter.rules[i].action == NC_ACCEPT_DENY)) {
+        VRB("Connection from %s denied by the accept filter.", host ? host : "<unknown>");
+        ret = -1;
+        goto cleanup;
     }
-    r = nc_write_msg_io(session, io_timeout, NC_MSG_REPLY, rpc->root, reply);
-    if (reply->type == NC_RPL_ERROR) {
-        ret |= NC_PSPOLL_REPLY_ERROR;
+
+    if (!server_opts.accept_filter.conn_rate && !server_opts.accept_filter.max_sessions) {
+        /* no source limits */
+        goto cleanup;
     }
-    nc_server_reply_free(reply);
 
-    if (r != NC_MSG_REPLY) {
-        ERR("Session %u: failed to write reply (%s).", session->id, nc_msgtype2str[r]);
-        ret |= NC_PSPOLL_ERROR;
+    nc_gettimespec_mono(&ts_cur);
+    src = nc_accept_src_get(src_addr, &ts_cur);
+    if (!src) {
+        VRB("Too many connection sources, dropping a new connection from %s.", host ? host : "<unknown>");
+        ret = -1;
+        goto cleanup;
     }
 
-    /* special case if term_reason was set in callback, last reply was sent (needed for <close-session> if nothing else) */
-    if ((session->status == NC_STATUS_RUNNING) && (session->term_reason != NC_SESSION_TERM_NONE)) {
-        session->status = NC_STATUS_INVALID;
+    if (!nc_rate_bucket_check(&src->conns, 1, &ts_cur)) {
+        VRB("Connection rate of %s exceeded, dropping a new connection.", host ? host : "<unknown>");
+        ret = -1;
+        goto cleanup;
+    }
+    if (server_opts.accept_filter.max_sessions && (src->sessions >= server_opts.accept_filter.max_sessions)) {
+        VRB("Maximum number of connections from %s reached, dropping a new connection.", host ? host : "<unknown>");
+        ret = -1;
+        goto cleanup;
     }
 
-    return ret;
+    nc_rate_bucket_take(&src->conns, 1);
+    ++src->sessions;
+    ret = 1;
+
+cleanup:
+    /* ACCEPT FILTER UNLOCK */
+    pthread_mutex_unlock(&server_opts.accept_filter.lock);
+    return ret;
 }
 
-/* session must be running and session RPC lock held!
- * returns: NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR, (msg filled)
- *          NC_PSPOLL_ERROR, (msg filled)
- *          NC_PSPOLL_TIMEOUT,
- *          NC_PSPOLL_RPC (some application data available),
- *          NC_PSPOLL_SSH_CHANNEL,
- *          NC_PSPOLL_SSH_MSG
- */
-static int
-nc_ps_poll_session_io(struct nc_session *session, int io_timeout, time_t now_mono, char *msg)
+void
+nc_server_accept_src_release(const uint8_t *addr)
 {
-    struct pollfd pfd;
-    int r, ret = 0;
-#ifdef NC_ENABLED_SSH
-    struct nc_session *new;
-#endif
+    struct nc_accept_src *src = NULL;
 
-    /* check timeout first */
-    if (!(session->flags & NC_SESSION_CALLHOME) && !session->opts.server.ntf_status && server_opts.idle_timeout
-            && (now_mono >= session->opts.server.last_rpc + server_opts.idle_timeout)) {
-        sprintf(msg, "session idle timeout elapsed");
-        session->status = NC_STATUS_INVALID;
-        session->term_reason = NC_SESSION_TERM_TIMEOUT;
-        return NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
+    /* ACCEPT FILTER LOCK */
+    pthread_mutex_lock(&server_opts.accept_filter.lock);
+
+    if (server_opts.accept_filter.srcs) {
+        for (src = server_opts.accept_filter.srcs[nc_accept_src_hash(addr)]; src; src = src->next) {
+            if (!memcmp(src->addr, addr, 16)) {
+                break;
+            }
+        }
+    }
+    if (src && src->sessions) {
+        --src->sessions;
     }
 
-    r = nc_session_io_lock(session, io_timeout, __func__);
-    if (r < 0) {
-        sprintf(msg, "session IO lock failed to be acquired");
-        return NC_PSPOLL_ERROR;
-    } else if (!r) {
-        return NC_PSPOLL_TIMEOUT;
+    /* ACCEPT FILTER UNLOCK */
+    pthread_mutex_unlock(&server_opts.accept_filter.lock);
+}
+
+API NC_MSG_TYPE
+nc_accept_inout(int fdin, int fdout, const char *username, struct nc_session **session)
+{
+    NC_MSG_TYPE msgtype;
+    struct timespec ts_cur;
+
+    if (!server_opts.ctx) {
+        ERRINIT;
+        return NC_MSG_ERROR;
+    } else if (fdin < 0) {
+        ERRARG("fdin");
+        return NC_MSG_ERROR;
+    } else if (fdout < 0) {
+        ERRARG("fdout");
+        return NC_MSG_ERROR;
+    } else if (!username) {
+        ERRARG("username");
+        return NC_MSG_ERROR;
+    } else if (!session) {
+        ERRARG("session");
+        return NC_MSG_ERROR;
     }
 
-    switch (session->ti_type) {
-#ifdef NC_ENABLED_SSH
-    case NC_TI_LIBSSH:
-        r = ssh_channel_poll_timeout(session->ti.libssh.channel, 0, 0);
-        if (r == SSH_EOF) {
-            sprintf(msg, "SSH channel unexpected EOF");
-            session->status = NC_STATUS_INVALID;
-            session->term_reason = NC_SESSION_TERM_DROPPED;
-            ret = NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
-        } else if (r == SSH_ERROR) {
-            sprintf(msg, "SSH channel poll error (%s)", ssh_get_error(session->ti.libssh.session));
-            session->status = NC_STATUS_INVALID;
-            session->term_reason = NC_SESSION_TERM_OTHER;
-            ret = NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
-        } else if (!r) {
-            if (session->flags & NC_SESSION_SSH_NEW_MSG) {
-                /* new SSH message */
-                session->flags &= ~NC_SESSION_SSH_NEW_MSG;
-                if (session->ti.libssh.next) {
-                    for (new = session->ti.libssh.next; new != session; new = new->ti.libssh.next) {
-                        if ((new->status == NC_STATUS_STARTING) && new->ti.libssh.channel
-                                && (new->flags & NC_SESSION_SSH_SUBSYS_NETCONF)) {
-                            /* new NETCONF SSH channel */
-                            ret = NC_PSPOLL_SSH_CHANNEL;
-                            break;
-                        }
-                    }
-                    if (new != session) {
-                        break;
-                    }
-                }
+    /* prepare session structure */
+    *session = nc_new_session(NC_SERVER, 0);
+    if (!(*session)) {
+        ERRMEM;
+        return NC_MSG_ERROR;
+    }
+    (*session)->status = NC_STATUS_STARTING;
 
-                /* just some SSH message */
-                ret = NC_PSPOLL_SSH_MSG;
-            } else {
-                ret = NC_PSPOLL_TIMEOUT;
-            }
-        } else {
-            /* we have some application data */
-            ret = NC_PSPOLL_RPC;
-        }
-        break;
-#endif
-#ifdef NC_ENABLED_TLS
-    case NC_TI_OPENSSL:
-        r = SSL_pending(session->ti.tls);
-        if (!r) {
-            /* no data pending in the SSL buffer, poll fd */
-            pfd.fd = SSL_get_rfd(session->ti.tls);
-            if (pfd.fd < 0) {
-                sprintf(msg, "internal error (%s:%d)", __FILE__, __LINE__);
-                ret = NC_PSPOLL_ERROR;
-                break;
-            }
-            pfd.events = POLLIN;
-            pfd.revents = 0;
-            r = poll(&pfd, 1, 0);
+    /* transport specific data */
+    (*session)->ti_type = NC_TI_FD;
+    (*session)->ti.fd.in = fdin;
+    (*session)->ti.fd.out = fdout;
 
-            if ((r < 0) && (errno != EINTR)) {
-                sprintf(msg, "poll failed (%s)", strerror(errno));
-                session->status = NC_STATUS_INVALID;
-                ret = NC_PSPOLL_ERROR;
-            } else if (r > 0) {
-                if (pfd.revents & (POLLHUP | POLLNVAL)) {
-                    sprintf(msg, "communication socket unexpectedly closed");
-                    session->status = NC_STATUS_INVALID;
-                    session->term_reason = NC_SESSION_TERM_DROPPED;
-                    ret = NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
-                } else if (pfd.revents & POLLERR) {
-                    sprintf(msg, "communication socket error");
-                    session->status = NC_STATUS_INVALID;
-                    session->term_reason = NC_SESSION_TERM_OTHER;
-                    ret = NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
-                } else {
-                    ret = NC_PSPOLL_RPC;
-                }
-            } else {
-                ret = NC_PSPOLL_TIMEOUT;
-            }
-        } else {
-            ret = NC_PSPOLL_RPC;
-        }
-        break;
-#endif
-    case NC_TI_FD:
-    case NC_TI_UNIX:
-        pfd.fd = (session->ti_type == NC_TI_FD) ? session->ti.fd.in : session->ti.unixsock.sock;
-        pfd.events = POLLIN;
-        pfd.revents = 0;
-        r = poll(&pfd, 1, 0);
+    /* assign context (dicionary needed for handshake) */
+    (*session)->flags = NC_SESSION_SHAREDCTX;
+    (*session)->ctx = server_opts.ctx;
 
-        if ((r < 0) && (errno != EINTR)) {
-            sprintf(msg, "poll failed (%s)", strerror(errno));
-            session->status = NC_STATUS_INVALID;
-            ret = NC_PSPOLL_ERROR;
-        } else if (r > 0) {
-            if (pfd.revents & (POLLHUP | POLLNVAL)) {
-                sprintf(msg, "communication socket unexpectedly closed");
-                session->status = NC_STATUS_INVALID;
-                session->term_reason = NC_SESSION_TERM_DROPPED;
-                ret = NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
-            } else if (pfd.revents & POLLERR) {
-                sprintf(msg, "communication socket error");
-                session->status = NC_STATUS_INVALID;
-                session->term_reason = NC_SESSION_TERM_OTHER;
-                ret = NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
+    /* assign new SID atomically */
+    (*session)->id = ATOMIC_INC(&server_opts.new_session_id);
+
+    /* NETCONF handshake */
+    msgtype = nc_handshake_io(*session);
+    if (msgtype != NC_MSG_HELLO) {
+        nc_session_free(*session, NULL);
+        *session = NULL;
+        return msgtype;
+    }
+
+    nc_gettimespec_mono(&ts_cur);
+    (*session)->opts.server.last_rpc = ts_cur.tv_sec;
+    nc_gettimespec_real(&ts_cur);
+    (*session)->opts.server.session_start = ts_cur.tv_sec;
+
+    (*session)->status = NC_STATUS_RUNNING;
+
+    return msgtype;
+}
+
+static void
+nc_ps_queue_add_id(struct nc_pollsession *ps, uint8_t *id)
+{
+    uint8_t q_last;
+
+    if (ps->queue_len == NC_PS_QUEUE_SIZE) {
+        ERRINT;
+        return;
+    }
+
+    /* get a unique queue value (by adding 1 to the last added value, if any) */
+    if (ps->queue_len) {
+        q_last = (ps->queue_begin + ps->queue_len - 1) % NC_PS_QUEUE_SIZE;
+        *id = ps->queue[q_last] + 1;
+    } else {
+        *id = 0;
+    }
+
+    /* add the id into the queue */
+    ++ps->queue_len;
+    q_last = (ps->queue_begin + ps->queue_len - 1) % NC_PS_QUEUE_SIZE;
+    ps->queue[q_last] = *id;
+    ATOMIC_INC(&server_opts.ps_queued);
+}
+
+static void
+nc_ps_queue_remove_id(struct nc_pollsession *ps, uint8_t id)
+{
+    uint8_t i, q_idx, found = 0;
+
+    for (i = 0; i < ps->queue_len; ++i) {
+        /* get the actual queue idx */
+        q_idx = (ps->queue_begin + i) % NC_PS_QUEUE_SIZE;
+
+        if (found) {
+            if (ps->queue[q_idx] == id) {
+                /* another equal value, simply cannot be */
+                ERRINT;
+            }
+            if (found == 2) {
+                /* move the following values */
+                ps->queue[q_idx ? q_idx - 1 : NC_PS_QUEUE_SIZE - 1] = ps->queue[q_idx];
+            }
+        } else if (ps->queue[q_idx] == id) {
+            /* found our id, there can be no more equal valid values */
+            if (i == 0) {
+                found = 1;
             } else {
-                ret = NC_PSPOLL_RPC;
+                /* this is not okay, our id is in the middle of the queue */
+                found = 2;
             }
-        } else {
-            ret = NC_PSPOLL_TIMEOUT;
         }
-        break;
-    case NC_TI_NONE:
-        sprintf(msg, "internal error (%s:%d)", __FILE__, __LINE__);
-        ret = NC_PSPOLL_ERROR;
-        break;
     }
+    if (!found) {
+        ERRINT;
+        return;
+    }
+
+    --ps->queue_len;
+    ATOMIC_DEC(&server_opts.ps_queued);
+    if (found == 1) {
+        /* remove the id by moving the queue, otherwise all the values in the queue were moved */
+        ps->queue_begin = (ps->queue_begin + 1) % NC_PS_QUEUE_SIZE;
+    }
+}
+
+int
+nc_ps_lock(struct nc_pollsession *ps, uint8_t *id, const char *func)
+{
+    int ret;
+    struct timespec ts;
+
+    nc_gettimespec_real(&ts);
+    nc_addtimespec(&ts, NC_PS_LOCK_TIMEOUT);
+
+    /* LOCK */
+    ret = pthread_mutex_timedlock(&ps->lock, &ts);
+    if (ret) {
+        ERR("%s: failed to lock a pollsession (%s).", func, strerror(ret));
+        return -1;
+    }
+
+    /* check that the queue is long enough */
+    if (ps->queue_len == NC_PS_QUEUE_SIZE) {
+        ERR("%s: pollsession queue size (%d) too small.", func, NC_PS_QUEUE_SIZE);
+        pthread_mutex_unlock(&ps->lock);
+        return -1;
+    }
+
+    /* add ourselves into the queue */
+    nc_ps_queue_add_id(ps, id);
+    DBL("PS 0x%p TID %lu queue: added %u, head %u, lenght %u", ps, (long unsigned int)pthread_self(), *id,
+            ps->queue[ps->queue_begin], ps->queue_len);
+
+    /* is it our turn? */
+    while (ps->queue[ps->queue_begin] != *id) {
+        nc_gettimespec_real(&ts);
+        nc_addtimespec(&ts, NC_PS_QUEUE_TIMEOUT);
+
+        ret = pthread_cond_timedwait(&ps->cond, &ps->lock, &ts);
+        if (ret) {
+            /**
+             * This may happen when another thread releases the lock and broadcasts the condition
+             * and this thread had already timed out. When this thread is scheduled, it returns timed out error
+             * but when actually this thread was ready for condition.
+             */
+            if ((ETIMEDOUT == ret) && (ps->queue[ps->queue_begin] == *id)) {
+                break;
+            }
+
+            ERR("%s: failed to wait for a pollsession condition (%s).", func, strerror(ret));
+            /* remove ourselves from the queue */
+            nc_ps_queue_remove_id(ps, *id);
+            pthread_mutex_unlock(&ps->lock);
+            return -1;
+        }
+    }
+
+    /* UNLOCK */
+    pthread_mutex_unlock(&ps->lock);
+
+    return 0;
+}
+
+int
+nc_ps_unlock(struct nc_pollsession *ps, uint8_t id, const char *func)
+{
+    int ret;
+    struct timespec ts;
+
+    nc_gettimespec_real(&ts);
+    nc_addtimespec(&ts, NC_PS_LOCK_TIMEOUT);
+
+    /* LOCK */
+    ret = pthread_mutex_timedlock(&ps->lock, &ts);
+    if (ret) {
+        ERR("%s: failed to lock a pollsession (%s).", func, strerror(ret));
+        ret = -1;
+    }
+
+    /* we must be the first, it was our turn after all, right? */
+    if (ps->queue[ps->queue_begin] != id) {
+        ERRINT;
+        /* UNLOCK */
+        if (!ret) {
+            pthread_mutex_unlock(&ps->lock);
+        }
+        return -1;
+    }
+
+    /* remove ourselves from the queue */
+    nc_ps_queue_remove_id(ps, id);
+    DBL("PS 0x%p TID %lu queue: removed %u, head %u, lenght %u", ps, (long unsigned int)pthread_self(), id,
+            ps->queue[ps->queue_begin], ps->queue_len);
+
+    /* broadcast to all other threads that the queue moved */
+    pthread_cond_broadcast(&ps->cond);
+
+    /* UNLOCK */
+    if (!ret) {
+        pthread_mutex_unlock(&ps->lock);
+    }
+
+    return ret;
+}
+
+API struct nc_pollsession *
+nc_ps_new(void)
+{
+    struct nc_pollsession *ps;
+
+    ps = calloc(1, sizeof(struct nc_pollsession));
+    if (!ps) {
+        ERRMEM;
+        return NULL;
+    }
+    pthread_cond_init(&ps->cond, NULL);
+    pthread_mutex_init(&ps->lock, NULL);
+
+    return ps;
+}
+
+API void
+nc_ps_free(struct nc_pollsession *ps)
+{
+    uint16_t i;
+
+    if (!ps) {
+        return;
+    }
+
+    if (ps->queue_len) {
+        ERR("FATAL: Freeing a pollsession structure that is currently being worked with!");
+    }
+
+    for (i = 0; i < ps->session_count; i++) {
+        free(ps->sessions[i]);
+    }
+
+    free(ps->sessions);
+    pthread_mutex_destroy(&ps->lock);
+    pthread_cond_destroy(&ps->cond);
+
+    free(ps);
+}
+
+API int
+nc_ps_add_session(struct nc_pollsession *ps, struct nc_session *session)
+{
+    uint8_t q_id;
+
+    if (!ps) {
+        ERRARG("ps");
+        return -1;
+    } else if (!session) {
+        ERRARG("session");
+        return -1;
+    }
+
+    /* LOCK */
+    if (nc_ps_lock(ps, &q_id, __func__)) {
+        return -1;
+    }
+
+    ++ps->session_count;
+    ps->sessions = nc_realloc(ps->sessions, ps->session_count * sizeof *ps->sessions);
+    if (!ps->sessions) {
+        ERRMEM;
+        /* UNLOCK */
+        nc_ps_unlock(ps, q_id, __func__);
+        return -1;
+    }
+    ps->sessions[ps->session_count - 1] = calloc(1, sizeof **ps->sessions);
+    if (!ps->sessions[ps->session_count - 1]) {
+        ERRMEM;
+        --ps->session_count;
+        /* UNLOCK */
+        nc_ps_unlock(ps, q_id, __func__);
+        return -1;
+    }
+    ps->sessions[ps->session_count - 1]->session = session;
+    ps->sessions[ps->session_count - 1]->state = NC_PS_STATE_NONE;
+
+    /* UNLOCK */
+    return nc_ps_unlock(ps, q_id, __func__);
+}
+
+static int
+_nc_ps_del_session(struct nc_pollsession *ps, struct nc_session *session, int index)
+{
+    uint16_t i;
+
+    if (index >= 0) {
+        i = (uint16_t)index;
+        goto remove;
+    }
+    for (i = 0; i < ps->session_count; ++i) {
+        if (ps->sessions[i]->session == session) {
+remove:
+            --ps->session_count;
+            if (i <= ps->session_count) {
+                free(ps->sessions[i]);
+                ps->sessions[i] = ps->sessions[ps->session_count];
+            }
+            if (!ps->session_count) {
+                free(ps->sessions);
+                ps->sessions = NULL;
+            }
+            ps->last_event_session = 0;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+API int
+nc_ps_del_session(struct nc_pollsession *ps, struct nc_session *session)
+{
+    uint8_t q_id;
+    int ret, ret2;
+
+    if (!ps) {
+        ERRARG("ps");
+        return -1;
+    } else if (!session) {
+        ERRARG("session");
+        return -1;
+    }
+
+    /* LOCK */
+    if (nc_ps_lock(ps, &q_id, __func__)) {
+        return -1;
+    }
+
+    ret = _nc_ps_del_session(ps, session, -1);
+
+    /* UNLOCK */
+    ret2 = nc_ps_unlock(ps, q_id, __func__);
+
+    return (ret || ret2 ? -1 : 0);
+}
+
+API struct nc_session *
+nc_ps_get_session(const struct nc_pollsession *ps, uint16_t idx)
+{
+    uint8_t q_id;
+    struct nc_session *ret = NULL;
+
+    if (!ps) {
+        ERRARG("ps");
+        return NULL;
+    }
+
+    /* LOCK */
+    if (nc_ps_lock((struct nc_pollsession *)ps, &q_id, __func__)) {
+        return NULL;
+    }
+
+    if (idx < ps->session_count) {
+        ret = ps->sessions[idx]->session;
+    }
+
+    /* UNLOCK */
+    nc_ps_unlock((struct nc_pollsession *)ps, q_id, __func__);
+
+    return ret;
+}
+
+API uint16_t
+nc_ps_session_count(struct nc_pollsession *ps)
+{
+    uint8_t q_id;
+    uint16_t session_count;
+
+    if (!ps) {
+        ERRARG("ps");
+        return 0;
+    }
+
+    /* LOCK (just for memory barrier so that we read the current value) */
+    if (nc_ps_lock((struct nc_pollsession *)ps, &q_id, __func__)) {
+        return 0;
+    }
+
+    session_count = ps->session_count;
+
+    /* UNLOCK */
+    nc_ps_unlock((struct nc_pollsession *)ps, q_id, __func__);
+
+    return session_count;
+}
+
+/* returns the RPC or action schema node of a parsed operation, NULL if there is none */
+static struct lys_node *
+nc_server_rpc_get_op(struct lyd_node *tree)
+{
+    struct lyd_node *node = tree;
+
+    /* an action tree is just the path to the action with list keys, so descend
+     * into the only container or list on every level, never into the action input */
+    while (node) {
+        if (node->schema->nodetype & (LYS_RPC | LYS_ACTION)) {
+            return node->schema;
+        } else if (node->schema->nodetype & (LYS_CONTAINER | LYS_LIST)) {
+            node = node->child;
+        } else {
+            node = node->next;
+        }
+    }
+
+    return NULL;
+}
+
+/* should be called holding the session RPC lock!
+ * returns: 1 if the last received message fits into all the rate limits, 0 otherwise */
+static int
+nc_server_rate_check(struct nc_session *session)
+{
+    struct timespec ts_cur;
+    struct nc_user_rate *user_rate = NULL;
+    uint64_t len = session->opts.server.last_msg_len;
+    uint16_t i;
+    int ret;
+
+    nc_gettimespec_mono(&ts_cur);
+
+    /* session limits */
+    if (!nc_rate_bucket_check(&session->opts.server.rpc_bucket, 1, &ts_cur)
+            || !nc_rate_bucket_check(&session->opts.server.byte_bucket, len, &ts_cur)) {
+        return 0;
+    }
+
+    /* USER RATE LOCK */
+    pthread_mutex_lock(&server_opts.user_rate_lock);
+
+    /* user limits */
+    if (session->username) {
+        for (i = 0; i < server_opts.user_rate_count; ++i) {
+            if (!strcmp(server_opts.user_rates[i].username, session->username)) {
+                user_rate = &server_opts.user_rates[i];
+                break;
+            }
+        }
+    }
+    if (user_rate && (!nc_rate_bucket_check(&user_rate->rpcs, 1, &ts_cur)
+            || !nc_rate_bucket_check(&user_rate->bytes, len, &ts_cur))) {
+        ret = 0;
+    } else {
+        /* all the limits passed, consume the tokens */
+        if (user_rate) {
+            nc_rate_bucket_take(&user_rate->rpcs, 1);
+            nc_rate_bucket_take(&user_rate->bytes, len);
+        }
+        nc_rate_bucket_take(&session->opts.server.rpc_bucket, 1);
+        nc_rate_bucket_take(&session->opts.server.byte_bucket, len);
+        ret = 1;
+    }
+
+    /* USER RATE UNLOCK */
+    pthread_mutex_unlock(&server_opts.user_rate_lock);
+
+    return ret;
+}
+
+/* should be called holding the session RPC lock! IO lock will be acquired as needed
+ * returns: NC_PSPOLL_ERROR,
+ *          NC_PSPOLL_BAD_RPC,
+ *          NC_PSPOLL_BAD_RPC | NC_PSPOLL_REPLY_ERROR,
+ *          NC_PSPOLL_RPC
+ */
+static int
+nc_server_recv_rpc_io(struct nc_session *session, int io_timeout, struct nc_server_rpc **rpc)
+{
+    struct lyxml_elem *xml = NULL;
+    char *str = NULL;
+    NC_MSG_TYPE msgtype;
+    struct nc_server_reply *reply = NULL;
+    int ret;
+
+    if (!session) {
+        ERRARG("session");
+        return NC_PSPOLL_ERROR;
+    } else if (!rpc) {
+        ERRARG("rpc");
+        return NC_PSPOLL_ERROR;
+    } else if ((session->status != NC_STATUS_RUNNING) || (session->side != NC_SERVER)) {
+        ERR("Session %u: invalid session to receive RPCs.", session->id);
+        return NC_PSPOLL_ERROR;
+    }
+
+    /* only the root element is checked, other messages are rejected without parsing them */
+    msgtype = nc_read_msg_str_io(session, io_timeout, &str, NULL, 0);
+
+    switch (msgtype) {
+    case NC_MSG_RPC:
+        msgtype = nc_parse_msg(session, io_timeout, str, &xml);
+        str = NULL;
+        if (msgtype == NC_MSG_ERROR) {
+            /* error printed, malformed reply sent */
+            ret = NC_PSPOLL_ERROR;
+            break;
+        } else if (msgtype != NC_MSG_RPC) {
+            /* the parsed root element is not the sniffed one */
+            ERR("Session %u: received %s instead of an RPC.", session->id, nc_msgtype2str[msgtype]);
+            nc_msg_malformed(session, io_timeout);
+            goto error;
+        }
+
+        *rpc = calloc(1, sizeof **rpc);
+        if (!*rpc) {
+            ERRMEM;
+            goto error;
+        }
+
+        /* keep only the envelope needed for the reply, the operation is freed while being parsed */
+        if (xml->ns->prefix) {
+            (*rpc)->prefix = lydict_insert(server_opts.ctx, xml->ns->prefix, 0);
+        }
+        if (lyxml_print_mem(&(*rpc)->attrs, xml, LYXML_PRINT_ATTRS) < 0) {
+            ERRMEM;
+            nc_server_rpc_free(*rpc, server_opts.ctx);
+            *rpc = NULL;
+            goto error;
+        }
+
+        /* over the limit or overloaded, reject the RPC before parsing it */
+        if (!nc_server_rate_check(session)) {
+            VRB("Session %u: rate limit exceeded, RPC denied.", session->id);
+            reply = nc_server_reply_err(nc_err(NC_ERR_RES_DENIED, NC_ERR_TYPE_PROT));
+        } else if (nc_server_load_shed_op(xml->child)) {
+            VRB("Session %u: server overloaded, RPC denied.", session->id);
+            reply = nc_server_reply_err(nc_err(NC_ERR_RES_DENIED, NC_ERR_TYPE_APP));
+        }
+        if (reply) {
+            ret = nc_write_msg_io(session, io_timeout, NC_MSG_REPLY, (*rpc)->prefix, (*rpc)->attrs, reply);
+            nc_server_reply_free(reply);
+            if (ret != NC_MSG_REPLY) {
+                ERR("Session %u: failed to write reply (%s).", session->id, nc_msgtype2str[ret]);
+            }
+            ret = NC_PSPOLL_REPLY_ERROR | NC_PSPOLL_BAD_RPC;
+            lyxml_free(server_opts.ctx, xml);
+            break;
+        }
+
+        ly_errno = LY_SUCCESS;
+        (*rpc)->tree = lyd_parse_xml(server_opts.ctx, &xml->child,
+                                     LYD_OPT_RPC | LYD_OPT_DESTRUCT | LYD_OPT_NOEXTDEPS | LYD_OPT_STRICT, NULL);
+        lyxml_free(server_opts.ctx, xml);
+        if (!(*rpc)->tree) {
+            /* parsing RPC failed */
+            reply = nc_server_reply_err(nc_err_libyang(server_opts.ctx));
+            ret = nc_write_msg_io(session, io_timeout, NC_MSG_REPLY, (*rpc)->prefix, (*rpc)->attrs, reply);
+            nc_server_reply_free(reply);
+            if (ret != NC_MSG_REPLY) {
+                ERR("Session %u: failed to write reply (%s).", session->id, nc_msgtype2str[ret]);
+            }
+            ret = NC_PSPOLL_REPLY_ERROR | NC_PSPOLL_BAD_RPC;
+        } else {
+            /* remember the operation so that it need not be searched for when dispatching */
+            (*rpc)->op = nc_server_rpc_get_op((*rpc)->tree);
+            ret = NC_PSPOLL_RPC;
+        }
+        break;
+    case NC_MSG_HELLO:
+        ERR("Session %u: received another <hello> message.", session->id);
+        ret = NC_PSPOLL_BAD_RPC;
+        goto error;
+    case NC_MSG_REPLY:
+        ERR("Session %u: received <rpc-reply> from a NETCONF client.", session->id);
+        ret = NC_PSPOLL_BAD_RPC;
+        goto error;
+    case NC_MSG_NOTIF:
+        ERR("Session %u: received <notification> from a NETCONF client.", session->id);
+        ret = NC_PSPOLL_BAD_RPC;
+        goto error;
+    default:
+        /* NC_MSG_ERROR,
+         * NC_MSG_WOULDBLOCK and NC_MSG_NONE is not returned by nc_read_msg_str_io()
+         */
+        ret = NC_PSPOLL_ERROR;
+        break;
+    }
+
+    return ret;
+
+error:
+    /* cleanup */
+    free(str);
+    lyxml_free(server_opts.ctx, xml);
+
+    return NC_PSPOLL_ERROR;
+}
+
+API void
+nc_set_global_rpc_clb(nc_rpc_clb clb)
+{
+    global_rpc_clb = clb;
+}
+
+API NC_MSG_TYPE
+nc_server_notif_send(struct nc_session *session, struct nc_server_notif *notif, int timeout)
+{
+    NC_MSG_TYPE ret;
+
+    /* check parameters */
+    if (!session || (session->side != NC_SERVER) || !session->opts.server.ntf_status) {
+        ERRARG("session");
+        return NC_MSG_ERROR;
+    } else if (!notif || !notif->tree || !notif->eventtime) {
+        ERRARG("notif");
+        return NC_MSG_ERROR;
+    }
+
+    /* we do not need RPC lock for this, IO lock will be acquired properly */
+    ret = nc_write_msg_io(session, timeout, NC_MSG_NOTIF, notif);
+    if (ret != NC_MSG_NOTIF) {
+        ERR("Session %u: failed to write notification (%s).", session->id, nc_msgtype2str[ret]);
+    }
+
+    return ret;
+}
+
+/* must be called holding the session RPC lock! IO lock will be acquired as needed
+ * returns: NC_PSPOLL_ERROR,
+ *          NC_PSPOLL_ERROR | NC_PSPOLL_REPLY_ERROR,
+ *          NC_PSPOLL_REPLY_ERROR,
+ *          0
+ */
+static int
+nc_server_send_reply_io(struct nc_session *session, int io_timeout, struct nc_server_rpc *rpc)
+{
+    nc_rpc_clb clb;
+    struct nc_server_reply *reply;
+    struct lys_node *rpc_act;
+    int ret = 0;
+    NC_MSG_TYPE r;
+
+    if (!rpc || !rpc->op) {
+        ERRINT;
+        return NC_PSPOLL_ERROR;
+    }
+
+    /* RPC or action found when the RPC was parsed */
+    rpc_act = rpc->op;
+
+    if (nc_server_load_shed_rpc(session, rpc->tree)) {
+        VRB("Session %u: server overloaded, RPC denied.", session->id);
+        reply = nc_server_reply_err(nc_err(NC_ERR_RES_DENIED, NC_ERR_TYPE_APP));
+    } else if (!rpc_act->priv) {
+        if (!global_rpc_clb) {
+            /* no callback, reply with a not-implemented error */
+            reply = nc_server_reply_err(nc_err(NC_ERR_OP_NOT_SUPPORTED, NC_ERR_TYPE_PROT));
+        } else {
+          reply = global_rpc_clb(rpc->tree, session);
+        }
+    } else {
+        clb = (nc_rpc_clb)rpc_act->priv;
+        reply = clb(rpc->tree, session);
+    }
+
+    if (!reply) {
+        reply = nc_server_reply_err(nc_err(NC_ERR_OP_FAILED, NC_ERR_TYPE_APP));
+    }
+    r = nc_write_msg_io(session, io_timeout, NC_MSG_REPLY, rpc->prefix, rpc->attrs, reply);
+    if (reply->type == NC_RPL_ERROR) {
+        ret |= NC_PSPOLL_REPLY_ERROR;
+    }
+    nc_server_reply_free(reply);
+
+    if (r != NC_MSG_REPLY) {
+        ERR("Session %u: failed to write reply (%s).", session->id, nc_msgtype2str[r]);
+        ret |= NC_PSPOLL_ERROR;
+    }
+
+    /* special case if term_reason was set in callback, last reply was sent (needed for <close-session> if nothing else) */
+    if ((session->status == NC_STATUS_RUNNING) && (session->term_reason != NC_SESSION_TERM_NONE)) {
+        session->status = NC_STATUS_INVALID;
+    }
+
+    return ret;
+}
+
+/* release the input buffers of an idle session, session IO lock (and input lock) held */
+static void
+nc_ps_session_release_buffers(struct nc_session *session)
+{
+    switch (session->ti_type) {
+#ifdef NC_ENABLED_SSH
+    case NC_TI_LIBSSH:
+        if (!session->ti.libssh.in_len) {
+            free(session->ti.libssh.in_buf);
+            session->ti.libssh.in_buf = NULL;
+        }
+        break;
+#endif
+#if defined(NC_ENABLED_TLS) && (OPENSSL_VERSION_NUMBER >= 0x10101000L) // >= 1.1.1
+    case NC_TI_OPENSSL:
+        /* fails if some data are pending */
+        SSL_free_buffers(session->ti.tls);
+        break;
+#endif
+    default:
+        break;
+    }
+}
+
+/* session must be running and session RPC lock held!
+ * returns: NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR, (msg filled)
+ *          NC_PSPOLL_ERROR, (msg filled)
+ *          NC_PSPOLL_TIMEOUT,
+ *          NC_PSPOLL_RPC (some application data available),
+ *          NC_PSPOLL_SSH_CHANNEL,
+ *          NC_PSPOLL_SSH_MSG
+ */
+static int
+nc_ps_poll_session_io(struct nc_session *session, int io_timeout, time_t now_mono, char *msg)
+{
+    struct pollfd pfd;
+    int r, ret = 0;
+#ifdef NC_ENABLED_SSH
+    struct nc_session *new;
+#endif
+
+    /* check timeout first */
+    if (!(session->flags & NC_SESSION_CALLHOME) && !session->opts.server.ntf_status && server_opts.idle_timeout
+            && (now_mono >= session->opts.server.last_rpc + server_opts.idle_timeout)) {
+        sprintf(msg, "session idle timeout elapsed");
+        session->status = NC_STATUS_INVALID;
+        session->term_reason = NC_SESSION_TERM_TIMEOUT;
+        return NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
+    }
+
+#ifdef NC_ENABLED_SSH
+    if (session->ti_type == NC_TI_LIBSSH) {
+        /* the channel input buffer is filled by the readers of this session, always locked before the IO lock */
+        r = nc_session_in_lock(session, io_timeout, __func__);
+        if (r < 0) {
+            sprintf(msg, "session input lock failed to be acquired");
+            return NC_PSPOLL_ERROR;
+        } else if (!r) {
+            return NC_PSPOLL_TIMEOUT;
+        }
+    }
+#endif
+
+    r = nc_session_io_lock(session, io_timeout, __func__);
+    if (r < 0) {
+        sprintf(msg, "session IO lock failed to be acquired");
+        ret = NC_PSPOLL_ERROR;
+        goto in_unlock;
+    } else if (!r) {
+        ret = NC_PSPOLL_TIMEOUT;
+        goto in_unlock;
+    }
+
+    switch (session->ti_type) {
+#ifdef NC_ENABLED_SSH
+    case NC_TI_LIBSSH:
+        if (session->ti.libssh.in_len) {
+            /* some data already read from the SSH session for this channel */
+            ret = NC_PSPOLL_RPC;
+            break;
+        }
+
+        r = ssh_channel_poll_timeout(session->ti.libssh.channel, 0, 0);
+        if (r == SSH_EOF) {
+            sprintf(msg, "SSH channel unexpected EOF");
+            session->status = NC_STATUS_INVALID;
+            session->term_reason = NC_SESSION_TERM_DROPPED;
+            ret = NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
+        } else if (r == SSH_ERROR) {
+            sprintf(msg, "SSH channel poll error (%s)", ssh_get_error(session->ti.libssh.session));
+            session->status = NC_STATUS_INVALID;
+            session->term_reason = NC_SESSION_TERM_OTHER;
+            ret = NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
+        } else if (!r) {
+            if (session->flags & NC_SESSION_SSH_NEW_MSG) {
+                /* new SSH message */
+                session->flags &= ~NC_SESSION_SSH_NEW_MSG;
+                if (session->ti.libssh.next) {
+                    for (new = session->ti.libssh.next; new != session; new = new->ti.libssh.next) {
+                        if ((new->status == NC_STATUS_STARTING) && new->ti.libssh.channel
+                                && (new->flags & NC_SESSION_SSH_SUBSYS_NETCONF)) {
+                            /* new NETCONF SSH channel */
+                            ret = NC_PSPOLL_SSH_CHANNEL;
+                            break;
+                        }
+                    }
+                    if (new != session) {
+                        break;
+                    }
+                }
+
+                /* just some SSH message */
+                ret = NC_PSPOLL_SSH_MSG;
+            } else {
+                ret = NC_PSPOLL_TIMEOUT;
+            }
+        } else {
+            /* we have some application data */
+            ret = NC_PSPOLL_RPC;
+        }
+        break;
+#endif
+#ifdef NC_ENABLED_TLS
+    case NC_TI_OPENSSL:
+        r = SSL_pending(session->ti.tls);
+        if (!r) {
+            /* no data pending in the SSL buffer, poll fd */
+            pfd.fd = SSL_get_rfd(session->ti.tls);
+            if (pfd.fd < 0) {
+                sprintf(msg, "internal error (%s:%d)", __FILE__, __LINE__);
+                ret = NC_PSPOLL_ERROR;
+                break;
+            }
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            r = poll(&pfd, 1, 0);
+
+            if ((r < 0) && (errno != EINTR)) {
+                sprintf(msg, "poll failed (%s)", strerror(errno));
+                session->status = NC_STATUS_INVALID;
+                ret = NC_PSPOLL_ERROR;
+            } else if (r > 0) {
+                if (pfd.revents & (POLLHUP | POLLNVAL)) {
+                    sprintf(msg, "communication socket unexpectedly closed");
+                    session->status = NC_STATUS_INVALID;
+                    session->term_reason = NC_SESSION_TERM_DROPPED;
+                    ret = NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
+                } else if (pfd.revents & POLLERR) {
+                    sprintf(msg, "communication socket error");
+                    session->status = NC_STATUS_INVALID;
+                    session->term_reason = NC_SESSION_TERM_OTHER;
+                    ret = NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
+                } else {
+                    ret = NC_PSPOLL_RPC;
+                }
+            } else {
+                ret = NC_PSPOLL_TIMEOUT;
+            }
+        } else {
+            ret = NC_PSPOLL_RPC;
+        }
+        break;
+#endif
+    case NC_TI_FD:
+    case NC_TI_UNIX:
+        pfd.fd = (session->ti_type == NC_TI_FD) ? session->ti.fd.in : session->ti.unixsock.sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        r = poll(&pfd, 1, 0);
+
+        if ((r < 0) && (errno != EINTR)) {
+            sprintf(msg, "poll failed (%s)", strerror(errno));
+            session->status = NC_STATUS_INVALID;
+            ret = NC_PSPOLL_ERROR;
+        } else if (r > 0) {
+            if (pfd.revents & (POLLHUP | POLLNVAL)) {
+                sprintf(msg, "communication socket unexpectedly closed");
+                session->status = NC_STATUS_INVALID;
+                session->term_reason = NC_SESSION_TERM_DROPPED;
+                ret = NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
+            } else if (pfd.revents & POLLERR) {
+                sprintf(msg, "communication socket error");
+                session->status = NC_STATUS_INVALID;
+                session->term_reason = NC_SESSION_TERM_OTHER;
+                ret = NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
+            } else {
+                ret = NC_PSPOLL_RPC;
+            }
+        } else {
+            ret = NC_PSPOLL_TIMEOUT;
+        }
+        break;
+    case NC_TI_NONE:
+        sprintf(msg, "internal error (%s:%d)", __FILE__, __LINE__);
+        ret = NC_PSPOLL_ERROR;
+        break;
+    }
+
+    if ((ret == NC_PSPOLL_TIMEOUT) && !session->opts.server.ntf_status
+            && (now_mono >= session->opts.server.last_rpc + NC_SESSION_IDLE_BUF_TIMEOUT)) {
+        /* idle session, the buffers are allocated again once some data arrive */
+        nc_ps_session_release_buffers(session);
+    }
+
+    nc_session_io_unlock(session, __func__);
+
+in_unlock:
+#ifdef NC_ENABLED_SSH
+    if (session->ti_type == NC_TI_LIBSSH) {
+        nc_session_in_unlock(session, __func__);
+    }
+#endif
+    return ret;
+}
+
+API int
+nc_ps_poll(struct nc_pollsession *ps, int timeout, struct nc_session **session)
+{
+    int ret, r;
+    uint8_t q_id;
+    uint16_t i, j;
+    char msg[256];
+    struct timespec ts_timeout, ts_cur, ts_rpc;
+    struct nc_session *cur_session;
+    struct nc_ps_session *cur_ps_session;
+    struct nc_server_rpc *rpc = NULL;
+
+    if (!ps) {
+        ERRARG("ps");
+        return NC_PSPOLL_ERROR;
+    }
+
+    /* PS LOCK */
+    if (nc_ps_lock(ps, &q_id, __func__)) {
+        return NC_PSPOLL_ERROR;
+    }
+
+    if (!ps->session_count) {
+        nc_ps_unlock(ps, q_id, __func__);
+        return NC_PSPOLL_NOSESSIONS;
+    }
+
+    /* fill timespecs */
+    nc_gettimespec_mono(&ts_cur);
+    if (timeout > -1) {
+        nc_gettimespec_mono(&ts_timeout);
+        nc_addtimespec(&ts_timeout, timeout);
+    }
+
+    /* poll all the sessions one-by-one */
+    do {
+        /* loop from i to j once (all sessions) */
+        if (ps->last_event_session == ps->session_count - 1) {
+            i = j = 0;
+        } else {
+            i = j = ps->last_event_session + 1;
+        }
+        do {
+            cur_ps_session = ps->sessions[i];
+            cur_session = cur_ps_session->session;
+
+            /* SESSION RPC LOCK */
+            r = nc_session_rpc_lock(cur_session, 0, __func__);
+            if (r == -1) {
+                ret = NC_PSPOLL_ERROR;
+            } else if (r == 1) {
+                /* no one else is currently working with the session, so we can, otherwise skip it */
+                switch (cur_ps_session->state) {
+                case NC_PS_STATE_NONE:
+                    if (cur_session->status == NC_STATUS_RUNNING) {
+                        /* session is fine, work with it */
+                        cur_ps_session->state = NC_PS_STATE_BUSY;
+
+                        ret = nc_ps_poll_session_io(cur_session, NC_SESSION_LOCK_TIMEOUT, ts_cur.tv_sec, msg);
+                        switch (ret) {
+                        case NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR:
+                            ERR("Session %u: %s.", cur_session->id, msg);
+                            cur_ps_session->state = NC_PS_STATE_INVALID;
+                            break;
+                        case NC_PSPOLL_ERROR:
+                            ERR("Session %u: %s.", cur_session->id, msg);
+                            cur_ps_session->state = NC_PS_STATE_NONE;
+                            break;
+                        case NC_PSPOLL_TIMEOUT:
+#ifdef NC_ENABLED_SSH
+                        case NC_PSPOLL_SSH_CHANNEL:
+                        case NC_PSPOLL_SSH_MSG:
+#endif
+                            cur_ps_session->state = NC_PS_STATE_NONE;
+                            break;
+                        case NC_PSPOLL_RPC:
+                            /* let's keep the state busy, we are not done with this session */
+                            break;
+                        }
+                    } else {
+                        /* session is not fine, let the caller know */
+                        ret = NC_PSPOLL_SESSION_TERM;
+                        if (cur_session->term_reason != NC_SESSION_TERM_CLOSED) {
+                            ret |= NC_PSPOLL_SESSION_ERROR;
+                        }
+                        cur_ps_session->state = NC_PS_STATE_INVALID;
+                    }
+                    break;
+                case NC_PS_STATE_BUSY:
+                    /* it definitely should not be busy because we have the lock */
+                    ERRINT;
+                    ret = NC_PSPOLL_ERROR;
+                    break;
+                case NC_PS_STATE_INVALID:
+                    /* we got it locked, but it will be freed, let it be */
+                    ret = NC_PSPOLL_TIMEOUT;
+                    break;
+                }
+
+                /* keep RPC lock in this one case */
+                if (ret != NC_PSPOLL_RPC) {
+                    /* SESSION RPC UNLOCK */
+                    nc_session_rpc_unlock(cur_session, NC_SESSION_LOCK_TIMEOUT, __func__);
+                }
+            } else {
+                /* timeout */
+                ret = NC_PSPOLL_TIMEOUT;
+            }
+
+            /* something happened */
+            if (ret != NC_PSPOLL_TIMEOUT) {
+                break;
+            }
+
+            if (i == ps->session_count - 1) {
+                i = 0;
+            } else {
+                ++i;
+            }
+        } while (i != j);
+
+        /* no event, no session remains locked */
+        if (ret == NC_PSPOLL_TIMEOUT) {
+            usleep(NC_TIMEOUT_STEP);
+            /* update current time */
+            nc_gettimespec_mono(&ts_cur);
+
+            if ((timeout > -1) && (nc_difftimespec(&ts_cur, &ts_timeout) < 1)) {
+                /* final timeout */
+                break;
+            }
+        }
+    } while (ret == NC_PSPOLL_TIMEOUT);
+
+    /* do we want to return the session? */
+    switch (ret) {
+    case NC_PSPOLL_RPC:
+    case NC_PSPOLL_SESSION_TERM:
+    case NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR:
+#ifdef NC_ENABLED_SSH
+    case NC_PSPOLL_SSH_CHANNEL:
+    case NC_PSPOLL_SSH_MSG:
+#endif
+        if (session) {
+            *session = cur_session;
+        }
+        ps->last_event_session = i;
+        break;
+    default:
+        break;
+    }
+
+    /* PS UNLOCK */
+    nc_ps_unlock(ps, q_id, __func__);
+
+    /* we have some data available and the session is RPC locked (but not IO locked) */
+    if (ret == NC_PSPOLL_RPC) {
+        nc_gettimespec_mono(&ts_rpc);
+        ret = nc_server_recv_rpc_io(cur_session, timeout, &rpc);
+        if (ret & (NC_PSPOLL_ERROR | NC_PSPOLL_BAD_RPC)) {
+            if (cur_session->status != NC_STATUS_RUNNING) {
+                ret |= NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
+                cur_ps_session->state = NC_PS_STATE_INVALID;
+            } else {
+                cur_ps_session->state = NC_PS_STATE_NONE;
+            }
+        } else {
+            cur_session->opts.server.last_rpc = ts_cur.tv_sec;
+
+            /* process RPC */
+            ret |= nc_server_send_reply_io(cur_session, timeout, rpc);
+            nc_server_load_rpc_done(&ts_rpc);
+            if (cur_session->status != NC_STATUS_RUNNING) {
+                ret |= NC_PSPOLL_SESSION_TERM;
+                if (!(cur_session->term_reason & (NC_SESSION_TERM_CLOSED | NC_SESSION_TERM_KILLED))) {
+                    ret |= NC_PSPOLL_SESSION_ERROR;
+                }
+                cur_ps_session->state = NC_PS_STATE_INVALID;
+            } else {
+                cur_ps_session->state = NC_PS_STATE_NONE;
+            }
+        }
+        nc_server_rpc_free(rpc, server_opts.ctx);
+
+        /* SESSION RPC UNLOCK */
+        nc_session_rpc_unlock(cur_session, NC_SESSION_LOCK_TIMEOUT, __func__);
+    }
+
+    return ret;
+}
+
+API void
+nc_ps_clear(struct nc_pollsession *ps, int all, void (*data_free)(void *))
+{
+    uint8_t q_id;
+    uint16_t i;
+    struct nc_session *session;
+
+    if (!ps) {
+        ERRARG("ps");
+        return;
+    }
+
+    /* LOCK */
+    if (nc_ps_lock(ps, &q_id, __func__)) {
+        return;
+    }
+
+    if (all) {
+        for (i = 0; i < ps->session_count; i++) {
+            nc_session_free(ps->sessions[i]->session, data_free);
+            free(ps->sessions[i]);
+        }
+        free(ps->sessions);
+        ps->sessions = NULL;
+        ps->session_count = 0;
+        ps->last_event_session = 0;
+    } else {
+        for (i = 0; i < ps->session_count; ) {
+            if (ps->sessions[i]->session->status != NC_STATUS_RUNNING) {
+                session = ps->sessions[i]->session;
+                _nc_ps_del_session(ps, NULL, i);
+                nc_session_free(session, data_free);
+                continue;
+            }
+
+            ++i;
+        }
+    }
+
+    /* UNLOCK */
+    nc_ps_unlock(ps, q_id, __func__);
+}
+
+#if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
+
+static int
+nc_get_uid(int sock, uid_t *uid)
+{
+    int ret;
+
+#ifdef SO_PEERCRED
+    struct ucred ucred;
+    socklen_t len;
+    len = sizeof(ucred);
+    ret = getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &ucred, &len);
+    if (!ret) {
+        *uid = ucred.uid;
+    }
+#else
+    ret = getpeereid(sock, uid, NULL);
+#endif
+
+    if (ret < 0) {
+        ERR("Failed to get credentials from unix socket (%s).", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int
+nc_accept_unix(struct nc_session *session, int sock)
+{
+#if defined(SO_PEERCRED) || defined(HAVE_GETPEEREID)
+    const struct passwd *pw;
+    char *username;
+    session->ti_type = NC_TI_UNIX;
+    uid_t uid;
+
+    if (nc_get_uid(sock, &uid)) {
+        close(sock);
+        return -1;
+    }
+
+    pw = getpwuid(uid);
+    if (pw == NULL) {
+        ERR("Failed to find username for uid=%u (%s).\n", uid,
+            strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    username = strdup(pw->pw_name);
+    if (username == NULL) {
+        ERRMEM;
+        close(sock);
+        return -1;
+    }
+    session->username = lydict_insert_zc(server_opts.ctx, username);
+
+    session->ti.unixsock.sock = sock;
+
+    return 1;
+#else
+    return -1;
+#endif
+}
+
+API int
+nc_server_add_endpt(const char *name, NC_TRANSPORT_IMPL ti)
+{
+    uint16_t i;
+    int ret = 0;
+
+    if (!name) {
+        ERRARG("name");
+        return -1;
+    }
+
+    /* BIND LOCK */
+    pthread_mutex_lock(&server_opts.bind_lock);
+
+    /* ENDPT WRITE LOCK */
+    pthread_rwlock_wrlock(&server_opts.endpt_lock);
+
+    /* check name uniqueness */
+    for (i = 0; i < server_opts.endpt_count; ++i) {
+        if (!strcmp(server_opts.endpts[i].name, name)) {
+            ERR("Endpoint \"%s\" already exists.", name);
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    ++server_opts.endpt_count;
+    server_opts.endpts = nc_realloc(server_opts.endpts, server_opts.endpt_count * sizeof *server_opts.endpts);
+    if (!server_opts.endpts) {
+        ERRMEM;
+        ret = -1;
+        goto cleanup;
+    }
+    memset(&server_opts.endpts[server_opts.endpt_count - 1], 0, sizeof *server_opts.endpts);
+    server_opts.endpts[server_opts.endpt_count - 1].name = lydict_insert(server_opts.ctx, name, 0);
+    server_opts.endpts[server_opts.endpt_count - 1].ti = ti;
+    server_opts.endpts[server_opts.endpt_count - 1].ka.idle_time = 1;
+    server_opts.endpts[server_opts.endpt_count - 1].ka.max_probes = 10;
+    server_opts.endpts[server_opts.endpt_count - 1].ka.probe_interval = 5;
+
+    server_opts.binds = nc_realloc(server_opts.binds, server_opts.endpt_count * sizeof *server_opts.binds);
+    if (!server_opts.binds) {
+        ERRMEM;
+        ret = -1;
+        goto cleanup;
+    }
+
+    memset(&server_opts.binds[server_opts.endpt_count - 1], 0, sizeof *server_opts.binds);
+    server_opts.binds[server_opts.endpt_count - 1].sock = -1;
+
+    switch (ti) {
+#ifdef NC_ENABLED_SSH
+    case NC_TI_LIBSSH:
+        server_opts.endpts[server_opts.endpt_count - 1].opts.ssh = calloc(1, sizeof(struct nc_server_ssh_opts));
+        if (!server_opts.endpts[server_opts.endpt_count - 1].opts.ssh) {
+            ERRMEM;
+            ret = -1;
+            goto cleanup;
+        }
+        server_opts.endpts[server_opts.endpt_count - 1].opts.ssh->auth_methods =
+            NC_SSH_AUTH_PUBLICKEY | NC_SSH_AUTH_PASSWORD | NC_SSH_AUTH_INTERACTIVE;
+        server_opts.endpts[server_opts.endpt_count - 1].opts.ssh->auth_attempts = 3;
+        server_opts.endpts[server_opts.endpt_count - 1].opts.ssh->auth_timeout = 30;
+        break;
+#endif
+#ifdef NC_ENABLED_TLS
+    case NC_TI_OPENSSL:
+        server_opts.endpts[server_opts.endpt_count - 1].opts.tls = calloc(1, sizeof(struct nc_server_tls_opts));
+        if (!server_opts.endpts[server_opts.endpt_count - 1].opts.tls) {
+            ERRMEM;
+            ret = -1;
+            goto cleanup;
+        }
+        break;
+#endif
+    case NC_TI_UNIX:
+        server_opts.endpts[server_opts.endpt_count - 1].opts.unixsock = calloc(1, sizeof(struct nc_server_unix_opts));
+        if (!server_opts.endpts[server_opts.endpt_count - 1].opts.unixsock) {
+            ERRMEM;
+            ret = -1;
+            goto cleanup;
+        }
+        server_opts.endpts[server_opts.endpt_count - 1].opts.unixsock->mode = (mode_t)-1;
+        server_opts.endpts[server_opts.endpt_count - 1].opts.unixsock->uid = (uid_t)-1;
+        server_opts.endpts[server_opts.endpt_count - 1].opts.unixsock->gid = (gid_t)-1;
+        break;
+    default:
+        ERRINT;
+        ret = -1;
+        goto cleanup;
+    }
+
+cleanup:
+    /* ENDPT UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+    /* BIND UNLOCK */
+    pthread_mutex_unlock(&server_opts.bind_lock);
+
+    return ret;
+}
+
+API int
+nc_server_del_endpt(const char *name, NC_TRANSPORT_IMPL ti)
+{
+    uint32_t i;
+    int ret = -1;
+
+    /* BIND LOCK */
+    pthread_mutex_lock(&server_opts.bind_lock);
+
+    /* ENDPT WRITE LOCK */
+    pthread_rwlock_wrlock(&server_opts.endpt_lock);
+
+    if (!name && !ti) {
+        /* remove all endpoints */
+        for (i = 0; i < server_opts.endpt_count; ++i) {
+            lydict_remove(server_opts.ctx, server_opts.endpts[i].name);
+            switch (server_opts.endpts[i].ti) {
+#ifdef NC_ENABLED_SSH
+            case NC_TI_LIBSSH:
+                nc_server_ssh_clear_opts(server_opts.endpts[i].opts.ssh);
+                free(server_opts.endpts[i].opts.ssh);
+                break;
+#endif
+#ifdef NC_ENABLED_TLS
+            case NC_TI_OPENSSL:
+                nc_server_tls_clear_opts(server_opts.endpts[i].opts.tls);
+                free(server_opts.endpts[i].opts.tls);
+                break;
+#endif
+            case NC_TI_UNIX:
+                free(server_opts.endpts[i].opts.unixsock);
+                break;
+            default:
+                ERRINT;
+                /* won't get here ...*/
+                break;
+            }
+            ret = 0;
+        }
+        free(server_opts.endpts);
+        server_opts.endpts = NULL;
+
+        /* remove all binds */
+        for (i = 0; i < server_opts.endpt_count; ++i) {
+            lydict_remove(server_opts.ctx, server_opts.binds[i].address);
+            if (server_opts.binds[i].sock > -1) {
+                nc_server_bind_close(server_opts.binds[i].sock);
+            }
+        }
+        free(server_opts.binds);
+        server_opts.binds = NULL;
+
+        server_opts.endpt_count = 0;
+
+    } else {
+        /* remove one endpoint with bind(s) or all endpoints using one transport protocol */
+        for (i = 0; i < server_opts.endpt_count; ++i) {
+            if ((name && !strcmp(server_opts.endpts[i].name, name)) || (!name && (server_opts.endpts[i].ti == ti))) {
+                /* remove endpt */
+                lydict_remove(server_opts.ctx, server_opts.endpts[i].name);
+                switch (server_opts.endpts[i].ti) {
+#ifdef NC_ENABLED_SSH
+                case NC_TI_LIBSSH:
+                    nc_server_ssh_clear_opts(server_opts.endpts[i].opts.ssh);
+                    free(server_opts.endpts[i].opts.ssh);
+                    break;
+#endif
+#ifdef NC_ENABLED_TLS
+                case NC_TI_OPENSSL:
+                    nc_server_tls_clear_opts(server_opts.endpts[i].opts.tls);
+                    free(server_opts.endpts[i].opts.tls);
+                    break;
+#endif
+                case NC_TI_UNIX:
+                    free(server_opts.endpts[i].opts.unixsock);
+                    break;
+                default:
+                    ERRINT;
+                    break;
+                }
+
+                /* remove bind(s) */
+                lydict_remove(server_opts.ctx, server_opts.binds[i].address);
+                if (server_opts.binds[i].sock > -1) {
+                    nc_server_bind_close(server_opts.binds[i].sock);
+                }
+
+                /* move last endpt and bind(s) to the empty space */
+                --server_opts.endpt_count;
+                if (!server_opts.endpt_count) {
+                    free(server_opts.binds);
+                    server_opts.binds = NULL;
+                    free(server_opts.endpts);
+                    server_opts.endpts = NULL;
+                } else if (i < server_opts.endpt_count) {
+                    memcpy(&server_opts.binds[i], &server_opts.binds[server_opts.endpt_count], sizeof *server_opts.binds);
+                    memcpy(&server_opts.endpts[i], &server_opts.endpts[server_opts.endpt_count], sizeof *server_opts.endpts);
+                }
+
+                ret = 0;
+                if (name) {
+                    break;
+                }
+            }
+        }
+    }
+
+    /* ENDPT UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+    /* BIND UNLOCK */
+    pthread_mutex_unlock(&server_opts.bind_lock);
+
+    return ret;
+}
+
+API int
+nc_server_endpt_count(void)
+{
+    return server_opts.endpt_count;
+}
+
+API int
+nc_server_is_endpt(const char *name)
+{
+    uint16_t i;
+    int found = 0;
+
+    if (!name) {
+        return found;
+    }
+
+    /* ENDPT READ LOCK */
+    pthread_rwlock_rdlock(&server_opts.endpt_lock);
+
+    /* check name uniqueness */
+    for (i = 0; i < server_opts.endpt_count; ++i) {
+        if (!strcmp(server_opts.endpts[i].name, name)) {
+            found = 1;
+            break;
+        }
+    }
+
+    /* ENDPT UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+    return found;
+}
+
+int
+nc_server_endpt_set_address_port(const char *endpt_name, const char *address, uint16_t port)
+{
+    struct nc_endpt *endpt;
+    struct nc_bind *bind = NULL;
+    uint16_t i;
+    int sock = -1, set_addr, ret = 0;
+
+    if (!endpt_name) {
+        ERRARG("endpt_name");
+        return -1;
+    } else if ((!address && !port) || (address && port)) {
+        ERRARG("address and port");
+        return -1;
+    }
+
+    if (address) {
+        set_addr = 1;
+    } else {
+        set_addr = 0;
+    }
+
+    /* BIND LOCK */
+    pthread_mutex_lock(&server_opts.bind_lock);
+
+    /* ENDPT LOCK */
+    endpt = nc_server_endpt_lock_get(endpt_name, 0, &i);
+    if (!endpt) {
+        /* BIND UNLOCK */
+        pthread_mutex_unlock(&server_opts.bind_lock);
+        return -1;
+    }
+
+    bind = &server_opts.binds[i];
+
+    if (set_addr) {
+        port = bind->port;
+    } else {
+        address = bind->address;
+    }
+
+    if (!set_addr && endpt->ti == NC_TI_UNIX) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    /* we have all the information we need to create a listening socket */
+    if (address && (port || endpt->ti == NC_TI_UNIX)) {
+        /* create new socket, close the old one */
+        if (endpt->ti == NC_TI_UNIX)
+            sock = nc_sock_listen_unix(address, endpt->opts.unixsock);
+        else
+            sock = nc_sock_listen_inet(address, port, &endpt->ka);
+        if (sock == -1) {
+            ret = -1;
+            goto cleanup;
+        }
+#ifdef NC_ACCEPT_EPOLL
+        if (nc_server_accept_epoll_add(sock)) {
+            close(sock);
+            ret = -1;
+            goto cleanup;
+        }
+#endif
+
+        if (bind->sock > -1) {
+            nc_server_bind_close(bind->sock);
+        }
+        bind->sock = sock;
+    } /* else we are just setting address or port */
+
+    if (set_addr) {
+        lydict_remove(server_opts.ctx, bind->address);
+        bind->address = lydict_insert(server_opts.ctx, address, 0);
+    } else {
+        bind->port = port;
+    }
+
+    if (sock > -1) {
+#if defined(NC_ENABLED_SSH) && defined(NC_ENABLED_TLS)
+        VRB("Listening on %s:%u for %s connections.", address, port, (endpt->ti == NC_TI_LIBSSH ? "SSH" : "TLS"));
+#elif defined(NC_ENABLED_SSH)
+        VRB("Listening on %s:%u for SSH connections.", address, port);
+#else
+        VRB("Listening on %s:%u for TLS connections.", address, port);
+#endif
+    }
+
+cleanup:
+    /* ENDPT UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+    /* BIND UNLOCK */
+    pthread_mutex_unlock(&server_opts.bind_lock);
+
+    return ret;
+}
+
+API int
+nc_server_endpt_set_address(const char *endpt_name, const char *address)
+{
+    return nc_server_endpt_set_address_port(endpt_name, address, 0);
+}
+
+API int
+nc_server_endpt_set_port(const char *endpt_name, uint16_t port)
+{
+    return nc_server_endpt_set_address_port(endpt_name, NULL, port);
+}
+
+API int
+nc_server_endpt_set_perms(const char *endpt_name, mode_t mode, uid_t uid, gid_t gid)
+{
+    struct nc_endpt *endpt;
+    uint16_t i;
+    int ret = 0;
+
+    if (!endpt_name) {
+        ERRARG("endpt_name");
+        return -1;
+    } else if (mode == 0) {
+        ERRARG("mode");
+        return -1;
+    }
+
+    /* ENDPT LOCK */
+    endpt = nc_server_endpt_lock_get(endpt_name, 0, &i);
+    if (!endpt)
+        return -1;
+
+    if (endpt->ti != NC_TI_UNIX) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    endpt->opts.unixsock->mode = mode;
+    endpt->opts.unixsock->uid = uid;
+    endpt->opts.unixsock->gid = gid;
+
+cleanup:
+    /* ENDPT UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+    return ret;
+}
+
+API int
+nc_server_endpt_enable_keepalives(const char *endpt_name, int enable)
+{
+    struct nc_endpt *endpt;
+    int ret = 0;
+
+    if (!endpt_name) {
+        ERRARG("endpt_name");
+        return -1;
+    }
+
+    /* ENDPT LOCK */
+    endpt = nc_server_endpt_lock_get(endpt_name, 0, NULL);
+    if (!endpt) {
+        return -1;
+    }
+
+    endpt->ka.enabled = (enable ? 1 : 0);
+
+    /* ENDPT UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
 
-    nc_session_io_unlock(session, __func__);
     return ret;
 }
 
 API int
-nc_ps_poll(struct nc_pollsession *ps, int timeout, struct nc_session **session)
+nc_server_endpt_set_keepalives(const char *endpt_name, int idle_time, int max_probes, int probe_interval)
 {
-    int ret, r;
-    uint8_t q_id;
-    uint16_t i, j;
-    char msg[256];
-    struct timespec ts_timeout, ts_cur;
-    struct nc_session *cur_session;
-    struct nc_ps_session *cur_ps_session;
-    struct nc_server_rpc *rpc = NULL;
+    struct nc_endpt *endpt;
+    int ret = 0;
 
-    if (!ps) {
-        ERRARG("ps");
-        return NC_PSPOLL_ERROR;
+    if (!endpt_name) {
+        ERRARG("endpt_name");
+        return -1;
     }
 
-    /* PS LOCK */
-    if (nc_ps_lock(ps, &q_id, __func__)) {
-        return NC_PSPOLL_ERROR;
+    /* ENDPT LOCK */
+    endpt = nc_server_endpt_lock_get(endpt_name, 0, NULL);
+    if (!endpt) {
+        return -1;
     }
 
-    if (!ps->session_count) {
-        nc_ps_unlock(ps, q_id, __func__);
-        return NC_PSPOLL_NOSESSIONS;
+    if (idle_time > -1) {
+        endpt->ka.idle_time = idle_time;
+    }
+    if (max_probes > -1) {
+        endpt->ka.max_probes = max_probes;
+    }
+    if (probe_interval > -1) {
+        endpt->ka.probe_interval = probe_interval;
     }
 
-    /* fill timespecs */
-    nc_gettimespec_mono(&ts_cur);
-    if (timeout > -1) {
-        nc_gettimespec_mono(&ts_timeout);
-        nc_addtimespec(&ts_timeout, timeout);
+    /* ENDPT UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+    return ret;
+}
+
+API int
+nc_server_endpt_set_rate_limit(const char *endpt_name, uint32_t rpc_rate, uint32_t rpc_burst, uint32_t byte_rate,
+        uint32_t byte_burst)
+{
+    struct nc_endpt *endpt;
+
+    if (!endpt_name) {
+        ERRARG("endpt_name");
+        return -1;
     }
 
-    /* poll all the sessions one-by-one */
-    do {
-        /* loop from i to j once (all sessions) */
-        if (ps->last_event_session == ps->session_count - 1) {
-            i = j = 0;
-        } else {
-            i = j = ps->last_event_session + 1;
-        }
-        do {
-            cur_ps_session = ps->sessions[i];
-            cur_session = cur_ps_session->session;
+    /* ENDPT LOCK */
+    endpt = nc_server_endpt_lock_get(endpt_name, 0, NULL);
+    if (!endpt) {
+        return -1;
+    }
 
-            /* SESSION RPC LOCK */
-            r = nc_session_rpc_lock(cur_session, 0, __func__);
-            if (r == -1) {
-                ret = NC_PSPOLL_ERROR;
-            } else if (r == 1) {
-                /* no one else is currently working with the session, so we can, otherwise skip it */
-                switch (cur_ps_session->state) {
-                case NC_PS_STATE_NONE:
-                    if (cur_session->status == NC_STATUS_RUNNING) {
-                        /* session is fine, work with it */
-                        cur_ps_session->state = NC_PS_STATE_BUSY;
+    endpt->rate.rpc_rate = rpc_rate;
+    endpt->rate.rpc_burst = rpc_burst;
+    endpt->rate.byte_rate = byte_rate;
+    endpt->rate.byte_burst = byte_burst;
 
-                        ret = nc_ps_poll_session_io(cur_session, NC_SESSION_LOCK_TIMEOUT, ts_cur.tv_sec, msg);
-                        switch (ret) {
-                        case NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR:
-                            ERR("Session %u: %s.", cur_session->id, msg);
-                            cur_ps_session->state = NC_PS_STATE_INVALID;
-                            break;
-                        case NC_PSPOLL_ERROR:
-                            ERR("Session %u: %s.", cur_session->id, msg);
-                            cur_ps_session->state = NC_PS_STATE_NONE;
-                            break;
-                        case NC_PSPOLL_TIMEOUT:
-#ifdef NC_ENABLED_SSH
-                        case NC_PSPOLL_SSH_CHANNEL:
-                        case NC_PSPOLL_SSH_MSG:
-#endif
-                            cur_ps_session->state = NC_PS_STATE_NONE;
-                            break;
-                        case NC_PSPOLL_RPC:
-                            /* let's keep the state busy, we are not done with this session */
-                            break;
-                        }
-                    } else {
-                        /* session is not fine, let the caller know */
-                        ret = NC_PSPOLL_SESSION_TERM;
-                        if (cur_session->term_reason != NC_SESSION_TERM_CLOSED) {
-                            ret |= NC_PSPOLL_SESSION_ERROR;
-                        }
-                        cur_ps_session->state = NC_PS_STATE_INVALID;
-                    }
-                    break;
-                case NC_PS_STATE_BUSY:
-                    /* it definitely should not be busy because we have the lock */
-                    ERRINT;
-                    ret = NC_PSPOLL_ERROR;
-                    break;
-                case NC_PS_STATE_INVALID:
-                    /* we got it locked, but it will be freed, let it be */
-                    ret = NC_PSPOLL_TIMEOUT;
-                    break;
-                }
+    /* ENDPT UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
 
-                /* keep RPC lock in this one case */
-                if (ret != NC_PSPOLL_RPC) {
-                    /* SESSION RPC UNLOCK */
-                    nc_session_rpc_unlock(cur_session, NC_SESSION_LOCK_TIMEOUT, __func__);
-                }
-            } else {
-                /* timeout */
-                ret = NC_PSPOLL_TIMEOUT;
-            }
+    return 0;
+}
 
-            /* something happened */
-            if (ret != NC_PSPOLL_TIMEOUT) {
-                break;
-            }
+/* LOCK expected to be held, it is always unlocked */
+static void
+nc_auth_token_unlock_release(struct nc_auth_token *token)
+{
+    int last;
 
-            if (i == ps->session_count - 1) {
-                i = 0;
-            } else {
-                ++i;
-            }
-        } while (i != j);
+    last = !--token->refs;
 
-        /* no event, no session remains locked */
-        if (ret == NC_PSPOLL_TIMEOUT) {
-            usleep(NC_TIMEOUT_STEP);
-            /* update current time */
-            nc_gettimespec_mono(&ts_cur);
+    /* UNLOCK */
+    pthread_mutex_unlock(&token->lock);
 
-            if ((timeout > -1) && (nc_difftimespec(&ts_cur, &ts_timeout) < 1)) {
-                /* final timeout */
-                break;
-            }
-        }
-    } while (ret == NC_PSPOLL_TIMEOUT);
+    if (last) {
+        close(token->pipe[0]);
+        close(token->pipe[1]);
+        pthread_cond_destroy(&token->cond);
+        pthread_mutex_destroy(&token->lock);
+        free(token);
+    }
+}
 
-    /* do we want to return the session? */
-    switch (ret) {
-    case NC_PSPOLL_RPC:
-    case NC_PSPOLL_SESSION_TERM:
-    case NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR:
-#ifdef NC_ENABLED_SSH
-    case NC_PSPOLL_SSH_CHANNEL:
-    case NC_PSPOLL_SSH_MSG:
-#endif
-        if (session) {
-            *session = cur_session;
-        }
-        ps->last_event_session = i;
-        break;
-    default:
-        break;
+API struct nc_auth_token *
+nc_server_auth_defer(const struct nc_session *session)
+{
+    struct nc_auth_token *token;
+
+    if (!session || (session->side != NC_SERVER) || (session->status != NC_STATUS_STARTING)) {
+        ERRARG("session");
+        return NULL;
+    } else if (session->opts.server.auth_token) {
+        ERR("Session %u: authentication already deferred.", session->id);
+        return NULL;
     }
 
-    /* PS UNLOCK */
-    nc_ps_unlock(ps, q_id, __func__);
+    token = malloc(sizeof *token);
+    if (!token) {
+        ERRMEM;
+        return NULL;
+    }
+    if (pipe(token->pipe)) {
+        ERR("Failed to create a pipe (%s).", strerror(errno));
+        free(token);
+        return NULL;
+    }
+    pthread_mutex_init(&token->lock, NULL);
+    pthread_cond_init(&token->cond, NULL);
+    token->result = -1;
+    token->refs = 2;
 
-    /* we have some data available and the session is RPC locked (but not IO locked) */
-    if (ret == NC_PSPOLL_RPC) {
-        ret = nc_server_recv_rpc_io(cur_session, timeout, &rpc);
-        if (ret & (NC_PSPOLL_ERROR | NC_PSPOLL_BAD_RPC)) {
-            if (cur_session->status != NC_STATUS_RUNNING) {
-                ret |= NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
-                cur_ps_session->state = NC_PS_STATE_INVALID;
-            } else {
-                cur_ps_session->state = NC_PS_STATE_NONE;
-            }
-        } else {
-            cur_session->opts.server.last_rpc = ts_cur.tv_sec;
+    /* only the callback of this session can be running, nobody else accesses it */
+    ((struct nc_session *)session)->opts.server.auth_token = token;
+    return token;
+}
 
-            /* process RPC */
-            ret |= nc_server_send_reply_io(cur_session, timeout, rpc);
-            if (cur_session->status != NC_STATUS_RUNNING) {
-                ret |= NC_PSPOLL_SESSION_TERM;
-                if (!(cur_session->term_reason & (NC_SESSION_TERM_CLOSED | NC_SESSION_TERM_KILLED))) {
-                    ret |= NC_PSPOLL_SESSION_ERROR;
-                }
-                cur_ps_session->state = NC_PS_STATE_INVALID;
-            } else {
-                cur_ps_session->state = NC_PS_STATE_NONE;
-            }
-        }
-        nc_server_rpc_free(rpc, server_opts.ctx);
+API void
+nc_server_auth_complete(struct nc_auth_token *token, int authenticated)
+{
+    if (!token) {
+        ERRARG("token");
+        return;
+    }
 
-        /* SESSION RPC UNLOCK */
-        nc_session_rpc_unlock(cur_session, NC_SESSION_LOCK_TIMEOUT, __func__);
+    /* LOCK */
+    pthread_mutex_lock(&token->lock);
+
+    token->result = authenticated ? 1 : 0;
+    pthread_cond_signal(&token->cond);
+
+    /* wake the handshake waiting on the session transport, the single byte always fits */
+    if (write(token->pipe[1], "", 1) == -1) {
+        ERR("Failed to write to a pipe (%s).", strerror(errno));
     }
 
-    return ret;
+    /* UNLOCK */
+    nc_auth_token_unlock_release(token);
 }
 
-API void
-nc_ps_clear(struct nc_pollsession *ps, int all, void (*data_free)(void *))
+/* remaining time until the authentication deadline in msec, -1 for none */
+static int
+nc_server_auth_timeout(struct nc_session *session)
 {
-    uint8_t q_id;
-    uint16_t i;
-    struct nc_session *session;
+    struct timespec ts_cur;
+    int32_t timeout;
 
-    if (!ps) {
-        ERRARG("ps");
-        return;
+    if (!session->opts.server.auth_deadline.tv_sec && !session->opts.server.auth_deadline.tv_nsec) {
+        return -1;
+    }
+
+    nc_gettimespec_mono(&ts_cur);
+    timeout = nc_difftimespec(&ts_cur, &session->opts.server.auth_deadline);
+    return (timeout > 0) ? timeout : 0;
+}
+
+int
+nc_server_auth_wait(struct nc_session *session, int clb_ret)
+{
+    struct nc_auth_token *token;
+    struct timespec ts_timeout;
+    int r, ret, timeout;
+
+    token = session->opts.server.auth_token;
+    if (!token) {
+        return -1;
+    }
+    session->opts.server.auth_token = NULL;
+
+    /* only the time left for the whole authentication */
+    timeout = nc_server_auth_timeout(session);
+    if (timeout > -1) {
+        nc_gettimespec_real(&ts_timeout);
+        nc_addtimespec(&ts_timeout, timeout);
     }
 
     /* LOCK */
-    if (nc_ps_lock(ps, &q_id, __func__)) {
-        return;
+    pthread_mutex_lock(&token->lock);
+
+    if (clb_ret != NC_AUTH_PENDING) {
+        /* deferred, but the callback returned the result anyway, the application still completes the token */
+        nc_auth_token_unlock_release(token);
+        return -1;
     }
 
-    if (all) {
-        for (i = 0; i < ps->session_count; i++) {
-            nc_session_free(ps->sessions[i]->session, data_free);
-            free(ps->sessions[i]);
+    while (token->result == -1) {
+        if (timeout > -1) {
+            r = pthread_cond_timedwait(&token->cond, &token->lock, &ts_timeout);
+        } else {
+            r = pthread_cond_wait(&token->cond, &token->lock);
         }
-        free(ps->sessions);
-        ps->sessions = NULL;
-        ps->session_count = 0;
-        ps->last_event_session = 0;
-    } else {
-        for (i = 0; i < ps->session_count; ) {
-            if (ps->sessions[i]->session->status != NC_STATUS_RUNNING) {
-                session = ps->sessions[i]->session;
-                _nc_ps_del_session(ps, NULL, i);
-                nc_session_free(session, data_free);
-                continue;
-            }
-
-            ++i;
+        if (r == ETIMEDOUT) {
+            ERR("Session %u: deferred authentication of user \"%s\" timeout.", session->id, session->username);
+            break;
+        } else if (r) {
+            ERR("Pthread condition wait failed (%s).", strerror(r));
+            break;
         }
     }
+    ret = (token->result == 1) ? 1 : 0;
 
     /* UNLOCK */
-    nc_ps_unlock(ps, q_id, __func__);
-}
+    nc_auth_token_unlock_release(token);
 
-#if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
+    return ret;
+}
 
-static int
-nc_get_uid(int sock, uid_t *uid)
+int
+nc_server_auth_pending(struct nc_session *session, int clb_ret)
 {
-    int ret;
+    struct nc_auth_token *token;
 
-#ifdef SO_PEERCRED
-    struct ucred ucred;
-    socklen_t len;
-    len = sizeof(ucred);
-    ret = getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &ucred, &len);
-    if (!ret) {
-        *uid = ucred.uid;
+    token = session->opts.server.auth_token;
+    if (!token) {
+        return -1;
     }
-#else
-    ret = getpeereid(sock, uid, NULL);
-#endif
 
-    if (ret < 0) {
-        ERR("Failed to get credentials from unix socket (%s).", strerror(errno));
+    if (clb_ret != NC_AUTH_PENDING) {
+        /* deferred, but the callback returned the result anyway, the application still completes the token */
+        nc_server_auth_release(session);
         return -1;
     }
-    return 0;
+
+    return 1;
 }
 
-static int
-nc_accept_unix(struct nc_session *session, int sock)
+int
+nc_server_auth_result(struct nc_session *session)
 {
-#if defined(SO_PEERCRED) || defined(HAVE_GETPEEREID)
-    const struct passwd *pw;
-    char *username;
-    session->ti_type = NC_TI_UNIX;
-    uid_t uid;
+    struct nc_auth_token *token;
+    int ret;
 
-    if (nc_get_uid(sock, &uid)) {
-        close(sock);
+    token = session->opts.server.auth_token;
+    if (!token) {
         return -1;
     }
 
-    pw = getpwuid(uid);
-    if (pw == NULL) {
-        ERR("Failed to find username for uid=%u (%s).\n", uid,
-            strerror(errno));
-        close(sock);
-        return -1;
-    }
+    /* LOCK */
+    pthread_mutex_lock(&token->lock);
 
-    username = strdup(pw->pw_name);
-    if (username == NULL) {
-        ERRMEM;
-        close(sock);
+    ret = token->result;
+    if (ret == -1) {
+        /* UNLOCK */
+        pthread_mutex_unlock(&token->lock);
         return -1;
     }
-    session->username = lydict_insert_zc(server_opts.ctx, username);
+    session->opts.server.auth_token = NULL;
 
-    session->ti.unixsock.sock = sock;
+    /* UNLOCK */
+    nc_auth_token_unlock_release(token);
 
-    return 1;
-#else
-    return -1;
-#endif
+    return ret;
 }
 
-API int
-nc_server_add_endpt(const char *name, NC_TRANSPORT_IMPL ti)
+int
+nc_server_auth_fd(const struct nc_session *session)
 {
-    uint16_t i;
-    int ret = 0;
-
-    if (!name) {
-        ERRARG("name");
+    if (!session->opts.server.auth_token) {
         return -1;
     }
 
-    /* BIND LOCK */
-    pthread_mutex_lock(&server_opts.bind_lock);
+    /* the pipe does not change while the token exists */
+    return session->opts.server.auth_token->pipe[0];
+}
 
-    /* ENDPT WRITE LOCK */
-    pthread_rwlock_wrlock(&server_opts.endpt_lock);
+void
+nc_server_auth_release(struct nc_session *session)
+{
+    struct nc_auth_token *token;
 
-    /* check name uniqueness */
-    for (i = 0; i < server_opts.endpt_count; ++i) {
-        if (!strcmp(server_opts.endpts[i].name, name)) {
-            ERR("Endpoint \"%s\" already exists.", name);
-            ret = -1;
-            goto cleanup;
-        }
+    token = session->opts.server.auth_token;
+    if (!token) {
+        return;
     }
+    session->opts.server.auth_token = NULL;
 
-    ++server_opts.endpt_count;
-    server_opts.endpts = nc_realloc(server_opts.endpts, server_opts.endpt_count * sizeof *server_opts.endpts);
-    if (!server_opts.endpts) {
-        ERRMEM;
-        ret = -1;
-        goto cleanup;
-    }
-    memset(&server_opts.endpts[server_opts.endpt_count - 1], 0, sizeof *server_opts.endpts);
-    server_opts.endpts[server_opts.endpt_count - 1].name = lydict_insert(server_opts.ctx, name, 0);
-    server_opts.endpts[server_opts.endpt_count - 1].ti = ti;
-    server_opts.endpts[server_opts.endpt_count - 1].ka.idle_time = 1;
-    server_opts.endpts[server_opts.endpt_count - 1].ka.max_probes = 10;
-    server_opts.endpts[server_opts.endpt_count - 1].ka.probe_interval = 5;
+    /* LOCK */
+    pthread_mutex_lock(&token->lock);
+
+    /* UNLOCK */
+    nc_auth_token_unlock_release(token);
+}
+
+/* ENDPT READ LOCK expected to be held, it is always unlocked (before the transport handshake),
+ * sock, host, and counted src_addr are always consumed */
+static NC_MSG_TYPE
+nc_accept_session(int sock, char *host, uint16_t port, const uint8_t *src_addr, uint16_t bind_idx,
+        struct nc_session **session)
+{
+    NC_MSG_TYPE msgtype;
+    NC_TRANSPORT_IMPL ti;
+    int ret;
+    struct timespec ts_cur;
+
+    *session = nc_new_session(NC_SERVER, 0);
+    if (!(*session)) {
+        /* ENDPT UNLOCK */
+        pthread_rwlock_unlock(&server_opts.endpt_lock);
 
-    server_opts.binds = nc_realloc(server_opts.binds, server_opts.endpt_count * sizeof *server_opts.binds);
-    if (!server_opts.binds) {
         ERRMEM;
-        ret = -1;
-        goto cleanup;
+        close(sock);
+        free(host);
+        if (src_addr) {
+            nc_server_accept_src_release(src_addr);
+        }
+        return NC_MSG_ERROR;
     }
+    (*session)->status = NC_STATUS_STARTING;
+    (*session)->ctx = server_opts.ctx;
+    (*session)->flags = NC_SESSION_SHAREDCTX;
+    if (src_addr) {
+        memcpy((*session)->opts.server.src_addr, src_addr, sizeof (*session)->opts.server.src_addr);
+        (*session)->flags |= NC_SESSION_SRC_COUNTED;
+    }
+    (*session)->host = lydict_insert_zc(server_opts.ctx, host);
+    (*session)->port = port;
+    nc_rate_bucket_init(&(*session)->opts.server.rpc_bucket, server_opts.endpts[bind_idx].rate.rpc_rate,
+                        server_opts.endpts[bind_idx].rate.rpc_burst);
+    nc_rate_bucket_init(&(*session)->opts.server.byte_bucket, server_opts.endpts[bind_idx].rate.byte_rate,
+                        server_opts.endpts[bind_idx].rate.byte_burst);
 
-    memset(&server_opts.binds[server_opts.endpt_count - 1], 0, sizeof *server_opts.binds);
-    server_opts.binds[server_opts.endpt_count - 1].sock = -1;
+    ti = server_opts.endpts[bind_idx].ti;
+    if (ti == NC_TI_UNIX) {
+        (*session)->data = server_opts.endpts[bind_idx].opts.unixsock;
+        ret = nc_accept_unix(*session, sock);
+        (*session)->data = NULL;
 
-    switch (ti) {
-#ifdef NC_ENABLED_SSH
-    case NC_TI_LIBSSH:
-        server_opts.endpts[server_opts.endpt_count - 1].opts.ssh = calloc(1, sizeof(struct nc_server_ssh_opts));
-        if (!server_opts.endpts[server_opts.endpt_count - 1].opts.ssh) {
-            ERRMEM;
-            ret = -1;
+        /* ENDPT UNLOCK */
+        pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+        if (ret < 0) {
+            msgtype = NC_MSG_ERROR;
             goto cleanup;
         }
-        server_opts.endpts[server_opts.endpt_count - 1].opts.ssh->auth_methods =
-            NC_SSH_AUTH_PUBLICKEY | NC_SSH_AUTH_PASSWORD | NC_SSH_AUTH_INTERACTIVE;
-        server_opts.endpts[server_opts.endpt_count - 1].opts.ssh->auth_attempts = 3;
-        server_opts.endpts[server_opts.endpt_count - 1].opts.ssh->auth_timeout = 30;
-        break;
+        goto handshake;
+    }
+
+    /* the endpoint options are looked up by name only while needed, so that the endpoints are not locked
+     * for the whole (possibly long) transport handshake */
+    (*session)->opts.server.endpt_name = lydict_insert(server_opts.ctx, server_opts.endpts[bind_idx].name, 0);
+
+    /* ENDPT UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+    /* sock gets assigned to session or closed */
+#ifdef NC_ENABLED_SSH
+    if (ti == NC_TI_LIBSSH) {
+        ret = nc_accept_ssh_session(*session, sock, NC_TRANSPORT_TIMEOUT);
+    } else
 #endif
 #ifdef NC_ENABLED_TLS
-    case NC_TI_OPENSSL:
-        server_opts.endpts[server_opts.endpt_count - 1].opts.tls = calloc(1, sizeof(struct nc_server_tls_opts));
-        if (!server_opts.endpts[server_opts.endpt_count - 1].opts.tls) {
-            ERRMEM;
-            ret = -1;
-            goto cleanup;
-        }
-        break;
+    if (ti == NC_TI_OPENSSL) {
+        ret = nc_accept_tls_session(*session, sock, NC_TRANSPORT_TIMEOUT);
+    } else
 #endif
-    case NC_TI_UNIX:
-        server_opts.endpts[server_opts.endpt_count - 1].opts.unixsock = calloc(1, sizeof(struct nc_server_unix_opts));
-        if (!server_opts.endpts[server_opts.endpt_count - 1].opts.unixsock) {
-            ERRMEM;
-            ret = -1;
-            goto cleanup;
-        }
-        server_opts.endpts[server_opts.endpt_count - 1].opts.unixsock->mode = (mode_t)-1;
-        server_opts.endpts[server_opts.endpt_count - 1].opts.unixsock->uid = (uid_t)-1;
-        server_opts.endpts[server_opts.endpt_count - 1].opts.unixsock->gid = (gid_t)-1;
-        break;
-    default:
+    {
         ERRINT;
+        close(sock);
         ret = -1;
+    }
+
+    lydict_remove(server_opts.ctx, (*session)->opts.server.endpt_name);
+    (*session)->opts.server.endpt_name = NULL;
+
+    if (ret < 0) {
+        msgtype = NC_MSG_ERROR;
+        goto cleanup;
+    } else if (!ret) {
+        msgtype = NC_MSG_WOULDBLOCK;
+        goto cleanup;
+    }
+
+handshake:
+    /* assign new SID atomically */
+    (*session)->id = ATOMIC_INC(&server_opts.new_session_id);
+
+    /* NETCONF handshake */
+    msgtype = nc_handshake_io(*session);
+    if (msgtype != NC_MSG_HELLO) {
         goto cleanup;
     }
 
-cleanup:
-    /* ENDPT UNLOCK */
-    pthread_rwlock_unlock(&server_opts.endpt_lock);
+    nc_gettimespec_mono(&ts_cur);
+    (*session)->opts.server.last_rpc = ts_cur.tv_sec;
+    nc_gettimespec_real(&ts_cur);
+    (*session)->opts.server.session_start = ts_cur.tv_sec;
+    (*session)->status = NC_STATUS_RUNNING;
+
+    return msgtype;
+
+cleanup:
+    nc_session_free(*session, NULL);
+    *session = NULL;
+    return msgtype;
+}
+
+API NC_MSG_TYPE
+nc_accept(int timeout, struct nc_session **session)
+{
+    int sock, src_counted;
+    char *host = NULL;
+    uint16_t port, bind_idx;
+    uint8_t src_addr[16];
+
+    if (!server_opts.ctx) {
+        ERRINIT;
+        return NC_MSG_ERROR;
+    } else if (!session) {
+        ERRARG("session");
+        return NC_MSG_ERROR;
+    }
+
+    /* BIND LOCK */
+    pthread_mutex_lock(&server_opts.bind_lock);
+
+    if (!server_opts.endpt_count) {
+        ERR("No endpoints to accept sessions on.");
+        /* BIND UNLOCK */
+        pthread_mutex_unlock(&server_opts.bind_lock);
+        return NC_MSG_ERROR;
+    }
+
+    sock = nc_server_accept_binds(timeout, &host, &port, &bind_idx);
+    if (sock < 1) {
+        /* BIND UNLOCK */
+        pthread_mutex_unlock(&server_opts.bind_lock);
+        free(host);
+        if (!sock) {
+            return NC_MSG_WOULDBLOCK;
+        }
+        return NC_MSG_ERROR;
+    }
+
+    if (nc_server_load_get() == NC_LOAD_OVERLOAD) {
+        /* BIND UNLOCK */
+        pthread_mutex_unlock(&server_opts.bind_lock);
+
+        /* drop the connection before any handshake */
+        VRB("Server overloaded, dropping a new connection from %s.", host ? host : "<unknown>");
+        close(sock);
+        free(host);
+        return NC_MSG_WOULDBLOCK;
+    }
+
+    src_counted = nc_server_accept_filter(sock, host, src_addr);
+    if (src_counted == -1) {
+        /* BIND UNLOCK */
+        pthread_mutex_unlock(&server_opts.bind_lock);
+
+        close(sock);
+        free(host);
+        return NC_MSG_WOULDBLOCK;
+    }
+
+    /* switch bind_lock for endpt_lock, so that another thread can accept another session */
+    /* ENDPT READ LOCK */
+    pthread_rwlock_rdlock(&server_opts.endpt_lock);
 
     /* BIND UNLOCK */
     pthread_mutex_unlock(&server_opts.bind_lock);
 
-    return ret;
+    return nc_accept_session(sock, host, port, src_counted ? src_addr : NULL, bind_idx, session);
 }
 
-API int
-nc_server_del_endpt(const char *name, NC_TRANSPORT_IMPL ti)
+static void
+nc_accept_pipe_job_free(struct nc_accept_job *job)
 {
-    uint32_t i;
-    int ret = -1;
+    if (job->sock > -1) {
+        close(job->sock);
+    }
+    free(job->host);
+    if (job->src_counted) {
+        nc_server_accept_src_release(job->src_addr);
+    }
+    lydict_remove(server_opts.ctx, job->endpt_name);
+    free(job);
+}
+
+#ifdef NC_ACCEPT_EPOLL
+
+/* wait for a new connection on any endpoint without holding BIND LOCK, so that nc_accept() is not blocked */
+static int
+nc_accept_pipe_wait(int timeout)
+{
+    struct epoll_event ev;
+    sigset_t sigmask;
+    int epfd, ret;
 
     /* BIND LOCK */
     pthread_mutex_lock(&server_opts.bind_lock);
 
-    /* ENDPT WRITE LOCK */
-    pthread_rwlock_wrlock(&server_opts.endpt_lock);
-
-    if (!name && !ti) {
-        /* remove all endpoints */
-        for (i = 0; i < server_opts.endpt_count; ++i) {
-            lydict_remove(server_opts.ctx, server_opts.endpts[i].name);
-            switch (server_opts.endpts[i].ti) {
-#ifdef NC_ENABLED_SSH
-            case NC_TI_LIBSSH:
-                nc_server_ssh_clear_opts(server_opts.endpts[i].opts.ssh);
-                free(server_opts.endpts[i].opts.ssh);
-                break;
-#endif
-#ifdef NC_ENABLED_TLS
-            case NC_TI_OPENSSL:
-                nc_server_tls_clear_opts(server_opts.endpts[i].opts.tls);
-                free(server_opts.endpts[i].opts.tls);
-                break;
-#endif
-            case NC_TI_UNIX:
-                free(server_opts.endpts[i].opts.unixsock);
-                break;
-            default:
-                ERRINT;
-                /* won't get here ...*/
-                break;
-            }
-            ret = 0;
-        }
-        free(server_opts.endpts);
-        server_opts.endpts = NULL;
+    if (server_opts.accepted_count) {
+        /* BIND UNLOCK */
+        pthread_mutex_unlock(&server_opts.bind_lock);
+        return 1;
+    }
+    if (nc_server_accept_epoll_init()) {
+        /* BIND UNLOCK */
+        pthread_mutex_unlock(&server_opts.bind_lock);
+        return -1;
+    }
+    epfd = server_opts.accept_epfd;
 
-        /* remove all binds */
-        for (i = 0; i < server_opts.endpt_count; ++i) {
-            lydict_remove(server_opts.ctx, server_opts.binds[i].address);
-            if (server_opts.binds[i].sock > -1) {
-                close(server_opts.binds[i].sock);
-            }
-        }
-        free(server_opts.binds);
-        server_opts.binds = NULL;
+    /* BIND UNLOCK */
+    pthread_mutex_unlock(&server_opts.bind_lock);
 
-        server_opts.endpt_count = 0;
+    /* the same set nc_accept() waits on, it keeps track of the added and removed endpoints, the set is level-triggered
+     * so the connection is then accepted from it again */
+    sigfillset(&sigmask);
+    ret = epoll_pwait(epfd, &ev, 1, timeout, &sigmask);
+    if (ret == -1) {
+        ERR("Epoll wait failed (%s).", strerror(errno));
+        return -1;
+    }
+    return ret ? 1 : 0;
+}
 
-    } else {
-        /* remove one endpoint with bind(s) or all endpoints using one transport protocol */
-        for (i = 0; i < server_opts.endpt_count; ++i) {
-            if ((name && !strcmp(server_opts.endpts[i].name, name)) || (!name && (server_opts.endpts[i].ti == ti))) {
-                /* remove endpt */
-                lydict_remove(server_opts.ctx, server_opts.endpts[i].name);
-                switch (server_opts.endpts[i].ti) {
-#ifdef NC_ENABLED_SSH
-                case NC_TI_LIBSSH:
-                    nc_server_ssh_clear_opts(server_opts.endpts[i].opts.ssh);
-                    free(server_opts.endpts[i].opts.ssh);
-                    break;
-#endif
-#ifdef NC_ENABLED_TLS
-                case NC_TI_OPENSSL:
-                    nc_server_tls_clear_opts(server_opts.endpts[i].opts.tls);
-                    free(server_opts.endpts[i].opts.tls);
-                    break;
-#endif
-                case NC_TI_UNIX:
-                    free(server_opts.endpts[i].opts.unixsock);
-                    break;
-                default:
-                    ERRINT;
-                    break;
-                }
+#else
 
-                /* remove bind(s) */
-                lydict_remove(server_opts.ctx, server_opts.binds[i].address);
-                if (server_opts.binds[i].sock > -1) {
-                    close(server_opts.binds[i].sock);
-                }
+/* wait for a new connection on any endpoint without holding BIND LOCK, so that nc_accept() is not blocked,
+ * the poll array is kept by the caller between the calls */
+static int
+nc_accept_pipe_wait(int timeout, struct pollfd **pfd, uint16_t *pfd_size)
+{
+    sigset_t sigmask, origmask;
+    struct pollfd *mem;
+    uint16_t i, pfd_count;
+    int ret, pending = 0;
 
-                /* move last endpt and bind(s) to the empty space */
-                --server_opts.endpt_count;
-                if (!server_opts.endpt_count) {
-                    free(server_opts.binds);
-                    server_opts.binds = NULL;
-                    free(server_opts.endpts);
-                    server_opts.endpts = NULL;
-                } else if (i < server_opts.endpt_count) {
-                    memcpy(&server_opts.binds[i], &server_opts.binds[server_opts.endpt_count], sizeof *server_opts.binds);
-                    memcpy(&server_opts.endpts[i], &server_opts.endpts[server_opts.endpt_count], sizeof *server_opts.endpts);
-                }
+    /* BIND LOCK */
+    pthread_mutex_lock(&server_opts.bind_lock);
 
-                ret = 0;
-                if (name) {
-                    break;
-                }
-            }
+    if (*pfd_size < server_opts.endpt_count) {
+        mem = realloc(*pfd, server_opts.endpt_count * sizeof **pfd);
+        if (!mem) {
+            /* BIND UNLOCK */
+            pthread_mutex_unlock(&server_opts.bind_lock);
+            ERRMEM;
+            return -1;
         }
+        *pfd = mem;
+        *pfd_size = server_opts.endpt_count;
+    }
+    for (i = 0, pfd_count = 0; i < server_opts.endpt_count; ++i) {
+        if (server_opts.binds[i].sock < 0) {
+            continue;
+        }
+        if (server_opts.binds[i].pollin) {
+            /* leftover pollin */
+            pending = 1;
+            break;
+        }
+        (*pfd)[pfd_count].fd = server_opts.binds[i].sock;
+        (*pfd)[pfd_count].events = POLLIN;
+        (*pfd)[pfd_count].revents = 0;
+        ++pfd_count;
     }
-
-    /* ENDPT UNLOCK */
-    pthread_rwlock_unlock(&server_opts.endpt_lock);
 
     /* BIND UNLOCK */
     pthread_mutex_unlock(&server_opts.bind_lock);
 
-    return ret;
-}
-
-API int
-nc_server_endpt_count(void)
-{
-    return server_opts.endpt_count;
-}
+    if (pending) {
+        return 1;
+    } else if (!pfd_count) {
+        /* wait for an endpoint to be added */
+        usleep(timeout * 1000);
+        return 0;
+    }
 
-API int
-nc_server_is_endpt(const char *name)
-{
-    uint16_t i;
-    int found = 0;
+    /* a socket closed in the meantime only delays the wakeup until the timeout, the connection is then
+     * accepted from the current binds */
+    sigfillset(&sigmask);
+    pthread_sigmask(SIG_SETMASK, &sigmask, &origmask);
+    ret = poll(*pfd, pfd_count, timeout);
+    pthread_sigmask(SIG_SETMASK, &origmask, NULL);
 
-    if (!name) {
-        return found;
+    if (ret == -1) {
+        ERR("Poll failed (%s).", strerror(errno));
+        return -1;
     }
+    return ret ? 1 : 0;
+}
 
-    /* ENDPT READ LOCK */
-    pthread_rwlock_rdlock(&server_opts.endpt_lock);
+#endif
 
-    /* check name uniqueness */
-    for (i = 0; i < server_opts.endpt_count; ++i) {
-        if (!strcmp(server_opts.endpts[i].name, name)) {
-            found = 1;
+static void *
+nc_accept_pipe_acceptor_thread(void *UNUSED(arg))
+{
+    int sock, src_counted;
+    char *host;
+    uint16_t port, bind_idx;
+    uint8_t src_addr[16];
+    struct nc_accept_job *job;
+#ifndef NC_ACCEPT_EPOLL
+    struct pollfd *pfd = NULL;
+    uint16_t pfd_size = 0;
+#endif
+
+    while (1) {
+        /* ACCEPT PIPE LOCK */
+        pthread_mutex_lock(&server_opts.accept_pipe.lock);
+        while (!server_opts.accept_pipe.stop && (server_opts.accept_pipe.job_count >= NC_ACCEPT_PIPE_QUEUE_SIZE)) {
+            /* all the handshake threads are busy, leave new connections in the listen backlog */
+            pthread_cond_wait(&server_opts.accept_pipe.cond, &server_opts.accept_pipe.lock);
+        }
+        if (server_opts.accept_pipe.stop) {
+            /* ACCEPT PIPE UNLOCK */
+            pthread_mutex_unlock(&server_opts.accept_pipe.lock);
             break;
         }
-    }
+        /* ACCEPT PIPE UNLOCK */
+        pthread_mutex_unlock(&server_opts.accept_pipe.lock);
 
-    /* ENDPT UNLOCK */
-    pthread_rwlock_unlock(&server_opts.endpt_lock);
+#ifdef NC_ACCEPT_EPOLL
+        sock = nc_accept_pipe_wait(NC_ACCEPT_PIPE_POLL_TIMEOUT);
+#else
+        sock = nc_accept_pipe_wait(NC_ACCEPT_PIPE_POLL_TIMEOUT, &pfd, &pfd_size);
+#endif
+        if (sock < 1) {
+            if (sock < 0) {
+                /* do not spin on a persistent error */
+                usleep(NC_ACCEPT_PIPE_POLL_TIMEOUT * 1000);
+            }
+            continue;
+        }
 
-    return found;
-}
+        host = NULL;
 
-int
-nc_server_endpt_set_address_port(const char *endpt_name, const char *address, uint16_t port)
-{
-    struct nc_endpt *endpt;
-    struct nc_bind *bind = NULL;
-    uint16_t i;
-    int sock = -1, set_addr, ret = 0;
+        /* BIND LOCK */
+        pthread_mutex_lock(&server_opts.bind_lock);
 
-    if (!endpt_name) {
-        ERRARG("endpt_name");
-        return -1;
-    } else if ((!address && !port) || (address && port)) {
-        ERRARG("address and port");
-        return -1;
-    }
+        if (!server_opts.endpt_count) {
+            /* BIND UNLOCK */
+            pthread_mutex_unlock(&server_opts.bind_lock);
+            continue;
+        }
 
-    if (address) {
-        set_addr = 1;
-    } else {
-        set_addr = 0;
-    }
+        /* a connection is pending, accept it without waiting */
+        sock = nc_server_accept_binds(0, &host, &port, &bind_idx);
+        if (sock < 1) {
+            /* BIND UNLOCK */
+            pthread_mutex_unlock(&server_opts.bind_lock);
+            free(host);
+            if (sock < 0) {
+                /* do not spin on a persistent error */
+                usleep(NC_ACCEPT_PIPE_POLL_TIMEOUT * 1000);
+            }
+            continue;
+        }
 
-    /* BIND LOCK */
-    pthread_mutex_lock(&server_opts.bind_lock);
+        if (nc_server_load_get() == NC_LOAD_OVERLOAD) {
+            /* BIND UNLOCK */
+            pthread_mutex_unlock(&server_opts.bind_lock);
 
-    /* ENDPT LOCK */
-    endpt = nc_server_endpt_lock_get(endpt_name, 0, &i);
-    if (!endpt) {
-        /* BIND UNLOCK */
-        pthread_mutex_unlock(&server_opts.bind_lock);
-        return -1;
-    }
+            VRB("Server overloaded, dropping a new connection from %s.", host ? host : "<unknown>");
+            close(sock);
+            free(host);
+            continue;
+        }
 
-    bind = &server_opts.binds[i];
+        src_counted = nc_server_accept_filter(sock, host, src_addr);
+        if (src_counted == -1) {
+            /* BIND UNLOCK */
+            pthread_mutex_unlock(&server_opts.bind_lock);
 
-    if (set_addr) {
-        port = bind->port;
-    } else {
-        address = bind->address;
-    }
+            close(sock);
+            free(host);
+            continue;
+        }
 
-    if (!set_addr && endpt->ti == NC_TI_UNIX) {
-        ret = -1;
-        goto cleanup;
-    }
+        job = malloc(sizeof *job);
+        if (!job) {
+            /* BIND UNLOCK */
+            pthread_mutex_unlock(&server_opts.bind_lock);
 
-    /* we have all the information we need to create a listening socket */
-    if (address && (port || endpt->ti == NC_TI_UNIX)) {
-        /* create new socket, close the old one */
-        if (endpt->ti == NC_TI_UNIX)
-            sock = nc_sock_listen_unix(address, endpt->opts.unixsock);
-        else
-            sock = nc_sock_listen_inet(address, port, &endpt->ka);
-        if (sock == -1) {
-            ret = -1;
-            goto cleanup;
+            ERRMEM;
+            close(sock);
+            free(host);
+            if (src_counted) {
+                nc_server_accept_src_release(src_addr);
+            }
+            continue;
         }
+        job->sock = sock;
+        job->host = host;
+        job->port = port;
+        memcpy(job->src_addr, src_addr, sizeof job->src_addr);
+        job->src_counted = src_counted;
+        /* endpoints cannot be added or removed while holding bind_lock */
+        job->endpt_name = lydict_insert(server_opts.ctx, server_opts.endpts[bind_idx].name, 0);
+        job->next = NULL;
 
-        if (bind->sock > -1) {
-            close(bind->sock);
-        }
-        bind->sock = sock;
-    } /* else we are just setting address or port */
+        /* BIND UNLOCK */
+        pthread_mutex_unlock(&server_opts.bind_lock);
 
-    if (set_addr) {
-        lydict_remove(server_opts.ctx, bind->address);
-        bind->address = lydict_insert(server_opts.ctx, address, 0);
-    } else {
-        bind->port = port;
+        /* ACCEPT PIPE LOCK */
+        pthread_mutex_lock(&server_opts.accept_pipe.lock);
+        if (server_opts.accept_pipe.jobs_last) {
+            server_opts.accept_pipe.jobs_last->next = job;
+        } else {
+            server_opts.accept_pipe.jobs = job;
+        }
+        server_opts.accept_pipe.jobs_last = job;
+        ++server_opts.accept_pipe.job_count;
+        pthread_cond_broadcast(&server_opts.accept_pipe.cond);
+        /* ACCEPT PIPE UNLOCK */
+        pthread_mutex_unlock(&server_opts.accept_pipe.lock);
     }
 
-    if (sock > -1) {
-#if defined(NC_ENABLED_SSH) && defined(NC_ENABLED_TLS)
-        VRB("Listening on %s:%u for %s connections.", address, port, (endpt->ti == NC_TI_LIBSSH ? "SSH" : "TLS"));
-#elif defined(NC_ENABLED_SSH)
-        VRB("Listening on %s:%u for SSH connections.", address, port);
-#else
-        VRB("Listening on %s:%u for TLS connections.", address, port);
+#ifndef NC_ACCEPT_EPOLL
+    free(pfd);
 #endif
-    }
-
-cleanup:
-    /* ENDPT UNLOCK */
-    pthread_rwlock_unlock(&server_opts.endpt_lock);
-
-    /* BIND UNLOCK */
-    pthread_mutex_unlock(&server_opts.bind_lock);
-
-    return ret;
+    return NULL;
 }
 
-API int
-nc_server_endpt_set_address(const char *endpt_name, const char *address)
+static void *
+nc_accept_pipe_handshake_thread(void *UNUSED(arg))
 {
-    return nc_server_endpt_set_address_port(endpt_name, address, 0);
-}
+    struct nc_accept_job *job;
+    struct nc_session *session;
+    uint16_t i;
 
-API int
-nc_server_endpt_set_port(const char *endpt_name, uint16_t port)
-{
-    return nc_server_endpt_set_address_port(endpt_name, NULL, port);
-}
+    while (1) {
+        /* ACCEPT PIPE LOCK */
+        pthread_mutex_lock(&server_opts.accept_pipe.lock);
+        while (!server_opts.accept_pipe.stop && !server_opts.accept_pipe.jobs) {
+            pthread_cond_wait(&server_opts.accept_pipe.cond, &server_opts.accept_pipe.lock);
+        }
+        if (server_opts.accept_pipe.stop) {
+            /* ACCEPT PIPE UNLOCK */
+            pthread_mutex_unlock(&server_opts.accept_pipe.lock);
+            break;
+        }
 
-API int
-nc_server_endpt_set_perms(const char *endpt_name, mode_t mode, uid_t uid, gid_t gid)
-{
-    struct nc_endpt *endpt;
-    uint16_t i;
-    int ret = 0;
+        job = server_opts.accept_pipe.jobs;
+        server_opts.accept_pipe.jobs = job->next;
+        if (!server_opts.accept_pipe.jobs) {
+            server_opts.accept_pipe.jobs_last = NULL;
+        }
+        --server_opts.accept_pipe.job_count;
 
-    if (!endpt_name) {
-        ERRARG("endpt_name");
-        return -1;
-    } else if (mode == 0) {
-        ERRARG("mode");
-        return -1;
-    }
+        /* the acceptor thread may be waiting for a free slot */
+        pthread_cond_broadcast(&server_opts.accept_pipe.cond);
 
-    /* ENDPT LOCK */
-    endpt = nc_server_endpt_lock_get(endpt_name, 0, &i);
-    if (!endpt)
-        return -1;
+        /* ACCEPT PIPE UNLOCK */
+        pthread_mutex_unlock(&server_opts.accept_pipe.lock);
 
-    if (endpt->ti != NC_TI_UNIX) {
-        ret = -1;
-        goto cleanup;
-    }
+        /* ENDPT READ LOCK */
+        pthread_rwlock_rdlock(&server_opts.endpt_lock);
 
-    endpt->opts.unixsock->mode = mode;
-    endpt->opts.unixsock->uid = uid;
-    endpt->opts.unixsock->gid = gid;
+        /* the endpoint could have been removed in the meantime */
+        for (i = 0; i < server_opts.endpt_count; ++i) {
+            if (!strcmp(server_opts.endpts[i].name, job->endpt_name)) {
+                break;
+            }
+        }
+        if (i == server_opts.endpt_count) {
+            /* ENDPT UNLOCK */
+            pthread_rwlock_unlock(&server_opts.endpt_lock);
 
-cleanup:
-    /* ENDPT UNLOCK */
-    pthread_rwlock_unlock(&server_opts.endpt_lock);
+            VRB("Endpoint \"%s\" was removed, dropping a new connection from %s.", job->endpt_name, job->host);
+            nc_accept_pipe_job_free(job);
+            continue;
+        }
 
-    return ret;
+        /* sock, host, and the source are consumed, ENDPT UNLOCK */
+        if (nc_accept_session(job->sock, job->host, job->port, job->src_counted ? job->src_addr : NULL, i, &session)
+                == NC_MSG_HELLO) {
+            server_opts.accept_pipe.session_clb(session, server_opts.accept_pipe.clb_data);
+        }
+        job->sock = -1;
+        job->host = NULL;
+        job->src_counted = 0;
+        nc_accept_pipe_job_free(job);
+    }
+
+    return NULL;
 }
 
 API int
-nc_server_endpt_enable_keepalives(const char *endpt_name, int enable)
+nc_server_accept_pipeline_start(uint16_t thread_count, void (*session_clb)(struct nc_session *new_session,
+        void *user_data), void *user_data)
 {
-    struct nc_endpt *endpt;
-    int ret = 0;
+    uint16_t i;
+    int ret;
 
-    if (!endpt_name) {
-        ERRARG("endpt_name");
+    if (!server_opts.ctx) {
+        ERRINIT;
         return -1;
-    }
-
-    /* ENDPT LOCK */
-    endpt = nc_server_endpt_lock_get(endpt_name, 0, NULL);
-    if (!endpt) {
+    } else if (!thread_count) {
+        ERRARG("thread_count");
+        return -1;
+    } else if (!session_clb) {
+        ERRARG("session_clb");
         return -1;
     }
 
-    endpt->ka.enabled = (enable ? 1 : 0);
-
-    /* ENDPT UNLOCK */
-    pthread_rwlock_unlock(&server_opts.endpt_lock);
-
-    return ret;
-}
-
-API int
-nc_server_endpt_set_keepalives(const char *endpt_name, int idle_time, int max_probes, int probe_interval)
-{
-    struct nc_endpt *endpt;
-    int ret = 0;
+    /* ACCEPT PIPE LOCK */
+    pthread_mutex_lock(&server_opts.accept_pipe.lock);
 
-    if (!endpt_name) {
-        ERRARG("endpt_name");
+    if (server_opts.accept_pipe.workers || server_opts.accept_pipe.stop) {
+        ERR("Accept pipeline is already running.");
+        /* ACCEPT PIPE UNLOCK */
+        pthread_mutex_unlock(&server_opts.accept_pipe.lock);
         return -1;
     }
 
-    /* ENDPT LOCK */
-    endpt = nc_server_endpt_lock_get(endpt_name, 0, NULL);
-    if (!endpt) {
+    server_opts.accept_pipe.workers = malloc(thread_count * sizeof *server_opts.accept_pipe.workers);
+    if (!server_opts.accept_pipe.workers) {
+        ERRMEM;
+        /* ACCEPT PIPE UNLOCK */
+        pthread_mutex_unlock(&server_opts.accept_pipe.lock);
         return -1;
     }
+    server_opts.accept_pipe.session_clb = session_clb;
+    server_opts.accept_pipe.clb_data = user_data;
 
-    if (idle_time > -1) {
-        endpt->ka.idle_time = idle_time;
-    }
-    if (max_probes > -1) {
-        endpt->ka.max_probes = max_probes;
-    }
-    if (probe_interval > -1) {
-        endpt->ka.probe_interval = probe_interval;
+    for (i = 0; i < thread_count; ++i) {
+        ret = pthread_create(&server_opts.accept_pipe.workers[i], NULL, nc_accept_pipe_handshake_thread, NULL);
+        if (ret) {
+            ERR("Creating a new thread failed (%s).", strerror(ret));
+            break;
+        }
     }
+    server_opts.accept_pipe.worker_count = i;
 
-    /* ENDPT UNLOCK */
-    pthread_rwlock_unlock(&server_opts.endpt_lock);
-
-    return ret;
-}
-
-API NC_MSG_TYPE
-nc_accept(int timeout, struct nc_session **session)
-{
-    NC_MSG_TYPE msgtype;
-    int sock, ret;
-    char *host = NULL;
-    uint16_t port, bind_idx;
-    struct timespec ts_cur;
-
-    if (!server_opts.ctx) {
-        ERRINIT;
-        return NC_MSG_ERROR;
-    } else if (!session) {
-        ERRARG("session");
-        return NC_MSG_ERROR;
+    if (i == thread_count) {
+        ret = pthread_create(&server_opts.accept_pipe.acceptor, NULL, nc_accept_pipe_acceptor_thread, NULL);
+        if (!ret) {
+            /* ACCEPT PIPE UNLOCK */
+            pthread_mutex_unlock(&server_opts.accept_pipe.lock);
+            return 0;
+        }
+        ERR("Creating a new thread failed (%s).", strerror(ret));
     }
 
-    /* BIND LOCK */
-    pthread_mutex_lock(&server_opts.bind_lock);
+    /* stop the threads created so far */
+    server_opts.accept_pipe.stop = 1;
+    pthread_cond_broadcast(&server_opts.accept_pipe.cond);
 
-    if (!server_opts.endpt_count) {
-        ERR("No endpoints to accept sessions on.");
-        /* BIND UNLOCK */
-        pthread_mutex_unlock(&server_opts.bind_lock);
-        return NC_MSG_ERROR;
-    }
+    /* ACCEPT PIPE UNLOCK */
+    pthread_mutex_unlock(&server_opts.accept_pipe.lock);
 
-    ret = nc_sock_accept_binds(server_opts.binds, server_opts.endpt_count, timeout, &host, &port, &bind_idx);
-    if (ret < 1) {
-        /* BIND UNLOCK */
-        pthread_mutex_unlock(&server_opts.bind_lock);
-        free(host);
-        if (!ret) {
-            return NC_MSG_WOULDBLOCK;
-        }
-        return NC_MSG_ERROR;
+    for (i = 0; i < server_opts.accept_pipe.worker_count; ++i) {
+        pthread_join(server_opts.accept_pipe.workers[i], NULL);
     }
 
-    /* switch bind_lock for endpt_lock, so that another thread can accept another session */
-    /* ENDPT READ LOCK */
-    pthread_rwlock_rdlock(&server_opts.endpt_lock);
+    /* ACCEPT PIPE LOCK */
+    pthread_mutex_lock(&server_opts.accept_pipe.lock);
+    free(server_opts.accept_pipe.workers);
+    server_opts.accept_pipe.workers = NULL;
+    server_opts.accept_pipe.worker_count = 0;
+    server_opts.accept_pipe.session_clb = NULL;
+    server_opts.accept_pipe.clb_data = NULL;
+    server_opts.accept_pipe.stop = 0;
+    /* ACCEPT PIPE UNLOCK */
+    pthread_mutex_unlock(&server_opts.accept_pipe.lock);
 
-    /* BIND UNLOCK */
-    pthread_mutex_unlock(&server_opts.bind_lock);
+    return -1;
+}
 
-    sock = ret;
+API void
+nc_server_accept_pipeline_stop(void)
+{
+    pthread_t *workers;
+    uint16_t worker_count, i;
+    struct nc_accept_job *job;
 
-    *session = nc_new_session(NC_SERVER, 0);
-    if (!(*session)) {
-        ERRMEM;
-        close(sock);
-        free(host);
-        msgtype = NC_MSG_ERROR;
-        goto cleanup;
-    }
-    (*session)->status = NC_STATUS_STARTING;
-    (*session)->ctx = server_opts.ctx;
-    (*session)->flags = NC_SESSION_SHAREDCTX;
-    (*session)->host = lydict_insert_zc(server_opts.ctx, host);
-    (*session)->port = port;
+    /* ACCEPT PIPE LOCK */
+    pthread_mutex_lock(&server_opts.accept_pipe.lock);
 
-    /* sock gets assigned to session or closed */
-#ifdef NC_ENABLED_SSH
-    if (server_opts.endpts[bind_idx].ti == NC_TI_LIBSSH) {
-        (*session)->data = server_opts.endpts[bind_idx].opts.ssh;
-        ret = nc_accept_ssh_session(*session, sock, NC_TRANSPORT_TIMEOUT);
-        if (ret < 0) {
-            msgtype = NC_MSG_ERROR;
-            goto cleanup;
-        } else if (!ret) {
-            msgtype = NC_MSG_WOULDBLOCK;
-            goto cleanup;
-        }
-    } else
-#endif
-#ifdef NC_ENABLED_TLS
-    if (server_opts.endpts[bind_idx].ti == NC_TI_OPENSSL) {
-        (*session)->data = server_opts.endpts[bind_idx].opts.tls;
-        ret = nc_accept_tls_session(*session, sock, NC_TRANSPORT_TIMEOUT);
-        if (ret < 0) {
-            msgtype = NC_MSG_ERROR;
-            goto cleanup;
-        } else if (!ret) {
-            msgtype = NC_MSG_WOULDBLOCK;
-            goto cleanup;
-        }
-    } else
-#endif
-    if (server_opts.endpts[bind_idx].ti == NC_TI_UNIX) {
-        (*session)->data = server_opts.endpts[bind_idx].opts.unixsock;
-        ret = nc_accept_unix(*session, sock);
-        if (ret < 0) {
-            msgtype = NC_MSG_ERROR;
-            goto cleanup;
-        }
-    } else {
-        ERRINT;
-        close(sock);
-        msgtype = NC_MSG_ERROR;
-        goto cleanup;
+    if (!server_opts.accept_pipe.workers || server_opts.accept_pipe.stop) {
+        /* not running or being stopped by another thread */
+        /* ACCEPT PIPE UNLOCK */
+        pthread_mutex_unlock(&server_opts.accept_pipe.lock);
+        return;
     }
 
-    (*session)->data = NULL;
+    server_opts.accept_pipe.stop = 1;
+    pthread_cond_broadcast(&server_opts.accept_pipe.cond);
+    workers = server_opts.accept_pipe.workers;
+    worker_count = server_opts.accept_pipe.worker_count;
 
-    /* ENDPT UNLOCK */
-    pthread_rwlock_unlock(&server_opts.endpt_lock);
-
-    /* assign new SID atomically */
-    (*session)->id = ATOMIC_INC(&server_opts.new_session_id);
+    /* ACCEPT PIPE UNLOCK */
+    pthread_mutex_unlock(&server_opts.accept_pipe.lock);
 
-    /* NETCONF handshake */
-    msgtype = nc_handshake_io(*session);
-    if (msgtype != NC_MSG_HELLO) {
-        nc_session_free(*session, NULL);
-        *session = NULL;
-        return msgtype;
+    /* handshakes in progress are finished */
+    pthread_join(server_opts.accept_pipe.acceptor, NULL);
+    for (i = 0; i < worker_count; ++i) {
+        pthread_join(workers[i], NULL);
     }
 
-    nc_gettimespec_mono(&ts_cur);
-    (*session)->opts.server.last_rpc = ts_cur.tv_sec;
-    nc_gettimespec_real(&ts_cur);
-    (*session)->opts.server.session_start = ts_cur.tv_sec;
-    (*session)->status = NC_STATUS_RUNNING;
+    /* ACCEPT PIPE LOCK */
+    pthread_mutex_lock(&server_opts.accept_pipe.lock);
 
-    return msgtype;
+    /* drop connections no thread got to */
+    while (server_opts.accept_pipe.jobs) {
+        job = server_opts.accept_pipe.jobs;
+        server_opts.accept_pipe.jobs = job->next;
+        nc_accept_pipe_job_free(job);
+    }
+    server_opts.accept_pipe.jobs_last = NULL;
+    server_opts.accept_pipe.job_count = 0;
 
-cleanup:
-    /* ENDPT UNLOCK */
-    pthread_rwlock_unlock(&server_opts.endpt_lock);
+    free(server_opts.accept_pipe.workers);
+    server_opts.accept_pipe.workers = NULL;
+    server_opts.accept_pipe.worker_count = 0;
+    server_opts.accept_pipe.session_clb = NULL;
+    server_opts.accept_pipe.clb_data = NULL;
+    server_opts.accept_pipe.stop = 0;
 
-    nc_session_free(*session, NULL);
-    *session = NULL;
-    return msgtype;
+    /* ACCEPT PIPE UNLOCK */
+    pthread_mutex_unlock(&server_opts.accept_pipe.lock);
 }
 
 /* client is expected to be locked */
@@ -89,6 +89,16 @@ void nc_session_set_status(struct nc_session *session, NC_STATUS status);
  */
 void nc_set_global_rpc_clb(nc_rpc_clb clb);
 
+/**
+ * @brief Set a callback deciding RPC priority when the server is overloaded (#NC_LOAD_OVERLOAD).
+ *
+ * Low-priority RPCs are answered with a resource-denied error while the server is overloaded.
+ * If no callback is set, only \<close-session\> and \<kill-session\> are considered high-priority.
+ *
+ * @param[in] prio_clb Callback returning non-zero for a high-priority \p rpc, NULL to default.
+ */
+void nc_server_set_rpc_priority_clb(int (*prio_clb)(const struct lyd_node *rpc, const struct nc_session *session));
+
 /**@} Server Session */
 
 /**
@@ -201,6 +211,87 @@ void nc_server_set_idle_timeout(uint16_t idle_timeout);
  */
 uint16_t nc_server_get_idle_timeout(void);
 
+/**
+ * @brief Set server overload thresholds.
+ *
+ * The server switches to #NC_LOAD_OVERLOAD once any of the high thresholds is reached
+ * and back to #NC_LOAD_NORMAL only after all the values drop to their low thresholds.
+ * While overloaded, new connections are dropped in nc_accept() before any handshake
+ * and low-priority RPCs (see nc_server_set_rpc_priority_clb()) are answered with a resource-denied error.
+ *
+ * @param[in] queue_high Number of threads waiting in all the pollsession queues, 0 to ignore.
+ * @param[in] queue_low Queued threads to return to normal state.
+ * @param[in] latency_high Average RPC processing time in msec, 0 to ignore.
+ * @param[in] latency_low Average RPC processing time to return to normal state.
+ * @param[in] mem_high Resident memory of the process in bytes, 0 to ignore.
+ * @param[in] mem_low Resident memory to return to normal state.
+ * @return 0 on success, -1 on error.
+ */
+int nc_server_set_overload_thresholds(uint32_t queue_high, uint32_t queue_low, uint32_t latency_high,
+        uint32_t latency_low, uint64_t mem_high, uint64_t mem_low);
+
+/**
+ * @brief Get current server load state.
+ *
+ * @param[out] queue_depth Number of threads waiting in all the pollsession queues. Can be NULL.
+ * @param[out] latency Average RPC processing time in msec. Can be NULL.
+ * @param[out] mem Last measured resident memory of the process in bytes, 0 if not measured. Can be NULL.
+ * @return Server load state.
+ */
+NC_LOAD_STATE nc_server_get_load_state(uint32_t *queue_depth, uint32_t *latency, uint64_t *mem);
+
+/**
+ * @brief Set RPC rate limits shared by all the sessions of a user.
+ *
+ * The limits are enforced using token buckets when an RPC is received, before it is parsed.
+ * RPCs over the limit are answered with a resource-denied error. Note that a message larger
+ * than \p byte_burst can never pass so it should be set to at least the largest expected message.
+ *
+ * @param[in] username Name of the user.
+ * @param[in] rpc_rate Number of RPCs per second, 0 for no limit.
+ * @param[in] rpc_burst Maximum burst of RPCs, 0 to use \p rpc_rate.
+ * @param[in] byte_rate Number of received bytes per second, 0 for no limit.
+ * @param[in] byte_burst Maximum burst of received bytes, 0 to use \p byte_rate.
+ * If both \p rpc_rate and \p byte_rate are 0, the user limits are removed.
+ * @return 0 on success, -1 on error.
+ */
+int nc_server_set_user_rate_limit(const char *username, uint32_t rpc_rate, uint32_t rpc_burst, uint32_t byte_rate,
+        uint32_t byte_burst);
+
+/**
+ * @brief Add an accept filter rule for a source address prefix or change the action of an existing one.
+ *
+ * Every new TCP connection is matched against the rules right after it is accepted, before any
+ * SSH or TLS handshake. The rule with the longest matching prefix is used, if none matches,
+ * the connection is allowed. IPv4 addresses also match IPv4-mapped IPv6 prefixes.
+ *
+ * @param[in] prefix Address prefix such as "192.0.2.0/24" or "2001:db8::/32", a plain address
+ *                   is a prefix of full length.
+ * @param[in] action Action for connections from \p prefix.
+ * @return 0 on success, -1 on error.
+ */
+int nc_server_add_accept_rule(const char *prefix, NC_ACCEPT_ACTION action);
+
+/**
+ * @brief Remove an accept filter rule.
+ *
+ * @param[in] prefix Address prefix of the rule, NULL removes all the rules.
+ * @return 0 on success, -1 on not finding any match.
+ */
+int nc_server_del_accept_rule(const char *prefix);
+
+/**
+ * @brief Set the limits of new TCP connections from a single source address.
+ *
+ * Connections over the limits are closed right after they are accepted, before any SSH
+ * or TLS handshake. Connections accepted before the limits were set are not counted.
+ *
+ * @param[in] conn_rate Number of new connections per second, 0 for no limit (default).
+ * @param[in] conn_burst Maximum burst of new connections, 0 to use \p conn_rate.
+ * @param[in] max_sessions Maximum number of concurrent sessions, 0 for no limit (default).
+ */
+void nc_server_set_accept_src_limits(uint32_t conn_rate, uint32_t conn_burst, uint16_t max_sessions);
+
 /**
  * @brief Get all the server capabilities including all the schemas.
  *
@@ -445,6 +536,59 @@ int nc_server_endpt_enable_keepalives(const char *endpt_name, int enable);
  */
 int nc_server_endpt_set_keepalives(const char *endpt_name, int idle_time, int max_probes, int probe_interval);
 
+/**
+ * @brief Change endpoint per-session RPC rate limits. Affects only new connections.
+ *
+ * Every session accepted on the endpoint gets its own token buckets, RPCs over the limit
+ * are answered with a resource-denied error before they are parsed.
+ *
+ * @param[in] endpt_name Existing endpoint name.
+ * @param[in] rpc_rate Number of RPCs per second, 0 for no limit (default).
+ * @param[in] rpc_burst Maximum burst of RPCs, 0 to use \p rpc_rate.
+ * @param[in] byte_rate Number of received bytes per second, 0 for no limit (default).
+ * @param[in] byte_burst Maximum burst of received bytes, 0 to use \p byte_rate.
+ * @return 0 on success, -1 on error.
+ */
+int nc_server_endpt_set_rate_limit(const char *endpt_name, uint32_t rpc_rate, uint32_t rpc_burst, uint32_t byte_rate,
+        uint32_t byte_burst);
+
+/**
+ * @brief Return value of an authentication callback whose result is delivered later using an authentication token.
+ */
+#define NC_AUTH_PENDING -2
+
+/**
+ * @brief Token of a deferred authentication.
+ */
+struct nc_auth_token;
+
+/**
+ * @brief Defer the authentication of a session. Can be called only from an authentication callback
+ *        (SSH password, public key, and interactive callbacks or the TLS user verify callback),
+ *        which must then return ::NC_AUTH_PENDING.
+ *
+ * The authentication is completed using nc_server_auth_complete() from any thread, which allows
+ * expensive authentication (PAM, directory services, databases) to run in an application thread pool.
+ * SSH password and signed public key requests are then answered from the authentication loop of the
+ * handshake once completed, the callback returns right away. SSH interactive requests, public key
+ * queries, and TLS user verification need the request for the answer so the callback waits for
+ * the completion. Either way, the result is waited for only until the authentication timeout
+ * of the handshake (for SSH the endpoint authentication timeout, for TLS the handshake timeout) elapses.
+ *
+ * @param[in] session Session being authenticated, as passed to the callback.
+ * @return Authentication token, NULL on error.
+ */
+struct nc_auth_token *nc_server_auth_defer(const struct nc_session *session);
+
+/**
+ * @brief Complete a deferred authentication. Must be called exactly once for every token,
+ *        even if the session has meanwhile timed out, the token is freed.
+ *
+ * @param[in] token Token returned by nc_server_auth_defer().
+ * @param[in] authenticated Non-zero if the user was authenticated, zero if not.
+ */
+void nc_server_auth_complete(struct nc_auth_token *token, int authenticated);
+
 /**@} Server */
 
 /**
@@ -458,6 +602,9 @@ int nc_server_endpt_set_keepalives(const char *endpt_name, int idle_time, int ma
  * is used for waiting for transport-related data, which means this call can block
  * for much longer that \p timeout, but only with slow/faulty/malicious clients.
  *
+ * If the server is overloaded (see nc_server_set_overload_thresholds()), the new connection
+ * is dropped right away and NC_MSG_WOULDBLOCK is returned.
+ *
  * @param[in] timeout Timeout for receiving a new connection in milliseconds, 0 for
  *                    non-blocking call, -1 for infinite waiting.
  * @param[out] session New session.
@@ -466,6 +613,34 @@ int nc_server_endpt_set_keepalives(const char *endpt_name, int idle_time, int ma
  */
 NC_MSG_TYPE nc_accept(int timeout, struct nc_session **session);
 
+/**
+ * @brief Start accepting new sessions on all the listening endpoints in the background.
+ *
+ * A single thread only accepts new connections and queues them, the transport and NETCONF
+ * handshakes are then performed by \p thread_count handshake threads in parallel so that
+ * a slow or malicious client delays only one of them. Every established session is passed
+ * to \p session_clb, which is then responsible for it (usually adds it into a pollsession).
+ * Connections that fail the handshake are just dropped.
+ *
+ * Can be used together with nc_accept(), but not more than one pipeline can run at a time.
+ *
+ * @param[in] thread_count Number of handshake threads.
+ * @param[in] session_clb Callback called from a handshake thread for every new session.
+ *                        It must not call nc_server_accept_pipeline_stop().
+ * @param[in] user_data Arbitrary user data passed to \p session_clb.
+ * @return 0 on success, -1 on error.
+ */
+int nc_server_accept_pipeline_start(uint16_t thread_count, void (*session_clb)(struct nc_session *new_session,
+        void *user_data), void *user_data);
+
+/**
+ * @brief Stop the background accepting of new sessions.
+ *
+ * Waits for all the handshakes in progress to finish, connections accepted but not
+ * handshaked yet are closed. Called by nc_server_destroy().
+ */
+void nc_server_accept_pipeline_stop(void);
+
 #endif /* NC_ENABLED_SSH || NC_ENABLED_TLS */
 
 #ifdef NC_ENABLED_SSH
@@ -518,6 +693,9 @@ int nc_server_ssh_add_authkey(const char *pubkey_base64, NC_SSH_KEY_TYPE type, c
  * @brief Add an authorized client SSH public key. This public key can be used for
  *        publickey authentication (for any SSH connection, even Call Home) afterwards.
  *
+ * The key file is read only once, by this function, so it must already exist. A key file
+ * created later or changed must be added (again) after that.
+ *
  * @param[in] pubkey_path Path to the public key.
  * @param[in] username Username that the client with the public key must use.
  * @return 0 on success, -1 on error.
@@ -540,7 +718,8 @@ int nc_server_ssh_del_authkey(const char *pubkey_path, const char *pubkey_base64
  * @brief Set the callback for SSH password authentication. If none is set, local system users are used.
  *
  * @param[in] passwd_auth_clb Callback that should authenticate the user. Username can be directly obtained from \p session.
- *                            Zero return indicates success, non-zero an error.
+ *                            Zero return indicates success, non-zero an error. ::NC_AUTH_PENDING if the
+ *                            authentication was deferred using nc_server_auth_defer().
  * @param[in] user_data Optional arbitrary user data that will be passed to \p passwd_auth_clb.
  * @param[in] free_user_data Optional callback that will be called during cleanup to free any \p user_data.
  */
@@ -548,11 +727,31 @@ void nc_server_ssh_set_passwd_auth_clb(int (*passwd_auth_clb)(const struct nc_se
                                                               void *user_data),
                                        void *user_data, void (*free_user_data)(void *user_data));
 
+/**
+ * @brief Set how long the password hashes of local system users are cached. Used only if no
+ *        password authentication callback is set. Users that cannot authenticate using a password
+ *        are cached as well. Any change flushes the cache.
+ *
+ * @param[in] ttl Number of seconds an entry stays in the cache, 0 disables caching (default).
+ */
+void nc_server_ssh_set_passwd_cache_ttl(uint16_t ttl);
+
+/**
+ * @brief Limit the number of concurrent password hash computations of local system users. Used only
+ *        if no password authentication callback is set. Authentication attempts that exceed both limits
+ *        are denied right away.
+ *
+ * @param[in] max_running Maximum number of hashes computed at once, 0 for no limit (default).
+ * @param[in] max_waiting Maximum number of attempts waiting for a computation to finish.
+ */
+void nc_server_ssh_set_passwd_crypt_limit(uint16_t max_running, uint16_t max_waiting);
+
 /**
  * @brief Set the callback for SSH interactive authentication. If none is set, local system users are used.
  *
  * @param[in] interactive_auth_clb Callback that should authenticate the user.
- *                            Zero return indicates success, non-zero an error.
+ *                            Zero return indicates success, non-zero an error, -1 if a reply was already sent.
+ *                            ::NC_AUTH_PENDING if the authentication was deferred using nc_server_auth_defer().
  * @param[in] user_data Optional arbitrary user data that will be passed to \p passwd_auth_clb.
  * @param[in] free_user_data Optional callback that will be called during cleanup to free any \p user_data.
  */
@@ -564,7 +763,8 @@ void nc_server_ssh_set_interactive_auth_clb(int (*interactive_auth_clb)(const st
  * @brief Set the callback for SSH public key authentication. If none is set, local system users are used.
  *
  * @param[in] pubkey_auth_clb Callback that should authenticate the user.
- *                            Zero return indicates success, non-zero an error.
+ *                            Zero return indicates success, non-zero an error. ::NC_AUTH_PENDING if the
+ *                            authentication was deferred using nc_server_auth_defer().
  * @param[in] user_data Optional arbitrary user data that will be passed to \p passwd_auth_clb.
  * @param[in] free_user_data Optional callback that will be called during cleanup to free any \p user_data.
  */
@@ -593,6 +793,9 @@ void nc_server_ssh_set_hostkey_clb(int (*hostkey_clb)(const char *name, void *us
  * @brief Add endpoint SSH host keys the server will identify itself with. Only the name is set, the key itself
  *        wil be retrieved using a callback.
  *
+ * With libssh 0.8 or newer the host keys of an endpoint are retrieved and imported only once, when
+ * the first client connects, and reused until the host keys of the endpoint are changed.
+ *
  * @param[in] endpt_name Existing endpoint name.
  * @param[in] name Arbitrary name of the host key.
  * @param[in] idx Optional index where to add the key. -1 adds at the end.
@@ -666,6 +869,17 @@ int nc_server_ssh_endpt_set_auth_attempts(const char *endpt_name, uint16_t auth_
  */
 int nc_server_ssh_endpt_set_auth_timeout(const char *endpt_name, uint16_t auth_timeout);
 
+/**
+ * @brief Set endpoint SSH write buffer size. Message data are coalesced into writes of this size
+ *        (including the chunk header and the end tag) before being sent to the SSH channel, larger
+ *        buffer means fewer SSH packets for large replies, useful on high-latency links. 1 kB by default.
+ *
+ * @param[in] endpt_name Existing endpoint name.
+ * @param[in] size Buffer size in bytes, 0 or values smaller than the default mean the default, at most 1 MB.
+ * @return 0 on success, -1 on error.
+ */
+int nc_server_ssh_endpt_set_write_buffer(const char *endpt_name, uint32_t size);
+
 /**@} Server SSH */
 
 #endif /* NC_ENABLED_SSH */
@@ -684,6 +898,10 @@ int nc_server_ssh_endpt_set_auth_timeout(const char *endpt_name, uint16_t auth_t
  * @brief Set the server TLS certificate. Only the name is set, the certificate itself
  *        wil be retrieved using a callback.
  *
+ * The certificates and keys of an endpoint are loaded only once, when the first client connects, and
+ * reused for all the following connections until any TLS setting of the endpoint changes. Setting
+ * the same certificate again can be used to reload it.
+ *
  * @param[in] endpt_name Existing endpoint name.
  * @param[in] name Arbitrary certificate name.
  * @return 0 on success, -1 on error.
@@ -708,6 +926,16 @@ void nc_server_tls_set_server_cert_clb(int (*cert_clb)(const char *name, void *u
         char **privkey_path, char **privkey_data, NC_SSH_KEY_TYPE *privkey_type), void *user_data,
         void (*free_user_data)(void *user_data));
 
+/**
+ * @brief Drop the TLS contexts cached for all the endpoints and Call Home clients.
+ *
+ * The server certificates and the trusted certificate lists are retrieved using their callbacks only
+ * when a context is created, on the next accepted session. Call this after the content returned by
+ * the callbacks changes under the same names (such as a rotated certificate), setting any of the
+ * callbacks does it too. Sessions already established are not affected.
+ */
+void nc_server_tls_invalidate_ctx(void);
+
 /**
  * @brief Set the callback for retrieving server certificate chain
  *
@@ -772,10 +1000,36 @@ int nc_server_tls_endpt_del_trusted_cert_list(const char *endpt_name, const char
  */
 int nc_server_tls_endpt_set_trusted_ca_paths(const char *endpt_name, const char *ca_file, const char *ca_dir);
 
+/**
+ * @brief Set TLS session resumption using a server-side session cache. Resumed sessions skip
+ *        the certificate verification and keep the username learned by cert-to-name when
+ *        the session was created. The cache is flushed when any TLS setting of the endpoint changes.
+ *
+ * @param[in] endpt_name Existing endpoint name.
+ * @param[in] cache_size Maximum number of cached sessions, 0 to disable resumption (default).
+ * @param[in] timeout Lifetime of a cached session in seconds, 0 for the OpenSSL default.
+ * @return 0 on success, -1 on error.
+ */
+int nc_server_tls_endpt_set_session_cache(const char *endpt_name, uint32_t cache_size, uint32_t timeout);
+
+/**
+ * @brief Set kernel TLS (kTLS) offload of new TLS sessions. Once the handshake is finished, the records
+ *        are encrypted and decrypted by the kernel. If the kernel or the negotiated cipher does not support it,
+ *        OpenSSL processes the records as usual. Disabled by default.
+ *
+ * @param[in] endpt_name Existing endpoint name.
+ * @param[in] enable Whether to request kTLS offload.
+ * @return 0 on success, -1 on error (including OpenSSL without kTLS support).
+ */
+int nc_server_tls_endpt_set_ktls(const char *endpt_name, int enable);
+
 /**
  * @brief Set Certificate Revocation List locations. There can only be one file
  *        and one directory, they are replaced if already set.
  *
+ * All the CRLs are loaded, verified for expiry, and indexed right away so later changes
+ * in the files are not reflected. Only the most recent CRL of every issuer is used.
+ *
  * @param[in] endpt_name Existing endpoint name.
  * @param[in] crl_file Path to a CRL store file in PEM format. Can be NULL.
  * @param[in] crl_dir Path to a CRL store hashed directory (c_rehash utility
@@ -852,7 +1106,8 @@ const X509 *nc_session_get_client_cert(const struct nc_session *session);
  *
  * Server will always perform cert-to-name based on its configuration. Only after it passes
  * and this callback is set, it is also called. It should return exactly what OpenSSL
- * verify callback meaning 1 for success, 0 to deny the user.
+ * verify callback meaning 1 for success, 0 to deny the user. ::NC_AUTH_PENDING can be returned
+ * if the verification was deferred using nc_server_auth_defer().
  *
  * @param[in] verify_clb Additional user verify callback.
  */
@@ -291,6 +291,16 @@ int nc_server_ssh_ch_client_endpt_set_auth_attempts(const char *client_name, con
  */
 int nc_server_ssh_ch_client_endpt_set_auth_timeout(const char *client_name, const char *endpt_name, uint16_t auth_timeout);
 
+/**
+ * @brief Set Call Home SSH write buffer size. 1 kB by default.
+ *
+ * @param[in] client_name Existing Call Home client name.
+ * @param[in] endpt_name Existing endpoint name of the client.
+ * @param[in] size Buffer size in bytes, 0 or values smaller than the default mean the default, at most 1 MB.
+ * @return 0 on success, -1 on error.
+ */
+int nc_server_ssh_ch_client_endpt_set_write_buffer(const char *client_name, const char *endpt_name, uint32_t size);
+
 /** @} Server-side Call Home on SSH */
 
 #endif /* NC_ENABLED_SSH */
@@ -352,10 +362,35 @@ int nc_server_tls_ch_client_endpt_del_trusted_cert_list(const char *client_name,
 int nc_server_tls_ch_client_endpt_set_trusted_ca_paths(const char *client_name, const char *endpt_name, const char *ca_file,
         const char *ca_dir);
 
+/**
+ * @brief Set Call Home TLS session resumption using a server-side session cache.
+ *
+ * @param[in] client_name Existing Call Home client name.
+ * @param[in] endpt_name Existing endpoint name of the client.
+ * @param[in] cache_size Maximum number of cached sessions, 0 to disable resumption (default).
+ * @param[in] timeout Lifetime of a cached session in seconds, 0 for the OpenSSL default.
+ * @return 0 on success, -1 on error.
+ */
+int nc_server_tls_ch_client_endpt_set_session_cache(const char *client_name, const char *endpt_name, uint32_t cache_size,
+        uint32_t timeout);
+
+/**
+ * @brief Set Call Home kernel TLS (kTLS) offload of new TLS sessions. Disabled by default.
+ *
+ * @param[in] client_name Existing Call Home client name.
+ * @param[in] endpt_name Existing endpoint name of the client.
+ * @param[in] enable Whether to request kTLS offload.
+ * @return 0 on success, -1 on error (including OpenSSL without kTLS support).
+ */
+int nc_server_tls_ch_client_endpt_set_ktls(const char *client_name, const char *endpt_name, int enable);
+
 /**
  * @brief Set Call Home Certificate Revocation List locations. There can only be
  *        one file and one directory, they are replaced if already set.
  *
+ * All the CRLs are loaded, verified for expiry, and indexed right away so later changes
+ * in the files are not reflected. Only the most recent CRL of every issuer is used.
+ *
  * @param[in] client_name Existing Call Home client name.
  * @param[in] endpt_name Existing endpoint name of the client.
  * @param[in] crl_file Path to a CRL store file in PEM format. Can be NULL.
@@ -14,6 +14,9 @@
 
 #define _GNU_SOURCE
 
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
 #include <string.h>
 #include <poll.h>
 #include <unistd.h>
@@ -21,6 +24,7 @@
 #include <openssl/ssl.h>
 #include <openssl/evp.h>
 #include <openssl/err.h>
+#include <openssl/pem.h>
 #include <openssl/x509v3.h>
 #include <openssl/x509.h>
 
@@ -30,7 +34,12 @@
 #include "libnetconf.h"
 
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
-#define X509_STORE_CTX_get_by_subject X509_STORE_get_by_subject
+#define X509_CRL_get0_lastUpdate X509_CRL_get_lastUpdate
+#define X509_CRL_get0_nextUpdate X509_CRL_get_nextUpdate
+#define X509_REVOKED_get0_serialNumber(revoked) ((revoked)->serialNumber)
+#define ASN1_STRING_get0_data ASN1_STRING_data
+#define X509_CRL_up_ref(crl) CRYPTO_add(&(crl)->references, 1, CRYPTO_LOCK_X509_CRL)
+#define SSL_CTX_up_ref(ctx) CRYPTO_add(&(ctx)->references, 1, CRYPTO_LOCK_SSL_CTX)
 #endif
 
 struct nc_server_tls_opts tls_ch_opts;
@@ -40,6 +49,19 @@ extern struct nc_server_opts server_opts;
 static pthread_key_t verify_key;
 static pthread_once_t verify_once = PTHREAD_ONCE_INIT;
 
+/* protects creating the cached TLS contexts of endpoints which are only READ locked when accepting */
+static pthread_mutex_t tls_ctx_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* protects the cert-to-name result caches for the same reason */
+static pthread_mutex_t ctn_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* protects the verified CRL signature keys for the same reason */
+static pthread_mutex_t crl_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* SSL_SESSION ex_data index of the cert-to-name username */
+static int sess_username_idx = -1;
+static pthread_once_t sess_username_once = PTHREAD_ONCE_INIT;
+
 static char *
 asn1time_to_str(const ASN1_TIME *t)
 {
@@ -73,22 +95,6 @@ asn1time_to_str(const ASN1_TIME *t)
     return cp;
 }
 
-static void
-digest_to_str(const unsigned char *digest, unsigned int dig_len, char **str)
-{
-    unsigned int i;
-
-    *str = malloc(dig_len * 3);
-    if (!*str) {
-        ERRMEM;
-        return;
-    }
-    for (i = 0; i < dig_len - 1; ++i) {
-        sprintf((*str) + (i * 3), "%02x:", digest[i]);
-    }
-    sprintf((*str) + (i * 3), "%02x", digest[i]);
-}
-
 /* return NULL - SSL error can be retrieved */
 static X509 *
 base64der_to_cert(const char *in)
@@ -309,179 +315,659 @@ nc_tls_ctn_get_username_from_cert(X509 *client_cert, NC_TLS_CTN_MAPTYPE map_type
     return 0;
 }
 
-/* return: 0 - OK, 1 - no match, -1 - error */
+static const EVP_MD *
+nc_tls_ctn_md(uint8_t fp_alg, const char **alg_name)
+{
+    switch (fp_alg) {
+    case 1:
+        *alg_name = "MD5";
+        return EVP_md5();
+    case 2:
+        *alg_name = "SHA-1";
+        return EVP_sha1();
+    case 3:
+        *alg_name = "SHA-224";
+        return EVP_sha224();
+    case 4:
+        *alg_name = "SHA-256";
+        return EVP_sha256();
+    case 5:
+        *alg_name = "SHA-384";
+        return EVP_sha384();
+    case 6:
+        *alg_name = "SHA-512";
+        return EVP_sha512();
+    default:
+        break;
+    }
+
+    return NULL;
+}
+
+static uint32_t
+nc_tls_ctn_hash(uint8_t fp_alg, const unsigned char *fp)
+{
+    /* the fingerprints are digests, their first bytes are random enough */
+    return (((uint32_t)fp[0] << 24) | ((uint32_t)fp[1] << 16) | ((uint32_t)fp[2] << 8) | fp[3]) ^ fp_alg;
+}
+
+/* decode "XX:hh:hh:..." into the algorithm and the binary fingerprint, returns 0 on success */
 static int
-nc_tls_cert_to_name(struct nc_ctn *ctn_first, X509 *cert, NC_TLS_CTN_MAPTYPE *map_type, const char **name)
+nc_tls_ctn_decode_fp(struct nc_ctn *ctn)
 {
-    char *digest_md5 = NULL, *digest_sha1 = NULL, *digest_sha224 = NULL;
-    char *digest_sha256 = NULL, *digest_sha384 = NULL, *digest_sha512 = NULL;
-    unsigned char *buf = malloc(64);
-    unsigned int buf_len = 64;
-    int ret = 0;
-    struct nc_ctn *ctn;
+    const char *ptr, *alg_name;
+    unsigned int byte;
+    uint8_t len = 0;
+    const EVP_MD *md;
+    int alg;
 
-    if (!buf) {
-        ERRMEM;
+    ctn->fp_alg = 0;
+    ctn->fp_len = 0;
+
+    if (!isxdigit((unsigned char)ctn->fingerprint[0]) || !isxdigit((unsigned char)ctn->fingerprint[1]) || (ctn->fingerprint[2] != ':')
+            || (sscanf(ctn->fingerprint, "%2x", &byte) != 1)) {
         return -1;
     }
+    alg = byte;
 
-    if (!ctn_first || !cert || !map_type || !name) {
-        free(buf);
+    md = nc_tls_ctn_md(alg, &alg_name);
+    if (!md) {
+        WRN("Unknown fingerprint algorithm used (%s), skipping.", ctn->fingerprint);
         return -1;
     }
 
-    for (ctn = ctn_first; ctn; ctn = ctn->next) {
-        /* first make sure the entry is valid */
-        if (!ctn->fingerprint || !ctn->map_type || ((ctn->map_type == NC_TLS_CTN_SPECIFIED) && !ctn->name)) {
-            VRB("Cert verify CTN: entry with id %u not valid, skipping.", ctn->id);
+    for (ptr = ctn->fingerprint + 2; *ptr == ':'; ptr += 3) {
+        if ((len == sizeof ctn->fp) || !isxdigit((unsigned char)ptr[1]) || !isxdigit((unsigned char)ptr[2])
+                || (sscanf(ptr + 1, "%2x", &byte) != 1)) {
+            return -1;
+        }
+        ctn->fp[len++] = byte;
+    }
+    if (*ptr || (len != EVP_MD_size(md))) {
+        /* such a fingerprint would never match */
+        return -1;
+    }
+
+    ctn->fp_alg = alg;
+    ctn->fp_len = len;
+    return 0;
+}
+
+static void
+nc_server_tls_ctn_cache_flush(struct nc_server_tls_opts *opts)
+{
+    uint16_t i;
+
+    /* CTN CACHE LOCK */
+    pthread_mutex_lock(&ctn_cache_lock);
+
+    for (i = 0; i < opts->ctn_cache_count; ++i) {
+        lydict_remove(server_opts.ctx, opts->ctn_cache[i].name);
+    }
+    free(opts->ctn_cache);
+    opts->ctn_cache = NULL;
+    opts->ctn_cache_count = 0;
+
+    /* CTN CACHE UNLOCK */
+    pthread_mutex_unlock(&ctn_cache_lock);
+}
+
+/* opts are expected to be locked exclusively */
+static void
+nc_server_tls_ctn_index(struct nc_server_tls_opts *opts)
+{
+    struct nc_ctn *ctn, **tail;
+    uint32_t count = 0, i;
+
+    nc_server_tls_ctn_cache_flush(opts);
+
+    free(opts->ctn_buckets);
+    opts->ctn_buckets = NULL;
+    opts->ctn_bucket_count = 0;
+    opts->ctn_algs = 0;
+
+    for (ctn = opts->ctn; ctn; ctn = ctn->next) {
+        ctn->fp_next = NULL;
+        if (!ctn->fingerprint || !ctn->map_type || ((ctn->map_type == NC_TLS_CTN_SPECIFIED) && !ctn->name)
+                || nc_tls_ctn_decode_fp(ctn)) {
+            VRB("Cert-to-name entry with id %u not valid, skipping.", ctn->id);
+            ctn->fp_alg = 0;
+            continue;
+        }
+        ++count;
+    }
+    if (!count) {
+        return;
+    }
+
+    /* power of 2 at least twice the number of entries */
+    for (opts->ctn_bucket_count = 1; opts->ctn_bucket_count < count * 2; opts->ctn_bucket_count <<= 1);
+    opts->ctn_buckets = calloc(opts->ctn_bucket_count, sizeof *opts->ctn_buckets);
+    if (!opts->ctn_buckets) {
+        ERRMEM;
+        opts->ctn_bucket_count = 0;
+        return;
+    }
+
+    for (ctn = opts->ctn; ctn; ctn = ctn->next) {
+        if (!ctn->fp_alg) {
             continue;
         }
 
-        /* MD5 */
-        if (!strncmp(ctn->fingerprint, "01", 2)) {
-            if (!digest_md5) {
-                if (X509_digest(cert, EVP_md5(), buf, &buf_len) != 1) {
-                    ERR("Calculating MD5 digest failed (%s).", ERR_reason_error_string(ERR_get_error()));
-                    ret = -1;
-                    goto cleanup;
-                }
-                digest_to_str(buf, buf_len, &digest_md5);
-            }
+        /* append so that the buckets are ordered by id just like the list */
+        i = nc_tls_ctn_hash(ctn->fp_alg, ctn->fp) & (opts->ctn_bucket_count - 1);
+        for (tail = &opts->ctn_buckets[i]; *tail; tail = &(*tail)->fp_next);
+        *tail = ctn;
 
-            if (!strcasecmp(ctn->fingerprint + 3, digest_md5)) {
-                /* we got ourselves a winner! */
-                VRB("Cert verify CTN: entry with a matching fingerprint found.");
-                *map_type = ctn->map_type;
-                if (ctn->map_type == NC_TLS_CTN_SPECIFIED) {
-                    *name = ctn->name;
-                }
-                break;
-            }
+        opts->ctn_algs |= 1 << ctn->fp_alg;
+    }
+}
 
-        /* SHA-1 */
-        } else if (!strncmp(ctn->fingerprint, "02", 2)) {
-            if (!digest_sha1) {
-                if (X509_digest(cert, EVP_sha1(), buf, &buf_len) != 1) {
-                    ERR("Calculating SHA-1 digest failed (%s).", ERR_reason_error_string(ERR_get_error()));
-                    ret = -1;
-                    goto cleanup;
-                }
-                digest_to_str(buf, buf_len, &digest_sha1);
-            }
+/* CTN CACHE LOCK expected to be held, returns the entry or NULL */
+static struct nc_ctn_cache *
+nc_tls_ctn_cache_find(struct nc_server_tls_opts *opts, const unsigned char *cert_digest)
+{
+    uint16_t i;
 
-            if (!strcasecmp(ctn->fingerprint + 3, digest_sha1)) {
-                /* we got ourselves a winner! */
-                VRB("Cert verify CTN: entry with a matching fingerprint found.");
-                *map_type = ctn->map_type;
-                if (ctn->map_type == NC_TLS_CTN_SPECIFIED) {
-                    *name = ctn->name;
-                }
-                break;
+    for (i = 0; i < opts->ctn_cache_count; ++i) {
+        if (!memcmp(opts->ctn_cache[i].cert_digest, cert_digest, sizeof opts->ctn_cache[i].cert_digest)) {
+            opts->ctn_cache[i].used = ++opts->ctn_cache_tick;
+            return &opts->ctn_cache[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* CTN CACHE LOCK expected to be held */
+static void
+nc_tls_ctn_cache_add(struct nc_server_tls_opts *opts, const unsigned char *cert_digest, NC_TLS_CTN_MAPTYPE map_type,
+        const char *name)
+{
+    struct nc_ctn_cache *entry;
+    uint16_t i;
+
+    if (!opts->ctn_cache) {
+        opts->ctn_cache = malloc(NC_CTN_CACHE_SIZE * sizeof *opts->ctn_cache);
+        if (!opts->ctn_cache) {
+            ERRMEM;
+            return;
+        }
+    }
+
+    if (opts->ctn_cache_count < NC_CTN_CACHE_SIZE) {
+        entry = &opts->ctn_cache[opts->ctn_cache_count++];
+    } else {
+        /* replace the least recently used result */
+        entry = &opts->ctn_cache[0];
+        for (i = 1; i < opts->ctn_cache_count; ++i) {
+            if (opts->ctn_cache[i].used < entry->used) {
+                entry = &opts->ctn_cache[i];
             }
+        }
+        lydict_remove(server_opts.ctx, entry->name);
+    }
 
-        /* SHA-224 */
-        } else if (!strncmp(ctn->fingerprint, "03", 2)) {
-            if (!digest_sha224) {
-                if (X509_digest(cert, EVP_sha224(), buf, &buf_len) != 1) {
-                    ERR("Calculating SHA-224 digest failed (%s).", ERR_reason_error_string(ERR_get_error()));
-                    ret = -1;
-                    goto cleanup;
-                }
-                digest_to_str(buf, buf_len, &digest_sha224);
+    memcpy(entry->cert_digest, cert_digest, sizeof entry->cert_digest);
+    entry->map_type = map_type;
+    entry->name = name ? lydict_insert(server_opts.ctx, name, 0) : NULL;
+    entry->used = ++opts->ctn_cache_tick;
+}
+
+/* return: 0 - OK, 1 - no match, -1 - error; name is returned in the dictionary */
+static int
+nc_tls_cert_to_name(struct nc_server_tls_opts *opts, X509 *cert, NC_TLS_CTN_MAPTYPE *map_type, const char **name)
+{
+    unsigned char cert_digest[32], digest[64];
+    unsigned int digest_len;
+    const char *alg_name;
+    struct nc_ctn_cache *entry;
+    struct nc_ctn *ctn, *match = NULL;
+    uint8_t alg;
+
+    if (!opts || !cert || !map_type || !name) {
+        return -1;
+    }
+
+    if (!opts->ctn_algs) {
+        /* no valid entries */
+        return 1;
+    }
+
+    /* the certificate SHA-256 is the cache key */
+    digest_len = sizeof cert_digest;
+    if (X509_digest(cert, EVP_sha256(), cert_digest, &digest_len) != 1) {
+        ERR("Calculating SHA-256 digest failed (%s).", ERR_reason_error_string(ERR_get_error()));
+        return -1;
+    }
+
+    /* CTN CACHE LOCK */
+    pthread_mutex_lock(&ctn_cache_lock);
+    entry = nc_tls_ctn_cache_find(opts, cert_digest);
+    if (entry) {
+        *map_type = entry->map_type;
+        *name = entry->name ? lydict_insert(server_opts.ctx, entry->name, 0) : NULL;
+    }
+    /* CTN CACHE UNLOCK */
+    pthread_mutex_unlock(&ctn_cache_lock);
+
+    if (entry) {
+        VRB("Cert verify CTN: cached result used.");
+        return *map_type ? 0 : 1;
+    }
+
+    /* compute a digest for every algorithm in use, the entry with the lowest id wins */
+    for (alg = 1; alg < 8; ++alg) {
+        if (!(opts->ctn_algs & (1 << alg))) {
+            continue;
+        }
+
+        if (alg == 4) {
+            memcpy(digest, cert_digest, sizeof cert_digest);
+            digest_len = sizeof cert_digest;
+        } else {
+            digest_len = sizeof digest;
+            if (X509_digest(cert, nc_tls_ctn_md(alg, &alg_name), digest, &digest_len) != 1) {
+                ERR("Calculating %s digest failed (%s).", alg_name, ERR_reason_error_string(ERR_get_error()));
+                return -1;
             }
+        }
 
-            if (!strcasecmp(ctn->fingerprint + 3, digest_sha224)) {
-                /* we got ourselves a winner! */
-                VRB("Cert verify CTN: entry with a matching fingerprint found.");
-                *map_type = ctn->map_type;
-                if (ctn->map_type == NC_TLS_CTN_SPECIFIED) {
-                    *name = ctn->name;
-                }
+        ctn = opts->ctn_buckets[nc_tls_ctn_hash(alg, digest) & (opts->ctn_bucket_count - 1)];
+        for (; ctn && (!match || (ctn->id < match->id)); ctn = ctn->fp_next) {
+            if ((ctn->fp_alg == alg) && (ctn->fp_len == digest_len) && !memcmp(ctn->fp, digest, digest_len)) {
+                match = ctn;
                 break;
             }
+        }
+    }
 
-        /* SHA-256 */
-        } else if (!strncmp(ctn->fingerprint, "04", 2)) {
-            if (!digest_sha256) {
-                if (X509_digest(cert, EVP_sha256(), buf, &buf_len) != 1) {
-                    ERR("Calculating SHA-256 digest failed (%s).", ERR_reason_error_string(ERR_get_error()));
-                    ret = -1;
-                    goto cleanup;
-                }
-                digest_to_str(buf, buf_len, &digest_sha256);
-            }
+    if (match) {
+        /* we got ourselves a winner! */
+        VRB("Cert verify CTN: entry with a matching fingerprint found.");
+        *map_type = match->map_type;
+        if (match->map_type == NC_TLS_CTN_SPECIFIED) {
+            *name = lydict_insert(server_opts.ctx, match->name, 0);
+        }
+    }
 
-            if (!strcasecmp(ctn->fingerprint + 3, digest_sha256)) {
-                /* we got ourselves a winner! */
-                VRB("Cert verify CTN: entry with a matching fingerprint found.");
-                *map_type = ctn->map_type;
-                if (ctn->map_type == NC_TLS_CTN_SPECIFIED) {
-                    *name = ctn->name;
-                }
+    /* CTN CACHE LOCK */
+    pthread_mutex_lock(&ctn_cache_lock);
+    if (!nc_tls_ctn_cache_find(opts, cert_digest)) {
+        nc_tls_ctn_cache_add(opts, cert_digest, match ? match->map_type : 0,
+                             (match && (match->map_type == NC_TLS_CTN_SPECIFIED)) ? match->name : NULL);
+    }
+    /* CTN CACHE UNLOCK */
+    pthread_mutex_unlock(&ctn_cache_lock);
+
+    return match ? 0 : 1;
+}
+
+static uint32_t
+nc_tls_serial_hash(const ASN1_INTEGER *serial)
+{
+    const unsigned char *data = ASN1_STRING_get0_data(serial);
+    int i, len = ASN1_STRING_length(serial);
+    uint32_t hash = 2166136261u;
+
+    /* FNV-1a */
+    for (i = 0; i < len; ++i) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void
+nc_tls_crl_free(struct nc_crl *crl)
+{
+    X509_CRL_free(crl->crl);
+    free(crl->revoked);
+}
+
+/* build the set of revoked serials, returns 0 on success */
+static int
+nc_tls_crl_index(struct nc_crl *crl)
+{
+    STACK_OF(X509_REVOKED) *revoked;
+    const ASN1_INTEGER *serial;
+    uint32_t i, j, count;
+
+    revoked = X509_CRL_get_REVOKED(crl->crl);
+    count = revoked ? sk_X509_REVOKED_num(revoked) : 0;
+
+    crl->revoked = NULL;
+    crl->revoked_size = 0;
+    if (!count) {
+        return 0;
+    }
+
+    /* power of 2 at least twice the number of serials */
+    for (crl->revoked_size = 1; crl->revoked_size < count * 2; crl->revoked_size <<= 1);
+    crl->revoked = calloc(crl->revoked_size, sizeof *crl->revoked);
+    if (!crl->revoked) {
+        ERRMEM;
+        return -1;
+    }
+
+    for (i = 0; i < count; ++i) {
+        serial = X509_REVOKED_get0_serialNumber(sk_X509_REVOKED_value(revoked, i));
+        for (j = nc_tls_serial_hash(serial) & (crl->revoked_size - 1); crl->revoked[j];
+                j = (j + 1) & (crl->revoked_size - 1)) {
+            if (!ASN1_INTEGER_cmp(crl->revoked[j], serial)) {
+                /* duplicate */
                 break;
             }
+        }
+        crl->revoked[j] = serial;
+    }
 
-        /* SHA-384 */
-        } else if (!strncmp(ctn->fingerprint, "05", 2)) {
-            if (!digest_sha384) {
-                if (X509_digest(cert, EVP_sha384(), buf, &buf_len) != 1) {
-                    ERR("Calculating SHA-384 digest failed (%s).", ERR_reason_error_string(ERR_get_error()));
-                    ret = -1;
-                    goto cleanup;
-                }
-                digest_to_str(buf, buf_len, &digest_sha384);
-            }
+    return 0;
+}
 
-            if (!strcasecmp(ctn->fingerprint + 3, digest_sha384)) {
-                /* we got ourselves a winner! */
-                VRB("Cert verify CTN: entry with a matching fingerprint found.");
-                *map_type = ctn->map_type;
-                if (ctn->map_type == NC_TLS_CTN_SPECIFIED) {
-                    *name = ctn->name;
-                }
+static int
+nc_tls_crl_is_revoked(const struct nc_crl *crl, const ASN1_INTEGER *serial)
+{
+    uint32_t i;
+
+    if (!crl->revoked_size) {
+        return 0;
+    }
+
+    for (i = nc_tls_serial_hash(serial) & (crl->revoked_size - 1); crl->revoked[i]; i = (i + 1) & (crl->revoked_size - 1)) {
+        if (!ASN1_INTEGER_cmp(crl->revoked[i], serial)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static struct nc_crl *
+nc_tls_crl_find(struct nc_server_tls_opts *opts, X509_NAME *issuer)
+{
+    unsigned long issuer_hash;
+    uint16_t i;
+
+    issuer_hash = X509_NAME_hash(issuer);
+    for (i = 0; i < opts->crl_count; ++i) {
+        if ((opts->crls[i].issuer_hash == issuer_hash) && !X509_NAME_cmp(X509_CRL_get_issuer(opts->crls[i].crl), issuer)) {
+            return &opts->crls[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* copy a loaded CRL into another CRL set, the CRL itself is shared, returns 0 on success */
+static int
+nc_tls_crl_dup(const struct nc_crl *src, struct nc_crl *dst)
+{
+    /* CRL LOCK */
+    pthread_mutex_lock(&crl_lock);
+    memcpy(dst, src, sizeof *dst);
+    /* CRL UNLOCK */
+    pthread_mutex_unlock(&crl_lock);
+
+    dst->revoked = NULL;
+    if (src->revoked_size) {
+        dst->revoked = malloc(src->revoked_size * sizeof *dst->revoked);
+        if (!dst->revoked) {
+            ERRMEM;
+            return -1;
+        }
+        memcpy(dst->revoked, src->revoked, src->revoked_size * sizeof *dst->revoked);
+    }
+    X509_CRL_up_ref(dst->crl);
+
+    return 0;
+}
+
+/* takes ownership of crl, only the most recent CRL of an issuer is kept */
+static int
+nc_tls_crl_add(struct nc_server_tls_opts *opts, X509_CRL *crl)
+{
+    struct nc_crl *entry, new;
+    int day, sec;
+    char *cp;
+    void *mem;
+
+    cp = X509_NAME_oneline(X509_CRL_get_issuer(crl), NULL, 0);
+
+    /* expiry is checked again for every certificate, just let the user know */
+    if (!X509_CRL_get0_nextUpdate(crl)) {
+        WRN("CRL from issuer %s has no nextUpdate field, all its certificates will be revoked.", cp);
+    } else if (X509_cmp_current_time(X509_CRL_get0_nextUpdate(crl)) < 0) {
+        WRN("CRL from issuer %s has expired, all its certificates will be revoked.", cp);
+    }
+
+    entry = nc_tls_crl_find(opts, X509_CRL_get_issuer(crl));
+    if (entry && ASN1_TIME_diff(&day, &sec, X509_CRL_get0_lastUpdate(crl), X509_CRL_get0_lastUpdate(entry->crl))
+            && ((day > 0) || (sec > 0))) {
+        VRB("Older CRL from issuer %s ignored.", cp);
+        OPENSSL_free(cp);
+        X509_CRL_free(crl);
+        return 0;
+    }
+
+    memset(&new, 0, sizeof new);
+    new.crl = crl;
+    new.issuer_hash = X509_NAME_hash(X509_CRL_get_issuer(crl));
+    if (nc_tls_crl_index(&new)) {
+        OPENSSL_free(cp);
+        X509_CRL_free(crl);
+        return -1;
+    }
+
+    if (entry) {
+        /* replace the older CRL */
+        nc_tls_crl_free(entry);
+    } else {
+        mem = realloc(opts->crls, (opts->crl_count + 1) * sizeof *opts->crls);
+        if (!mem) {
+            ERRMEM;
+            OPENSSL_free(cp);
+            nc_tls_crl_free(&new);
+            return -1;
+        }
+        opts->crls = mem;
+        entry = &opts->crls[opts->crl_count++];
+    }
+    memcpy(entry, &new, sizeof *entry);
+
+    VRB("CRL from issuer %s loaded (%d revoked certificates).", cp,
+        X509_CRL_get_REVOKED(crl) ? sk_X509_REVOKED_num(X509_CRL_get_REVOKED(crl)) : 0);
+    OPENSSL_free(cp);
+    return 0;
+}
+
+static int
+nc_tls_crl_load_file(struct nc_server_tls_opts *opts, const char *path)
+{
+    X509_CRL *crl;
+    BIO *bio;
+    unsigned long err;
+    int ret = 0, count = 0;
+
+    bio = BIO_new_file(path, "r");
+    if (!bio) {
+        ERR("Failed to open the CRL file \"%s\" (%s).", path, ERR_reason_error_string(ERR_get_error()));
+        return -1;
+    }
+
+    /* other PEM objects are skipped */
+    while ((crl = PEM_read_bio_X509_CRL(bio, NULL, NULL, NULL))) {
+        if (nc_tls_crl_add(opts, crl)) {
+            ret = -1;
+            break;
+        }
+        ++count;
+    }
+
+    if (!ret) {
+        /* reaching the end of the file is reported as no start line, anything else means a corrupted CRL */
+        err = ERR_peek_last_error();
+        if (!count) {
+            ERR("No CRL found in the file \"%s\".", path);
+            ret = -1;
+        } else if ((ERR_GET_LIB(err) != ERR_LIB_PEM) || (ERR_GET_REASON(err) != PEM_R_NO_START_LINE)) {
+            ERR("Failed to read a CRL from the file \"%s\" (%s).", path, ERR_reason_error_string(err));
+            ret = -1;
+        }
+    }
+    ERR_clear_error();
+    BIO_free(bio);
+    return ret;
+}
+
+static int
+nc_tls_crl_load_dir(struct nc_server_tls_opts *opts, const char *dir_path)
+{
+    DIR *dir;
+    struct dirent *file;
+    char *path;
+    size_t i;
+    int ret = 0;
+
+    dir = opendir(dir_path);
+    if (!dir) {
+        ERR("Failed to open the CRL directory \"%s\" (%s).", dir_path, strerror(errno));
+        return -1;
+    }
+
+    while ((file = readdir(dir))) {
+        /* only the "<hash>.r<n>" files created by c_rehash */
+        for (i = 0; i < 8; ++i) {
+            if (!isxdigit((unsigned char)file->d_name[i])) {
                 break;
             }
+        }
+        if ((i < 8) || strncmp(file->d_name + 8, ".r", 2) || !isdigit((unsigned char)file->d_name[10])) {
+            continue;
+        }
 
-        /* SHA-512 */
-        } else if (!strncmp(ctn->fingerprint, "06", 2)) {
-            if (!digest_sha512) {
-                if (X509_digest(cert, EVP_sha512(), buf, &buf_len) != 1) {
-                    ERR("Calculating SHA-512 digest failed (%s).", ERR_reason_error_string(ERR_get_error()));
-                    ret = -1;
-                    goto cleanup;
-                }
-                digest_to_str(buf, buf_len, &digest_sha512);
-            }
+        if (asprintf(&path, "%s/%s", dir_path, file->d_name) == -1) {
+            ERRMEM;
+            ret = -1;
+            break;
+        }
+        ret = nc_tls_crl_load_file(opts, path);
+        free(path);
+        if (ret) {
+            break;
+        }
+    }
+
+    closedir(dir);
+    return ret;
+}
+
+/* return: 1 - OK, 0 - revoked or invalid CRL */
+static int
+nc_tls_crl_check(struct nc_server_tls_opts *opts, X509 *cert, X509_STORE_CTX *x509_ctx)
+{
+    X509_NAME *subject, *issuer;
+    struct nc_crl *crl;
+    EVP_PKEY *pubkey;
+    const ASN1_TIME *last_update, *next_update;
+    unsigned char key_digest[32];
+    unsigned int key_digest_len = sizeof key_digest;
+    int verified;
+    char *cp;
+    long serial;
+
+    subject = X509_get_subject_name(cert);
+    issuer = X509_get_issuer_name(cert);
+
+    /* a CRL corresponding to the _subject_ of the current certificate, verify its integrity */
+    crl = nc_tls_crl_find(opts, subject);
+    if (crl) {
+        cp = X509_NAME_oneline(subject, NULL, 0);
+        VRB("Cert verify CRL: issuer: %s.", cp);
+        OPENSSL_free(cp);
+
+        last_update = X509_CRL_get0_lastUpdate(crl->crl);
+        next_update = X509_CRL_get0_nextUpdate(crl->crl);
+        cp = asn1time_to_str(last_update);
+        VRB("Cert verify CRL: last update: %s.", cp);
+        free(cp);
+        cp = asn1time_to_str(next_update);
+        VRB("Cert verify CRL: next update: %s.", cp);
+        free(cp);
+
+        /* verify the signature on this CRL, only once for every key */
+        if (X509_pubkey_digest(cert, EVP_sha256(), key_digest, &key_digest_len) != 1) {
+            ERR("Cert verify CRL: calculating the key digest failed (%s).", ERR_reason_error_string(ERR_get_error()));
+            X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_UNSPECIFIED);
+            return 0;
+        }
 
-            if (!strcasecmp(ctn->fingerprint + 3, digest_sha512)) {
-                /* we got ourselves a winner! */
-                VRB("Cert verify CTN: entry with a matching fingerprint found.");
-                *map_type = ctn->map_type;
-                if (ctn->map_type == NC_TLS_CTN_SPECIFIED) {
-                    *name = ctn->name;
+        /* CRL LOCK */
+        pthread_mutex_lock(&crl_lock);
+        verified = crl->verified && !memcmp(crl->verified_key, key_digest, sizeof key_digest);
+        /* CRL UNLOCK */
+        pthread_mutex_unlock(&crl_lock);
+
+        if (!verified) {
+            pubkey = X509_get_pubkey(cert);
+            if (X509_CRL_verify(crl->crl, pubkey) <= 0) {
+                ERR("Cert verify CRL: invalid signature.");
+                X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_CRL_SIGNATURE_FAILURE);
+                if (pubkey) {
+                    EVP_PKEY_free(pubkey);
                 }
-                break;
+                return 0;
+            }
+            if (pubkey) {
+                EVP_PKEY_free(pubkey);
             }
 
-        /* unknown */
-        } else {
-            WRN("Unknown fingerprint algorithm used (%s), skipping.", ctn->fingerprint);
+            /* CRL LOCK */
+            pthread_mutex_lock(&crl_lock);
+            memcpy(crl->verified_key, key_digest, sizeof key_digest);
+            crl->verified = 1;
+            /* CRL UNLOCK */
+            pthread_mutex_unlock(&crl_lock);
+        }
+
+        /* check date of CRL to make sure it's not expired */
+        if (!next_update) {
+            ERR("Cert verify CRL: invalid nextUpdate field.");
+            X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_ERROR_IN_CRL_NEXT_UPDATE_FIELD);
+            return 0;
+        }
+        if (X509_cmp_current_time(next_update) < 0) {
+            ERR("Cert verify CRL: expired - revoking all certificates.");
+            X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_CRL_HAS_EXPIRED);
+            return 0;
         }
     }
 
-    if (!ctn) {
-        ret = 1;
+    /* a CRL corresponding to the _issuer_ of the current certificate, check for revocation */
+    crl = nc_tls_crl_find(opts, issuer);
+    if (crl && nc_tls_crl_is_revoked(crl, X509_get_serialNumber(cert))) {
+        serial = ASN1_INTEGER_get(X509_get_serialNumber(cert));
+        cp = X509_NAME_oneline(issuer, NULL, 0);
+        ERR("Cert verify CRL: certificate with serial %ld (0x%lX) revoked per CRL from issuer %s.", serial, serial, cp);
+        OPENSSL_free(cp);
+        X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_CERT_REVOKED);
+        return 0;
     }
 
-cleanup:
-    free(digest_md5);
-    free(digest_sha1);
-    free(digest_sha224);
-    free(digest_sha256);
-    free(digest_sha384);
-    free(digest_sha512);
-    free(buf);
-    return ret;
+    return 1;
+}
+
+/* call the user verify callback, wait for its result if deferred, ret 1 on success, 0 to deny the user */
+static int
+nc_tls_user_verify(struct nc_session *session)
+{
+    int ret, r;
+
+    ret = server_opts.user_verify_clb(session);
+    r = nc_server_auth_wait(session, ret);
+    if (r > -1) {
+        ret = r;
+    }
+
+    return ret ? 1 : 0;
 }
 
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L // >= 1.1.0
@@ -489,23 +975,16 @@ cleanup:
 static int
 nc_tlsclb_verify(int preverify_ok, X509_STORE_CTX *x509_ctx)
 {
-    X509_STORE_CTX *store_ctx;
-    X509_OBJECT *obj;
     X509_NAME *subject;
     X509_NAME *issuer;
     X509 *cert;
-    X509_CRL *crl;
-    X509_REVOKED *revoked;
     STACK_OF(X509) *cert_stack;
-    EVP_PKEY *pubkey;
     struct nc_session* session;
     struct nc_server_tls_opts *opts;
-    const ASN1_INTEGER *serial;
-    int i, n, rc, depth;
+    int i, rc, depth;
     char *cp;
     const char *username = NULL;
     NC_TLS_CTN_MAPTYPE map_type = 0;
-    const ASN1_TIME *last_update = NULL, *next_update = NULL;
 
     /* get the thread session */
     session = pthread_getspecific(verify_key);
@@ -514,8 +993,6 @@ nc_tlsclb_verify(int preverify_ok, X509_STORE_CTX *x509_ctx)
         return 0;
     }
 
-    opts = session->data;
-
     /* get the last certificate, that is the peer (client) certificate */
     if (!session->opts.server.client_cert) {
         cert_stack = X509_STORE_CTX_get1_chain(x509_ctx);
@@ -562,95 +1039,28 @@ nc_tlsclb_verify(int preverify_ok, X509_STORE_CTX *x509_ctx)
     VRB("Cert verify: issuer:  %s.", cp);
     OPENSSL_free(cp);
 
-    /* check for revocation if set */
-    if (opts->crl_store) {
-        /* try to retrieve a CRL corresponding to the _subject_ of
-         * the current certificate in order to verify it's integrity */
-        store_ctx = X509_STORE_CTX_new();
-        obj = X509_OBJECT_new();
-        X509_STORE_CTX_init(store_ctx, opts->crl_store, NULL, NULL);
-        rc = X509_STORE_CTX_get_by_subject(store_ctx, X509_LU_CRL, subject, obj);
-        X509_STORE_CTX_free(store_ctx);
-        crl = X509_OBJECT_get0_X509_CRL(obj);
-        if (rc > 0 && crl) {
-            cp = X509_NAME_oneline(subject, NULL, 0);
-            VRB("Cert verify CRL: issuer: %s.", cp);
-            OPENSSL_free(cp);
-
-            last_update = X509_CRL_get0_lastUpdate(crl);
-            next_update = X509_CRL_get0_nextUpdate(crl);
-            cp = asn1time_to_str(last_update);
-            VRB("Cert verify CRL: last update: %s.", cp);
-            free(cp);
-            cp = asn1time_to_str(next_update);
-            VRB("Cert verify CRL: next update: %s.", cp);
-            free(cp);
-
-            /* verify the signature on this CRL */
-            pubkey = X509_get_pubkey(cert);
-            if (X509_CRL_verify(crl, pubkey) <= 0) {
-                ERR("Cert verify CRL: invalid signature.");
-                X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_CRL_SIGNATURE_FAILURE);
-                X509_OBJECT_free(obj);
-                if (pubkey) {
-                    EVP_PKEY_free(pubkey);
-                }
-                return 0;
-            }
-            if (pubkey) {
-                EVP_PKEY_free(pubkey);
-            }
+    /* the options are needed only for the revocation check and cert-to-name */
+    opts = nc_server_endpt_opts_lock(session, NC_TI_OPENSSL);
+    if (!opts) {
+        X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_APPLICATION_VERIFICATION);
+        return 0;
+    }
 
-            /* check date of CRL to make sure it's not expired */
-            if (!next_update) {
-                ERR("Cert verify CRL: invalid nextUpdate field.");
-                X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_ERROR_IN_CRL_NEXT_UPDATE_FIELD);
-                X509_OBJECT_free(obj);
-                return 0;
-            }
-            if (X509_cmp_current_time(next_update) < 0) {
-                ERR("Cert verify CRL: expired - revoking all certificates.");
-                X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_CRL_HAS_EXPIRED);
-                X509_OBJECT_free(obj);
-                return 0;
-            }
-            X509_OBJECT_free(obj);
-        }
-
-        /* try to retrieve a CRL corresponding to the _issuer_ of
-         * the current certificate in order to check for revocation */
-        store_ctx = X509_STORE_CTX_new();
-        obj = X509_OBJECT_new();
-        X509_STORE_CTX_init(store_ctx, opts->crl_store, NULL, NULL);
-        rc = X509_STORE_CTX_get_by_subject(store_ctx, X509_LU_CRL, issuer, obj);
-        X509_STORE_CTX_free(store_ctx);
-        crl = X509_OBJECT_get0_X509_CRL(obj);
-        if (rc > 0 && crl) {
-            /* check if the current certificate is revoked by this CRL */
-            n = sk_X509_REVOKED_num(X509_CRL_get_REVOKED(crl));
-            for (i = 0; i < n; i++) {
-                revoked = sk_X509_REVOKED_value(X509_CRL_get_REVOKED(crl), i);
-                serial = X509_REVOKED_get0_serialNumber(revoked);
-                if (ASN1_INTEGER_cmp(serial, X509_get_serialNumber(cert)) == 0) {
-                    cp = X509_NAME_oneline(issuer, NULL, 0);
-                    ERR("Cert verify CRL: certificate with serial %ld (0x%lX) revoked per CRL from issuer %s.", serial, serial, cp);
-                    OPENSSL_free(cp);
-                    X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_CERT_REVOKED);
-                    X509_OBJECT_free(obj);
-                    return 0;
-                }
-            }
-            X509_OBJECT_free(obj);
-        }
+    /* check for revocation if set */
+    if (opts->crl_count && !nc_tls_crl_check(opts, cert, x509_ctx)) {
+        nc_server_endpt_opts_unlock(session);
+        return 0;
     }
 
     /* cert-to-name already successful */
     if (session->username) {
+        nc_server_endpt_opts_unlock(session);
         return 1;
     }
 
     /* cert-to-name */
-    rc = nc_tls_cert_to_name(opts->ctn, cert, &map_type, &username);
+    rc = nc_tls_cert_to_name(opts, cert, &map_type, &username);
+    nc_server_endpt_opts_unlock(session);
 
     if (rc) {
         if (rc == -1) {
@@ -663,7 +1073,7 @@ nc_tlsclb_verify(int preverify_ok, X509_STORE_CTX *x509_ctx)
 
     /* cert-to-name match, now to extract the specific field from the peer cert */
     if (map_type == NC_TLS_CTN_SPECIFIED) {
-        session->username = lydict_insert(server_opts.ctx, username, 0);
+        session->username = username;
     } else {
         rc = nc_tls_ctn_get_username_from_cert(session->opts.server.client_cert, map_type, &cp);
         if (rc) {
@@ -677,7 +1087,7 @@ nc_tlsclb_verify(int preverify_ok, X509_STORE_CTX *x509_ctx)
 
     VRB("Cert verify CTN: new client username recognized as \"%s\".", session->username);
 
-    if (server_opts.user_verify_clb && !server_opts.user_verify_clb(session)) {
+    if (server_opts.user_verify_clb && !nc_tls_user_verify(session)) {
         VRB("Cert verify: user verify callback revoked authorization.");
         X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_APPLICATION_VERIFICATION);
         return 0;
@@ -701,23 +1111,16 @@ fail:
 static int
 nc_tlsclb_verify(int preverify_ok, X509_STORE_CTX *x509_ctx)
 {
-    X509_STORE_CTX store_ctx;
-    X509_OBJECT obj;
     X509_NAME *subject;
     X509_NAME *issuer;
     X509 *cert;
-    X509_CRL *crl;
-    X509_REVOKED *revoked;
     STACK_OF(X509) *cert_stack;
-    EVP_PKEY *pubkey;
     struct nc_session* session;
     struct nc_server_tls_opts *opts;
-    long serial;
-    int i, n, rc, depth;
+    int i, rc, depth;
     char *cp;
     const char *username = NULL;
     NC_TLS_CTN_MAPTYPE map_type = 0;
-    ASN1_TIME *last_update = NULL, *next_update = NULL;
 
     /* get the thread session */
     session = pthread_getspecific(verify_key);
@@ -726,8 +1129,6 @@ nc_tlsclb_verify(int preverify_ok, X509_STORE_CTX *x509_ctx)
         return 0;
     }
 
-    opts = session->data;
-
     /* get the last certificate, that is the peer (client) certificate */
     if (!session->opts.server.client_cert) {
         cert_stack = X509_STORE_CTX_get1_chain(x509_ctx);
@@ -776,93 +1177,28 @@ nc_tlsclb_verify(int preverify_ok, X509_STORE_CTX *x509_ctx)
     VRB("Cert verify: issuer:  %s.", cp);
     OPENSSL_free(cp);
 
-    /* check for revocation if set */
-    if (opts->crl_store) {
-        /* try to retrieve a CRL corresponding to the _subject_ of
-         * the current certificate in order to verify it's integrity */
-        memset((char *)&obj, 0, sizeof(obj));
-        X509_STORE_CTX_init(&store_ctx, opts->crl_store, NULL, NULL);
-        rc = X509_STORE_CTX_get_by_subject(&store_ctx, X509_LU_CRL, subject, &obj);
-        X509_STORE_CTX_cleanup(&store_ctx);
-        crl = obj.data.crl;
-        if (rc > 0 && crl) {
-            cp = X509_NAME_oneline(subject, NULL, 0);
-            VRB("Cert verify CRL: issuer: %s.", cp);
-            OPENSSL_free(cp);
-
-            last_update = X509_CRL_get_lastUpdate(crl);
-            next_update = X509_CRL_get_nextUpdate(crl);
-            cp = asn1time_to_str(last_update);
-            VRB("Cert verify CRL: last update: %s.", cp);
-            free(cp);
-            cp = asn1time_to_str(next_update);
-            VRB("Cert verify CRL: next update: %s.", cp);
-            free(cp);
-
-            /* verify the signature on this CRL */
-            pubkey = X509_get_pubkey(cert);
-            if (X509_CRL_verify(crl, pubkey) <= 0) {
-                ERR("Cert verify CRL: invalid signature.");
-                X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_CRL_SIGNATURE_FAILURE);
-                X509_OBJECT_free_contents(&obj);
-                if (pubkey) {
-                    EVP_PKEY_free(pubkey);
-                }
-                return 0;
-            }
-            if (pubkey) {
-                EVP_PKEY_free(pubkey);
-            }
+    /* the options are needed only for the revocation check and cert-to-name */
+    opts = nc_server_endpt_opts_lock(session, NC_TI_OPENSSL);
+    if (!opts) {
+        X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_APPLICATION_VERIFICATION);
+        return 0;
+    }
 
-            /* check date of CRL to make sure it's not expired */
-            if (!next_update) {
-                ERR("Cert verify CRL: invalid nextUpdate field.");
-                X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_ERROR_IN_CRL_NEXT_UPDATE_FIELD);
-                X509_OBJECT_free_contents(&obj);
-                return 0;
-            }
-            if (X509_cmp_current_time(next_update) < 0) {
-                ERR("Cert verify CRL: expired - revoking all certificates.");
-                X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_CRL_HAS_EXPIRED);
-                X509_OBJECT_free_contents(&obj);
-                return 0;
-            }
-            X509_OBJECT_free_contents(&obj);
-        }
-
-        /* try to retrieve a CRL corresponding to the _issuer_ of
-         * the current certificate in order to check for revocation */
-        memset((char *)&obj, 0, sizeof(obj));
-        X509_STORE_CTX_init(&store_ctx, opts->crl_store, NULL, NULL);
-        rc = X509_STORE_CTX_get_by_subject(&store_ctx, X509_LU_CRL, issuer, &obj);
-        X509_STORE_CTX_cleanup(&store_ctx);
-        crl = obj.data.crl;
-        if (rc > 0 && crl) {
-            /* check if the current certificate is revoked by this CRL */
-            n = sk_X509_REVOKED_num(X509_CRL_get_REVOKED(crl));
-            for (i = 0; i < n; i++) {
-                revoked = sk_X509_REVOKED_value(X509_CRL_get_REVOKED(crl), i);
-                if (ASN1_INTEGER_cmp(revoked->serialNumber, X509_get_serialNumber(cert)) == 0) {
-                    serial = ASN1_INTEGER_get(revoked->serialNumber);
-                    cp = X509_NAME_oneline(issuer, NULL, 0);
-                    ERR("Cert verify CRL: certificate with serial %ld (0x%lX) revoked per CRL from issuer %s.", serial, serial, cp);
-                    OPENSSL_free(cp);
-                    X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_CERT_REVOKED);
-                    X509_OBJECT_free_contents(&obj);
-                    return 0;
-                }
-            }
-            X509_OBJECT_free_contents(&obj);
-        }
+    /* check for revocation if set */
+    if (opts->crl_count && !nc_tls_crl_check(opts, cert, x509_ctx)) {
+        nc_server_endpt_opts_unlock(session);
+        return 0;
     }
 
     /* cert-to-name already successful */
     if (session->username) {
+        nc_server_endpt_opts_unlock(session);
         return 1;
     }
 
     /* cert-to-name */
-    rc = nc_tls_cert_to_name(opts->ctn, cert, &map_type, &username);
+    rc = nc_tls_cert_to_name(opts, cert, &map_type, &username);
+    nc_server_endpt_opts_unlock(session);
 
     if (rc) {
         if (rc == -1) {
@@ -875,7 +1211,7 @@ nc_tlsclb_verify(int preverify_ok, X509_STORE_CTX *x509_ctx)
 
     /* cert-to-name match, now to extract the specific field from the peer cert */
     if (map_type == NC_TLS_CTN_SPECIFIED) {
-        session->username = lydict_insert(server_opts.ctx, username, 0);
+        session->username = username;
     } else {
         rc = nc_tls_ctn_get_username_from_cert(session->opts.server.client_cert, map_type, &cp);
         if (rc) {
@@ -889,7 +1225,7 @@ nc_tlsclb_verify(int preverify_ok, X509_STORE_CTX *x509_ctx)
 
     VRB("Cert verify CTN: new client username recognized as \"%s\".", session->username);
 
-    if (server_opts.user_verify_clb && !server_opts.user_verify_clb(session)) {
+    if (server_opts.user_verify_clb && !nc_tls_user_verify(session)) {
         VRB("Cert verify: user verify callback revoked authorization.");
         X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_APPLICATION_VERIFICATION);
         return 0;
@@ -910,9 +1246,75 @@ fail:
 
 #endif
 
+/* opts are expected to be locked exclusively */
+static void
+nc_server_tls_ctx_invalidate(struct nc_server_tls_opts *opts)
+{
+    /* sessions created from the context keep their own reference */
+    SSL_CTX_free(opts->tls_ctx);
+    opts->tls_ctx = NULL;
+}
+
+/* opts are expected to be locked exclusively */
+static void
+nc_server_tls_sessions_flush(struct nc_server_tls_opts *opts)
+{
+    if (opts->tls_ctx) {
+        /* cached sessions were authorized with the previous settings */
+        SSL_CTX_flush_sessions(opts->tls_ctx, 0);
+    }
+}
+
+/* the certificates are loaded using the callbacks, so all the cached contexts must be created again */
+static void
+nc_server_tls_ctx_invalidate_all(void)
+{
+    uint16_t i, j;
+
+    /* ENDPT WRITE LOCK */
+    pthread_rwlock_wrlock(&server_opts.endpt_lock);
+
+    for (i = 0; i < server_opts.endpt_count; ++i) {
+        if (server_opts.endpts[i].ti == NC_TI_OPENSSL) {
+            nc_server_tls_ctx_invalidate(server_opts.endpts[i].opts.tls);
+        }
+    }
+
+    /* ENDPT UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+    /* CH CLIENT READ LOCK */
+    pthread_rwlock_rdlock(&server_opts.ch_client_lock);
+
+    for (i = 0; i < server_opts.ch_client_count; ++i) {
+        /* CH CLIENT LOCK */
+        pthread_mutex_lock(&server_opts.ch_clients[i].lock);
+
+        for (j = 0; j < server_opts.ch_clients[i].ch_endpt_count; ++j) {
+            if (server_opts.ch_clients[i].ch_endpts[j].ti == NC_TI_OPENSSL) {
+                nc_server_tls_ctx_invalidate(server_opts.ch_clients[i].ch_endpts[j].opts.tls);
+            }
+        }
+
+        /* CH CLIENT UNLOCK */
+        pthread_mutex_unlock(&server_opts.ch_clients[i].lock);
+    }
+
+    /* CH CLIENT READ UNLOCK */
+    pthread_rwlock_unlock(&server_opts.ch_client_lock);
+}
+
+API void
+nc_server_tls_invalidate_ctx(void)
+{
+    nc_server_tls_ctx_invalidate_all();
+}
+
 static int
 nc_server_tls_set_server_cert(const char *name, struct nc_server_tls_opts *opts)
 {
+    nc_server_tls_ctx_invalidate(opts);
+
     if (!name) {
         if (opts->server_cert) {
             lydict_remove(server_opts.ctx, opts->server_cert);
@@ -986,6 +1388,9 @@ nc_server_tls_set_server_cert_clb(int (*cert_clb)(const char *name, void *user_d
     server_opts.server_cert_clb = cert_clb;
     server_opts.server_cert_data = user_data;
     server_opts.server_cert_data_free = free_user_data;
+
+    /* the callback may return different certificates */
+    nc_server_tls_ctx_invalidate_all();
 }
 
 API void
@@ -1000,6 +1405,9 @@ nc_server_tls_set_server_cert_chain_clb(int (*cert_chain_clb)(const char *name,
     server_opts.server_cert_chain_clb = cert_chain_clb;
     server_opts.server_cert_chain_data = user_data;
     server_opts.server_cert_chain_data_free = free_user_data;
+
+    /* the callback may return different certificates */
+    nc_server_tls_ctx_invalidate_all();
 }
 
 static int
@@ -1010,6 +1418,8 @@ nc_server_tls_add_trusted_cert_list(const char *name, struct nc_server_tls_opts
         return -1;
     }
 
+    nc_server_tls_ctx_invalidate(opts);
+
     ++opts->trusted_cert_list_count;
     opts->trusted_cert_lists = nc_realloc(opts->trusted_cert_lists, opts->trusted_cert_list_count * sizeof *opts->trusted_cert_lists);
     if (!opts->trusted_cert_lists) {
@@ -1078,6 +1488,9 @@ nc_server_tls_set_trusted_cert_list_clb(int (*cert_list_clb)(const char *name, v
     server_opts.trusted_cert_list_clb = cert_list_clb;
     server_opts.trusted_cert_list_data = user_data;
     server_opts.trusted_cert_list_data_free = free_user_data;
+
+    /* the callback may return different certificates */
+    nc_server_tls_ctx_invalidate_all();
 }
 
 static int
@@ -1085,6 +1498,8 @@ nc_server_tls_del_trusted_cert_list(const char *name, struct nc_server_tls_opts
 {
     uint16_t i;
 
+    nc_server_tls_ctx_invalidate(opts);
+
     if (!name) {
         for (i = 0; i < opts->trusted_cert_list_count; ++i) {
             lydict_remove(server_opts.ctx, opts->trusted_cert_lists[i]);
@@ -1164,6 +1579,9 @@ nc_server_tls_set_trusted_ca_paths(const char *ca_file, const char *ca_dir, stru
         return -1;
     }
 
+    /* the files are read only when the context is created */
+    nc_server_tls_ctx_invalidate(opts);
+
     if (ca_file) {
         if (opts->trusted_ca_file) {
             lydict_remove(server_opts.ctx, opts->trusted_ca_file);
@@ -1229,46 +1647,54 @@ nc_server_tls_ch_client_endpt_set_trusted_ca_paths(const char *client_name, cons
 static int
 nc_server_tls_set_crl_paths(const char *crl_file, const char *crl_dir, struct nc_server_tls_opts *opts)
 {
-    X509_LOOKUP *lookup;
+    struct nc_server_tls_opts crl_opts;
+    uint16_t i;
 
     if (!crl_file && !crl_dir) {
         ERRARG("crl_file and crl_dir");
         return -1;
     }
 
-    if (!opts->crl_store) {
-        opts->crl_store = X509_STORE_new();
-    }
-
-    if (crl_file) {
-        lookup = X509_STORE_add_lookup(opts->crl_store, X509_LOOKUP_file());
-        if (!lookup) {
-            ERR("Failed to add a lookup method.");
-            goto fail;
+    /* all the CRLs are loaded and indexed right away into a new CRL set, the current one is kept on error */
+    memset(&crl_opts, 0, sizeof crl_opts);
+    if (opts->crl_count) {
+        crl_opts.crls = malloc(opts->crl_count * sizeof *crl_opts.crls);
+        if (!crl_opts.crls) {
+            ERRMEM;
+            return -1;
         }
-
-        if (X509_LOOKUP_load_file(lookup, crl_file, X509_FILETYPE_PEM) != 1) {
-            ERR("Failed to add a revocation lookup file (%s).", ERR_reason_error_string(ERR_get_error()));
-            goto fail;
+        for (i = 0; i < opts->crl_count; ++i) {
+            if (nc_tls_crl_dup(&opts->crls[i], &crl_opts.crls[i])) {
+                goto fail;
+            }
+            ++crl_opts.crl_count;
         }
     }
 
-    if (crl_dir) {
-        lookup = X509_STORE_add_lookup(opts->crl_store, X509_LOOKUP_hash_dir());
-        if (!lookup) {
-            ERR("Failed to add a lookup method.");
-            goto fail;
-        }
+    if (crl_file && nc_tls_crl_load_file(&crl_opts, crl_file)) {
+        ERR("Failed to add a revocation lookup file.");
+        goto fail;
+    }
 
-        if (X509_LOOKUP_add_dir(lookup, crl_dir, X509_FILETYPE_PEM) != 1) {
-            ERR("Failed to add a revocation lookup directory (%s).", ERR_reason_error_string(ERR_get_error()));
-            goto fail;
-        }
+    if (crl_dir && nc_tls_crl_load_dir(&crl_opts, crl_dir)) {
+        ERR("Failed to add a revocation lookup directory.");
+        goto fail;
     }
 
+    nc_server_tls_sessions_flush(opts);
+    for (i = 0; i < opts->crl_count; ++i) {
+        nc_tls_crl_free(&opts->crls[i]);
+    }
+    free(opts->crls);
+    opts->crls = crl_opts.crls;
+    opts->crl_count = crl_opts.crl_count;
     return 0;
 
 fail:
+    for (i = 0; i < crl_opts.crl_count; ++i) {
+        nc_tls_crl_free(&crl_opts.crls[i]);
+    }
+    free(crl_opts.crls);
     return -1;
 }
 
@@ -1320,12 +1746,19 @@ nc_server_tls_ch_client_set_crl_paths(const char *client_name, const char *endpt
 static void
 nc_server_tls_clear_crls(struct nc_server_tls_opts *opts)
 {
-    if (!opts->crl_store) {
+    uint16_t i;
+
+    if (!opts->crl_count) {
         return;
     }
 
-    X509_STORE_free(opts->crl_store);
-    opts->crl_store = NULL;
+    nc_server_tls_sessions_flush(opts);
+    for (i = 0; i < opts->crl_count; ++i) {
+        nc_tls_crl_free(&opts->crls[i]);
+    }
+    free(opts->crls);
+    opts->crls = NULL;
+    opts->crl_count = 0;
 }
 
 API void
@@ -1366,12 +1799,129 @@ nc_server_tls_ch_client_endpt_clear_crls(const char *client_name, const char *en
     nc_server_ch_client_unlock(client);
 }
 
+static int
+nc_server_tls_set_session_cache(uint32_t cache_size, uint32_t timeout, struct nc_server_tls_opts *opts)
+{
+    opts->sess_cache_size = cache_size;
+    opts->sess_timeout = timeout;
+
+    /* the cache is a part of the context */
+    nc_server_tls_ctx_invalidate(opts);
+
+    return 0;
+}
+
+API int
+nc_server_tls_endpt_set_session_cache(const char *endpt_name, uint32_t cache_size, uint32_t timeout)
+{
+    int ret;
+    struct nc_endpt *endpt;
+
+    if (!endpt_name) {
+        ERRARG("endpt_name");
+        return -1;
+    }
+
+    /* LOCK */
+    endpt = nc_server_endpt_lock_get(endpt_name, NC_TI_OPENSSL, NULL);
+    if (!endpt) {
+        return -1;
+    }
+    ret = nc_server_tls_set_session_cache(cache_size, timeout, endpt->opts.tls);
+    /* UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+    return ret;
+}
+
+API int
+nc_server_tls_ch_client_endpt_set_session_cache(const char *client_name, const char *endpt_name, uint32_t cache_size,
+        uint32_t timeout)
+{
+    int ret;
+    struct nc_ch_client *client;
+    struct nc_ch_endpt *endpt;
+
+    /* LOCK */
+    endpt = nc_server_ch_client_lock(client_name, endpt_name, NC_TI_OPENSSL, &client);
+    if (!endpt) {
+        return -1;
+    }
+
+    ret = nc_server_tls_set_session_cache(cache_size, timeout, endpt->opts.tls);
+
+    /* UNLOCK */
+    nc_server_ch_client_unlock(client);
+
+    return ret;
+}
+
+static int
+nc_server_tls_set_ktls(int enable, struct nc_server_tls_opts *opts)
+{
+#ifndef SSL_OP_ENABLE_KTLS
+    if (enable) {
+        ERR("Kernel TLS offload is not supported by the OpenSSL library.");
+        return -1;
+    }
+#endif
+
+    opts->ktls = enable ? 1 : 0;
+    return 0;
+}
+
+API int
+nc_server_tls_endpt_set_ktls(const char *endpt_name, int enable)
+{
+    int ret;
+    struct nc_endpt *endpt;
+
+    if (!endpt_name) {
+        ERRARG("endpt_name");
+        return -1;
+    }
+
+    /* LOCK */
+    endpt = nc_server_endpt_lock_get(endpt_name, NC_TI_OPENSSL, NULL);
+    if (!endpt) {
+        return -1;
+    }
+    ret = nc_server_tls_set_ktls(enable, endpt->opts.tls);
+    /* UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+    return ret;
+}
+
+API int
+nc_server_tls_ch_client_endpt_set_ktls(const char *client_name, const char *endpt_name, int enable)
+{
+    int ret;
+    struct nc_ch_client *client;
+    struct nc_ch_endpt *endpt;
+
+    /* LOCK */
+    endpt = nc_server_ch_client_lock(client_name, endpt_name, NC_TI_OPENSSL, &client);
+    if (!endpt) {
+        return -1;
+    }
+
+    ret = nc_server_tls_set_ktls(enable, endpt->opts.tls);
+
+    /* UNLOCK */
+    nc_server_ch_client_unlock(client);
+
+    return ret;
+}
+
 static int
 nc_server_tls_add_ctn(uint32_t id, const char *fingerprint, NC_TLS_CTN_MAPTYPE map_type, const char *name,
         struct nc_server_tls_opts *opts)
 {
     struct nc_ctn *ctn, *new;
 
+    nc_server_tls_sessions_flush(opts);
+
     if (!opts->ctn) {
         /* the first item */
         opts->ctn = new = calloc(1, sizeof *new);
@@ -1422,6 +1972,7 @@ nc_server_tls_add_ctn(uint32_t id, const char *fingerprint, NC_TLS_CTN_MAPTYPE m
         new->name = lydict_insert(server_opts.ctx, name, 0);
     }
 
+    nc_server_tls_ctn_index(opts);
     return 0;
 }
 
@@ -1478,6 +2029,8 @@ nc_server_tls_del_ctn(int64_t id, const char *fingerprint, NC_TLS_CTN_MAPTYPE ma
     struct nc_ctn *ctn, *next, *prev;
     int ret = -1;
 
+    nc_server_tls_sessions_flush(opts);
+
     if ((id < 0) && !fingerprint && !map_type && !name) {
         ctn = opts->ctn;
         while (ctn) {
@@ -1520,6 +2073,7 @@ nc_server_tls_del_ctn(int64_t id, const char *fingerprint, NC_TLS_CTN_MAPTYPE ma
         }
     }
 
+    nc_server_tls_ctn_index(opts);
     return ret;
 }
 
@@ -1683,6 +2237,7 @@ nc_server_tls_clear_opts(struct nc_server_tls_opts *opts)
     lydict_remove(server_opts.ctx, opts->trusted_ca_dir);
     nc_server_tls_clear_crls(opts);
     nc_server_tls_del_ctn(-1, NULL, 0, NULL, opts);
+    nc_server_tls_ctx_invalidate(opts);
 }
 
 static void
@@ -1691,6 +2246,68 @@ nc_tls_make_verify_key(void)
     pthread_key_create(&verify_key, NULL);
 }
 
+static void
+nc_tls_sess_username_free(void *UNUSED(parent), void *ptr, CRYPTO_EX_DATA *UNUSED(ad), int UNUSED(idx),
+        long UNUSED(argl), void *UNUSED(argp))
+{
+    free(ptr);
+}
+
+static void
+nc_tls_make_sess_username_idx(void)
+{
+    sess_username_idx = SSL_SESSION_get_ex_new_index(0, NULL, NULL, NULL, nc_tls_sess_username_free);
+}
+
+/* called when a new session is added into the server session cache, remember its username for resumption */
+static int
+nc_tlsclb_sess_new(SSL *UNUSED(ssl), SSL_SESSION *sess)
+{
+    struct nc_session *session;
+    char *username;
+
+    session = pthread_getspecific(verify_key);
+    if (!session || !session->username || (sess_username_idx < 0)) {
+        return 0;
+    }
+
+    username = strdup(session->username);
+    if (!username) {
+        ERRMEM;
+        return 0;
+    }
+    free(SSL_SESSION_get_ex_data(sess, sess_username_idx));
+    SSL_SESSION_set_ex_data(sess, sess_username_idx, username);
+
+    /* no reference kept */
+    return 0;
+}
+
+/* resumed session skips certificate verification, restore its cert-to-name result */
+static int
+nc_tls_sess_resumed(struct nc_session *session)
+{
+    const char *username;
+
+    username = SSL_SESSION_get_ex_data(SSL_get_session(session->ti.tls), sess_username_idx);
+    if (!username) {
+        ERR("Resumed TLS session without a cert-to-name username.");
+        return -1;
+    }
+
+    session->username = lydict_insert(server_opts.ctx, username, 0);
+    X509_free(session->opts.server.client_cert);
+    session->opts.server.client_cert = SSL_get_peer_certificate(session->ti.tls);
+    VRB("Resumed TLS session, client username \"%s\".", session->username);
+
+    if (server_opts.user_verify_clb && !nc_tls_user_verify(session)) {
+        VRB("Cert verify: user verify callback revoked authorization.");
+        return -1;
+    }
+
+    return 0;
+}
+
 static X509*
 tls_load_cert(const char *cert_path, const char *cert_data)
 {
@@ -1885,17 +2502,12 @@ nc_tls_store_set_trusted_certs(X509_STORE *cert_store, const char **trusted_cert
     return 0;
 }
 
-int
-nc_accept_tls_session(struct nc_session *session, int sock, int timeout)
+static SSL_CTX *
+nc_tls_ctx_new(struct nc_server_tls_opts *opts)
 {
     X509_STORE *cert_store;
     SSL_CTX *tls_ctx;
     X509_LOOKUP *lookup;
-    struct nc_server_tls_opts *opts;
-    int ret;
-    struct timespec ts_timeout, ts_cur;
-
-    opts = session->data;
 
     /* SSL_CTX */
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L // >= 1.1.0
@@ -1946,13 +2558,101 @@ nc_accept_tls_session(struct nc_session *session, int sock, int timeout)
         }
     }
 
-    session->ti_type = NC_TI_OPENSSL;
-    session->ti.tls = SSL_new(tls_ctx);
+    if (opts->sess_cache_size) {
+        /* server-side session cache, the cert-to-name username is stored with the sessions */
+        pthread_once(&sess_username_once, nc_tls_make_sess_username_idx);
+        if (sess_username_idx < 0) {
+            ERR("Failed to create TLS session data index.");
+            goto error;
+        }
+        SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(tls_ctx, opts->sess_cache_size);
+        if (opts->sess_timeout) {
+            SSL_CTX_set_timeout(tls_ctx, opts->sess_timeout);
+        }
+        SSL_CTX_set_session_id_context(tls_ctx, (const unsigned char *)"libnetconf2", 11);
+        SSL_CTX_sess_set_new_cb(tls_ctx, nc_tlsclb_sess_new);
+    } else {
+        SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_OFF);
+    }
+
+    /* tickets are stored by the client and could not carry the username */
+    SSL_CTX_set_options(tls_ctx, SSL_OP_NO_TICKET);
 
-    /* context can be freed already, trusted certs must be freed manually */
+    return tls_ctx;
+
+error:
     SSL_CTX_free(tls_ctx);
-    tls_ctx = NULL;
+    return NULL;
+}
+
+/* opts are expected to be at least READ locked, the caller gets its own reference of the context */
+static SSL_CTX *
+nc_server_tls_ctx_get(struct nc_server_tls_opts *opts)
+{
+    SSL_CTX *tls_ctx;
+
+    /* TLS CTX LOCK */
+    pthread_mutex_lock(&tls_ctx_lock);
+    tls_ctx = opts->tls_ctx;
+    if (tls_ctx) {
+        SSL_CTX_up_ref(tls_ctx);
+    }
+    /* TLS CTX UNLOCK */
+    pthread_mutex_unlock(&tls_ctx_lock);
+
+    if (tls_ctx) {
+        return tls_ctx;
+    }
+
+    /* create it unlocked, loading the certificates may take a while */
+    tls_ctx = nc_tls_ctx_new(opts);
+    if (!tls_ctx) {
+        return NULL;
+    }
+
+    /* TLS CTX LOCK */
+    pthread_mutex_lock(&tls_ctx_lock);
+    if (opts->tls_ctx) {
+        /* another thread was faster */
+        SSL_CTX_free(tls_ctx);
+        tls_ctx = opts->tls_ctx;
+    } else {
+        opts->tls_ctx = tls_ctx;
+    }
+    SSL_CTX_up_ref(tls_ctx);
+    /* TLS CTX UNLOCK */
+    pthread_mutex_unlock(&tls_ctx_lock);
+
+    return tls_ctx;
+}
+
+int
+nc_accept_tls_session(struct nc_session *session, int sock, int timeout)
+{
+    SSL_CTX *tls_ctx;
+    struct nc_server_tls_opts *opts;
+    int ret, ktls;
+    struct timespec ts_timeout, ts_cur;
+
+    /* the options are not kept locked during the handshake */
+    opts = nc_server_endpt_opts_lock(session, NC_TI_OPENSSL);
+    if (!opts) {
+        goto error;
+    }
+
+    /* cached context, it is created only once for the current options */
+    tls_ctx = nc_server_tls_ctx_get(opts);
+    ktls = opts->ktls;
+    nc_server_endpt_opts_unlock(session);
+    if (!tls_ctx) {
+        goto error;
+    }
 
+    session->ti_type = NC_TI_OPENSSL;
+    session->ti.tls = SSL_new(tls_ctx);
+    /* the TLS structure keeps its own reference */
+    SSL_CTX_free(tls_ctx);
     if (!session->ti.tls) {
         ERR("Failed to create TLS structure from context.");
         goto error;
@@ -1960,7 +2660,15 @@ nc_accept_tls_session(struct nc_session *session, int sock, int timeout)
 
     SSL_set_fd(session->ti.tls, sock);
     sock = -1;
+#if OPENSSL_VERSION_NUMBER < 0x10101000L // < 1.1.1
+    /* the record buffers cannot be released only for idle sessions, do not keep them while no data are pending */
+    SSL_set_mode(session->ti.tls, SSL_MODE_AUTO_RETRY | SSL_MODE_RELEASE_BUFFERS);
+#else
     SSL_set_mode(session->ti.tls, SSL_MODE_AUTO_RETRY);
+#endif
+    if (ktls) {
+        nc_tls_ktls_enable(session->ti.tls);
+    }
 
     /* store session on per-thread basis */
     pthread_once(&verify_once, nc_tls_make_verify_key);
@@ -1969,6 +2677,9 @@ nc_accept_tls_session(struct nc_session *session, int sock, int timeout)
     if (timeout > -1) {
         nc_gettimespec_mono(&ts_timeout);
         nc_addtimespec(&ts_timeout, timeout);
+
+        /* a deferred user verification is waited for only until the handshake timeout */
+        session->opts.server.auth_deadline = ts_timeout;
     }
     while (((ret = SSL_accept(session->ti.tls)) == -1) && (SSL_get_error(session->ti.tls, ret) == SSL_ERROR_WANT_READ)) {
         usleep(NC_TIMEOUT_STEP);
@@ -1996,12 +2707,16 @@ nc_accept_tls_session(struct nc_session *session, int sock, int timeout)
         return -1;
     }
 
+    if (SSL_session_reused(session->ti.tls) && nc_tls_sess_resumed(session)) {
+        return -1;
+    }
+    nc_tls_ktls_print(session->ti.tls);
+
     return 1;
 
 error:
     if (sock > -1) {
         close(sock);
     }
-    SSL_CTX_free(tls_ctx);
     return -1;
 }
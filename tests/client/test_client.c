@@ -4,10 +4,16 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <cmocka.h>
 #include <libyang/libyang.h>
 #include <session_client.h>
+#include <session_server.h>
 #include <log.h>
 #include "tests/config.h"
 
@@ -109,12 +115,177 @@ test_nc_client_setting_schema_callback(void **state)
     nc_client_destroy();
 }
 
+static nc_rpc_clb get_schema_clb;
+static int get_schema_count;
+
+/* the default <get-schema> callback, counting the schemas retrieved */
+static struct nc_server_reply *
+clb_get_schema(struct lyd_node *rpc, struct nc_session *session)
+{
+    ++get_schema_count;
+    return get_schema_clb(rpc, session);
+}
+
+static void *
+cache_server_thread(void *arg)
+{
+    int fd = *(int *)arg, ret;
+    struct nc_session *session;
+    struct nc_pollsession *ps;
+
+    if (nc_accept_inout(fd, fd, "test", &session) != NC_MSG_HELLO) {
+        return arg;
+    }
+
+    /* reply to the RPCs until the client closes the session */
+    ps = nc_ps_new();
+    nc_ps_add_session(ps, session);
+    do {
+        ret = nc_ps_poll(ps, 5000, NULL);
+    } while (!(ret & (NC_PSPOLL_SESSION_TERM | NC_PSPOLL_TIMEOUT | NC_PSPOLL_ERROR)));
+    nc_ps_clear(ps, 1, NULL);
+    nc_ps_free(ps);
+
+    return (ret & NC_PSPOLL_SESSION_TERM) ? NULL : arg;
+}
+
+/* connect to the server, returns the number of schemas retrieved via <get-schema> */
+static int
+cache_connect(void)
+{
+    struct nc_session *session;
+    pthread_t tid;
+    void *tret;
+    int sock[2], ret;
+
+    ret = socketpair(AF_UNIX, SOCK_STREAM, 0, sock);
+    assert_int_equal(ret, 0);
+
+    get_schema_count = 0;
+    ret = pthread_create(&tid, NULL, cache_server_thread, &sock[0]);
+    assert_int_equal(ret, 0);
+
+    session = nc_connect_inout(sock[1], sock[1], NULL);
+    assert_non_null(session);
+    assert_non_null(ly_ctx_get_module(nc_session_get_ctx(session), "module-a", NULL, 1));
+    nc_session_free(session, NULL);
+
+    pthread_join(tid, &tret);
+    assert_null(tret);
+    close(sock[0]);
+    close(sock[1]);
+
+    return get_schema_count;
+}
+
+/* append to the first cached schema file */
+static void
+cache_corrupt(const char *dir)
+{
+    char path[PATH_MAX];
+    struct dirent *ent;
+    DIR *d;
+    FILE *f;
+    size_t len;
+
+    d = opendir(dir);
+    assert_non_null(d);
+    while ((ent = readdir(d))) {
+        len = strlen(ent->d_name);
+        if ((len > 5) && !strcmp(ent->d_name + len - 5, ".yang")) {
+            break;
+        }
+    }
+    assert_non_null(ent);
+    snprintf(path, sizeof path, "%s/%s", dir, ent->d_name);
+    closedir(d);
+
+    f = fopen(path, "a");
+    assert_non_null(f);
+    fputs("\n", f);
+    fclose(f);
+}
+
+static void
+cache_remove(const char *dir)
+{
+    char path[PATH_MAX];
+    struct dirent *ent;
+    DIR *d;
+
+    d = opendir(dir);
+    assert_non_null(d);
+    while ((ent = readdir(d))) {
+        if (strcmp(ent->d_name, ".") && strcmp(ent->d_name, "..")) {
+            snprintf(path, sizeof path, "%s/%s", dir, ent->d_name);
+            assert_int_equal(unlink(path), 0);
+        }
+    }
+    closedir(d);
+    assert_int_equal(rmdir(dir), 0);
+}
+
+static void
+test_nc_client_schema_cache(void **state)
+{
+    (void)state;
+    char dir[] = "/tmp/nc_schema_cache_XXXXXX";
+    struct ly_ctx *ctx;
+    const struct lys_node *node;
+    int ret, count;
+
+    nc_client_init();
+
+    /* server with <get-schema>, all the schemas are retrieved from it */
+    ctx = ly_ctx_new(TESTS_DIR"/data/modules", 0);
+    assert_non_null(ctx);
+    assert_non_null(ly_ctx_load_module(ctx, "ietf-netconf", NULL));
+    assert_non_null(ly_ctx_load_module(ctx, "ietf-netconf-monitoring", NULL));
+    assert_non_null(ly_ctx_load_module(ctx, "module-a", NULL));
+    nc_server_init(ctx);
+    node = ly_ctx_get_node(ctx, NULL, "/ietf-netconf-monitoring:get-schema", 0);
+    assert_non_null(node);
+    get_schema_clb = (nc_rpc_clb)node->priv;
+    assert_non_null(get_schema_clb);
+    lys_set_private(node, clb_get_schema);
+
+    assert_non_null(mkdtemp(dir));
+    ret = nc_client_set_schema_cache(dir);
+    assert_int_equal(ret, 0);
+    assert_string_equal(nc_client_get_schema_cache(), dir);
+
+    /* cache miss, the schemas are stored */
+    count = cache_connect();
+    assert_true(count > 0);
+
+    /* cache hit */
+    assert_int_equal(cache_connect(), 0);
+
+    /* only the corrupted schema is retrieved again and replaced */
+    cache_corrupt(dir);
+    assert_int_equal(cache_connect(), 1);
+    assert_int_equal(cache_connect(), 0);
+
+    /* disabled */
+    ret = nc_client_set_schema_cache(NULL);
+    assert_int_equal(ret, 0);
+    assert_null(nc_client_get_schema_cache());
+    assert_int_equal(cache_connect(), count);
+
+    cache_remove(dir);
+
+    nc_server_destroy();
+    ly_ctx_destroy(ctx, NULL);
+    nc_client_destroy();
+}
+
 int
 main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test_setup_teardown(test_nc_client_setting_schema_searchpath, setup_f, teardown_f),
         cmocka_unit_test_setup_teardown(test_nc_client_setting_schema_callback, setup_f, teardown_f),
+        cmocka_unit_test_setup_teardown(test_nc_client_schema_cache, setup_f, teardown_f),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -452,6 +452,26 @@ test_nc_client_ssh_setting_username(void **state)
     assert_string_equal(username_ret, "new_username");
 }
 
+static void
+test_nc_client_ssh_setting_write_buffer(void **state)
+{
+    (void)state;
+    int ret;
+
+    ret = nc_client_ssh_set_write_buffer(64 * 1024);
+    assert_int_equal(ret, 0);
+    assert_int_equal(nc_client_ssh_get_write_buffer(), 64 * 1024);
+
+    /* too large, the previous size is kept */
+    ret = nc_client_ssh_set_write_buffer(1024 * 1024 + 1);
+    assert_int_equal(ret, -1);
+    assert_int_equal(nc_client_ssh_get_write_buffer(), 64 * 1024);
+
+    ret = nc_client_ssh_set_write_buffer(0);
+    assert_int_equal(ret, 0);
+    assert_int_equal(nc_client_ssh_get_write_buffer(), 0);
+}
+
 static void
 test_nc_connect_ssh_interactive_succesfull(void **state)
 {
@@ -632,6 +652,7 @@ main(void)
         cmocka_unit_test_setup_teardown(test_nc_client_ssh_setting_auth_privkey_passphrase_clb, setup_f, teardown_f),
         cmocka_unit_test_setup_teardown(test_nc_client_ssh_adding_keypair, setup_f, teardown_f),
         cmocka_unit_test_setup_teardown(test_nc_client_ssh_setting_username, setup_f, teardown_f),
+        cmocka_unit_test_setup_teardown(test_nc_client_ssh_setting_write_buffer, setup_f, teardown_f),
         cmocka_unit_test_setup_teardown(test_nc_connect_ssh_interactive_succesfull, setup_f, teardown_f),
         cmocka_unit_test_setup_teardown(test_nc_connect_ssh_password_succesfull, setup_f, teardown_f),
         cmocka_unit_test_setup_teardown(test_nc_connect_ssh_pubkey_succesfull, setup_f, teardown_f),
@@ -4,6 +4,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include <cmocka.h>
 #include <libyang/libyang.h>
@@ -64,6 +65,17 @@ __wrap_nc_ctx_check_and_fill(struct nc_session *session)
     return (int)mock();
 }
 
+/* the pooled sessions are not really connected */
+static int session_connected;
+
+MOCK int
+__wrap_nc_session_is_connected(struct nc_session *session)
+{
+    (void)session;
+
+    return session_connected;
+}
+
 static void
 test_nc_client_tls_setting_cert_key_paths(void **state)
 {
@@ -137,6 +149,104 @@ test_nc_connect_tls_succesfull(void **state)
     nc_session_free(session, NULL);
 }
 
+static void
+pool_connect_will_succeed(void)
+{
+    will_return(__wrap_connect, 0);
+    will_return(__wrap_SSL_connect, 1);
+    will_return(__wrap_nc_handshake_io, 3);
+    will_return(__wrap_nc_ctx_check_and_fill, 0);
+}
+
+static void
+test_nc_client_pool(void **state)
+{
+    (void)state;
+    int ret;
+    struct nc_session *session, *session2;
+
+    ret = nc_client_tls_set_cert_key_paths(TESTS_DIR"/data/client.crt", TESTS_DIR"/data/client.key");
+    assert_int_equal(ret, 0);
+    ret = nc_client_tls_set_trusted_ca_paths(NULL, TESTS_DIR"/data");
+    assert_int_equal(ret, 0);
+
+    nc_client_pool_set_limits(0, 0);
+    session_connected = 1;
+
+    /* new session */
+    pool_connect_will_succeed();
+    session = nc_client_pool_get("0.0.0.0", 6001, NULL, NC_TI_OPENSSL, NULL);
+    assert_non_null(session);
+    nc_client_pool_put(session);
+
+    /* reused without connecting */
+    session2 = nc_client_pool_get("0.0.0.0", 6001, NULL, NC_TI_OPENSSL, NULL);
+    assert_ptr_equal(session2, session);
+
+    /* in use, so a new one is connected */
+    pool_connect_will_succeed();
+    session2 = nc_client_pool_get("0.0.0.0", 6001, NULL, NC_TI_OPENSSL, NULL);
+    assert_non_null(session2);
+    assert_ptr_not_equal(session2, session);
+    nc_client_pool_put(session2);
+
+    /* another server */
+    pool_connect_will_succeed();
+    session2 = nc_client_pool_get("0.0.0.0", 6002, NULL, NC_TI_OPENSSL, NULL);
+    assert_non_null(session2);
+    assert_ptr_not_equal(session2, session);
+    nc_client_pool_put(session2);
+    nc_client_pool_put(session);
+
+    /* dropped by the server, replaced by a new one */
+    session_connected = 0;
+    pool_connect_will_succeed();
+    session = nc_client_pool_get("0.0.0.0", 6002, NULL, NC_TI_OPENSSL, NULL);
+    assert_non_null(session);
+    session_connected = 1;
+    nc_client_pool_put(session);
+
+    /* another client certificate, so another identity */
+    ret = nc_client_tls_set_cert_key_paths(TESTS_DIR"/data/server.crt", TESTS_DIR"/data/server.key");
+    assert_int_equal(ret, 0);
+    pool_connect_will_succeed();
+    session2 = nc_client_pool_get("0.0.0.0", 6002, NULL, NC_TI_OPENSSL, NULL);
+    assert_non_null(session2);
+    assert_ptr_not_equal(session2, session);
+    nc_client_pool_put(session2);
+
+    /* the username is not used with TLS */
+    ret = nc_client_tls_set_cert_key_paths(TESTS_DIR"/data/client.crt", TESTS_DIR"/data/client.key");
+    assert_int_equal(ret, 0);
+    session2 = nc_client_pool_get("0.0.0.0", 6002, "other", NC_TI_OPENSSL, NULL);
+    assert_ptr_equal(session2, session);
+    nc_client_pool_put(session2);
+
+    /* idle for too long */
+    nc_client_pool_set_limits(50, 0);
+    usleep(100000);
+    pool_connect_will_succeed();
+    session = nc_client_pool_get("0.0.0.0", 6002, NULL, NC_TI_OPENSSL, NULL);
+    assert_non_null(session);
+    nc_client_pool_put(session);
+
+    /* established for too long, freed right when returned */
+    nc_client_pool_set_limits(0, 50);
+    session2 = nc_client_pool_get("0.0.0.0", 6002, NULL, NC_TI_OPENSSL, NULL);
+    assert_ptr_equal(session2, session);
+    usleep(100000);
+    nc_client_pool_put(session);
+    pool_connect_will_succeed();
+    session = nc_client_pool_get("0.0.0.0", 6002, NULL, NC_TI_OPENSSL, NULL);
+    assert_non_null(session);
+
+    /* flushed while in use, freed when returned */
+    session_connected = 0;
+    nc_client_pool_set_limits(0, 0);
+    nc_client_pool_flush();
+    nc_client_pool_put(session);
+}
+
 static void
 test_nc_client_tls_setting_crl_paths(void **state)
 {
@@ -192,6 +302,7 @@ main(void)
         cmocka_unit_test_setup_teardown(test_nc_client_tls_setting_cert_key_paths, setup_f, teardown_f),
         cmocka_unit_test_setup_teardown(test_nc_connect_tls_handshake_failed, setup_f, teardown_f),
         cmocka_unit_test_setup_teardown(test_nc_connect_tls_succesfull, setup_f, teardown_f),
+        cmocka_unit_test_setup_teardown(test_nc_client_pool, setup_f, teardown_f),
         cmocka_unit_test_setup_teardown(test_nc_client_tls_setting_trusted_ca_paths, setup_f, teardown_f),
         cmocka_unit_test_setup_teardown(test_nc_client_tls_setting_crl_paths, setup_f, teardown_f),
     };
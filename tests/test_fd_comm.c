@@ -487,6 +487,115 @@ test_send_recv_notif_11(void **state)
     test_send_recv_notif();
 }
 
+static void
+test_send_recv_denied(NC_ERR_TYPE err_type)
+{
+    int ret;
+    uint64_t msgid;
+    NC_MSG_TYPE msgtype;
+    struct nc_rpc *rpc;
+    struct nc_reply *reply;
+    struct nc_pollsession *ps;
+
+    /* client RPC */
+    rpc = nc_rpc_get(NULL, 0, 0);
+    assert_non_null(rpc);
+
+    msgtype = nc_send_rpc(client_session, rpc, 0, &msgid);
+    assert_int_equal(msgtype, NC_MSG_RPC);
+
+    /* server denies the RPC without calling the callback */
+    ps = nc_ps_new();
+    assert_non_null(ps);
+    nc_ps_add_session(ps, server_session);
+
+    ret = nc_ps_poll(ps, 0, NULL);
+    assert_int_equal(ret, NC_PSPOLL_BAD_RPC | NC_PSPOLL_REPLY_ERROR);
+
+    /* server finished */
+    nc_ps_free(ps);
+
+    /* client reply */
+    msgtype = nc_recv_reply(client_session, rpc, msgid, 0, 0, &reply);
+    assert_int_equal(msgtype, NC_MSG_REPLY);
+
+    nc_rpc_free(rpc);
+    assert_int_equal(reply->type, NC_RPL_ERROR);
+    assert_string_equal(((struct nc_reply_error *)reply)->err->tag, "resource-denied");
+    assert_string_equal(((struct nc_reply_error *)reply)->err->type,
+                        (err_type == NC_ERR_TYPE_PROT) ? "protocol" : "application");
+    nc_reply_free(reply);
+}
+
+static void
+test_rate_limit(void **state)
+{
+    (void)state;
+    int ret;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+    server_session->username = lydict_insert(ctx, "test", 0);
+
+    /* a single RPC per second */
+    ret = nc_server_set_user_rate_limit("test", 1, 1, 0, 0);
+    assert_int_equal(ret, 0);
+
+    test_send_recv_ok();
+    test_send_recv_denied(NC_ERR_TYPE_PROT);
+
+    /* other users are not limited */
+    ret = nc_server_set_user_rate_limit("other", 1, 1, 0, 0);
+    assert_int_equal(ret, 0);
+    ret = nc_server_set_user_rate_limit("test", 0, 0, 0, 0);
+    assert_int_equal(ret, 0);
+
+    test_send_recv_ok();
+    test_send_recv_ok();
+
+    ret = nc_server_set_user_rate_limit("other", 0, 0, 0, 0);
+    assert_int_equal(ret, 0);
+}
+
+static void
+test_overload(void **state)
+{
+    (void)state;
+    int ret;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+
+    /* any process uses at least a byte of memory */
+    ret = nc_server_set_overload_thresholds(0, 0, 0, 0, 1, 0);
+    assert_int_equal(ret, 0);
+    assert_int_equal(nc_server_get_load_state(NULL, NULL, NULL), NC_LOAD_OVERLOAD);
+
+    /* RPCs are denied, except those releasing resources */
+    test_send_recv_denied(NC_ERR_TYPE_APP);
+    test_send_recv_error();
+
+    /* below the high threshold but not under the low one, stays overloaded */
+    ret = nc_server_set_overload_thresholds(0, 0, 0, 0, UINT64_MAX, 1);
+    assert_int_equal(ret, 0);
+    assert_int_equal(nc_server_get_load_state(NULL, NULL, NULL), NC_LOAD_OVERLOAD);
+    test_send_recv_denied(NC_ERR_TYPE_APP);
+
+    /* under the low threshold */
+    ret = nc_server_set_overload_thresholds(0, 0, 0, 0, UINT64_MAX, UINT64_MAX - 1);
+    assert_int_equal(ret, 0);
+    assert_int_equal(nc_server_get_load_state(NULL, NULL, NULL), NC_LOAD_NORMAL);
+    test_send_recv_ok();
+
+    /* invalid thresholds */
+    ret = nc_server_set_overload_thresholds(0, 0, 0, 0, 1, 2);
+    assert_int_equal(ret, -1);
+
+    ret = nc_server_set_overload_thresholds(0, 0, 0, 0, 0, 0);
+    assert_int_equal(ret, 0);
+    assert_int_equal(nc_server_get_load_state(NULL, NULL, NULL), NC_LOAD_NORMAL);
+}
+
 int
 main(void)
 {
@@ -534,6 +643,8 @@ main(void)
         cmocka_unit_test_setup_teardown(test_send_recv_error_11, setup_sessions, teardown_sessions),
         cmocka_unit_test_setup_teardown(test_send_recv_data_11, setup_sessions, teardown_sessions),
         cmocka_unit_test_setup_teardown(test_send_recv_notif_11, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_rate_limit, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_overload, setup_sessions, teardown_sessions),
     };
 
     ret = cmocka_run_group_tests(comm, NULL, NULL);
@@ -12,12 +12,15 @@
  *     https://opensource.org/licenses/BSD-3-Clause
  */
 
+#define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <pthread.h>
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
@@ -175,13 +178,223 @@ test_write_rpc_11_bad(void **state)
     return test_write_rpc_bad(state);
 }
 
+struct rd {
+    struct nc_session *session;
+    struct nc_rpc *rpc;
+    int srv_out;
+    int srv_in;
+};
+
+static int
+setup_read(void **state)
+{
+    int fd, flags, c2s[2], s2c[2];
+    struct rd *r;
+
+    r = calloc(1, sizeof *r);
+    r->session = nc_new_session(NC_CLIENT, 0);
+    assert_non_null(r->session);
+    r->session->ctx = ly_ctx_new(TESTS_DIR"/data/modules", 0);
+
+    /* ietf-netconf */
+    fd = open(TESTS_DIR"/data/modules/ietf-netconf.yin", O_RDONLY);
+    if (fd == -1) {
+        nc_session_free(r->session, NULL);
+        free(r);
+        return -1;
+    }
+
+    lys_parse_fd(r->session->ctx, fd, LYS_IN_YIN);
+    close(fd);
+
+    pipe(c2s);
+    pipe(s2c);
+
+    /* the client must never block on reading */
+    flags = fcntl(s2c[0], F_GETFL);
+    fcntl(s2c[0], F_SETFL, flags | O_NONBLOCK);
+
+    r->session->status = NC_STATUS_RUNNING;
+    r->session->version = NC_VERSION_11;
+    r->session->ti_type = NC_TI_FD;
+    r->session->ti.fd.in = s2c[0];
+    r->session->ti.fd.out = c2s[1];
+    r->srv_in = c2s[0];
+    r->srv_out = s2c[1];
+
+    r->rpc = nc_rpc_lock(NC_DATASTORE_RUNNING);
+    assert_non_null(r->rpc);
+
+    *state = r;
+
+    return 0;
+}
+
+static int
+teardown_read(void **state)
+{
+    struct rd *r = (struct rd *)*state;
+
+    /* no <close-session> */
+    r->session->status = NC_STATUS_CLOSING;
+    close(r->session->ti.fd.in);
+    close(r->session->ti.fd.out);
+    nc_session_free(r->session, NULL);
+    nc_rpc_free(r->rpc);
+    close(r->srv_in);
+    close(r->srv_out);
+    free(r);
+    *state = NULL;
+
+    return 0;
+}
+
+/* write a reply in the chunked framing, only len bytes of the whole frame starting at off */
+static void
+write_reply_11(struct rd *r, uint64_t msgid, size_t off, size_t len)
+{
+    char *reply, *frame;
+    int frame_len;
+
+    assert_int_not_equal(asprintf(&reply, "<rpc-reply message-id=\"%" PRIu64 "\" xmlns=\"urn:ietf:params:xml:ns:netconf:base:1.0\">"
+            "<ok/></rpc-reply>", msgid), -1);
+    frame_len = asprintf(&frame, "\n#%zu\n%s\n##\n", strlen(reply), reply);
+    assert_int_not_equal(frame_len, -1);
+    free(reply);
+
+    if (!len) {
+        len = frame_len - off;
+    }
+    assert_int_equal(write(r->srv_out, frame + off, len), len);
+    free(frame);
+}
+
+static void
+async_reply_clb(struct nc_session *session, uint64_t msgid, NC_MSG_TYPE msgtype, struct nc_reply *reply, void *user_data)
+{
+    int *done = user_data;
+
+    (void)session;
+    (void)msgid;
+
+    assert_int_equal(msgtype, NC_MSG_REPLY);
+    assert_non_null(reply);
+    assert_int_equal(reply->type, NC_RPL_OK);
+    nc_reply_free(reply);
+    ++(*done);
+}
+
+static void
+test_process_io_partial(void **state)
+{
+    struct rd *r = (struct rd *)*state;
+    uint64_t msgid;
+    int done = 0;
+
+    assert_int_equal(nc_send_rpc_async(r->session, r->rpc, 1000, 0, async_reply_clb, &done, &msgid), NC_MSG_RPC);
+
+    /* nothing received yet */
+    assert_int_equal(nc_session_process_io(r->session), 0);
+
+    /* a partial message is kept until the rest arrives, without blocking */
+    write_reply_11(r, msgid, 0, 20);
+    assert_int_equal(nc_session_process_io(r->session), 0);
+    assert_int_equal(done, 0);
+
+    write_reply_11(r, msgid, 20, 0);
+    assert_int_equal(nc_session_process_io(r->session), 1);
+    assert_int_equal(done, 1);
+    assert_int_equal(r->session->status, NC_STATUS_RUNNING);
+}
+
+struct rd_thread {
+    struct rd *r;
+    uint64_t msgid;
+    NC_MSG_TYPE msgtype;
+    NC_RPL rpl_type;
+};
+
+static void *
+recv_reply_thread(void *arg)
+{
+    struct rd_thread *t = arg;
+    struct nc_reply *reply = NULL;
+
+    t->msgtype = nc_recv_reply(t->r->session, t->r->rpc, t->msgid, 5000, 0, &reply);
+    if (reply) {
+        t->rpl_type = reply->type;
+        nc_reply_free(reply);
+    }
+    return NULL;
+}
+
+static void
+test_recv_reply_threads(void **state)
+{
+    struct rd *r = (struct rd *)*state;
+    struct rd_thread t[2];
+    pthread_t tid[2];
+    int i;
+
+    for (i = 0; i < 2; ++i) {
+        memset(&t[i], 0, sizeof t[i]);
+        t[i].r = r;
+        assert_int_equal(nc_send_rpc(r->session, r->rpc, 1000, &t[i].msgid), NC_MSG_RPC);
+    }
+    for (i = 0; i < 2; ++i) {
+        assert_int_equal(pthread_create(&tid[i], NULL, recv_reply_thread, &t[i]), 0);
+    }
+
+    /* the replies arrive in the reverse order, each must reach its own waiter */
+    write_reply_11(r, t[1].msgid, 0, 0);
+    write_reply_11(r, t[0].msgid, 0, 0);
+
+    for (i = 0; i < 2; ++i) {
+        pthread_join(tid[i], NULL);
+        assert_int_equal(t[i].msgtype, NC_MSG_REPLY);
+        assert_int_equal(t[i].rpl_type, NC_RPL_OK);
+    }
+
+    /* no slots are left */
+    for (i = 0; i < NC_REPLY_MAP_SIZE; ++i) {
+        assert_null(r->session->opts.client.replies[i]);
+    }
+}
+
+static void
+test_recv_reply_retry(void **state)
+{
+    struct rd *r = (struct rd *)*state;
+    struct nc_reply *reply = NULL;
+    struct nc_msg_cont *cont;
+    uint64_t msgid;
+
+    assert_int_equal(nc_send_rpc(r->session, r->rpc, 1000, &msgid), NC_MSG_RPC);
+
+    /* the waiter gives up, the slot is kept for a while */
+    assert_int_equal(nc_recv_reply(r->session, r->rpc, msgid, 0, 0, &reply), NC_MSG_WOULDBLOCK);
+    cont = r->session->opts.client.replies[msgid & (NC_REPLY_MAP_SIZE - 1)];
+    assert_non_null(cont);
+    assert_int_not_equal(cont->abandoned, 0);
+
+    /* and the reply can still be received */
+    write_reply_11(r, msgid, 0, 0);
+    assert_int_equal(nc_recv_reply(r->session, r->rpc, msgid, 1000, 0, &reply), NC_MSG_REPLY);
+    assert_non_null(reply);
+    nc_reply_free(reply);
+    assert_null(r->session->opts.client.replies[msgid & (NC_REPLY_MAP_SIZE - 1)]);
+}
+
 int main(void)
 {
     const struct CMUnitTest io[] = {
         cmocka_unit_test_setup_teardown(test_write_rpc_10, setup_write, teardown_write),
         cmocka_unit_test_setup_teardown(test_write_rpc_10_bad, setup_write, teardown_write),
         cmocka_unit_test_setup_teardown(test_write_rpc_11, setup_write, teardown_write),
-        cmocka_unit_test_setup_teardown(test_write_rpc_11_bad, setup_write, teardown_write)};
+        cmocka_unit_test_setup_teardown(test_write_rpc_11_bad, setup_write, teardown_write),
+        cmocka_unit_test_setup_teardown(test_process_io_partial, setup_read, teardown_read),
+        cmocka_unit_test_setup_teardown(test_recv_reply_threads, setup_read, teardown_read),
+        cmocka_unit_test_setup_teardown(test_recv_reply_retry, setup_read, teardown_read)};
 
     return cmocka_run_group_tests(io, NULL, NULL);
 }
@@ -0,0 +1,341 @@
+/**
+ * \file test_server_accept.c
+ * \brief libnetconf2 tests - server accept filter
+ *
+ * Copyright (c) 2015 CESNET, z.s.p.o.
+ *
+ * This source code is licensed under BSD 3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/BSD-3-Clause
+ */
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <cmocka.h>
+#include <libyang/libyang.h>
+
+#include <session_server.h>
+#include <session_p.h>
+#include <log.h>
+#include "tests/config.h"
+
+#define TEST_PORT 6521
+/* millisec */
+#define TEST_ACCEPT_TIMEOUT 2000
+
+#ifdef NC_ENABLED_TLS
+#   define TEST_TI NC_TI_OPENSSL
+#else
+#   define TEST_TI NC_TI_LIBSSH
+#endif
+
+extern struct nc_server_opts server_opts;
+
+struct ly_ctx *ctx;
+
+static int
+client_connect(void)
+{
+    struct sockaddr_in addr;
+    int sock, ret;
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    assert_int_not_equal(sock, -1);
+
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TEST_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ret = connect(sock, (struct sockaddr *)&addr, sizeof addr);
+    assert_int_equal(ret, 0);
+
+    return sock;
+}
+
+/* the connection must be closed by the server before any handshake */
+static void
+accept_dropped(void)
+{
+    struct nc_session *session = NULL;
+    NC_MSG_TYPE msgtype;
+    char buf[1];
+    int sock;
+
+    sock = client_connect();
+
+    msgtype = nc_accept(TEST_ACCEPT_TIMEOUT, &session);
+    assert_int_equal(msgtype, NC_MSG_WOULDBLOCK);
+    assert_null(session);
+
+    /* EOF, not an SSH banner or a timeout */
+    assert_int_equal(read(sock, buf, 1), 0);
+    close(sock);
+}
+
+/* the connection must get to the handshake, which fails because the client is gone */
+static void
+accept_allowed(void)
+{
+    struct nc_session *session = NULL;
+    NC_MSG_TYPE msgtype;
+
+    close(client_connect());
+
+    msgtype = nc_accept(TEST_ACCEPT_TIMEOUT, &session);
+    assert_int_equal(msgtype, NC_MSG_ERROR);
+    assert_null(session);
+}
+
+#ifdef NC_ENABLED_TLS
+
+static int
+clb_server_cert(const char *name, void *UNUSED(user_data), char **cert_path, char **UNUSED(cert_data),
+        char **privkey_path, char **UNUSED(privkey_data), NC_SSH_KEY_TYPE *UNUSED(privkey_type))
+{
+    if (!strcmp(name, "server_cert")) {
+        *cert_path = strdup(TESTS_DIR"/data/server.crt");
+        *privkey_path = strdup(TESTS_DIR"/data/server.key");
+        return 0;
+    }
+
+    return 1;
+}
+
+#else
+
+static int
+clb_hostkeys(const char *name, void *UNUSED(user_data), char **privkey_path, char **UNUSED(privkey_data),
+        NC_SSH_KEY_TYPE *UNUSED(privkey_type))
+{
+    if (!strcmp(name, "key_rsa")) {
+        *privkey_path = strdup(TESTS_DIR"/data/key_rsa");
+        return 0;
+    }
+
+    return 1;
+}
+
+#endif
+
+/* number of connections currently counted by the accept filter */
+static uint32_t
+accept_src_sessions(void)
+{
+    struct nc_accept_src *src;
+    uint32_t i, count = 0;
+
+    pthread_mutex_lock(&server_opts.accept_filter.lock);
+    for (i = 0; server_opts.accept_filter.srcs && (i < NC_ACCEPT_SRC_BUCKETS); ++i) {
+        for (src = server_opts.accept_filter.srcs[i]; src; src = src->next) {
+            count += src->sessions;
+        }
+    }
+    pthread_mutex_unlock(&server_opts.accept_filter.lock);
+
+    return count;
+}
+
+static void *
+accept_thread(void *arg)
+{
+    struct nc_session *session = NULL;
+    NC_MSG_TYPE *msgtype = arg;
+
+    *msgtype = nc_accept(TEST_ACCEPT_TIMEOUT, &session);
+    nc_session_free(session, NULL);
+
+    return NULL;
+}
+
+static int
+teardown_filter(void **state)
+{
+    (void)state;
+
+    nc_server_del_accept_rule(NULL);
+    nc_server_set_accept_src_limits(0, 0, 0);
+
+    return 0;
+}
+
+static void
+test_accept_rules(void **state)
+{
+    (void)state;
+    int ret;
+
+    /* no rules */
+    accept_allowed();
+
+    ret = nc_server_add_accept_rule("127.0.0.0/8", NC_ACCEPT_DENY);
+    assert_int_equal(ret, 0);
+    accept_dropped();
+
+    /* the longest prefix wins */
+    ret = nc_server_add_accept_rule("127.0.0.1/32", NC_ACCEPT_ALLOW);
+    assert_int_equal(ret, 0);
+    accept_allowed();
+
+    /* a plain address is the same full-length prefix, only its action is changed */
+    ret = nc_server_add_accept_rule("127.0.0.1", NC_ACCEPT_DENY);
+    assert_int_equal(ret, 0);
+    accept_dropped();
+
+    ret = nc_server_del_accept_rule("127.0.0.1/32");
+    assert_int_equal(ret, 0);
+    accept_dropped();
+
+    ret = nc_server_del_accept_rule("127.0.0.0/8");
+    assert_int_equal(ret, 0);
+    accept_allowed();
+
+    ret = nc_server_del_accept_rule("127.0.0.0/8");
+    assert_int_equal(ret, -1);
+
+    /* IPv4 connections match IPv4-mapped IPv6 prefixes */
+    ret = nc_server_add_accept_rule("::ffff:127.0.0.0/104", NC_ACCEPT_DENY);
+    assert_int_equal(ret, 0);
+    accept_dropped();
+}
+
+static void
+test_accept_rule_invalid(void **state)
+{
+    (void)state;
+    int ret;
+
+    ret = nc_server_add_accept_rule(NULL, NC_ACCEPT_DENY);
+    assert_int_equal(ret, -1);
+    ret = nc_server_add_accept_rule("127.0.0.0/33", NC_ACCEPT_DENY);
+    assert_int_equal(ret, -1);
+    ret = nc_server_add_accept_rule("::/129", NC_ACCEPT_DENY);
+    assert_int_equal(ret, -1);
+    ret = nc_server_add_accept_rule("127.0.0.0/", NC_ACCEPT_DENY);
+    assert_int_equal(ret, -1);
+    ret = nc_server_add_accept_rule("localhost", NC_ACCEPT_DENY);
+    assert_int_equal(ret, -1);
+
+    /* nothing was added */
+    ret = nc_server_del_accept_rule("127.0.0.0/8");
+    assert_int_equal(ret, -1);
+    accept_allowed();
+}
+
+static void
+test_accept_conn_rate(void **state)
+{
+    (void)state;
+
+    /* a single connection per second */
+    nc_server_set_accept_src_limits(1, 1, 0);
+    accept_allowed();
+    accept_dropped();
+
+    nc_server_set_accept_src_limits(0, 0, 0);
+    accept_allowed();
+}
+
+static void
+test_accept_conn_rate_update(void **state)
+{
+    (void)state;
+
+    nc_server_set_accept_src_limits(1, 1, 0);
+    accept_allowed();
+
+    /* a larger burst does not refill the limited source */
+    nc_server_set_accept_src_limits(1, 2, 0);
+    accept_dropped();
+}
+
+static void
+test_accept_max_sessions(void **state)
+{
+    (void)state;
+    pthread_t tid;
+    NC_MSG_TYPE msgtype;
+    int sock, ret;
+
+    nc_server_set_accept_src_limits(0, 0, 1);
+
+    /* the first connection stays counted while its handshake waits for the client */
+    sock = client_connect();
+    ret = pthread_create(&tid, NULL, accept_thread, &msgtype);
+    assert_int_equal(ret, 0);
+    while (!accept_src_sessions()) {
+        usleep(10000);
+    }
+
+    /* the second one from the same source is over the limit */
+    accept_dropped();
+
+    /* the handshake fails and the connection is released */
+    close(sock);
+    pthread_join(tid, NULL);
+    assert_int_equal(msgtype, NC_MSG_ERROR);
+    assert_int_equal(accept_src_sessions(), 0);
+
+    accept_allowed();
+    assert_int_equal(accept_src_sessions(), 0);
+}
+
+int
+main(void)
+{
+    int ret;
+
+    /* the server may write to closed connections */
+    signal(SIGPIPE, SIG_IGN);
+
+    nc_verbosity(NC_VERB_VERBOSE);
+
+    ctx = ly_ctx_new(TESTS_DIR"/data/modules", 0);
+    assert_non_null(ctx);
+    nc_server_init(ctx);
+
+    ret = nc_server_add_endpt("main", TEST_TI);
+    assert_int_equal(ret, 0);
+    ret = nc_server_endpt_set_address("main", "127.0.0.1");
+    assert_int_equal(ret, 0);
+    ret = nc_server_endpt_set_port("main", TEST_PORT);
+    assert_int_equal(ret, 0);
+
+    /* so that the handshake waits for the client */
+#ifdef NC_ENABLED_TLS
+    nc_server_tls_set_server_cert_clb(clb_server_cert, NULL, NULL);
+    ret = nc_server_tls_endpt_set_server_cert("main", "server_cert");
+#else
+    nc_server_ssh_set_hostkey_clb(clb_hostkeys, NULL, NULL);
+    ret = nc_server_ssh_endpt_add_hostkey("main", "key_rsa", -1);
+#endif
+    assert_int_equal(ret, 0);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_accept_rules, NULL, teardown_filter),
+        cmocka_unit_test_setup_teardown(test_accept_rule_invalid, NULL, teardown_filter),
+        cmocka_unit_test_setup_teardown(test_accept_conn_rate, NULL, teardown_filter),
+        cmocka_unit_test_setup_teardown(test_accept_conn_rate_update, NULL, teardown_filter),
+        cmocka_unit_test_setup_teardown(test_accept_max_sessions, NULL, teardown_filter),
+    };
+
+    ret = cmocka_run_group_tests(tests, NULL, NULL);
+
+    nc_server_destroy();
+    ly_ctx_destroy(ctx, NULL);
+
+    return ret;
+}
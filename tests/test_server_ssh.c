@@ -0,0 +1,590 @@
+/**
+ * \file test_server_ssh.c
+ * \brief libnetconf2 tests - SSH server options
+ *
+ * Copyright (c) 2015 CESNET, z.s.p.o.
+ *
+ * This source code is licensed under BSD 3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/BSD-3-Clause
+ */
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cmocka.h>
+#include <libyang/libyang.h>
+
+#include <session_client.h>
+#include <session_server.h>
+#include <session_p.h>
+#include <log.h>
+#include "tests/config.h"
+
+#define TEST_PORT 6522
+/* millisec */
+#define TEST_TIMEOUT 5000
+/* RPCs sent on each channel */
+#define TEST_RPC_COUNT 200
+
+extern struct nc_server_opts server_opts;
+
+struct ly_ctx *ctx;
+
+pthread_mutex_t rpc_lock = PTHREAD_MUTEX_INITIALIZER;
+int rpc_count;
+
+/* deferred authentications completed by the test */
+struct auth_defer {
+    struct nc_auth_token *token;
+    int authenticated;
+    pthread_t tid;
+} auth_defers[8];
+int auth_defer_count;
+int auth_defer_complete;
+
+/* every key must be found in its bucket and nowhere else */
+static void
+authkey_index_check(void)
+{
+    uint32_t i, bucket, count = 0;
+    int32_t j;
+    int found;
+
+    if (!server_opts.authkey_count) {
+        assert_int_equal(server_opts.authkey_bucket_count, 0);
+        return;
+    }
+
+    /* a power of 2 with the load factor at most 1/2 */
+    assert_int_equal(server_opts.authkey_bucket_count & (server_opts.authkey_bucket_count - 1), 0);
+    assert_true(server_opts.authkey_bucket_count >= 2 * (uint32_t)server_opts.authkey_count);
+
+    for (i = 0; i < server_opts.authkey_count; ++i) {
+        bucket = server_opts.authkeys[i].hash & (server_opts.authkey_bucket_count - 1);
+        found = 0;
+        for (j = server_opts.authkey_buckets[bucket]; j > -1; j = server_opts.authkeys[j].next) {
+            if ((uint32_t)j == i) {
+                found = 1;
+            }
+        }
+        assert_true(found);
+    }
+
+    for (i = 0; i < server_opts.authkey_bucket_count; ++i) {
+        for (j = server_opts.authkey_buckets[i]; j > -1; j = server_opts.authkeys[j].next) {
+            ++count;
+        }
+    }
+    assert_int_equal(count, server_opts.authkey_count);
+}
+
+static int
+teardown_authkeys(void **state)
+{
+    (void)state;
+
+    nc_server_ssh_del_authkey(NULL, NULL, 0, NULL);
+    assert_int_equal(server_opts.authkey_count, 0);
+    authkey_index_check();
+
+    return 0;
+}
+
+static void
+test_authkey_index(void **state)
+{
+    (void)state;
+    char username[16];
+    int ret, i;
+
+    ret = nc_server_ssh_add_authkey_path(TESTS_DIR"/data/key_rsa.pub", "rsa");
+    assert_int_equal(ret, 0);
+    ret = nc_server_ssh_add_authkey_path(TESTS_DIR"/data/key_dsa.pub", "dsa");
+    assert_int_equal(ret, 0);
+    ret = nc_server_ssh_add_authkey_path(TESTS_DIR"/data/key_ecdsa.pub", "ecdsa");
+    assert_int_equal(ret, 0);
+    assert_int_equal(server_opts.authkey_count, 3);
+    authkey_index_check();
+
+    /* the same key of many users, the index grows */
+    for (i = 0; i < 40; ++i) {
+        sprintf(username, "user%d", i);
+        ret = nc_server_ssh_add_authkey_path(TESTS_DIR"/data/key_rsa.pub", username);
+        assert_int_equal(ret, 0);
+        authkey_index_check();
+    }
+    assert_int_equal(server_opts.authkey_count, 43);
+    assert_int_equal(server_opts.authkey_bucket_count, 128);
+
+    /* all the keys of a user */
+    ret = nc_server_ssh_del_authkey(NULL, NULL, 0, "user7");
+    assert_int_equal(ret, 0);
+    assert_int_equal(server_opts.authkey_count, 42);
+    authkey_index_check();
+
+    /* all the users of a key */
+    ret = nc_server_ssh_del_authkey(TESTS_DIR"/data/key_rsa.pub", NULL, 0, NULL);
+    assert_int_equal(ret, 0);
+    assert_int_equal(server_opts.authkey_count, 2);
+    authkey_index_check();
+
+    ret = nc_server_ssh_del_authkey(NULL, NULL, 0, "user7");
+    assert_int_equal(ret, -1);
+}
+
+static void
+test_authkey_invalid(void **state)
+{
+    (void)state;
+    int ret;
+
+    ret = nc_server_ssh_add_authkey_path(TESTS_DIR"/data/key_rsa.pub", "rsa");
+    assert_int_equal(ret, 0);
+
+    /* the key file must exist */
+    ret = nc_server_ssh_add_authkey_path(TESTS_DIR"/data/key_missing.pub", "missing");
+    assert_int_equal(ret, -1);
+
+    /* not a public key */
+    ret = nc_server_ssh_add_authkey_path(TESTS_DIR"/data/serverca.pem", "pem");
+    assert_int_equal(ret, -1);
+    ret = nc_server_ssh_add_authkey("bm90IGEga2V5", NC_SSH_KEY_RSA, "base64");
+    assert_int_equal(ret, -1);
+
+    /* nothing was added */
+    assert_int_equal(server_opts.authkey_count, 1);
+    authkey_index_check();
+}
+
+static int
+clb_hostkeys(const char *name, void *UNUSED(user_data), char **privkey_path, char **UNUSED(privkey_data),
+        NC_SSH_KEY_TYPE *UNUSED(privkey_type))
+{
+    if (!strcmp(name, "key_rsa")) {
+        *privkey_path = strdup(TESTS_DIR"/data/key_rsa");
+        return 0;
+    }
+
+    return 1;
+}
+
+static int
+clb_hostkey_check(const char *UNUSED(hostname), ssh_session UNUSED(session), void *UNUSED(priv))
+{
+    /* skip the knownhost check */
+    return 0;
+}
+
+static struct nc_server_reply *
+clb_get(struct lyd_node *UNUSED(rpc), struct nc_session *UNUSED(session))
+{
+    pthread_mutex_lock(&rpc_lock);
+    ++rpc_count;
+    pthread_mutex_unlock(&rpc_lock);
+
+    return nc_server_reply_ok();
+}
+
+static int
+setup_channels(void **state)
+{
+    (void)state;
+    int ret;
+
+    ret = nc_server_ssh_add_authkey_path(TESTS_DIR"/data/key_ecdsa.pub", "test");
+    assert_int_equal(ret, 0);
+
+    nc_client_ssh_set_auth_hostkey_check_clb(clb_hostkey_check, NULL);
+    ret = nc_client_ssh_set_username("test");
+    assert_int_equal(ret, 0);
+    ret = nc_client_ssh_add_keypair(TESTS_DIR"/data/key_ecdsa.pub", TESTS_DIR"/data/key_ecdsa");
+    assert_int_equal(ret, 0);
+    nc_client_ssh_set_auth_pref(NC_SSH_AUTH_PUBLICKEY, 1);
+    nc_client_ssh_set_auth_pref(NC_SSH_AUTH_PASSWORD, -1);
+    nc_client_ssh_set_auth_pref(NC_SSH_AUTH_INTERACTIVE, -1);
+
+    rpc_count = 0;
+
+    return 0;
+}
+
+static int
+teardown_channels(void **state)
+{
+    nc_client_ssh_destroy_opts();
+
+    return teardown_authkeys(state);
+}
+
+static void *
+accept_thread(void *arg)
+{
+    struct nc_session **session = arg;
+
+    nc_accept(TEST_TIMEOUT, session);
+
+    return NULL;
+}
+
+struct channel_arg {
+    struct nc_pollsession *ps;
+    struct nc_session *session;
+};
+
+/* poll the sessions until a new channel is opened */
+static void *
+accept_channel_thread(void *arg)
+{
+    struct channel_arg *carg = arg;
+    int ret;
+
+    do {
+        ret = nc_ps_poll(carg->ps, TEST_TIMEOUT, NULL);
+    } while (!(ret & (NC_PSPOLL_SSH_CHANNEL | NC_PSPOLL_TIMEOUT | NC_PSPOLL_SESSION_TERM | NC_PSPOLL_ERROR)));
+
+    if (ret & NC_PSPOLL_SSH_CHANNEL) {
+        nc_ps_accept_ssh_channel(carg->ps, &carg->session);
+    }
+
+    return NULL;
+}
+
+/* reply to the RPCs on all the channels, returns non-NULL on error */
+static void *
+server_poll_thread(void *arg)
+{
+    struct nc_pollsession *ps = arg;
+    int ret, done;
+
+    do {
+        ret = nc_ps_poll(ps, 100, NULL);
+        if (ret & (NC_PSPOLL_BAD_RPC | NC_PSPOLL_REPLY_ERROR | NC_PSPOLL_SESSION_TERM | NC_PSPOLL_ERROR)) {
+            return arg;
+        }
+
+        pthread_mutex_lock(&rpc_lock);
+        done = (rpc_count == 2 * TEST_RPC_COUNT);
+        pthread_mutex_unlock(&rpc_lock);
+    } while (!done);
+
+    return NULL;
+}
+
+/* send all the RPCs on a channel and then read their replies, returns non-NULL on error */
+static void *
+client_rpc_thread(void *arg)
+{
+    struct nc_session *session = arg;
+    struct nc_rpc *rpc;
+    struct nc_reply *reply;
+    uint64_t msgids[TEST_RPC_COUNT];
+    NC_MSG_TYPE msgtype;
+    void *ret = NULL;
+    int i;
+
+    rpc = nc_rpc_get(NULL, 0, NC_PARAMTYPE_CONST);
+    if (!rpc) {
+        return arg;
+    }
+
+    for (i = 0; i < TEST_RPC_COUNT; ++i) {
+        msgtype = nc_send_rpc(session, rpc, TEST_TIMEOUT, &msgids[i]);
+        if (msgtype != NC_MSG_RPC) {
+            ret = arg;
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < TEST_RPC_COUNT; ++i) {
+        msgtype = nc_recv_reply(session, rpc, msgids[i], TEST_TIMEOUT, 0, &reply);
+        if ((msgtype != NC_MSG_REPLY) || (reply->type != NC_RPL_OK)) {
+            ret = arg;
+        }
+        nc_reply_free(reply);
+        if (ret) {
+            goto cleanup;
+        }
+    }
+
+cleanup:
+    nc_rpc_free(rpc);
+    return ret;
+}
+
+static void
+test_channels_concurrent(void **state)
+{
+    (void)state;
+    struct nc_session *client1, *client2, *server1 = NULL;
+    struct channel_arg carg;
+    pthread_t tids[4];
+    void *tret[4];
+    int ret, i;
+
+    /* the first channel */
+    ret = pthread_create(&tids[0], NULL, accept_thread, &server1);
+    assert_int_equal(ret, 0);
+    client1 = nc_connect_ssh("127.0.0.1", TEST_PORT, ctx);
+    pthread_join(tids[0], NULL);
+    assert_non_null(client1);
+    assert_non_null(server1);
+
+    carg.ps = nc_ps_new();
+    assert_non_null(carg.ps);
+    carg.session = NULL;
+    ret = nc_ps_add_session(carg.ps, server1);
+    assert_int_equal(ret, 0);
+
+    /* the second channel on the same SSH session */
+    ret = pthread_create(&tids[0], NULL, accept_channel_thread, &carg);
+    assert_int_equal(ret, 0);
+    client2 = nc_connect_ssh_channel(client1, ctx);
+    pthread_join(tids[0], NULL);
+    assert_non_null(client2);
+    assert_non_null(carg.session);
+    ret = nc_ps_add_session(carg.ps, carg.session);
+    assert_int_equal(ret, 0);
+
+    /* both channels are read at the same time on both sides */
+    ret = pthread_create(&tids[0], NULL, server_poll_thread, carg.ps);
+    ret += pthread_create(&tids[1], NULL, server_poll_thread, carg.ps);
+    ret += pthread_create(&tids[2], NULL, client_rpc_thread, client1);
+    ret += pthread_create(&tids[3], NULL, client_rpc_thread, client2);
+    assert_int_equal(ret, 0);
+    for (i = 0; i < 4; ++i) {
+        pthread_join(tids[i], &tret[i]);
+    }
+    for (i = 0; i < 4; ++i) {
+        assert_null(tret[i]);
+    }
+    assert_int_equal(rpc_count, 2 * TEST_RPC_COUNT);
+
+    nc_session_free(client2, NULL);
+    nc_session_free(client1, NULL);
+    nc_ps_clear(carg.ps, 1, NULL);
+    nc_ps_free(carg.ps);
+}
+
+static void *
+auth_complete_thread(void *arg)
+{
+    struct auth_defer *defer = arg;
+
+    /* as if checked by an application thread pool */
+    usleep(100000);
+    nc_server_auth_complete(defer->token, defer->authenticated);
+
+    return NULL;
+}
+
+static int
+clb_passwd_defer(const struct nc_session *session, const char *password, void *UNUSED(user_data))
+{
+    struct auth_defer *defer;
+
+    if (auth_defer_count == sizeof auth_defers / sizeof *auth_defers) {
+        return 1;
+    }
+    defer = &auth_defers[auth_defer_count];
+
+    defer->token = nc_server_auth_defer(session);
+    if (!defer->token) {
+        return 1;
+    }
+    ++auth_defer_count;
+
+    defer->authenticated = !strcmp(password, "pass");
+    if (auth_defer_complete && pthread_create(&defer->tid, NULL, auth_complete_thread, defer)) {
+        /* the token must be completed anyway */
+        nc_server_auth_complete(defer->token, 0);
+        defer->token = NULL;
+    }
+
+    return NC_AUTH_PENDING;
+}
+
+static char *
+clb_client_passwd(const char *UNUSED(username), const char *UNUSED(hostname), void *priv)
+{
+    return strdup(priv);
+}
+
+static int
+setup_auth_defer(void **state)
+{
+    (void)state;
+    int ret;
+
+    nc_server_ssh_set_passwd_auth_clb(clb_passwd_defer, NULL, NULL);
+
+    nc_client_ssh_set_auth_hostkey_check_clb(clb_hostkey_check, NULL);
+    ret = nc_client_ssh_set_username("test");
+    assert_int_equal(ret, 0);
+    nc_client_ssh_set_auth_pref(NC_SSH_AUTH_PUBLICKEY, -1);
+    nc_client_ssh_set_auth_pref(NC_SSH_AUTH_PASSWORD, 1);
+    nc_client_ssh_set_auth_pref(NC_SSH_AUTH_INTERACTIVE, -1);
+
+    auth_defer_count = 0;
+    auth_defer_complete = 1;
+
+    return 0;
+}
+
+static int
+teardown_auth_defer(void **state)
+{
+    (void)state;
+    int i, ret;
+
+    for (i = 0; i < auth_defer_count; ++i) {
+        if (auth_defer_complete && auth_defers[i].token) {
+            pthread_join(auth_defers[i].tid, NULL);
+        }
+    }
+
+    nc_server_ssh_set_passwd_auth_clb(NULL, NULL, NULL);
+    ret = nc_server_ssh_endpt_set_auth_timeout("main", 30);
+    assert_int_equal(ret, 0);
+    nc_client_ssh_destroy_opts();
+
+    return 0;
+}
+
+/* connect with the password, returns the result of the server accept */
+static NC_MSG_TYPE
+auth_defer_connect(const char *password)
+{
+    struct nc_session *client, *server = NULL;
+    pthread_t tid;
+    int ret;
+
+    nc_client_ssh_set_auth_password_clb(clb_client_passwd, (void *)password);
+
+    ret = pthread_create(&tid, NULL, accept_thread, &server);
+    assert_int_equal(ret, 0);
+    client = nc_connect_ssh("127.0.0.1", TEST_PORT, ctx);
+    pthread_join(tid, NULL);
+
+    /* both sides agree */
+    if (server) {
+        assert_non_null(client);
+        assert_string_equal(nc_session_get_username(server), "test");
+    } else {
+        assert_null(client);
+    }
+    nc_session_free(client, NULL);
+    if (!server) {
+        return NC_MSG_ERROR;
+    }
+    nc_session_free(server, NULL);
+
+    return NC_MSG_HELLO;
+}
+
+static void
+test_auth_defer(void **state)
+{
+    (void)state;
+
+    /* completed from another thread while the handshake waits */
+    assert_int_equal(auth_defer_connect("pass"), NC_MSG_HELLO);
+    assert_int_equal(auth_defer_count, 1);
+
+    /* a deferred authentication can fail as well */
+    assert_int_equal(auth_defer_connect("wrong"), NC_MSG_ERROR);
+    assert_true(auth_defer_count > 1);
+}
+
+static void
+test_auth_defer_timeout(void **state)
+{
+    (void)state;
+    int ret, i;
+
+    ret = nc_server_ssh_endpt_set_auth_timeout("main", 1);
+    assert_int_equal(ret, 0);
+
+    /* never completed in time */
+    auth_defer_complete = 0;
+    assert_int_equal(auth_defer_connect("pass"), NC_MSG_ERROR);
+    assert_true(auth_defer_count > 0);
+
+    /* the session is gone, completing the tokens only frees them */
+    for (i = 0; i < auth_defer_count; ++i) {
+        nc_server_auth_complete(auth_defers[i].token, 1);
+    }
+}
+
+static void
+test_auth_defer_invalid(void **state)
+{
+    (void)state;
+    struct nc_session *session;
+
+    assert_null(nc_server_auth_defer(NULL));
+
+    /* only sessions being authenticated */
+    session = nc_new_session(NC_SERVER, 0);
+    assert_non_null(session);
+    session->status = NC_STATUS_INVALID;
+    assert_null(nc_server_auth_defer(session));
+    nc_session_free(session, NULL);
+
+    nc_server_auth_complete(NULL, 1);
+}
+
+int
+main(void)
+{
+    int ret;
+    const struct lys_module *module;
+    const struct lys_node *node;
+
+    nc_verbosity(NC_VERB_VERBOSE);
+
+    ctx = ly_ctx_new(TESTS_DIR"/data/modules", 0);
+    assert_non_null(ctx);
+    module = ly_ctx_load_module(ctx, "ietf-netconf", NULL);
+    assert_non_null(module);
+    node = ly_ctx_get_node(ctx, NULL, "/ietf-netconf:get", 0);
+    assert_non_null(node);
+    lys_set_private(node, clb_get);
+
+    nc_server_init(ctx);
+
+    nc_server_ssh_set_hostkey_clb(clb_hostkeys, NULL, NULL);
+    ret = nc_server_add_endpt("main", NC_TI_LIBSSH);
+    assert_int_equal(ret, 0);
+    ret = nc_server_endpt_set_address("main", "127.0.0.1");
+    assert_int_equal(ret, 0);
+    ret = nc_server_endpt_set_port("main", TEST_PORT);
+    assert_int_equal(ret, 0);
+    ret = nc_server_ssh_endpt_add_hostkey("main", "key_rsa", -1);
+    assert_int_equal(ret, 0);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_authkey_index, NULL, teardown_authkeys),
+        cmocka_unit_test_setup_teardown(test_authkey_invalid, NULL, teardown_authkeys),
+        cmocka_unit_test_setup_teardown(test_channels_concurrent, setup_channels, teardown_channels),
+        cmocka_unit_test_setup_teardown(test_auth_defer, setup_auth_defer, teardown_auth_defer),
+        cmocka_unit_test_setup_teardown(test_auth_defer_timeout, setup_auth_defer, teardown_auth_defer),
+        cmocka_unit_test(test_auth_defer_invalid),
+    };
+
+    ret = cmocka_run_group_tests(tests, NULL, NULL);
+
+    nc_server_destroy();
+    ly_ctx_destroy(ctx, NULL);
+
+    return ret;
+}
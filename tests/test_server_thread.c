@@ -491,7 +491,7 @@ tls_endpt_set_crl_paths_thread(void *arg)
 
     pthread_barrier_wait(&barrier);
 
-    ret = nc_server_tls_endpt_set_crl_paths("quaternary", NULL, "data");
+    ret = nc_server_tls_endpt_set_crl_paths("quaternary", NULL, TESTS_DIR"/data");
     nc_assert(!ret);
 
     nc_thread_destroy();
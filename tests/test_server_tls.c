@@ -0,0 +1,480 @@
+/**
+ * \file test_server_tls.c
+ * \brief libnetconf2 tests - TLS server options
+ *
+ * Copyright (c) 2015 CESNET, z.s.p.o.
+ *
+ * This source code is licensed under BSD 3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/BSD-3-Clause
+ */
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <cmocka.h>
+#include <libyang/libyang.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include <session_server.h>
+#include <session_p.h>
+#include <log.h>
+#include "tests/config.h"
+
+#define FP_SHA1 "02:B3:9F:26:65:76:6B:CC:FC:86:8E:D4:1A:81:64:0F:92:EB:18:AE:FF"
+#define FP_SHA1_LOWER "02:b3:9f:26:65:76:6b:cc:fc:86:8e:d4:1a:81:64:0f:92:eb:18:ae:ff"
+#define FP_OTHER "02:00:11:22:33:44:55:66:77:88:99:AA:BB:CC:DD:EE:FF:A0:A1:A2:A3"
+
+#define TEST_PORT 6523
+/* millisec */
+#define TEST_TIMEOUT 5000
+#define CLIENT_HELLO "<hello xmlns=\"urn:ietf:params:xml:ns:netconf:base:1.0\"><capabilities>" \
+    "<capability>urn:ietf:params:netconf:base:1.0</capability></capabilities></hello>]]>]]>"
+
+extern struct nc_server_opts server_opts;
+
+struct ly_ctx *ctx;
+
+static int
+setup_endpt(void **state)
+{
+    (void)state;
+    int ret;
+
+    ret = nc_server_add_endpt("tls", NC_TI_OPENSSL);
+    assert_int_equal(ret, 0);
+
+    return 0;
+}
+
+static int
+teardown_endpt(void **state)
+{
+    (void)state;
+    int ret;
+
+    ret = nc_server_del_endpt("tls", NC_TI_NONE);
+    assert_int_equal(ret, 0);
+
+    return 0;
+}
+
+static struct nc_server_tls_opts *
+tls_opts(void)
+{
+    assert_int_equal(server_opts.endpt_count, 1);
+    return server_opts.endpts[0].opts.tls;
+}
+
+/* ids of the indexed CTN entries with the fingerprint, in the order they are matched */
+static int
+ctn_index_ids(const char *fingerprint, uint32_t *ids, int max)
+{
+    struct nc_server_tls_opts *opts = tls_opts();
+    struct nc_ctn *ctn;
+    uint32_t i;
+    int count = 0;
+
+    for (i = 0; i < opts->ctn_bucket_count; ++i) {
+        for (ctn = opts->ctn_buckets[i]; ctn; ctn = ctn->fp_next) {
+            if (!strcasecmp(ctn->fingerprint, fingerprint) && (count < max)) {
+                ids[count++] = ctn->id;
+            }
+        }
+    }
+
+    return count;
+}
+
+static void
+test_ctn_index_order(void **state)
+{
+    (void)state;
+    uint32_t ids[4];
+    int ret;
+
+    /* added out of order, the same fingerprint written differently */
+    ret = nc_server_tls_endpt_add_ctn("tls", 5, FP_SHA1, NC_TLS_CTN_SPECIFIED, "five");
+    assert_int_equal(ret, 0);
+    ret = nc_server_tls_endpt_add_ctn("tls", 9, FP_OTHER, NC_TLS_CTN_SAN_ANY, NULL);
+    assert_int_equal(ret, 0);
+    ret = nc_server_tls_endpt_add_ctn("tls", 2, FP_SHA1, NC_TLS_CTN_SPECIFIED, "two");
+    assert_int_equal(ret, 0);
+    ret = nc_server_tls_endpt_add_ctn("tls", 3, FP_SHA1_LOWER, NC_TLS_CTN_SPECIFIED, "three");
+    assert_int_equal(ret, 0);
+
+    /* the lowest id is matched first */
+    ret = ctn_index_ids(FP_SHA1, ids, 4);
+    assert_int_equal(ret, 3);
+    assert_int_equal(ids[0], 2);
+    assert_int_equal(ids[1], 3);
+    assert_int_equal(ids[2], 5);
+
+    ret = ctn_index_ids(FP_OTHER, ids, 4);
+    assert_int_equal(ret, 1);
+    assert_int_equal(ids[0], 9);
+
+    /* the index is rebuilt on removal */
+    ret = nc_server_tls_endpt_del_ctn("tls", 2, NULL, 0, NULL);
+    assert_int_equal(ret, 0);
+    ret = ctn_index_ids(FP_SHA1, ids, 4);
+    assert_int_equal(ret, 2);
+    assert_int_equal(ids[0], 3);
+    assert_int_equal(ids[1], 5);
+
+    ret = nc_server_tls_endpt_del_ctn("tls", -1, NULL, 0, NULL);
+    assert_int_equal(ret, 0);
+    ret = ctn_index_ids(FP_SHA1, ids, 4);
+    assert_int_equal(ret, 0);
+}
+
+static X509 *
+read_cert(const char *path)
+{
+    FILE *f;
+    X509 *cert;
+
+    f = fopen(path, "r");
+    assert_non_null(f);
+    cert = PEM_read_X509(f, NULL, NULL, NULL);
+    fclose(f);
+    assert_non_null(cert);
+
+    return cert;
+}
+
+static int
+crl_revoked(const struct nc_crl *crl, const ASN1_INTEGER *serial)
+{
+    uint32_t i;
+
+    for (i = 0; i < crl->revoked_size; ++i) {
+        if (crl->revoked[i] && !ASN1_INTEGER_cmp(crl->revoked[i], serial)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* write data into a new temporary file, returns its path */
+static char *
+write_tmp_file(const char *data1, const char *data2)
+{
+    char *path;
+    int fd;
+
+    path = strdup("/tmp/nc_test_crl_XXXXXX");
+    assert_non_null(path);
+    fd = mkstemp(path);
+    assert_int_not_equal(fd, -1);
+    if (data1) {
+        assert_int_equal(write(fd, data1, strlen(data1)), strlen(data1));
+    }
+    if (data2) {
+        assert_int_equal(write(fd, data2, strlen(data2)), strlen(data2));
+    }
+    close(fd);
+
+    return path;
+}
+
+static char *
+read_file(const char *path)
+{
+    FILE *f;
+    char *data;
+    long len;
+
+    f = fopen(path, "r");
+    assert_non_null(f);
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = malloc(len + 1);
+    assert_non_null(data);
+    assert_int_equal(fread(data, 1, len, f), len);
+    data[len] = '\0';
+    fclose(f);
+
+    return data;
+}
+
+static void
+test_crl_load(void **state)
+{
+    (void)state;
+    struct nc_server_tls_opts *opts;
+    X509 *ca, *client, *server;
+    int ret;
+
+    ret = nc_server_tls_endpt_set_crl_paths("tls", TESTS_DIR"/data/serverca.crl", NULL);
+    assert_int_equal(ret, 0);
+
+    opts = tls_opts();
+    assert_int_equal(opts->crl_count, 1);
+
+    ca = read_cert(TESTS_DIR"/data/serverca.pem");
+    client = read_cert(TESTS_DIR"/data/client.crt");
+    server = read_cert(TESTS_DIR"/data/server.crt");
+
+    /* CRL of the CA revoking only the client certificate */
+    assert_int_equal(opts->crls[0].issuer_hash, X509_NAME_hash(X509_get_subject_name(ca)));
+    assert_true(crl_revoked(&opts->crls[0], X509_get_serialNumber(client)));
+    assert_false(crl_revoked(&opts->crls[0], X509_get_serialNumber(server)));
+
+    /* the same CRL again replaces the loaded one */
+    ret = nc_server_tls_endpt_set_crl_paths("tls", TESTS_DIR"/data/serverca.crl", NULL);
+    assert_int_equal(ret, 0);
+    assert_int_equal(opts->crl_count, 1);
+
+    nc_server_tls_endpt_clear_crls("tls");
+    assert_int_equal(opts->crl_count, 0);
+
+    X509_free(ca);
+    X509_free(client);
+    X509_free(server);
+}
+
+static void
+test_crl_corrupt(void **state)
+{
+    (void)state;
+    struct nc_server_tls_opts *opts;
+    char *crl, *path;
+    int ret;
+
+    /* the loaded CRL must be kept on any failure */
+    ret = nc_server_tls_endpt_set_crl_paths("tls", TESTS_DIR"/data/serverca.crl", NULL);
+    assert_int_equal(ret, 0);
+    opts = tls_opts();
+    assert_int_equal(opts->crl_count, 1);
+
+    /* empty file */
+    path = write_tmp_file(NULL, NULL);
+    ret = nc_server_tls_endpt_set_crl_paths("tls", path, NULL);
+    assert_int_equal(ret, -1);
+    unlink(path);
+    free(path);
+
+    /* no CRL in the file */
+    path = write_tmp_file("not a CRL\n", NULL);
+    ret = nc_server_tls_endpt_set_crl_paths("tls", path, NULL);
+    assert_int_equal(ret, -1);
+    unlink(path);
+    free(path);
+
+    /* corrupted CRL */
+    path = write_tmp_file("-----BEGIN X509 CRL-----\nMIIBnotavalidcrl\n-----END X509 CRL-----\n", NULL);
+    ret = nc_server_tls_endpt_set_crl_paths("tls", path, NULL);
+    assert_int_equal(ret, -1);
+    unlink(path);
+    free(path);
+
+    /* valid CRL followed by a corrupted one */
+    crl = read_file(TESTS_DIR"/data/serverca.crl");
+    path = write_tmp_file(crl, "-----BEGIN X509 CRL-----\nMIIBnotavalidcrl\n-----END X509 CRL-----\n");
+    ret = nc_server_tls_endpt_set_crl_paths("tls", path, NULL);
+    assert_int_equal(ret, -1);
+    unlink(path);
+    free(path);
+    free(crl);
+
+    /* missing file */
+    ret = nc_server_tls_endpt_set_crl_paths("tls", TESTS_DIR"/data/missing.crl", NULL);
+    assert_int_equal(ret, -1);
+
+    assert_int_equal(opts->crl_count, 1);
+    assert_non_null(opts->crls[0].crl);
+}
+
+static int
+clb_server_cert(const char *name, void *UNUSED(user_data), char **cert_path, char **UNUSED(cert_data),
+        char **privkey_path, char **UNUSED(privkey_data), NC_SSH_KEY_TYPE *UNUSED(privkey_type))
+{
+    if (!strcmp(name, "server_cert")) {
+        *cert_path = strdup(TESTS_DIR"/data/server.crt");
+        *privkey_path = strdup(TESTS_DIR"/data/server.key");
+        return 0;
+    }
+
+    return 1;
+}
+
+static void
+test_ctx_invalidate(void **state)
+{
+    (void)state;
+    struct nc_server_tls_opts *opts = tls_opts();
+
+    /* as if a session was accepted */
+    opts->tls_ctx = SSL_CTX_new(TLS_server_method());
+    assert_non_null(opts->tls_ctx);
+    nc_server_tls_invalidate_ctx();
+    assert_null(opts->tls_ctx);
+
+    /* a new callback may return different certificates */
+    opts->tls_ctx = SSL_CTX_new(TLS_server_method());
+    assert_non_null(opts->tls_ctx);
+    nc_server_tls_set_server_cert_clb(clb_server_cert, NULL, NULL);
+    assert_null(opts->tls_ctx);
+}
+
+static void *
+accept_thread(void *arg)
+{
+    struct nc_session **session = arg;
+
+    nc_accept(TEST_TIMEOUT, session);
+
+    return NULL;
+}
+
+/* connect a plain OpenSSL client, resuming sess if set, and wait for the server to accept the NETCONF session */
+static SSL *
+tls_client_connect(SSL_CTX *client_ctx, SSL_SESSION *sess, struct nc_session **session)
+{
+    struct sockaddr_in addr;
+    pthread_t tid;
+    SSL *tls;
+    int sock, ret;
+
+    *session = NULL;
+    ret = pthread_create(&tid, NULL, accept_thread, session);
+    assert_int_equal(ret, 0);
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    assert_int_not_equal(sock, -1);
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TEST_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ret = connect(sock, (struct sockaddr *)&addr, sizeof addr);
+    assert_int_equal(ret, 0);
+
+    tls = SSL_new(client_ctx);
+    assert_non_null(tls);
+    SSL_set_fd(tls, sock);
+    if (sess) {
+        SSL_set_session(tls, sess);
+    }
+    ret = SSL_connect(tls);
+    assert_int_equal(ret, 1);
+
+    /* the server <hello> is not read */
+    ret = SSL_write(tls, CLIENT_HELLO, strlen(CLIENT_HELLO));
+    assert_int_equal(ret, strlen(CLIENT_HELLO));
+
+    pthread_join(tid, NULL);
+    assert_non_null(*session);
+
+    return tls;
+}
+
+static void
+tls_client_close(SSL *tls)
+{
+    int sock;
+
+    sock = SSL_get_fd(tls);
+    SSL_shutdown(tls);
+    SSL_free(tls);
+    close(sock);
+}
+
+static void
+test_sess_resumption(void **state)
+{
+    (void)state;
+    SSL_CTX *client_ctx;
+    SSL_SESSION *sess;
+    SSL *tls;
+    struct nc_session *session;
+    int ret;
+
+    ret = nc_server_endpt_set_address("tls", "127.0.0.1");
+    assert_int_equal(ret, 0);
+    ret = nc_server_endpt_set_port("tls", TEST_PORT);
+    assert_int_equal(ret, 0);
+    nc_server_tls_set_server_cert_clb(clb_server_cert, NULL, NULL);
+    ret = nc_server_tls_endpt_set_server_cert("tls", "server_cert");
+    assert_int_equal(ret, 0);
+    ret = nc_server_tls_endpt_set_trusted_ca_paths("tls", TESTS_DIR"/data/serverca.pem", NULL);
+    assert_int_equal(ret, 0);
+    ret = nc_server_tls_endpt_add_ctn("tls", 0, FP_SHA1, NC_TLS_CTN_SPECIFIED, "test");
+    assert_int_equal(ret, 0);
+    ret = nc_server_tls_endpt_set_session_cache("tls", 16, 0);
+    assert_int_equal(ret, 0);
+
+    /* TLS 1.2 session IDs, the session can be resumed as soon as the handshake finishes */
+    client_ctx = SSL_CTX_new(TLS_client_method());
+    assert_non_null(client_ctx);
+    SSL_CTX_set_max_proto_version(client_ctx, TLS1_2_VERSION);
+    ret = SSL_CTX_use_certificate_file(client_ctx, TESTS_DIR"/data/client.crt", SSL_FILETYPE_PEM);
+    assert_int_equal(ret, 1);
+    ret = SSL_CTX_use_PrivateKey_file(client_ctx, TESTS_DIR"/data/client.key", SSL_FILETYPE_PEM);
+    assert_int_equal(ret, 1);
+
+    /* full handshake, the username is mapped from the certificate */
+    tls = tls_client_connect(client_ctx, NULL, &session);
+    assert_false(SSL_session_reused(tls));
+    assert_string_equal(nc_session_get_username(session), "test");
+    sess = SSL_get1_session(tls);
+    assert_non_null(sess);
+    nc_session_free(session, NULL);
+    tls_client_close(tls);
+
+    /* resumed, the certificate is not verified again and the username is restored from the cached session */
+    tls = tls_client_connect(client_ctx, sess, &session);
+    assert_true(SSL_session_reused(tls));
+    assert_true(SSL_session_reused(session->ti.tls));
+    assert_string_equal(nc_session_get_username(session), "test");
+    nc_session_free(session, NULL);
+    tls_client_close(tls);
+
+    SSL_SESSION_free(sess);
+    SSL_CTX_free(client_ctx);
+}
+
+int
+main(void)
+{
+    int ret;
+
+    nc_verbosity(NC_VERB_VERBOSE);
+
+    ctx = ly_ctx_new(TESTS_DIR"/data/modules", 0);
+    assert_non_null(ctx);
+    assert_non_null(ly_ctx_load_module(ctx, "ietf-netconf", NULL));
+    nc_server_init(ctx);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_ctn_index_order, setup_endpt, teardown_endpt),
+        cmocka_unit_test_setup_teardown(test_crl_load, setup_endpt, teardown_endpt),
+        cmocka_unit_test_setup_teardown(test_crl_corrupt, setup_endpt, teardown_endpt),
+        cmocka_unit_test_setup_teardown(test_ctx_invalidate, setup_endpt, teardown_endpt),
+        cmocka_unit_test_setup_teardown(test_sess_resumption, setup_endpt, teardown_endpt),
+    };
+
+    ret = cmocka_run_group_tests(tests, NULL, NULL);
+
+    nc_server_destroy();
+    ly_ctx_destroy(ctx, NULL);
+
+    return ret;
+}